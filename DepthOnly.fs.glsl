@@ -0,0 +1,13 @@
+// FILE: DepthOnly.fs.glsl
+// FRAGMENT SHADER
+
+#version 430 core
+
+//============================================================================
+// Fragment shader of the depth pre-pass. Color writes are masked off and
+// the depth comes from the rasterizer, so there is nothing to compute.
+//============================================================================
+
+void main()
+{
+}
@@ -0,0 +1,407 @@
+// FILE: Displacement.glsl
+// DISPLACEMENT KERNEL LIBRARY
+
+// Not a shader on its own. The application inserts this file into the
+// shaders that need it, after #version and the permutation defines, so it
+// must not contain a #version line. helper/displacement.cpp is the C++
+// implementation of the same kernels; keep the two in step.
+
+//============================================================================
+// Kernels, selected with DISPLACEMENT_KERNEL (defined by the application):
+//   DISPLACEMENT_HEMISPHERES  One hemispherical mirror in the middle of each
+//                             tile (the default).
+//   DISPLACEMENT_FBM          Fractal sum of value noise. Where it exceeds
+//                             one half it rises as mirror, elsewhere it is
+//                             flat wood.
+//   DISPLACEMENT_VORONOI      One hemispherical mirror per tile around a
+//                             jittered feature point, so the mirrors no
+//                             longer form a regular grid.
+//   DISPLACEMENT_HEIGHTFIELD  Like DISPLACEMENT_FBM, but the height is read
+//                             from HeightMap, repeated once per tile.
+//
+// All kernels work in tile space, MirrorTileDensity * texture coordinates,
+// and return heights in texture-coordinate units, which are object-space
+// units on the unit planes. Wood is never displaced.
+//============================================================================
+#define DISPLACEMENT_HEMISPHERES  0
+#define DISPLACEMENT_FBM          1
+#define DISPLACEMENT_VORONOI      2
+#define DISPLACEMENT_HEIGHTFIELD  3
+
+#ifndef DISPLACEMENT_KERNEL
+#define DISPLACEMENT_KERNEL DISPLACEMENT_HEMISPHERES
+#endif
+
+const int FBM_OCTAVES = 5;
+const float VORONOI_JITTER = 0.5;  // Feature points lie within the middle half of their tile.
+
+//============================================================================
+// MirrorTileDensity defines the number of hemispherical mirrors across each
+// dimension when the corresponding texture coordinate ranges from 0.0 to 1.0.
+//============================================================================
+uniform float MirrorTileDensity;  // (0.0, inf)
+
+//============================================================================
+// MirrorRadius is the radius of the hemispherical mirror in the "tile space".
+// The radius is relative to the tile size, which is considered to be 1.0 x 1.0.
+// The noise and heightfield kernels rise to the height of such a mirror.
+//============================================================================
+uniform float MirrorRadius;  // (0.0, 0.5]
+
+#if DISPLACEMENT_KERNEL == DISPLACEMENT_HEIGHTFIELD
+//============================================================================
+// Height in the red channel, in [0, 1]. Must use GL_REPEAT wrapping and be
+// mipmapped for displacementAtLod().
+//============================================================================
+layout (binding = 2) uniform sampler2D HeightMap;
+
+//============================================================================
+// Min/max pyramid of HeightMap (see helper/heightpyramid.h), RG32F with one
+// mip level per pyramid level. Only read with texelFetch().
+//============================================================================
+layout (binding = 3) uniform sampler2D HeightPyramid;
+#endif
+
+#ifdef LOD_MORPH
+//============================================================================
+// With LOD_MORPH (defined by the application), the displacement fades out
+// as mirror tiles get small on screen, from full height where a tile spans
+// MorphFullTilePixels pixels to none at MorphFlatTilePixels. Where it is
+// gone the surface stays flat and only the fragment shader's normal
+// perturbation remains, so the tessellator can stop there.
+//============================================================================
+uniform float MorphFullTilePixels = 32.0;
+uniform float MorphFlatTilePixels = 16.0;
+#endif
+
+//============================================================================
+// Result of a kernel at one point.
+//   height  Displacement along the surface normal.
+//   normal  Unit normal of the displaced surface in tangent space: x along
+//           increasing s, y along increasing t, z along the surface normal.
+//   mirror  Whether the point is mirror rather than wood.
+//============================================================================
+struct DisplacementSample
+{
+    float height;
+    vec3 normal;
+    bool mirror;
+};
+
+
+// 32-bit integer hash of a lattice point; identical to the C++ version.
+uint displacementHash(ivec2 p, uint seed)
+{
+    uint h = uint(p.x) * 0x8da6b343u ^ uint(p.y) * 0xd8163841u ^ seed * 0x9e3779b9u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+// Top 24 bits of a hash as a float in [0, 1).
+float displacementHashToUnit(uint h)
+{
+    return float(h >> 8) * (1.0 / 16777216.0);
+}
+
+
+// Tile-space centre of the mirror of a tile, for the kernels with one
+// hemispherical mirror per tile.
+vec2 mirrorCenter(ivec2 tile)
+{
+#if DISPLACEMENT_KERNEL == DISPLACEMENT_VORONOI
+    vec2 jitter = vec2(displacementHashToUnit(displacementHash(tile, 0u)),
+                       displacementHashToUnit(displacementHash(tile, 1u))) - vec2(0.5);
+    return vec2(tile) + vec2(0.5) + VORONOI_JITTER * jitter;
+#else
+    return vec2(tile) + vec2(0.5);
+#endif
+}
+
+
+// Hemisphere of radius MirrorRadius centred at the tile-space point center.
+DisplacementSample hemisphereSample(vec2 x, vec2 center)
+{
+    DisplacementSample result;
+    vec2 p = x - center;
+    float sqrDist = dot(p, p);
+    result.mirror = (sqrDist <= MirrorRadius * MirrorRadius);
+    float h = sqrt(max(MirrorRadius * MirrorRadius - sqrDist, 0.0));
+    result.height = result.mirror ? h / MirrorTileDensity : 0.0;
+    result.normal = result.mirror ? normalize(vec3(p, h)) : vec3(0.0, 0.0, 1.0);
+    return result;
+}
+
+
+// Height field n in [0, 1] with tile-space gradient dn: the part above one
+// half is mirror, rising to the height of a hemispherical mirror at n = 1.
+DisplacementSample thresholdSample(float n, vec2 dn)
+{
+    DisplacementSample result;
+    result.mirror = (n > 0.5);
+    float scale = 2.0 * MirrorRadius;
+    result.height = result.mirror ? scale * (n - 0.5) / MirrorTileDensity : 0.0;
+    result.normal = result.mirror ? normalize(vec3(-scale * dn, 1.0)) : vec3(0.0, 0.0, 1.0);
+    return result;
+}
+
+
+// Value noise in [0, 1] with quintic interpolation, and its gradient.
+float valueNoise(vec2 x, uint seed, out vec2 dn)
+{
+    vec2 i = floor(x);
+    vec2 f = x - i;
+    vec2 u = f * f * f * (f * (f * 6.0 - 15.0) + 10.0);
+    vec2 du = 30.0 * f * f * (f * (f - 2.0) + 1.0);
+
+    ivec2 c = ivec2(i);
+    float a = displacementHashToUnit(displacementHash(c, seed));
+    float b = displacementHashToUnit(displacementHash(c + ivec2(1, 0), seed));
+    float d = displacementHashToUnit(displacementHash(c + ivec2(0, 1), seed));
+    float e = displacementHashToUnit(displacementHash(c + ivec2(1, 1), seed));
+
+    float k1 = b - a;
+    float k2 = d - a;
+    float k3 = a - b - d + e;
+    dn = du * vec2(k1 + k3 * u.y, k2 + k3 * u.x);
+    return a + k1 * u.x + k2 * u.y + k3 * u.x * u.y;
+}
+
+
+//============================================================================
+// Fraction of the displacement kept where a mirror tile spans tilePixels
+// pixels on screen: 1 without LOD_MORPH.
+//============================================================================
+float displacementMorph(float tilePixels)
+{
+#ifdef LOD_MORPH
+    return smoothstep(MorphFlatTilePixels, MorphFullTilePixels, tilePixels);
+#else
+    return 1.0;
+#endif
+}
+
+
+//============================================================================
+// Mip level of HeightMap for vertices spaced objectUnitsPerSegment apart, so
+// that the TES samples about one texel per segment. 0 for the other kernels.
+//============================================================================
+float displacementLod(float objectUnitsPerSegment)
+{
+#if DISPLACEMENT_KERNEL == DISPLACEMENT_HEIGHTFIELD
+    float texels = objectUnitsPerSegment * MirrorTileDensity * float(textureSize(HeightMap, 0).x);
+    return max(log2(max(texels, 1.0e-6)), 0.0);
+#else
+    return 0.0;
+#endif
+}
+
+
+//============================================================================
+// Distance in texture coordinates beyond which samples at mip level lod no
+// longer see HeightMap, for growing the bounds below. Trilinear filtering at
+// level lod blends texels of levels floor(lod) and floor(lod) + 1.
+//============================================================================
+float displacementFilterMargin(float lod)
+{
+#if DISPLACEMENT_KERNEL == DISPLACEMENT_HEIGHTFIELD
+    float texels = exp2(floor(lod) + 1.0) + 1.0;
+    return texels / (MirrorTileDensity * float(textureSize(HeightMap, 0).x));
+#else
+    return 0.0;
+#endif
+}
+
+
+// Displacement at texture coordinates texCoord, with HeightMap sampled at
+// mip level lod.
+DisplacementSample displacementAtLod(vec2 texCoord, float lod)
+{
+    vec2 x = MirrorTileDensity * texCoord;
+
+#if DISPLACEMENT_KERNEL == DISPLACEMENT_FBM
+    float n = 0.0;
+    vec2 dn = vec2(0.0);
+    float amplitude = 0.5;
+    float frequency = 1.0;
+    float total = 0.0;
+    for (int octave = 0; octave < FBM_OCTAVES; octave++) {
+        vec2 d;
+        n += amplitude * valueNoise(frequency * x, uint(octave), d);
+        dn += amplitude * frequency * d;
+        total += amplitude;
+        amplitude *= 0.5;
+        frequency *= 2.0;
+    }
+    return thresholdSample(n / total, dn / total);
+
+#elif DISPLACEMENT_KERNEL == DISPLACEMENT_VORONOI
+    // The nearest mirror can be in a neighbouring tile; the highest one wins.
+    ivec2 tile = ivec2(floor(x));
+    DisplacementSample result = DisplacementSample(0.0, vec3(0.0, 0.0, 1.0), false);
+    for (int j = -1; j <= 1; j++) {
+        for (int i = -1; i <= 1; i++) {
+            DisplacementSample s = hemisphereSample(x, mirrorCenter(tile + ivec2(i, j)));
+            if (s.mirror && (!result.mirror || s.height > result.height)) result = s;
+        }
+    }
+    return result;
+
+#elif DISPLACEMENT_KERNEL == DISPLACEMENT_HEIGHTFIELD
+    // Central differences one texel of the sampled level apart.
+    vec2 texel = exp2(floor(lod)) / vec2(textureSize(HeightMap, 0));
+    float n = textureLod(HeightMap, x, lod).r;
+    float nx = textureLod(HeightMap, x + vec2(texel.x, 0.0), lod).r -
+               textureLod(HeightMap, x - vec2(texel.x, 0.0), lod).r;
+    float ny = textureLod(HeightMap, x + vec2(0.0, texel.y), lod).r -
+               textureLod(HeightMap, x - vec2(0.0, texel.y), lod).r;
+    return thresholdSample(n, vec2(nx, ny) / (2.0 * texel));
+
+#else
+    return hemisphereSample(x, mirrorCenter(ivec2(floor(x))));
+#endif
+}
+
+
+DisplacementSample displacementAt(vec2 texCoord)
+{
+    return displacementAtLod(texCoord, 0.0);
+}
+
+
+
+//============================================================================
+// Conservative bounds for choosing tessellation levels and culling, the
+// same as in helper/displacement.cpp: whether anything in a region, given
+// in texture coordinates, may be displaced, and the largest height there.
+// Points within margin of the region count too (see
+// displacementFilterMargin()). The fBm kernel has no bound, and neither do
+// regions spanning more than MAX_BOUND_TILES tiles.
+//============================================================================
+const int MAX_BOUND_TILES = 64;
+
+#if DISPLACEMENT_KERNEL == DISPLACEMENT_HEIGHTFIELD
+// Bounds of HeightMap's bilinear samples over the box [lo, hi] in its own
+// texture coordinates, repeating: at most 2x2 cells of the finest pyramid
+// level whose cells are large enough. See HeightPyramid::getBounds().
+vec2 heightPyramidBounds(vec2 lo, vec2 hi)
+{
+    // Level-0 cell c lies between texel centres c and c + 1.
+    vec2 mapSize = vec2(textureSize(HeightMap, 0));
+    vec2 a = lo * mapSize - vec2(0.5);
+    vec2 b = hi * mapSize - vec2(0.5);
+
+    int numLevels = textureQueryLevels(HeightPyramid);
+    for (int level = 0; level < numLevels; level++) {
+        ivec2 size = textureSize(HeightPyramid, level);
+        vec2 scale = vec2(size) / mapSize;
+        ivec2 first = ivec2(floor(a * scale));
+        ivec2 span = ivec2(floor(b * scale)) - first;
+        bool fits = (span.x <= 1 || size.x <= 2) && (span.y <= 1 || size.y <= 2);
+        if (!fits && level < numLevels - 1) continue;
+
+        vec2 bounds = vec2(1.0, 0.0);
+        for (int j = 0; j <= min(span.y, 1); j++) {
+            for (int i = 0; i <= min(span.x, 1); i++) {
+                ivec2 c = first + ivec2(i, j);
+                c -= size * ivec2(floor(vec2(c) / vec2(size)));
+                vec2 cell = texelFetch(HeightPyramid, c, level).rg;
+                bounds = vec2(min(bounds.x, cell.x), max(bounds.y, cell.y));
+            }
+        }
+        return bounds;
+    }
+    return vec2(0.0, 1.0);
+}
+#endif
+
+// Range of tiles whose mirror, grown by margin, can reach the tile-space
+// box [lo, hi].
+bool mirrorTileRange(vec2 lo, vec2 hi, float margin, out ivec2 first, out ivec2 last)
+{
+#if DISPLACEMENT_KERNEL == DISPLACEMENT_VORONOI
+    float reach = MirrorRadius + margin + 0.5 * VORONOI_JITTER;
+#else
+    float reach = MirrorRadius + margin;
+#endif
+    first = ivec2(floor(lo - vec2(0.5 + reach)));
+    last = ivec2(floor(hi - vec2(0.5 - reach)));
+    ivec2 count = last - first + ivec2(1);
+    return count.x * count.y <= MAX_BOUND_TILES;
+}
+
+
+bool displacementBoxMayDisplace(vec2 texLo, vec2 texHi, float margin)
+{
+#if DISPLACEMENT_KERNEL == DISPLACEMENT_HEMISPHERES || DISPLACEMENT_KERNEL == DISPLACEMENT_VORONOI
+    vec2 lo = MirrorTileDensity * texLo;
+    vec2 hi = MirrorTileDensity * texHi;
+    float reach = MirrorRadius + MirrorTileDensity * margin;
+    ivec2 first, last;
+    if (!mirrorTileRange(lo, hi, MirrorTileDensity * margin, first, last)) return true;
+
+    for (int j = first.y; j <= last.y; j++) {
+        for (int i = first.x; i <= last.x; i++) {
+            vec2 c = mirrorCenter(ivec2(i, j));
+            vec2 d = c - clamp(c, lo, hi);
+            if (dot(d, d) <= reach * reach) return true;
+        }
+    }
+    return false;
+#elif DISPLACEMENT_KERNEL == DISPLACEMENT_HEIGHTFIELD
+    return heightPyramidBounds(MirrorTileDensity * (texLo - vec2(margin)),
+                               MirrorTileDensity * (texHi + vec2(margin))).y > 0.5;
+#else
+    return true;
+#endif
+}
+
+
+// The result does not depend on the order of a and b, so both patches
+// sharing an edge agree on it.
+bool displacementSegmentMayDisplace(vec2 texA, vec2 texB, float margin)
+{
+#if DISPLACEMENT_KERNEL == DISPLACEMENT_HEMISPHERES || DISPLACEMENT_KERNEL == DISPLACEMENT_VORONOI
+    if (texA.x > texB.x || (texA.x == texB.x && texA.y > texB.y)) {
+        vec2 tmp = texA;
+        texA = texB;
+        texB = tmp;
+    }
+    vec2 a = MirrorTileDensity * texA;
+    vec2 b = MirrorTileDensity * texB;
+    float reach = MirrorRadius + MirrorTileDensity * margin;
+    ivec2 first, last;
+    if (!mirrorTileRange(min(a, b), max(a, b), MirrorTileDensity * margin, first, last)) return true;
+
+    vec2 ab = b - a;
+    float abLength2 = dot(ab, ab);
+    for (int j = first.y; j <= last.y; j++) {
+        for (int i = first.x; i <= last.x; i++) {
+            vec2 c = mirrorCenter(ivec2(i, j));
+            float t = (abLength2 > 0.0) ? clamp(dot(c - a, ab) / abLength2, 0.0, 1.0) : 0.0;
+            vec2 d = c - (a + t * ab);
+            if (dot(d, d) <= reach * reach) return true;
+        }
+    }
+    return false;
+#else
+    return displacementBoxMayDisplace(min(texA, texB), max(texA, texB), margin);
+#endif
+}
+
+
+float displacementMaxHeight(vec2 texLo, vec2 texHi, float margin)
+{
+    // Every kernel peaks at the height of a hemispherical mirror.
+    float peak = MirrorRadius / MirrorTileDensity;
+#if DISPLACEMENT_KERNEL == DISPLACEMENT_HEIGHTFIELD
+    float n = heightPyramidBounds(MirrorTileDensity * (texLo - vec2(margin)),
+                                  MirrorTileDensity * (texHi + vec2(margin))).y;
+    return 2.0 * max(n - 0.5, 0.0) * peak;
+#else
+    return displacementBoxMayDisplace(texLo, texHi, margin) ? peak : 0.0;
+#endif
+}
@@ -0,0 +1,24 @@
+// FILE: FullScreen.vs.glsl
+// VERTEX SHADER
+
+#version 430 core
+
+//============================================================================
+// Draws one triangle that covers the viewport, for passes that process a
+// whole image: gl_VertexID 0, 1 and 2 become (-1, -1), (3, -1) and (-1, 3)
+// in normalized device coordinates. Fragment shaders read their input with
+// texelFetch() at gl_FragCoord, or sample it at TexCoord.
+//============================================================================
+
+//============================================================================
+// Output to Fragment Shader.
+//============================================================================
+out vec2 TexCoord;   // [0, 1] across the viewport.
+
+
+void main()
+{
+    vec2 ndc = vec2((gl_VertexID & 1) * 4 - 1, (gl_VertexID & 2) * 2 - 1);
+    TexCoord = 0.5 * ndc + 0.5;
+    gl_Position = vec4(ndc, 0.0, 1.0);
+}
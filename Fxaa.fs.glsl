@@ -0,0 +1,127 @@
+// FILE: Fxaa.fs.glsl
+// FRAGMENT SHADER
+
+#version 430 core
+
+//============================================================================
+// FXAA-style anti-aliasing of the finished scene image, drawn with
+// FullScreen.vs.glsl. helper/fxaa.cpp is the same filter on the CPU, where
+// each step is explained; keep the two in step.
+//============================================================================
+
+//============================================================================
+// Output to framebuffer.
+//============================================================================
+layout (location = 0) out vec4 FragColor;
+
+//============================================================================
+// The scene image, sampled with GL_LINEAR and GL_CLAMP_TO_EDGE.
+//============================================================================
+layout (binding = 0) uniform sampler2D SceneColor;
+
+//============================================================================
+// Same meaning and values as Fxaa::defaultParams().
+//============================================================================
+uniform float EdgeThreshold = 0.125;
+uniform float EdgeThresholdMin = 0.0312;
+uniform float SubpixelBlend = 0.75;
+
+
+const int NUM_SEARCH_STEPS = 12;
+const float SearchSteps[NUM_SEARCH_STEPS] = float[]( 1.0, 1.0, 1.0, 1.0, 1.0, 1.5, 2.0, 2.0, 2.0, 2.0, 4.0, 8.0 );
+
+
+float Luma(vec3 color)
+{
+    return dot(color, vec3(0.299, 0.587, 0.114));
+}
+
+float LumaAt(vec2 uv, ivec2 offset)
+{
+    return Luma(textureLodOffset(SceneColor, uv, 0.0, offset).rgb);
+}
+
+
+void main()
+{
+    vec2 texelSize = 1.0 / vec2(textureSize(SceneColor, 0));
+    vec2 uv = gl_FragCoord.xy * texelSize;
+
+    vec4 colorM = textureLod(SceneColor, uv, 0.0);
+    float lumaM = Luma(colorM.rgb);
+    float lumaN = LumaAt(uv, ivec2(0, -1));
+    float lumaS = LumaAt(uv, ivec2(0, 1));
+    float lumaW = LumaAt(uv, ivec2(-1, 0));
+    float lumaE = LumaAt(uv, ivec2(1, 0));
+
+    float lumaMax = max(max(lumaM, max(lumaN, lumaS)), max(lumaW, lumaE));
+    float lumaMin = min(min(lumaM, min(lumaN, lumaS)), min(lumaW, lumaE));
+    float range = lumaMax - lumaMin;
+    if (range < max(EdgeThresholdMin, lumaMax * EdgeThreshold))
+    {
+        FragColor = colorM;
+        return;
+    }
+
+    float lumaNW = LumaAt(uv, ivec2(-1, -1));
+    float lumaNE = LumaAt(uv, ivec2(1, -1));
+    float lumaSW = LumaAt(uv, ivec2(-1, 1));
+    float lumaSE = LumaAt(uv, ivec2(1, 1));
+
+    float lumaAverage = (2.0 * (lumaN + lumaS + lumaW + lumaE) + (lumaNW + lumaNE + lumaSW + lumaSE)) / 12.0;
+    float subpixel = min(abs(lumaAverage - lumaM) / range, 1.0);
+    subpixel = (3.0 - 2.0 * subpixel) * subpixel * subpixel;
+    float subpixelOffset = subpixel * subpixel * SubpixelBlend;
+
+    float horizontal = abs(lumaNW + lumaSW - 2.0 * lumaW) + 2.0 * abs(lumaN + lumaS - 2.0 * lumaM) +
+                       abs(lumaNE + lumaSE - 2.0 * lumaE);
+    float vertical = abs(lumaNW + lumaNE - 2.0 * lumaN) + 2.0 * abs(lumaW + lumaE - 2.0 * lumaM) +
+                     abs(lumaSW + lumaSE - 2.0 * lumaS);
+    bool isHorizontal = (horizontal >= vertical);
+
+    float luma1 = isHorizontal ? lumaN : lumaW;
+    float luma2 = isHorizontal ? lumaS : lumaE;
+    float gradient1 = luma1 - lumaM;
+    float gradient2 = luma2 - lumaM;
+    bool side1 = abs(gradient1) >= abs(gradient2);
+    float gradientScaled = 0.25 * max(abs(gradient1), abs(gradient2));
+    float stepLength = side1 ? -1.0 : 1.0;
+    float lumaLocalAverage = 0.5 * ((side1 ? luma1 : luma2) + lumaM);
+
+    vec2 across = isHorizontal ? vec2(0.0, texelSize.y) : vec2(texelSize.x, 0.0);
+    vec2 along = isHorizontal ? vec2(texelSize.x, 0.0) : vec2(0.0, texelSize.y);
+    vec2 uvEdge = uv + (0.5 * stepLength) * across;
+
+    vec2 uv1 = uvEdge;
+    vec2 uv2 = uvEdge;
+    float lumaEnd1 = 0.0;
+    float lumaEnd2 = 0.0;
+    bool reached1 = false;
+    bool reached2 = false;
+    for (int i = 0; i < NUM_SEARCH_STEPS && !(reached1 && reached2); i++)
+    {
+        if (!reached1)
+        {
+            uv1 -= SearchSteps[i] * along;
+            lumaEnd1 = Luma(textureLod(SceneColor, uv1, 0.0).rgb) - lumaLocalAverage;
+            reached1 = abs(lumaEnd1) >= gradientScaled;
+        }
+        if (!reached2)
+        {
+            uv2 += SearchSteps[i] * along;
+            lumaEnd2 = Luma(textureLod(SceneColor, uv2, 0.0).rgb) - lumaLocalAverage;
+            reached2 = abs(lumaEnd2) >= gradientScaled;
+        }
+    }
+
+    float distance1 = isHorizontal ? (uv.x - uv1.x) : (uv.y - uv1.y);
+    float distance2 = isHorizontal ? (uv2.x - uv.x) : (uv2.y - uv.y);
+    bool nearer1 = distance1 < distance2;
+    float edgeOffset = 0.5 - min(distance1, distance2) / (distance1 + distance2);
+
+    bool centerBelow = lumaM < lumaLocalAverage;
+    bool correct = ((nearer1 ? lumaEnd1 : lumaEnd2) < 0.0) != centerBelow;
+    float offset = max(correct ? edgeOffset : 0.0, subpixelOffset);
+
+    FragColor = textureLod(SceneColor, uv + (offset * stepLength) * across, 0.0);
+}
@@ -17,6 +17,7 @@ in vec3 VertexWeights;     // For drawing wireframe.
 // Output to framebuffer.
 //============================================================================
 layout (location = 0) out vec4 FragColor;
+layout (location = 1) out float EdgePixelDistance;  // To the nearest triangle edge; see WireframeComposite.fs.glsl.
 
 
 uniform mat4 ViewMatrix;          // View transformation matrix.
@@ -29,6 +30,40 @@ uniform vec3 LightAmbient;
 uniform vec3 LightDiffuse;
 uniform vec3 LightSpecular;
 
+#ifdef CLUSTERED_LIGHTS
+//============================================================================
+// Point lights in eye space, binned into a froxel grid by the application
+// (helper/lightclusters.cpp). Each froxel has an offset and a count into
+// the index list. Tiles split NDC evenly; slices split the eye distance
+// exponentially from ClusterNearZ.
+//============================================================================
+struct PointLight {
+    vec4 positionRadius;  // Eye-space position, and the distance where it fades out.
+    vec4 color;
+};
+layout (std430, binding = 0) readonly buffer PointLights { PointLight pointLights[]; };
+layout (std430, binding = 1) readonly buffer LightCells { uvec2 lightCells[]; };
+layout (std430, binding = 2) readonly buffer LightIndices { uint lightIndices[]; };
+
+uniform vec3 ClusterGridSize;     // Tiles in x and y, and slices.
+uniform vec2 ClusterProjScale;    // ProjMatrix[0][0] and ProjMatrix[1][1].
+uniform float ClusterNearZ;
+uniform float ClusterSliceScale;  // Slices / log(far / near).
+#endif
+
+#ifdef SHADOWS
+//============================================================================
+// Cascaded shadow maps of the directional light, one array layer per
+// cascade. ShadowMatrices take eye space to a layer's texture coordinates
+// and depth; ShadowSplits holds the far eye distance of each cascade.
+//============================================================================
+const int MAX_SHADOW_CASCADES = 4;
+layout (binding = 4) uniform sampler2DArrayShadow ShadowMap;
+uniform mat4 ShadowMatrices[MAX_SHADOW_CASCADES];
+uniform vec4 ShadowSplits;
+uniform int NumShadowCascades;
+#endif
+
 //============================================================================
 // Material info.
 //============================================================================
@@ -38,19 +73,15 @@ uniform vec3 MatlSpecular;
 uniform float MatlShininess;
 
 //============================================================================
-// MirrorTileDensity defines the number of hemispherical mirrors across each 
-// dimension when the corresponding texture coordinate ranges from 0.0 to 1.0.
+// The displacement kernel (MirrorTileDensity, MirrorRadius and
+// displacementAt()) comes from Displacement.glsl, which the application
+// inserts before this shader.
 //============================================================================
-uniform float MirrorTileDensity;  // (0.0, inf)
 
 //============================================================================
-// MirrorRadius is the radius of the hemispherical mirror in the "tile space".
-// The radius is relative to the tile size, which is considered to be 1.0 x 1.0.
-//============================================================================
-uniform float MirrorRadius;  // (0.0, 0.5]
-
-//============================================================================
-// Environment cubemap used for skybox and reflection mapping.
+// Environment cubemap used for skybox and reflection mapping. Its mip levels
+// are the environment blurred over about one of their texels, e.g. by
+// helper/envprefilter.cpp.
 //============================================================================
 layout (binding = 0) uniform samplerCube EnvMap;
 
@@ -92,6 +123,74 @@ void Phong(in vec3 ecPos, in vec3 ecN, out float N_dot_L, out float R_dot_V_pow_
 
 
 
+#ifdef SHADOWS
+/////////////////////////////////////////////////////////////////////////////
+// Fraction of the directional light reaching eye-space point ecPos, from
+// the nearest cascade that covers it. Beyond the last cascade everything
+// is lit.
+/////////////////////////////////////////////////////////////////////////////
+float ShadowFactor(in vec3 ecPos)
+{
+    float depth = -ecPos.z;
+    if (depth > ShadowSplits[NumShadowCascades - 1])
+        return 1.0;
+
+    int cascade = 0;
+    while (cascade < NumShadowCascades - 1 && depth > ShadowSplits[cascade])
+        cascade++;
+
+    // The projections are orthographic, so w is 1. Linear filtering of the
+    // comparison gives 2x2 percentage-closer filtering.
+    vec3 sc = vec3(ShadowMatrices[cascade] * vec4(ecPos, 1.0));
+    return texture(ShadowMap, vec4(sc.xy, float(cascade), sc.z));
+}
+#endif
+
+
+
+#ifdef CLUSTERED_LIGHTS
+/////////////////////////////////////////////////////////////////////////////
+// Diffuse and specular light from the point lights of the froxel holding
+// ecPos. The froxel is found from ecPos rather than gl_FragCoord, as on the
+// CPU, so displaced fragments still get the lists their shading point was
+// binned against.
+/////////////////////////////////////////////////////////////////////////////
+vec3 ClusteredLighting(in vec3 ecPos, in vec3 ecN, in vec3 diffuseMatl)
+{
+    float depth = -ecPos.z;
+    vec2 ndc = ecPos.xy * ClusterProjScale / depth;
+    ivec3 cell = ivec3(floor(vec3((0.5 * ndc + 0.5) * ClusterGridSize.xy,
+                                  log(depth / ClusterNearZ) * ClusterSliceScale)));
+    ivec3 gridSize = ivec3(ClusterGridSize);
+    if (any(lessThan(cell, ivec3(0))) || any(greaterThanEqual(cell.xy, gridSize.xy)) || depth <= 0.0)
+        return vec3(0.0);
+    cell.z = min(cell.z, gridSize.z - 1);
+
+    vec3 V = normalize( -ecPos );
+    vec3 N = normalize( ecN );
+    uvec2 list = lightCells[(cell.z * gridSize.y + cell.y) * gridSize.x + cell.x];
+
+    vec3 sum = vec3(0.0);
+    for (uint i = 0u; i < list.y; i++)
+    {
+        PointLight light = pointLights[lightIndices[list.x + i]];
+        vec3 toLight = light.positionRadius.xyz - ecPos;
+        float dist = length( toLight );
+        float falloff = max( 1.0 - dist / light.positionRadius.w, 0.0 );
+
+        vec3 L = toLight / max( dist, 1.0e-4 );
+        vec3 R = reflect( -L, N );
+        float N_dot_L = max( 0.0, dot( N, L ) );
+        float R_dot_V = max( 0.0, dot( R, V ) );
+        float R_dot_V_pow_n = ( R_dot_V == 0.0 )? 0.0 : pow( R_dot_V, MatlShininess );
+        sum += (falloff * falloff) * light.color.rgb * (diffuseMatl * N_dot_L + MatlSpecular * R_dot_V_pow_n);
+    }
+    return sum;
+}
+#endif
+
+
+
 /////////////////////////////////////////////////////////////////////////////
 // Computes and returns the tangent and binormal vectors.
 /////////////////////////////////////////////////////////////////////////////
@@ -116,51 +215,78 @@ void compute_tangent_vectors( vec3 N, vec3 p, vec2 uv, out vec3 T, out vec3 B )
 
 
 /////////////////////////////////////////////////////////////////////////////
-// Computes fragment color on wooden cube with hemisphereical mirrors.
+// Computes fragment color on wooden cube with mirrors shaped by the
+// displacement kernel.
 /////////////////////////////////////////////////////////////////////////////
 void drawWoodenCube()
 {
     vec3 Base_ecNNormal = normalize(Base_ecNormal);
 
     // Find out whether fragment is in mirror or wood region.
-    vec2 c = MirrorTileDensity * TexCoord.st;
-    vec2 p = fract( c ) - vec2( 0.5 );
-    float sqrDist = dot( p, p );
-
-    if ( sqrDist > MirrorRadius * MirrorRadius ) 
+    DisplacementSample disp = displacementAt( TexCoord.st );
+
+    // Derivatives are undefined in control flow that differs between the
+    // fragments of a quad, as the mirror test below does at a mirror's rim,
+    // so the mirror's reflection vector and its derivatives are computed
+    // for every fragment first. Wood fragments get the flat normal. The wood
+    // texture's derivatives are taken here for the same reason.
+    vec2 dTexCoord_dx = dFdx(TexCoord.st);
+    vec2 dTexCoord_dy = dFdy(TexCoord.st);
+
+    // Compute perturbed normal vector from the kernel's tangent-space normal.
+    vec3 T, B;
+    compute_tangent_vectors( Base_ecNNormal, Base_ecPosition, TexCoord.st, T, B );
+    vec3 tanPerturbedNormal = disp.normal;
+    vec3 ecPerturbedNormal = normalize( tanPerturbedNormal.x * T  +  tanPerturbedNormal.y * B  +  
+                                        tanPerturbedNormal.z * Base_ecNNormal );
+
+    vec3 viewVec = normalize( -ecPosition );
+
+    // Compute eye-space view reflection vector.
+    vec3 ecReflectVec = reflect( -viewVec, ecPerturbedNormal );
+
+    // View reflection vector transformed to world space.
+    vec3 wcReflectVec = transpose(mat3(ViewMatrix)) * ecReflectVec;  
+    vec3 dReflect_dx = dFdx(wcReflectVec);
+    vec3 dReflect_dy = dFdy(wcReflectVec);
+
+    if ( !disp.mirror ) 
     {
         // In wood region.
         float N_dot_L, R_dot_V_pow_n;
         Phong( Base_ecPosition, Base_ecNNormal, N_dot_L, R_dot_V_pow_n );
 
-        vec3 diffuseAmbientMatl = texture(WoodTexMap, TexCoord.st).rgb;
+        vec3 diffuseAmbientMatl = textureGrad(WoodTexMap, TexCoord.st, dTexCoord_dx, dTexCoord_dy).rgb;
+
+#ifdef SHADOWS
+        if (LightPosition.w == 0.0)
+        {
+            float shadow = ShadowFactor( ecPosition );
+            N_dot_L *= shadow;
+            R_dot_V_pow_n *= shadow;
+        }
+#endif
 
         FragColor.rgb = LightAmbient * diffuseAmbientMatl +
                         LightDiffuse * diffuseAmbientMatl * N_dot_L +
                         LightSpecular * MatlSpecular * R_dot_V_pow_n;
+#ifdef CLUSTERED_LIGHTS
+        FragColor.rgb += ClusteredLighting( Base_ecPosition, Base_ecNNormal, diffuseAmbientMatl );
+#endif
         FragColor.a = 1.0;
     }
     else 
     {
         // In mirror region.
 
-        // Compute perturbed normal vector.
-        vec3 T, B;
-        compute_tangent_vectors( Base_ecNNormal, Base_ecPosition, TexCoord.st, T, B );
-        float h = sqrt( abs( MirrorRadius * MirrorRadius - sqrDist ) );
-        vec3 tanPerturbedNormal = normalize( vec3( p.x, p.y, h ) );
-        vec3 ecPerturbedNormal = normalize( tanPerturbedNormal.x * T  +  tanPerturbedNormal.y * B  +  
-                                            tanPerturbedNormal.z * Base_ecNNormal );
-
-        vec3 viewVec = normalize( -ecPosition );
+        // The curved mirrors turn the reflection vector quickly, so choose the
+        // level whose texels span the angle it sweeps across this pixel.
+        const float PI = 3.14159265;
+        float pixelAngle = max(length(dReflect_dx), length(dReflect_dy));
+        float texelsPerRadian = 2.0 * float(textureSize(EnvMap, 0).x) / PI;
+        float lod = log2(max(pixelAngle * texelsPerRadian, 1.0));
 
-        // Compute eye-space view reflection vector.
-        vec3 ecReflectVec = reflect( -viewVec, ecPerturbedNormal );
-
-        // View reflection vector transformed to world space.
-        vec3 wcReflectVec = transpose(mat3(ViewMatrix)) * ecReflectVec;  
-
-        FragColor = texture(EnvMap, wcReflectVec);
+        FragColor = textureLod(EnvMap, wcReflectVec, lod);
     }
 }
 
@@ -185,14 +311,17 @@ void main()
 {
     drawWoodenCube();
 
+    // The smallest vertex weight falls to 0 at the nearest edge; over its
+    // rate of change across the screen, it is the distance in pixels.
+    uint minIdx = findMinIndex(VertexWeights);
+    float minWeight = VertexWeights[minIdx];
+    float dMinWeight_dx = dFdx(minWeight);
+    float dMinWeight_dy = dFdy(minWeight);
+    float dMinWeight = length( vec2(dMinWeight_dx, dMinWeight_dy) );
+    EdgePixelDistance = minWeight / max( dMinWeight, 1.0e-6 );
+
     if (ShowWireframe)
     {
-        uint minIdx = findMinIndex(VertexWeights);
-        float minWeight = VertexWeights[minIdx];
-        float dMinWeight_dx = dFdx(minWeight);
-        float dMinWeight_dy = dFdy(minWeight);
-        float dMinWeight = length( vec2(dMinWeight_dx, dMinWeight_dy) );
-
         float lineWidth = WireframePixelWidth * dMinWeight;
 
         if (minWeight <= lineWidth)
@@ -26,6 +26,10 @@ out vec2 TexCoord;          // Texture coordinates of vertex.
 out vec3 ecPosition;        // Eye-space positions of vertices AFTER displacement.
 out vec3 VertexWeights;     // For drawing wireframe.
 
+// Passed through unchanged, so it matches the depth pre-pass, which has no
+// geometry shader.
+invariant gl_Position;
+
 
 const vec3 VERTEX_WEIGHTS[3] = { vec3(1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1) };
 
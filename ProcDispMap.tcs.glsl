@@ -6,7 +6,27 @@
 
 #version 430 core
 
+//============================================================================
+// Permutations (defined by the application before compiling):
+//   QUAD_PATCHES         Each patch is a 4-vertex quad (one grid cell) instead of
+//                        a 3-vertex triangle.
+//   FEATURE_LOD          Edges that no mirror reaches get level 1, and so does
+//                        the inside of patches that no mirror overlaps. Such
+//                        regions are flat, so one segment is exact there.
+//   LOD_MORPH            Edges and insides where the displacement has faded
+//                        out with distance (see Displacement.glsl) get level 1
+//                        too, for the same reason.
+//   DISPLACEMENT_KERNEL  See Displacement.glsl, which the application inserts
+//                        before this shader.
+//
+// Patches outside the view frustum, even when displaced as far as the
+// kernel's bounds allow, are culled in every permutation.
+//============================================================================
+#ifdef QUAD_PATCHES
+layout (vertices = 4) out;  // Each patch is a quad patch.
+#else
 layout (vertices = 3) out;  // Each patch is a triangle patch.
+#endif
 
 //============================================================================
 // Input from Vertex Shader.
@@ -23,9 +43,11 @@ out vec2 tcs_TexCoord[]; // Texture coordinates.
 //============================================================================
 // Other Uniform variables.
 //============================================================================
+uniform mat4 ModelViewMatrix;     // ModelView matrix.
 uniform mat4 ModelViewProjMatrix; // ModelView matrix * Projection matrix.
 uniform float ViewportWidth;      // Viewport width in pixels.
 uniform float ViewportHeight;     // Viewport Height in pixels.
+uniform float FocalLengthPixels;  // Pixels per eye-space unit at eye depth 1.
 
 //============================================================================
 // TessEdgePixelLength is the desired pixel length of each short edge produced by the 
@@ -36,6 +58,11 @@ uniform float ViewportHeight;     // Viewport Height in pixels.
 //============================================================================
 uniform float TessEdgePixelLength = 20.0;  
 
+// Scales the levels from the edge lengths. Passes that tolerate coarser
+// geometry than the view, like the shadow pass, set it below 1. It does not
+// change the displacement, which follows the view.
+uniform float TessLevelScale = 1.0;
+
 
 void main()
 {
@@ -44,7 +71,7 @@ void main()
     tcs_Normal[gl_InvocationID] = vs_Normal[gl_InvocationID];
     tcs_TexCoord[gl_InvocationID] = vs_TexCoord[gl_InvocationID];
 
-    // Let only one of the 3 TCS invocations compute the tessellation levels.
+    // Let only one of the TCS invocations compute the tessellation levels.
     if (gl_InvocationID == 0)
     {
         /////////////////////////////////////////////////////////////////////////////
@@ -65,19 +92,158 @@ void main()
     	vec4 p0 = mat * ModelViewProjMatrix * gl_in[0].gl_Position;
     	vec4 p1 = mat * ModelViewProjMatrix * gl_in[1].gl_Position;
     	vec4 p2 = mat * ModelViewProjMatrix * gl_in[2].gl_Position;
+#ifdef QUAD_PATCHES
+    	vec4 p3 = mat * ModelViewProjMatrix * gl_in[3].gl_Position;
+#endif
 
     	// Compute the length of the patch edges in pixels
     	float pix = sqrt(ViewportHeight * ViewportHeight + ViewportWidth * ViewportWidth);
+#ifdef QUAD_PATCHES
+    	// Corners are (u,v) = (0,0), (1,0), (1,1), (0,1). Outer edge 0 is u = 0,
+    	// 1 is v = 0, 2 is u = 1 and 3 is v = 1.
+    	float pix_length0 = distance(p0, p3) * pix;
+    	float pix_length1 = distance(p0, p1) * pix;
+    	float pix_length2 = distance(p1, p2) * pix;
+    	float pix_length3 = distance(p3, p2) * pix;
+
+    	gl_TessLevelOuter[0] = pix_length0 / TessEdgePixelLength * TessLevelScale;
+    	gl_TessLevelOuter[1] = pix_length1 / TessEdgePixelLength * TessLevelScale;
+    	gl_TessLevelOuter[2] = pix_length2 / TessEdgePixelLength * TessLevelScale;
+    	gl_TessLevelOuter[3] = pix_length3 / TessEdgePixelLength * TessLevelScale;
+
+    	// Inner level 0 runs along u, inner level 1 along v.
+    	gl_TessLevelInner[0] = max(gl_TessLevelOuter[1], gl_TessLevelOuter[3]);
+    	gl_TessLevelInner[1] = max(gl_TessLevelOuter[0], gl_TessLevelOuter[2]);
+#else
     	float pix_length0 = distance(p1, p2) * pix;
     	float pix_length1 = distance(p0, p2) * pix;
     	float pix_length2 = distance(p0, p1) * pix;
 
     	// Compute the tessellation level for each outer edge
-    	gl_TessLevelOuter[0] = pix_length0 / TessEdgePixelLength;
-    	gl_TessLevelOuter[1] = pix_length1 / TessEdgePixelLength;
-    	gl_TessLevelOuter[2] = pix_length2 / TessEdgePixelLength;
+    	gl_TessLevelOuter[0] = pix_length0 / TessEdgePixelLength * TessLevelScale;
+    	gl_TessLevelOuter[1] = pix_length1 / TessEdgePixelLength * TessLevelScale;
+    	gl_TessLevelOuter[2] = pix_length2 / TessEdgePixelLength * TessLevelScale;
 
     	// The inner tessellation level is the max of those of the 3 outer edges
     	gl_TessLevelInner[0] = max(max(gl_TessLevelOuter[0], gl_TessLevelOuter[1]), gl_TessLevelOuter[2]);
+#endif
+
+    	vec2 st0 = vs_TexCoord[0];
+    	vec2 st1 = vs_TexCoord[1];
+    	vec2 st2 = vs_TexCoord[2];
+#ifdef QUAD_PATCHES
+    	vec2 st3 = vs_TexCoord[3];
+    	vec2 stLo = min(min(st0, st1), min(st2, st3));
+    	vec2 stHi = max(max(st0, st1), max(st2, st3));
+#else
+    	vec2 stLo = min(min(st0, st1), st2);
+    	vec2 stHi = max(max(st0, st1), st2);
+#endif
+
+    	// The TES samples height maps at a mip level that grows with eye depth,
+    	// and filtering reaches beyond the patch. Grow the bounds to cover the
+    	// coarsest level any vertex of the patch can use. Depths are taken in
+    	// eye space, like the TES does, rather than from the projection, which
+    	// is the light's in the shadow pass.
+    	vec4 c0 = ModelViewProjMatrix * gl_in[0].gl_Position;
+    	vec4 c1 = ModelViewProjMatrix * gl_in[1].gl_Position;
+    	vec4 c2 = ModelViewProjMatrix * gl_in[2].gl_Position;
+    	float depth0 = -(ModelViewMatrix * gl_in[0].gl_Position).z;
+    	float depth1 = -(ModelViewMatrix * gl_in[1].gl_Position).z;
+    	float depth2 = -(ModelViewMatrix * gl_in[2].gl_Position).z;
+#ifdef QUAD_PATCHES
+    	vec4 c3 = ModelViewProjMatrix * gl_in[3].gl_Position;
+    	float depth3 = -(ModelViewMatrix * gl_in[3].gl_Position).z;
+    	float maxDepth = max(max(depth0, depth1), max(depth2, depth3));
+#else
+    	float maxDepth = max(max(depth0, depth1), depth2);
+#endif
+    	float objectScale = length(ModelViewMatrix[0].xyz);
+    	float maxLod = displacementLod(TessEdgePixelLength * maxDepth / (FocalLengthPixels * objectScale));
+    	float margin = displacementFilterMargin(maxLod);
+
+#ifdef FEATURE_LOD
+    	// Drop the levels where the displacement is zero. The inner levels keep
+    	// the edge-length levels from above when a mirror is inside the patch,
+    	// even if it touches none of the edges.
+#ifdef QUAD_PATCHES
+    	if (!displacementSegmentMayDisplace(st0, st3, margin)) gl_TessLevelOuter[0] = 1.0;
+    	if (!displacementSegmentMayDisplace(st0, st1, margin)) gl_TessLevelOuter[1] = 1.0;
+    	if (!displacementSegmentMayDisplace(st1, st2, margin)) gl_TessLevelOuter[2] = 1.0;
+    	if (!displacementSegmentMayDisplace(st3, st2, margin)) gl_TessLevelOuter[3] = 1.0;
+    	if (!displacementBoxMayDisplace(stLo, stHi, margin)) {
+    	    gl_TessLevelInner[0] = 1.0;
+    	    gl_TessLevelInner[1] = 1.0;
+    	}
+#else
+    	if (!displacementSegmentMayDisplace(st1, st2, margin)) gl_TessLevelOuter[0] = 1.0;
+    	if (!displacementSegmentMayDisplace(st0, st2, margin)) gl_TessLevelOuter[1] = 1.0;
+    	if (!displacementSegmentMayDisplace(st0, st1, margin)) gl_TessLevelOuter[2] = 1.0;
+    	if (!displacementBoxMayDisplace(stLo, stHi, margin))
+    	    gl_TessLevelInner[0] = 1.0;
+#endif
+#endif
+
+#ifdef LOD_MORPH
+    	// The TES fades the displacement by the depth of each vertex, and depth
+    	// is linear along a patch, so an edge or patch is flat once the
+    	// displacement is gone at its nearest corner. The edge tests only read
+    	// the edge's own corners, so neighbouring patches agree.
+    	float tilePixelsAtDepth1 = FocalLengthPixels * objectScale / MirrorTileDensity;
+    	float morph0 = displacementMorph(tilePixelsAtDepth1 / max(depth0, 1.0e-4));
+    	float morph1 = displacementMorph(tilePixelsAtDepth1 / max(depth1, 1.0e-4));
+    	float morph2 = displacementMorph(tilePixelsAtDepth1 / max(depth2, 1.0e-4));
+#ifdef QUAD_PATCHES
+    	float morph3 = displacementMorph(tilePixelsAtDepth1 / max(depth3, 1.0e-4));
+    	if (max(morph0, morph3) == 0.0) gl_TessLevelOuter[0] = 1.0;
+    	if (max(morph0, morph1) == 0.0) gl_TessLevelOuter[1] = 1.0;
+    	if (max(morph1, morph2) == 0.0) gl_TessLevelOuter[2] = 1.0;
+    	if (max(morph3, morph2) == 0.0) gl_TessLevelOuter[3] = 1.0;
+    	if (max(max(morph0, morph1), max(morph2, morph3)) == 0.0) {
+    	    gl_TessLevelInner[0] = 1.0;
+    	    gl_TessLevelInner[1] = 1.0;
+    	}
+#else
+    	if (max(morph1, morph2) == 0.0) gl_TessLevelOuter[0] = 1.0;
+    	if (max(morph0, morph2) == 0.0) gl_TessLevelOuter[1] = 1.0;
+    	if (max(morph0, morph1) == 0.0) gl_TessLevelOuter[2] = 1.0;
+    	if (max(max(morph0, morph1), morph2) == 0.0)
+    	    gl_TessLevelInner[0] = 1.0;
+#endif
+#endif
+
+    	// Frustum culling. The patch is flat, so it stays within the prism
+    	// between its corners and the corners moved out along their normals
+    	// by the largest height. Cull it if all of those lie outside one
+    	// clip plane.
+    	float height = displacementMaxHeight(stLo, stHi, margin);
+#ifdef QUAD_PATCHES
+    	const int NUM_CORNERS = 4;
+    	vec4 corners[2 * NUM_CORNERS] = vec4[2 * NUM_CORNERS](c0, c1, c2, c3,
+    	    ModelViewProjMatrix * vec4(gl_in[0].gl_Position.xyz + height * normalize(vs_Normal[0]), 1.0),
+    	    ModelViewProjMatrix * vec4(gl_in[1].gl_Position.xyz + height * normalize(vs_Normal[1]), 1.0),
+    	    ModelViewProjMatrix * vec4(gl_in[2].gl_Position.xyz + height * normalize(vs_Normal[2]), 1.0),
+    	    ModelViewProjMatrix * vec4(gl_in[3].gl_Position.xyz + height * normalize(vs_Normal[3]), 1.0));
+#else
+    	const int NUM_CORNERS = 3;
+    	vec4 corners[2 * NUM_CORNERS] = vec4[2 * NUM_CORNERS](c0, c1, c2,
+    	    ModelViewProjMatrix * vec4(gl_in[0].gl_Position.xyz + height * normalize(vs_Normal[0]), 1.0),
+    	    ModelViewProjMatrix * vec4(gl_in[1].gl_Position.xyz + height * normalize(vs_Normal[1]), 1.0),
+    	    ModelViewProjMatrix * vec4(gl_in[2].gl_Position.xyz + height * normalize(vs_Normal[2]), 1.0));
+#endif
+    	vec3 maxBelow = vec3(-1.0e30);  // Largest xyz + w: negative if all below -w.
+    	vec3 minAbove = vec3(1.0e30);   // Smallest xyz - w: positive if all above w.
+    	for (int i = 0; i < 2 * NUM_CORNERS; i++) {
+    	    maxBelow = max(maxBelow, corners[i].xyz + corners[i].www);
+    	    minAbove = min(minAbove, corners[i].xyz - corners[i].www);
+    	}
+    	if (any(lessThan(maxBelow, vec3(0.0))) || any(greaterThan(minAbove, vec3(0.0)))) {
+    	    gl_TessLevelOuter[0] = 0.0;
+    	    gl_TessLevelOuter[1] = 0.0;
+    	    gl_TessLevelOuter[2] = 0.0;
+#ifdef QUAD_PATCHES
+    	    gl_TessLevelOuter[3] = 0.0;
+#endif
+    	}
     }
 }
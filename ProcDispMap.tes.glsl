@@ -6,7 +6,18 @@
 
 #version 430 core
 
+//============================================================================
+// Permutations (defined by the application before compiling):
+//   QUAD_PATCHES         Patches are 4-vertex quads interpolated bilinearly
+//                        instead of 3-vertex triangles.
+//   LOD_MORPH            Fade the displacement out with distance.
+//   DISPLACEMENT_KERNEL  See Displacement.glsl.
+//============================================================================
+#ifdef QUAD_PATCHES
+layout (quads, fractional_odd_spacing) in;
+#else
 layout (triangles, fractional_odd_spacing) in;
+#endif
 
 //============================================================================
 // Input from TCS.
@@ -22,6 +33,10 @@ out vec3 tes_Base_ecNormal;    // Eye-space normal vector at new vertex on the t
 out vec2 tes_TexCoord;         // Texture coordinates of new vertex.
 out vec3 tes_ecPosition;       // Eye-space position of new vertex AFTER displacement.
 
+// The depth pre-pass runs this shader without the geometry shader, and the
+// main pass tests against its depths with GL_EQUAL.
+invariant gl_Position;
+
 //============================================================================
 // Other Uniform variables.
 //============================================================================
@@ -29,24 +44,29 @@ uniform mat4 ViewMatrix;          // View transformation matrix.
 uniform mat4 ModelViewMatrix;     // ModelView matrix.
 uniform mat4 ModelViewProjMatrix; // ModelView matrix * Projection matrix.
 uniform mat3 NormalMatrix;        // For transforming object-space direction vector to eye space.
+uniform float FocalLengthPixels;  // Pixels per eye-space unit at eye depth 1.
 
-//============================================================================
-// MirrorTileDensity defines the number of hemispherical mirrors across each 
-// dimension when the corresponding texture coordinate ranges from 0.0 to 1.0.
-//============================================================================
-uniform float MirrorTileDensity;  // (0.0, inf)
+// Same as in the TCS: desired length in pixels of each tessellated edge.
+uniform float TessEdgePixelLength = 20.0;
 
 //============================================================================
-// MirrorRadius is the radius of the hemispherical mirror in the "tile space".
-// The radius is relative to the tile size, which is considered to be 1.0 x 1.0.
+// The displacement kernel (MirrorTileDensity, MirrorRadius and
+// displacementAtLod()) comes from Displacement.glsl, which the application
+// inserts before this shader.
 //============================================================================
-uniform float MirrorRadius;  // (0.0, 0.5]
 
-//============================================================================
-// MirrorRadiusObjectSpace is the radius of the hemispherical mirror in object space.
-//============================================================================
-uniform float MirrorRadiusObjectSpace;
+#ifdef QUAD_PATCHES
+// Corners are ordered (u,v) = (0,0), (1,0), (1,1), (0,1).
+vec2 interpolate2D(vec2 v0, vec2 v1, vec2 v2, vec2 v3)
+{
+    return mix(mix(v0, v1, gl_TessCoord.x), mix(v3, v2, gl_TessCoord.x), gl_TessCoord.y);
+}
 
+vec3 interpolate3D(vec3 v0, vec3 v1, vec3 v2, vec3 v3)
+{
+    return mix(mix(v0, v1, gl_TessCoord.x), mix(v3, v2, gl_TessCoord.x), gl_TessCoord.y);
+}
+#else
 vec2 interpolate2D(vec2 v0, vec2 v1, vec2 v2)                                                   
 {                                                                                               
     return vec2(gl_TessCoord.x) * v0 + vec2(gl_TessCoord.y) * v1 + vec2(gl_TessCoord.z) * v2;   
@@ -56,6 +76,7 @@ vec3 interpolate3D(vec3 v0, vec3 v1, vec3 v2)
 {                                                                                               
     return vec3(gl_TessCoord.x) * v0 + vec3(gl_TessCoord.y) * v1 + vec3(gl_TessCoord.z) * v2;   
 }    
+#endif
 
 void main(void)
 {
@@ -71,32 +92,39 @@ void main(void)
 
 	// Interpolate data (BEFORE DISPLACEMENT)
 	// Use the barycentric coordinates of the new vertex to interpolate the 3D position
+#ifdef QUAD_PATCHES
+	vec3 mcPos = interpolate3D(gl_in[0].gl_Position.xyz, gl_in[1].gl_Position.xyz,
+	                           gl_in[2].gl_Position.xyz, gl_in[3].gl_Position.xyz);
+#else
 	vec3 mcPos = interpolate3D(gl_in[0].gl_Position.xyz, gl_in[1].gl_Position.xyz, gl_in[2].gl_Position.xyz);
+#endif
 	tes_Base_ecPosition = vec3(ModelViewMatrix * vec4(mcPos, 1.0));
 	// Interpolate normal vector
+#ifdef QUAD_PATCHES
+	vec3 mcNorm = interpolate3D(tcs_Normal[0], tcs_Normal[1], tcs_Normal[2], tcs_Normal[3]);
+#else
 	vec3 mcNorm = interpolate3D(tcs_Normal[0], tcs_Normal[1], tcs_Normal[2]);
+#endif
 	tes_Base_ecNormal = NormalMatrix * mcNorm;
 	tes_Base_ecNormal = normalize(tes_Base_ecNormal);
 	// Interpolate texture coordinates
+#ifdef QUAD_PATCHES
+	tes_TexCoord = interpolate2D(tcs_TexCoord[0], tcs_TexCoord[1], tcs_TexCoord[2], tcs_TexCoord[3]);
+#else
 	tes_TexCoord = interpolate2D(tcs_TexCoord[0], tcs_TexCoord[1], tcs_TexCoord[2]);
+#endif
 
+	// Displace along the interpolated normal. Kernel heights are in texture-coordinate
+	// units, which are object-space units on the unit planes.
+	// The mip level follows from the segment length the TCS aims for at this
+	// depth. It depends on the vertex alone, so vertices shared by
+	// neighbouring patches get the same height and no cracks open.
+	float objectScale = length(ModelViewMatrix[0].xyz);
+	float depth = max(-tes_Base_ecPosition.z, 1.0e-4);
+	float lod = displacementLod(TessEdgePixelLength * depth / (FocalLengthPixels * objectScale));
+	DisplacementSample disp = displacementAtLod(tes_TexCoord, lod);
+	float morph = displacementMorph(FocalLengthPixels * objectScale / (MirrorTileDensity * depth));
+	mcPos += normalize(mcNorm) * (morph * disp.height);
+	tes_ecPosition = vec3(ModelViewMatrix * vec4(mcPos, 1.0));
 	gl_Position = ModelViewProjMatrix * vec4(mcPos, 1.0);
-	
-	vec2 c = MirrorTileDensity * tes_TexCoord.st;
-    vec2 p = fract( c ) - vec2( 0.5 );
-    float sqrDist = dot( p, p );
-
-    // Determine whether new vertex is in mirror region or not
-    if ( sqrDist <= MirrorRadius * MirrorRadius ) {
-    	// If new vertex is in the mirror region, displace it suitably.
-    	//mcNorm = normalize(mcPos);
-		// Compute displacement height
-		
-		float displacement = sqrt(MirrorRadiusObjectSpace * MirrorRadiusObjectSpace 
-			- mcPos.x * mcPos.x - mcPos.z * mcPos.z);
-		mcPos += mcNorm * displacement;
-		tes_ecPosition = vec3(ModelViewMatrix * vec4(mcPos, 1.0));
-		gl_Position = ModelViewProjMatrix * vec4(mcPos, 1.0);
-    }
-
 }
@@ -0,0 +1,30 @@
+// FILE: Skybox.fs.glsl
+// FRAGMENT SHADER
+
+#version 430 core
+
+//============================================================================
+// Input from Vertex Shader.
+//============================================================================
+in vec3 wcDirection;   // World-space view direction, not normalized.
+
+//============================================================================
+// Output to framebuffer.
+//============================================================================
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out float EdgePixelDistance;  // For the wireframe composite.
+
+//============================================================================
+// The environment cubemap, as bound for the reflections.
+//============================================================================
+layout (binding = 0) uniform samplerCube EnvMap;
+
+
+void main()
+{
+    // Level 0 is the unfiltered environment in either cubemap.
+    FragColor = textureLod(EnvMap, wcDirection, 0.0);
+
+    // No edges in the sky. The largest half float.
+    EdgePixelDistance = 65504.0;
+}
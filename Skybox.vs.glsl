@@ -0,0 +1,34 @@
+// FILE: Skybox.vs.glsl
+// VERTEX SHADER
+
+#version 430 core
+
+//============================================================================
+// Draws one triangle that covers the viewport, at the far plane, without
+// vertex buffers: gl_VertexID 0, 1 and 2 become (-1, -1), (3, -1) and
+// (-1, 3) in normalized device coordinates.
+//============================================================================
+
+//============================================================================
+// Output to Fragment Shader.
+//============================================================================
+out vec3 wcDirection;   // World-space view direction, not normalized.
+
+//============================================================================
+// Uniform variables.
+//============================================================================
+uniform mat3 InvViewRotation;  // Eye-space to world-space directions.
+uniform vec2 InvProjScale;     // 1 / ProjectionMatrix[0][0], 1 / ProjectionMatrix[1][1].
+
+
+void main()
+{
+    vec2 ndc = vec2((gl_VertexID & 1) * 4 - 1, (gl_VertexID & 2) * 2 - 1);
+
+    // Linear across the screen, so interpolating it is exact.
+    wcDirection = InvViewRotation * vec3(ndc * InvProjScale, -1.0);
+
+    // z = w puts every fragment at depth 1.0, which passes GL_LEQUAL only
+    // where nothing else has been drawn.
+    gl_Position = vec4(ndc, 1.0, 1.0);
+}
@@ -0,0 +1,68 @@
+// FILE: TeapotPatch.tcs.glsl
+// TESSELLATION CONTROL SHADER (TCS)
+
+#version 430 core
+
+layout (vertices = 16) out;  // Each patch is a bicubic Bezier patch.
+
+//============================================================================
+// Uniform variables.
+//============================================================================
+uniform mat4 ModelViewProjMatrix; // ModelView matrix * Projection matrix.
+uniform float ViewportWidth;      // Viewport width in pixels.
+uniform float ViewportHeight;     // Viewport Height in pixels.
+
+//============================================================================
+// TessEdgePixelLength is the desired pixel length of each short edge produced
+// by the tessellation on the outer edges of the patch.
+//============================================================================
+uniform float TessEdgePixelLength = 20.0;
+
+// Scales the levels; see ProcDispMap.tcs.glsl.
+uniform float TessLevelScale = 1.0;
+
+const float MAX_TESS_LEVEL = 64.0;
+
+
+// Viewport position of control point i. Points behind the eye are clamped
+// to the near side so they still give a large, finite length.
+vec2 toViewport(int i)
+{
+    vec4 clipPos = ModelViewProjMatrix * gl_in[i].gl_Position;
+    vec2 ndc = clipPos.xy / max(clipPos.w, 1.0e-4);
+    return (ndc * 0.5 + 0.5) * vec2(ViewportWidth, ViewportHeight);
+}
+
+// Tessellation level of the boundary curve through control points a, b,
+// c and d. The length of the control polygon bounds the curve's length.
+float edgeLevel(vec2 a, vec2 b, vec2 c, vec2 d)
+{
+    float pixelLength = distance(a, b) + distance(b, c) + distance(c, d);
+    return clamp(pixelLength / TessEdgePixelLength * TessLevelScale, 1.0, MAX_TESS_LEVEL);
+}
+
+
+void main()
+{
+    // Pass along the control point unmodified.
+    gl_out[gl_InvocationID].gl_Position = gl_in[gl_InvocationID].gl_Position;
+
+    // Let only one of the TCS invocations compute the tessellation levels.
+    if (gl_InvocationID == 0)
+    {
+        // Control point (i, j) is at index 4 * i + j, with i along u
+        // (gl_TessCoord.x) and j along v (gl_TessCoord.y).
+        vec2 p[16];
+        for (int i = 0; i < 16; i++) p[i] = toViewport(i);
+
+        // Outer edge 0 is u = 0, 1 is v = 0, 2 is u = 1 and 3 is v = 1.
+        gl_TessLevelOuter[0] = edgeLevel(p[0], p[1], p[2], p[3]);
+        gl_TessLevelOuter[1] = edgeLevel(p[0], p[4], p[8], p[12]);
+        gl_TessLevelOuter[2] = edgeLevel(p[12], p[13], p[14], p[15]);
+        gl_TessLevelOuter[3] = edgeLevel(p[3], p[7], p[11], p[15]);
+
+        // Inner level 0 runs along u, inner level 1 along v.
+        gl_TessLevelInner[0] = max(gl_TessLevelOuter[1], gl_TessLevelOuter[3]);
+        gl_TessLevelInner[1] = max(gl_TessLevelOuter[0], gl_TessLevelOuter[2]);
+    }
+}
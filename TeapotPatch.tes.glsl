@@ -0,0 +1,85 @@
+// FILE: TeapotPatch.tes.glsl
+// TESSELLATION EVALUATION SHADER (TES)
+//
+// Evaluates a bicubic Bezier patch with the Bernstein basis. The outputs
+// are those of ProcDispMap.tes.glsl, so the ProcDispMap geometry and
+// fragment shaders can be reused. VBOTeapotPatch::evaluate() is the CPU
+// reference of this shader and must be kept in sync with it.
+
+#version 430 core
+
+layout (quads, fractional_odd_spacing) in;
+
+//============================================================================
+// Output to Geometry Shader.
+//============================================================================
+out vec3 tes_Base_ecPosition;  // Eye-space position of new vertex on the patch.
+out vec3 tes_Base_ecNormal;    // Eye-space normal vector at new vertex on the patch.
+out vec2 tes_TexCoord;         // Texture coordinates of new vertex, (u, v) of the patch.
+out vec3 tes_ecPosition;       // Same as tes_Base_ecPosition; the teapot is not displaced.
+
+// Must match the depth pre-pass exactly; see ProcDispMap.tes.glsl.
+invariant gl_Position;
+
+//============================================================================
+// Uniform variables.
+//============================================================================
+uniform mat4 ModelViewMatrix;     // ModelView matrix.
+uniform mat4 ModelViewProjMatrix; // ModelView matrix * Projection matrix.
+uniform mat3 NormalMatrix;        // For transforming object-space direction vector to eye space.
+
+
+// Cubic Bernstein polynomials and their derivatives at t.
+void basisFunctions(float t, out vec4 b, out vec4 db)
+{
+    float s = 1.0 - t;
+    b = vec4(s * s * s, 3.0 * s * s * t, 3.0 * s * t * t, t * t * t);
+    db = vec4(-3.0 * s * s, 3.0 * s * s - 6.0 * s * t, 6.0 * s * t - 3.0 * t * t, 3.0 * t * t);
+}
+
+// Position and partial derivatives of the patch at (u, v). Control point
+// (i, j) is at index 4 * i + j, with i along u.
+void evaluatePatch(vec2 uv, out vec3 pos, out vec3 du, out vec3 dv)
+{
+    vec4 bu, dbu, bv, dbv;
+    basisFunctions(uv.x, bu, dbu);
+    basisFunctions(uv.y, bv, dbv);
+
+    pos = vec3(0.0);
+    du = vec3(0.0);
+    dv = vec3(0.0);
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            vec3 cp = gl_in[4 * i + j].gl_Position.xyz;
+            pos += bu[i] * bv[j] * cp;
+            du += dbu[i] * bv[j] * cp;
+            dv += bu[i] * dbv[j] * cp;
+        }
+    }
+}
+
+
+void main(void)
+{
+    vec2 uv = gl_TessCoord.xy;
+
+    vec3 mcPos, du, dv;
+    evaluatePatch(uv, mcPos, du, dv);
+
+    // Where a patch edge collapses to a point (the tip of the lid, the
+    // centre of the bottom) the normal is taken a little way inside.
+    vec3 mcNorm = cross(du, dv);
+    if (dot(mcNorm, mcNorm) < 1.0e-12) {
+        vec3 innerPos;
+        evaluatePatch(mix(uv, vec2(0.5), 1.0e-3), innerPos, du, dv);
+        mcNorm = cross(du, dv);
+    }
+    mcNorm = normalize(mcNorm);
+
+    tes_Base_ecPosition = vec3(ModelViewMatrix * vec4(mcPos, 1.0));
+    tes_Base_ecNormal = normalize(NormalMatrix * mcNorm);
+    tes_TexCoord = uv;
+    tes_ecPosition = tes_Base_ecPosition;
+
+    gl_Position = ModelViewProjMatrix * vec4(mcPos, 1.0);
+}
@@ -0,0 +1,15 @@
+// FILE: TeapotPatch.vs.glsl
+// VERTEX SHADER
+
+#version 430 core
+
+//============================================================================
+// Vertex attributes.
+//============================================================================
+layout (location = 0) in vec3 vPosition;  // Bezier control point in object space.
+
+
+void main()
+{
+    gl_Position = vec4(vPosition, 1.0);
+}
@@ -0,0 +1,43 @@
+// FILE: WireframeComposite.fs.glsl
+// FRAGMENT SHADER
+
+#version 430 core
+
+//============================================================================
+// Draws the scene image with the wireframe laid over it. ProcDispMap.fs.glsl
+// writes each pixel's distance to the nearest triangle edge into a second
+// render target, so the overlay needs neither a second geometry pass nor a
+// program of its own in the scene pass.
+//============================================================================
+
+//============================================================================
+// Output to framebuffer.
+//============================================================================
+layout (location = 0) out vec4 FragColor;
+
+//============================================================================
+// The scene's render targets.
+//============================================================================
+layout (binding = 0) uniform sampler2D SceneColor;
+layout (binding = 1) uniform sampler2D EdgePixelDistance;
+
+//============================================================================
+// Same meaning and defaults as in ProcDispMap.fs.glsl.
+//============================================================================
+uniform bool ShowWireframe;
+uniform float WireframePixelWidth = 1.0;
+uniform vec3 WireframeColor = vec3(0.1, 0.1, 0.1);
+
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    FragColor = texelFetch(SceneColor, pixel, 0);
+
+    if (ShowWireframe)
+    {
+        float d = texelFetch(EdgePixelDistance, pixel, 0).r;
+        if (d <= WireframePixelWidth)
+            FragColor.rgb = mix( WireframeColor, FragColor.rgb, smoothstep( 0, WireframePixelWidth, d ) );
+    }
+}
@@ -0,0 +1,105 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <new>
+#include <cstdint>
+
+Arena::Arena(size_t blockSize)
+    : current(0), offset(0), usedBefore(0), blockSize(blockSize), peakBytesUsed(0)
+{
+}
+
+
+Arena::~Arena()
+{
+    release();
+}
+
+
+void *Arena::allocate(size_t bytes, size_t alignment)
+{
+    for( ;; ) {
+        if( current == blocks.size() ) {
+            Block block = { NULL, std::max(blockSize, bytes + alignment), 0 };
+            block.memory = static_cast<char *>(::operator new(block.size));
+            blocks.push_back(block);
+        }
+
+        // A block kept from before a rewind that is too small even when
+        // empty is replaced by one that fits.
+        Block &block = blocks[current];
+        if( offset == 0 && block.size < bytes + alignment ) {
+            ::operator delete(block.memory);
+            block.size = std::max(blockSize, bytes + alignment);
+            block.memory = static_cast<char *>(::operator new(block.size));
+        }
+
+        uintptr_t base = reinterpret_cast<uintptr_t>(block.memory);
+        size_t start = size_t(((base + offset + alignment - 1) & ~uintptr_t(alignment - 1)) - base);
+        if( start + bytes <= block.size ) {
+            offset = start + bytes;
+            peakBytesUsed = std::max(peakBytesUsed, usedBefore + offset);
+            return block.memory + start;
+        }
+
+        block.used = offset;
+        usedBefore += offset;
+        current++;
+        offset = 0;
+    }
+}
+
+
+Arena::Marker Arena::getMarker() const
+{
+    Marker marker = { current, offset };
+    return marker;
+}
+
+
+void Arena::rewind(const Marker &marker)
+{
+    current = marker.block;
+    offset = marker.offset;
+    usedBefore = 0;
+    for( size_t i = 0; i < current; i++ ) usedBefore += blocks[i].used;
+}
+
+
+void Arena::reset()
+{
+    Marker start = { 0, 0 };
+    rewind(start);
+}
+
+
+void Arena::release()
+{
+    for( size_t i = 0; i < blocks.size(); i++ ) ::operator delete(blocks[i].memory);
+    blocks.clear();
+    current = 0;
+    offset = 0;
+    usedBefore = 0;
+    peakBytesUsed = 0;
+}
+
+
+size_t Arena::getBytesUsed() const
+{
+    return usedBefore + offset;
+}
+
+
+size_t Arena::getBytesReserved() const
+{
+    size_t bytes = 0;
+    for( size_t i = 0; i < blocks.size(); i++ ) bytes += blocks[i].size;
+    return bytes;
+}
+
+
+Arena &Arena::scratch()
+{
+    static thread_local Arena arena;
+    return arena;
+}
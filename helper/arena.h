@@ -0,0 +1,94 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+// A linear allocator for transient buffers, such as the arrays a mesh
+// generator fills before they are uploaded. Allocation bumps an offset in
+// the current block; nothing is freed on its own, but rewind() drops
+// everything allocated after a marker at once. Blocks are kept after a
+// rewind, so loading mesh after mesh reuses the same memory instead of
+// going back to the heap for every array.
+//
+// Memory is uninitialised and destructors are not run: use it for plain
+// data only. Not thread-safe; each thread has its own scratch().
+class Arena
+{
+public:
+    // Where the arena stood at some point, for rewind().
+    struct Marker
+    {
+        size_t block;
+        size_t offset;
+    };
+
+    // Rewinds the arena to where it stood at construction when it goes
+    // out of scope.
+    class Scope
+    {
+    public:
+        explicit Scope(Arena &arena) : arena(arena), marker(arena.getMarker()) {}
+        ~Scope() { arena.rewind(marker); }
+
+    private:
+        Arena &arena;
+        Marker marker;
+
+        Scope(const Scope &);
+        Scope &operator=(const Scope &);
+    };
+
+    // Blocks are at least blockSize bytes; a larger allocation gets a
+    // block of its own size.
+    explicit Arena(size_t blockSize = 1 << 20);
+    ~Arena();
+
+    // Aligned to alignment, a power of two up to 4096. Never NULL; zero
+    // bytes gives a valid pointer too.
+    void *allocate(size_t bytes, size_t alignment = 16);
+
+    template <typename T>
+    T *allocateArray(size_t count) { return static_cast<T *>(allocate(count * sizeof(T), alignof(T) > 16 ? alignof(T) : 16)); }
+
+    Marker getMarker() const;
+
+    // Frees everything allocated since the marker was taken.
+    void rewind(const Marker &marker);
+
+    // Frees everything, keeping the blocks.
+    void reset();
+
+    // Frees everything and returns the blocks to the heap.
+    void release();
+
+    size_t getBytesUsed() const;
+    size_t getBytesReserved() const;
+
+    // Most bytes in use at once since construction or release().
+    size_t getPeakBytesUsed() const { return peakBytesUsed; }
+
+    // The calling thread's arena for transient buffers. Callers take a
+    // Scope on it, so it is empty between them.
+    static Arena &scratch();
+
+private:
+    struct Block
+    {
+        char *memory;
+        size_t size;
+        size_t used;      // Bytes used in it when allocation moved on to the next.
+    };
+
+    std::vector<Block> blocks;
+    size_t current;       // Block allocations come from; blocks.size() if none.
+    size_t offset;        // Bytes used in it.
+    size_t usedBefore;    // Bytes used in the blocks before it.
+    size_t blockSize;
+    size_t peakBytesUsed;
+
+    Arena(const Arena &);
+    Arena &operator=(const Arena &);
+};
+
+#endif // ARENA_H
@@ -0,0 +1,1795 @@
+#include "benchmarks.h"
+#include "stopwatch.h"
+#include "parallel.h"
+#include "jobsystem.h"
+#include "vboplanepatches.h"
+#include "vboteapot.h"
+#include "vboteapotpatch.h"
+#include "meshoptimize.h"
+#include "meshsimplify.h"
+#include "displacement.h"
+#include "heightpyramid.h"
+#include "normalbaker.h"
+#include "envprefilter.h"
+#include "lightclusters.h"
+#include "shadowcascades.h"
+#include "fxaa.h"
+#include "imagemetrics.h"
+#include "dynamicresolution.h"
+#include "spscqueue.h"
+#include "arena.h"
+#include "indexbuffer.h"
+#include "processmemory.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+using std::vector;
+
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace Benchmarks {
+
+/////////////////////////////////////////////////////////////////////////////
+// Throughput of the VBOPlanePatches wave kernel on a 1000 x 1000 grid
+// (about 1M control points), scalar vs. SSE, single vs. multithreaded.
+/////////////////////////////////////////////////////////////////////////////
+static bool benchPlaneUpdate()
+{
+    const int gridVerts = 1000;
+    const int nVerts = gridVerts * gridVerts;
+    const int iterations = 20;
+
+    vector<float> restX(nVerts), restZ(nVerts);
+    vector<float> v(3 * nVerts), n(3 * nVerts);
+    for( int i = 0; i < gridVerts; i++ ) {
+        for( int j = 0; j < gridVerts; j++ ) {
+            restX[i * gridVerts + j] = (float)j / (gridVerts - 1) - 0.5f;
+            restZ[i * gridVerts + j] = (float)i / (gridVerts - 1) - 0.5f;
+        }
+    }
+
+    const PlaneWave waves[3] = {
+        { 0.020f, 12.0f,  0.0f, 2.0f },
+        { 0.010f,  5.0f, 17.0f, 3.1f },
+        { 0.005f, -9.0f, 23.0f, 4.7f }
+    };
+
+    struct Config { const char *name; bool simd; bool threads; };
+    const Config configs[4] = {
+        { "scalar, 1 thread ", false, false },
+        { "SSE,    1 thread ", true,  false },
+        { "scalar, threaded ", false, true },
+        { "SSE,    threaded ", true,  true }
+    };
+
+    printf("Plane wave update: %d control points, 3 waves, %d threads available\n",
+           nVerts, Parallel::getNumThreads());
+
+    for( int c = 0; c < 4; c++ ) {
+        // Warm up once so page faults are not timed.
+        VBOPlanePatches::evaluateWaves(waves, 3, 0.0f, &restX[0], &restZ[0], &v[0], &n[0],
+                                       0, nVerts, configs[c].simd, configs[c].threads);
+        Stopwatch timer;
+        for( int it = 0; it < iterations; it++ ) {
+            VBOPlanePatches::evaluateWaves(waves, 3, 0.01f * it, &restX[0], &restZ[0], &v[0], &n[0],
+                                           0, nVerts, configs[c].simd, configs[c].threads);
+        }
+        double ms = timer.elapsedMs() / iterations;
+        printf("  %s %8.3f ms/update  %8.1f Mpoints/s\n", configs[c].name, ms, nVerts / (ms * 1000.0));
+    }
+    return true;
+}
+
+
+// A triangle as a number, the smallest of its three rotations, so that
+// rotated copies compare equal but reversed ones do not.
+static unsigned long long canonicalTriangle(const unsigned int *v, unsigned int nVerts)
+{
+    unsigned long long best = 0;
+    for( int r = 0; r < 3; r++ ) {
+        unsigned long long key = ((unsigned long long)v[r] * nVerts + v[(r + 1) % 3]) * nVerts + v[(r + 2) % 3];
+        if( r == 0 || key < best ) best = key;
+    }
+    return best;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Checks the output of MeshOptimize::optimizeMesh() against its input:
+// remap is a permutation, the remapped input triangles are the output
+// triangles (in any order, each rotated any way but with its winding
+// kept), and the output uses the vertices in order 0, 1, 2, ...
+/////////////////////////////////////////////////////////////////////////////
+static bool checkOptimizedMesh(const vector<unsigned int> &input, const vector<unsigned int> &output,
+                               const vector<unsigned int> &remap, unsigned int nVerts)
+{
+    if( remap.size() != nVerts || output.size() != input.size() ) return false;
+    vector<bool> used(nVerts, false);
+    for( unsigned int v = 0; v < nVerts; v++ ) {
+        if( remap[v] >= nVerts || used[remap[v]] ) return false;
+        used[remap[v]] = true;
+    }
+
+    unsigned int next = 0;
+    for( size_t i = 0; i < output.size(); i++ ) {
+        if( output[i] > next ) return false;
+        if( output[i] == next ) next++;
+    }
+
+    // Each triangle as the smallest of its three rotations.
+    size_t numTriangles = input.size() / 3;
+    vector<unsigned long long> expected(numTriangles), actual(numTriangles);
+    for( size_t t = 0; t < numTriangles; t++ ) {
+        unsigned int a[3] = { remap[input[3 * t]], remap[input[3 * t + 1]], remap[input[3 * t + 2]] };
+        expected[t] = canonicalTriangle(a, nVerts);
+        actual[t] = canonicalTriangle(&output[3 * t], nVerts);
+    }
+    std::sort(expected.begin(), expected.end());
+    std::sort(actual.begin(), actual.end());
+    return expected == actual;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Vertex cache optimization of a torus-style grid (the VBOTorus index
+// pattern), both in generator order and with the triangles shuffled, which
+// is closer to what an exported OBJ file looks like. Checks the output
+// with checkOptimizedMesh() and that the cache misses do not go up.
+/////////////////////////////////////////////////////////////////////////////
+static bool benchMeshOptimize()
+{
+    const unsigned int rings = 512, sides = 512;
+    const unsigned int nVerts = sides * (rings + 1);
+
+    vector<unsigned int> grid;
+    grid.reserve(6 * rings * sides);
+    for( unsigned int ring = 0; ring < rings; ring++ ) {
+        unsigned int ringStart = ring * sides;
+        unsigned int nextRingStart = (ring + 1) * sides;
+        for( unsigned int side = 0; side < sides; side++ ) {
+            unsigned int nextSide = (side + 1) % sides;
+            unsigned int quad[6] = { ringStart + side, nextRingStart + side, nextRingStart + nextSide,
+                                     ringStart + side, nextRingStart + nextSide, ringStart + nextSide };
+            grid.insert(grid.end(), quad, quad + 6);
+        }
+    }
+
+    vector<unsigned int> shuffled(grid);
+    unsigned int seed = 12345;
+    for( size_t t = shuffled.size() / 3 - 1; t > 0; t-- ) {
+        seed = seed * 1664525u + 1013904223u;
+        size_t r = seed % (t + 1);
+        for( int k = 0; k < 3; k++ ) std::swap(shuffled[3 * t + k], shuffled[3 * r + k]);
+    }
+
+    printf("Mesh optimization: %u vertices, %u triangles, cache size %d\n",
+           nVerts, (unsigned int)(grid.size() / 3), MeshOptimize::DEFAULT_CACHE_SIZE);
+
+    bool passed = true;
+    struct Input { const char *name; const vector<unsigned int> *indices; };
+    const Input inputs[2] = { { "generator order", &grid }, { "shuffled       ", &shuffled } };
+    for( int i = 0; i < 2; i++ ) {
+        vector<unsigned int> el(*inputs[i].indices);
+        vector<unsigned int> remap;
+        MeshOptimize::CacheStats before, after;
+        Stopwatch timer;
+        MeshOptimize::optimizeMesh(&el[0], el.size(), nVerts, remap, &before, &after);
+        double ms = timer.elapsedMs();
+        bool checked = checkOptimizedMesh(*inputs[i].indices, el, remap, nVerts) && after.acmr <= before.acmr;
+        passed = passed && checked;
+        printf("  %s ACMR %.3f -> %.3f  ATVR %.3f -> %.3f  %8.2f ms  %s\n", inputs[i].name,
+               before.acmr, after.acmr, before.atvr, after.atvr, ms, checked ? "ok" : "FAILED");
+    }
+    printf("  %s\n", passed ? "PASSED" : "FAILED");
+    return passed;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Distance from p to the triangle abc (Ericson, "Real-Time Collision
+// Detection", 5.1.5).
+/////////////////////////////////////////////////////////////////////////////
+static float pointTriangleDistance(const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b,
+                                   const glm::vec3 &c)
+{
+    glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+    float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+    if( d1 <= 0.0f && d2 <= 0.0f ) return glm::length(p - a);
+
+    glm::vec3 bp = p - b;
+    float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+    if( d3 >= 0.0f && d4 <= d3 ) return glm::length(p - b);
+
+    float vc = d1 * d4 - d3 * d2;
+    if( vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f )
+        return glm::length(p - (a + ab * (d1 / (d1 - d3))));
+
+    glm::vec3 cp = p - c;
+    float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+    if( d6 >= 0.0f && d5 <= d6 ) return glm::length(p - c);
+
+    float vb = d5 * d2 - d1 * d6;
+    if( vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f )
+        return glm::length(p - (a + ac * (d2 / (d2 - d6))));
+
+    float va = d3 * d6 - d5 * d4;
+    if( va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f )
+        return glm::length(p - (b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)))));
+
+    float denom = 1.0f / (va + vb + vc);
+    return glm::length(p - (a + ab * (vb * denom) + ac * (vc * denom)));
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Largest distance from a vertex of the source triangles to the nearest
+// triangle of a level, looking only within maxDistance of each vertex; a
+// vertex with no triangle that close counts as FLT_MAX. Vertices used
+// only by slivers (triangles under a thousandth of the mean area, such as the
+// fans at the poles of a sphere) are skipped: they bound no surface, and
+// collapsing along them costs nothing in the quadric metric. The level's
+// triangles are binned in a uniform grid of about one triangle per cell,
+// each grown by maxDistance.
+/////////////////////////////////////////////////////////////////////////////
+static float levelDistance(const float *positions, const unsigned int *source, size_t sourceCount,
+                           const unsigned int *level, size_t levelCount, float maxDistance)
+{
+    size_t numSourceTriangles = sourceCount / 3;
+    vector<float> area(numSourceTriangles);
+    double totalArea = 0.0;
+    for( size_t t = 0; t < numSourceTriangles; t++ ) {
+        const unsigned int *tri = source + 3 * t;
+        glm::vec3 a(positions[3 * tri[0]], positions[3 * tri[0] + 1], positions[3 * tri[0] + 2]);
+        glm::vec3 b(positions[3 * tri[1]], positions[3 * tri[1] + 1], positions[3 * tri[1] + 2]);
+        glm::vec3 c(positions[3 * tri[2]], positions[3 * tri[2] + 1], positions[3 * tri[2] + 2]);
+        area[t] = 0.5f * glm::length(glm::cross(b - a, c - a));
+        totalArea += area[t];
+    }
+    float minArea = float(1.0e-3 * totalArea / std::max(numSourceTriangles, size_t(1)));
+    vector<unsigned int> measured;
+    for( size_t t = 0; t < numSourceTriangles; t++ )
+        if( area[t] > minArea ) measured.insert(measured.end(), source + 3 * t, source + 3 * t + 3);
+    std::sort(measured.begin(), measured.end());
+    measured.erase(std::unique(measured.begin(), measured.end()), measured.end());
+
+    glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+    for( size_t i = 0; i < measured.size(); i++ ) {
+        const float *q = positions + 3 * measured[i];
+        lo = glm::min(lo, glm::vec3(q[0], q[1], q[2]));
+        hi = glm::max(hi, glm::vec3(q[0], q[1], q[2]));
+    }
+    lo -= glm::vec3(maxDistance);
+    hi += glm::vec3(maxDistance);
+
+    int numTriangles = int(levelCount / 3);
+    glm::vec3 extent = hi - lo;
+    float cellSize = std::max(cbrtf(extent.x * extent.y * extent.z / std::max(numTriangles, 1)), 1.0e-6f);
+    int res[3];
+    for( int k = 0; k < 3; k++ ) res[k] = std::min(std::max(int(extent[k] / cellSize) + 1, 1), 256);
+    glm::vec3 scale = glm::vec3(res[0], res[1], res[2]) / glm::max(extent, glm::vec3(1.0e-6f));
+    auto cellOf = [&](const glm::vec3 &p, int k) {
+        return std::min(std::max(int((p[k] - lo[k]) * scale[k]), 0), res[k] - 1);
+    };
+
+    vector< vector<int> > cells(res[0] * res[1] * res[2]);
+    for( int t = 0; t < numTriangles; t++ ) {
+        glm::vec3 tlo(FLT_MAX), thi(-FLT_MAX);
+        for( int k = 0; k < 3; k++ ) {
+            const float *q = positions + 3 * level[3 * t + k];
+            tlo = glm::min(tlo, glm::vec3(q[0], q[1], q[2]));
+            thi = glm::max(thi, glm::vec3(q[0], q[1], q[2]));
+        }
+        tlo -= glm::vec3(maxDistance);
+        thi += glm::vec3(maxDistance);
+        for( int z = cellOf(tlo, 2); z <= cellOf(thi, 2); z++ )
+            for( int y = cellOf(tlo, 1); y <= cellOf(thi, 1); y++ )
+                for( int x = cellOf(tlo, 0); x <= cellOf(thi, 0); x++ )
+                    cells[(z * res[1] + y) * res[0] + x].push_back(t);
+    }
+
+    float worst = 0.0f;
+    for( size_t i = 0; i < measured.size(); i++ ) {
+        const float *q = positions + 3 * measured[i];
+        glm::vec3 p(q[0], q[1], q[2]);
+        const vector<int> &cell = cells[(cellOf(p, 2) * res[1] + cellOf(p, 1)) * res[0] + cellOf(p, 0)];
+        float nearest = FLT_MAX;
+        for( size_t c = 0; c < cell.size() && nearest > 0.0f; c++ ) {
+            const unsigned int *tri = level + 3 * cell[c];
+            glm::vec3 a(positions[3 * tri[0]], positions[3 * tri[0] + 1], positions[3 * tri[0] + 2]);
+            glm::vec3 b(positions[3 * tri[1]], positions[3 * tri[1] + 1], positions[3 * tri[1] + 2]);
+            glm::vec3 d(positions[3 * tri[2]], positions[3 * tri[2] + 1], positions[3 * tri[2] + 2]);
+            float dist = pointTriangleDistance(p, a, b, d);
+            if( dist <= maxDistance ) nearest = std::min(nearest, dist);
+        }
+        worst = std::max(worst, nearest);
+    }
+    return worst;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// LOD chain generation for a batch of bumpy spheres, one mesh per thread
+// vs. all meshes on one thread. Prints the chain of the first mesh and
+// checks every chain: triangle counts at or under the targets and
+// decreasing, errors not decreasing, every source vertex within a level's
+// error of that level, and the threaded chains equal to the serial ones.
+/////////////////////////////////////////////////////////////////////////////
+static bool benchSimplify()
+{
+    const int numMeshes = 8;
+    const int maxLevels = 6;
+    const float reduction = 0.5f;
+    const unsigned int slices = 256, stacks = 128;
+    const unsigned int nVerts = (slices + 1) * (stacks + 1);
+
+    vector< vector<float> > positions(numMeshes);
+    vector<unsigned int> el;
+    for( int m = 0; m < numMeshes; m++ ) {
+        vector<float> &v = positions[m];
+        v.reserve(3 * nVerts);
+        for( unsigned int i = 0; i <= slices; i++ ) {
+            float theta = 6.2831853f * i / slices;
+            for( unsigned int j = 0; j <= stacks; j++ ) {
+                float phi = 3.1415927f * j / stacks;
+                float r = 1.0f + 0.02f * (m + 1) * sinf(7.0f * theta) * sinf(5.0f * phi);
+                v.push_back(r * sinf(phi) * cosf(theta));
+                v.push_back(r * sinf(phi) * sinf(theta));
+                v.push_back(r * cosf(phi));
+            }
+        }
+    }
+    for( unsigned int i = 0; i < slices; i++ ) {
+        unsigned int stackStart = i * (stacks + 1), nextStackStart = (i + 1) * (stacks + 1);
+        for( unsigned int j = 0; j < stacks; j++ ) {
+            if( j != 0 ) {
+                el.push_back(stackStart + j); el.push_back(stackStart + j + 1); el.push_back(nextStackStart + j + 1);
+            }
+            if( j != stacks - 1 ) {
+                el.push_back(nextStackStart + j); el.push_back(stackStart + j); el.push_back(nextStackStart + j + 1);
+            }
+        }
+    }
+
+    vector<MeshSimplify::MeshLODJob> jobs(numMeshes);
+    for( int m = 0; m < numMeshes; m++ ) {
+        jobs[m].positions = &positions[m][0];
+        jobs[m].numVertices = nVerts;
+        jobs[m].indices = &el[0];
+        jobs[m].indexCount = el.size();
+    }
+    vector<MeshSimplify::MeshLODJob> serialJobs(jobs);
+
+    printf("LOD chains: %d meshes of %u triangles, %d threads available\n",
+           numMeshes, (unsigned int)(el.size() / 3), Parallel::getNumThreads());
+
+    int threads = Parallel::getNumThreads();
+    Parallel::setNumThreads(1);
+    Stopwatch timer;
+    MeshSimplify::buildLODChains(serialJobs, maxLevels, reduction);
+    double serialMs = timer.elapsedMs();
+
+    // At least a few threads, so that the chains are built on workers and
+    // compared with the serial ones even on a single core.
+    Parallel::setNumThreads(std::max(threads, 4));
+    timer.reset();
+    MeshSimplify::buildLODChains(jobs, maxLevels, reduction);
+    double parallelMs = timer.elapsedMs();
+    Parallel::setNumThreads(threads);
+
+    bool passed = true;
+    vector<float> distances(jobs[0].levels.size(), 0.0f);
+    for( int m = 0; m < numMeshes; m++ ) {
+        const MeshSimplify::MeshLODJob &job = jobs[m];
+        const vector<MeshSimplify::LODLevel> &levels = job.levels;
+
+        const MeshSimplify::MeshLODJob &serial = serialJobs[m];
+        bool sameLevels = serial.levels.size() == levels.size();
+        for( size_t i = 0; sameLevels && i < levels.size(); i++ ) {
+            sameLevels = serial.levels[i].indexOffset == levels[i].indexOffset &&
+                         serial.levels[i].indexCount == levels[i].indexCount &&
+                         serial.levels[i].error == levels[i].error;
+        }
+        passed = passed && sameLevels && serial.lodIndices == job.lodIndices;
+
+        double target = (double)levels[0].indexCount;
+        for( size_t i = 1; i < levels.size(); i++ ) {
+            target *= reduction;
+            passed = passed && levels[i].indexCount <= (size_t)target / 3 * 3 &&
+                     levels[i].indexCount < levels[i - 1].indexCount &&
+                     levels[i].error >= levels[i - 1].error;
+
+            float allowed = levels[i].error * 1.0001f + 1.0e-6f;
+            float dist = levelDistance(job.positions, job.indices, job.indexCount,
+                                       &job.lodIndices[levels[i].indexOffset], levels[i].indexCount, allowed);
+            passed = passed && dist <= allowed;
+            if( m == 0 ) distances[i] = dist;
+        }
+    }
+
+    const vector<MeshSimplify::LODLevel> &levels = jobs[0].levels;
+    for( size_t i = 0; i < levels.size(); i++ )
+        printf("  LOD %d: %7u triangles, error %.5f, source within %.5f\n", (int)i,
+               levels[i].indexCount / 3, levels[i].error, distances[i]);
+    printf("  1 thread  %8.1f ms\n", serialMs);
+    printf("  %d threads %8.1f ms\n", std::max(threads, 4), parallelMs);
+    printf("  %s\n", passed ? "PASSED" : "FAILED");
+    return passed;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Teapot tessellation at a high grid value: the original point-by-point
+// evaluator vs. the batched one, scalar vs. SSE, single vs. multithreaded.
+// Every configuration's positions, texture coordinates, indices and
+// normals are checked against the original evaluator's.
+/////////////////////////////////////////////////////////////////////////////
+static bool benchTeapot()
+{
+    const int grid = 256;
+    const int iterations = 5;
+    const int nVerts = VBOTeapot::getNumVertices(grid);
+    const int nIndices = VBOTeapot::getNumIndices(grid);
+
+    vector<float> refV(3 * nVerts), refN(3 * nVerts), refTc(2 * nVerts);
+    vector<unsigned int> refEl(nIndices);
+    vector<float> v(3 * nVerts), n(3 * nVerts), tc(2 * nVerts);
+    vector<unsigned int> el(nIndices);
+    glm::mat4 lid = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 1.5f, 0.25f));
+
+    // At least a few threads for the threaded configurations, so that
+    // their split of the work is checked even on a single core.
+    int threads = Parallel::getNumThreads();
+    int manyThreads = std::max(threads, 4);
+    printf("Teapot generation: grid %d, %d points, %d threads for the threaded configurations\n",
+           grid, nVerts, manyThreads);
+
+    struct Config { const char *name; bool reference; bool simd; bool threads; };
+    const Config configs[5] = {
+        { "reference         ", true,  false, false },
+        { "batched, 1 thread ", false, false, false },
+        { "SSE,     1 thread ", false, true,  false },
+        { "batched, threaded ", false, false, true },
+        { "SSE,     threaded ", false, true,  true }
+    };
+
+    bool passed = true;
+    for( int c = 0; c < 5; c++ ) {
+        const Config &cfg = configs[c];
+        Parallel::setNumThreads(cfg.threads ? manyThreads : threads);
+        std::fill(v.begin(), v.end(), -1.0e30f);
+        std::fill(n.begin(), n.end(), -1.0e30f);
+        std::fill(tc.begin(), tc.end(), -1.0e30f);
+        std::fill(el.begin(), el.end(), 0xFFFFFFFFu);
+        Stopwatch timer;
+        for( int it = 0; it < iterations; it++ ) {
+            if( cfg.reference )
+                VBOTeapot::generateReference(grid, lid, &refV[0], &refN[0], &refTc[0], &refEl[0]);
+            else
+                VBOTeapot::generate(grid, lid, &v[0], &n[0], &tc[0], &el[0], cfg.simd, cfg.threads);
+        }
+        double ms = timer.elapsedMs() / iterations;
+        if( cfg.reference ) {
+            printf("  %s %8.2f ms  %8.1f Mpoints/s\n", cfg.name, ms, nVerts / (ms * 1000.0));
+            continue;
+        }
+
+        // Normals are arbitrary where a patch row collapses to a point (the
+        // tip of the lid, the centre of the bottom); those are skipped, as
+        // in benchTeapotPatch().
+        float maxPosError = 0.0f, maxTcError = 0.0f, minNormalDot = 1.0f;
+        for( int r = 0; r < nVerts; r++ ) {
+            glm::vec3 refPos(refV[3 * r], refV[3 * r + 1], refV[3 * r + 2]);
+            glm::vec3 pos(v[3 * r], v[3 * r + 1], v[3 * r + 2]);
+            maxPosError = std::max(maxPosError, glm::length(pos - refPos));
+            maxTcError = std::max(maxTcError, std::max(fabsf(tc[2 * r] - refTc[2 * r]),
+                                                       fabsf(tc[2 * r + 1] - refTc[2 * r + 1])));
+
+            int j = r % (grid + 1);
+            int rn = r + ((j < grid) ? 1 : -1);
+            glm::vec3 neighbourPos(refV[3 * rn], refV[3 * rn + 1], refV[3 * rn + 2]);
+            if( glm::length(neighbourPos - refPos) > 1.0e-6f ) {
+                glm::vec3 refNorm(refN[3 * r], refN[3 * r + 1], refN[3 * r + 2]);
+                glm::vec3 norm(n[3 * r], n[3 * r + 1], n[3 * r + 2]);
+                minNormalDot = std::min(minNormalDot, glm::dot(norm, refNorm));
+            }
+        }
+        bool sameIndices = el == refEl;
+        bool checked = maxPosError < 1.0e-4f && maxTcError < 1.0e-6f && minNormalDot > 0.9999f && sameIndices;
+        passed = passed && checked;
+        printf("  %s %8.2f ms  %8.1f Mpoints/s  pos %.1e  tc %.1e  normal dot %.6f  indices %s  %s\n",
+               cfg.name, ms, nVerts / (ms * 1000.0), maxPosError, maxTcError, minNormalDot,
+               sameIndices ? "same" : "DIFFERENT", checked ? "ok" : "FAILED");
+    }
+    Parallel::setNumThreads(threads);
+    printf("  %s\n", passed ? "PASSED" : "FAILED");
+    return passed;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Correctness check of the GPU teapot: evaluates the CPU reference of
+// TeapotPatch.tes.glsl on VBOTeapotPatch's control points and compares it
+// with the CPU-tessellated VBOTeapot at the same (u, v) samples.
+/////////////////////////////////////////////////////////////////////////////
+static bool benchTeapotPatch()
+{
+    const int grid = 16;
+    const int stride = grid + 1;
+    const int nVerts = VBOTeapot::getNumVertices(grid);
+
+    vector<float> v(3 * nVerts), n(3 * nVerts), tc(2 * nVerts);
+    vector<unsigned int> el(VBOTeapot::getNumIndices(grid));
+    VBOTeapot::generateReference(grid, glm::mat4(1.0f), &v[0], &n[0], &tc[0], &el[0]);
+
+    vector<float> cp(3 * 16 * VBOTeapotPatch::NUM_PATCHES);
+    VBOTeapotPatch::getControlPoints(&cp[0]);
+
+    // VBOTeapotPatch stores each patch with its v direction reversed
+    // relative to VBOTeapot, so that cross(du, dv) faces outwards.
+    float maxPosError = 0.0f, minNormalDot = 1.0f;
+    int compared = 0;
+    Stopwatch timer;
+    for( int p = 0; p < VBOTeapotPatch::NUM_PATCHES; p++ ) {
+        for( int i = 0; i <= grid; i++ ) {
+            for( int j = 0; j <= grid; j++ ) {
+                glm::vec3 pos, norm;
+                VBOTeapotPatch::evaluate(&cp[3 * 16 * p], (float)i / grid, 1.0f - (float)j / grid, pos, norm);
+
+                int r = p * stride * stride + i * stride + j;
+                glm::vec3 refPos(v[3 * r], v[3 * r + 1], v[3 * r + 2]);
+                glm::vec3 refNorm(n[3 * r], n[3 * r + 1], n[3 * r + 2]);
+                maxPosError = std::max(maxPosError, glm::length(pos - refPos));
+
+                // VBOTeapot's normals are arbitrary where a patch row
+                // collapses to a point (the tip of the lid, the centre of
+                // the bottom); skip those samples.
+                int rn = r + ((j < grid) ? 1 : -1);
+                glm::vec3 neighbourPos(v[3 * rn], v[3 * rn + 1], v[3 * rn + 2]);
+                if( glm::length(neighbourPos - refPos) > 1.0e-6f ) {
+                    minNormalDot = std::min(minNormalDot, glm::dot(norm, refNorm));
+                    compared++;
+                }
+            }
+        }
+    }
+    double ms = timer.elapsedMs();
+
+    printf("Teapot patch evaluator vs. VBOTeapot, grid %d:\n", grid);
+    printf("  max position error %g\n", maxPosError);
+    printf("  min normal dot     %f (%d normals compared)\n", minNormalDot, compared);
+    bool passed = maxPosError < 1.0e-4f && minNormalDot > 0.999f;
+    printf("  %s (%.2f ms)\n", passed ? "PASSED" : "FAILED", ms);
+    return passed;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// The C++ displacement kernels: throughput per kernel, and their analytic
+// normals against normals from finite differences of their heights. Only
+// mirror samples away from the rim are compared, where the surface is
+// smooth and not too steep for differencing. The heightfield kernel
+// differences one texel apart itself, so it is checked at that spacing.
+// Also checks that the tessellation bounds are conservative.
+/////////////////////////////////////////////////////////////////////////////
+static bool benchDisplacement()
+{
+    const int gridSize = 512;
+
+    // A tileable stand-in for images/heightmap.png.
+    const int mapSize = 64;
+    vector<unsigned char> mapData(mapSize * mapSize);
+    for( int y = 0; y < mapSize; y++ ) {
+        for( int x = 0; x < mapSize; x++ ) {
+            float u = 6.2831853f * x / mapSize, v = 6.2831853f * y / mapSize;
+            float h = 0.5f + 0.3f * cosf(u + v) + 0.2f * cosf(u - v + 1.3f);
+            mapData[y * mapSize + x] = (unsigned char)(255.0f * h + 0.5f);
+        }
+    }
+    Displacement::HeightMap heightMap;
+    heightMap.set(&mapData[0], mapSize, mapSize, 1);
+    HeightPyramid heightPyramid;
+    heightPyramid.build(heightMap);
+
+    printf("Displacement kernels: %d x %d samples, MirrorTileDensity 3, MirrorRadius 0.4\n",
+           gridSize, gridSize);
+
+    bool passed = true;
+    for( int k = 0; k < Displacement::NUM_KERNELS; k++ ) {
+        Displacement::Params params = { (Displacement::Kernel)k, 3.0f, 0.4f, &heightMap, &heightPyramid };
+
+        Stopwatch timer;
+        double sum = 0.0;
+        int mirrors = 0;
+        for( int i = 0; i < gridSize; i++ ) {
+            for( int j = 0; j < gridSize; j++ ) {
+                Displacement::Sample d = Displacement::evaluate(params, (j + 0.5f) / gridSize, (i + 0.5f) / gridSize);
+                sum += d.height;
+                if( d.mirror ) mirrors++;
+            }
+        }
+        double ms = timer.elapsedMs();
+
+        float eps = (k == Displacement::HEIGHTFIELD) ? 1.0f / (params.mirrorTileDensity * mapSize) : 1.0e-3f;
+        float minDot = 1.0f;
+        int compared = 0;
+        for( int i = 0; i < gridSize; i += 4 ) {
+            for( int j = 0; j < gridSize; j += 4 ) {
+                float s = (j + 0.5f) / gridSize, t = (i + 0.5f) / gridSize;
+                Displacement::Sample d = Displacement::evaluate(params, s, t);
+                if( !d.mirror || d.normal.z < 0.5f ) continue;
+
+                Displacement::Sample ds0 = Displacement::evaluate(params, s - eps, t);
+                Displacement::Sample ds1 = Displacement::evaluate(params, s + eps, t);
+                Displacement::Sample dt0 = Displacement::evaluate(params, s, t - eps);
+                Displacement::Sample dt1 = Displacement::evaluate(params, s, t + eps);
+                if( !ds0.mirror || !ds1.mirror || !dt0.mirror || !dt1.mirror ) continue;
+
+                // Skip creases, e.g. where two Voronoi mirrors meet.
+                const float maxKink = 100.0f * eps * eps;
+                if( fabsf(ds0.height + ds1.height - 2.0f * d.height) > maxKink ||
+                    fabsf(dt0.height + dt1.height - 2.0f * d.height) > maxKink ) continue;
+
+                glm::vec3 fd = glm::normalize(glm::vec3(-(ds1.height - ds0.height) / (2.0f * eps),
+                                                        -(dt1.height - dt0.height) / (2.0f * eps), 1.0f));
+                minDot = std::min(minDot, glm::dot(fd, d.normal));
+                compared++;
+            }
+        }
+        passed = passed && compared > 0 && minDot > 0.99f;
+
+        // The tessellation bounds must never skip a displaced point. Checks
+        // the edges and cells of a grid of patches like VBOPlanePatches'.
+        const int cells = 20, samples = 32;
+        int flatEdges = 0, flatCells = 0;
+        bool conservative = true;
+        for( int i = 0; i <= cells; i++ ) {
+            for( int j = 0; j <= cells; j++ ) {
+                glm::vec2 corner((float)j / cells, (float)i / cells);
+                glm::vec2 edgeEnd[2] = { corner + glm::vec2(1.0f / cells, 0.0f), corner + glm::vec2(0.0f, 1.0f / cells) };
+                for( int e = 0; e < 2; e++ ) {
+                    if( Displacement::segmentMayDisplace(params, corner, edgeEnd[e]) ) continue;
+                    flatEdges++;
+                    for( int q = 0; q <= samples; q++ ) {
+                        glm::vec2 st = glm::mix(corner, edgeEnd[e], (float)q / samples);
+                        if( Displacement::evaluate(params, st.x, st.y).mirror ) conservative = false;
+                    }
+                }
+                glm::vec2 hi = corner + glm::vec2(1.0f / cells);
+                if( Displacement::boxMayDisplace(params, corner, hi) ) continue;
+                flatCells++;
+                for( int q = 0; q <= samples * samples; q++ ) {
+                    glm::vec2 st = glm::mix(corner, hi, glm::vec2((float)(q % (samples + 1)) / samples,
+                                                                  (float)(q / (samples + 1)) / samples));
+                    if( Displacement::evaluate(params, st.x, st.y).mirror ) conservative = false;
+                }
+            }
+        }
+        passed = passed && conservative;
+
+        printf("  %-12s %8.1f Msamples/s  mirror %5.1f%%  mean height %.4f  min normal dot %f (%d compared)\n",
+               Displacement::getKernelName(params.kernel), gridSize * gridSize / (ms * 1000.0),
+               100.0 * mirrors / (gridSize * gridSize), sum / (gridSize * gridSize), minDot, compared);
+        printf("  %-12s flat edges %5.1f%%  flat cells %5.1f%%  bounds %s\n", "",
+               100.0 * flatEdges / (2 * (cells + 1) * (cells + 1)), 100.0 * flatCells / ((cells + 1) * (cells + 1)),
+               conservative ? "conservative" : "MISSED DISPLACEMENT");
+    }
+    printf("  %s\n", passed ? "PASSED" : "FAILED");
+    return passed;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Builds the min/max pyramid of a large height map on one thread and on
+// all of them, and checks that getBounds() contains every bilinear sample
+// of random boxes of all sizes.
+/////////////////////////////////////////////////////////////////////////////
+static bool benchHeightPyramid()
+{
+    const int mapSize = 4096;
+    const int repeats = 5;
+
+    // Smooth waves plus per-texel noise, so neighbouring cells differ.
+    vector<unsigned char> mapData((size_t)mapSize * mapSize);
+    unsigned int seed = 12345u;
+    for( int y = 0; y < mapSize; y++ ) {
+        for( int x = 0; x < mapSize; x++ ) {
+            float u = 6.2831853f * x / mapSize, v = 6.2831853f * y / mapSize;
+            seed = seed * 1664525u + 1013904223u;
+            float h = 0.45f + 0.25f * cosf(4.0f * u + v) + 0.15f * cosf(u - 3.0f * v) + 0.1f * (seed >> 8) / 16777216.0f;
+            mapData[(size_t)y * mapSize + x] = (unsigned char)(255.0f * h + 0.5f);
+        }
+    }
+    Displacement::HeightMap heightMap;
+    heightMap.set(&mapData[0], mapSize, mapSize, 1);
+
+    printf("Height pyramid: %d x %d map, best of %d builds, %d threads\n",
+           mapSize, mapSize, repeats, Parallel::getNumThreads());
+
+    HeightPyramid pyramid;
+    double bestMs[2] = { 1.0e30, 1.0e30 };
+    for( int threaded = 0; threaded < 2; threaded++ ) {
+        for( int r = 0; r < repeats; r++ ) {
+            Stopwatch timer;
+            pyramid.build(heightMap, threaded != 0);
+            bestMs[threaded] = std::min(bestMs[threaded], timer.elapsedMs());
+        }
+    }
+    printf("  1 thread  %8.2f ms\n", bestMs[0]);
+    printf("  threaded  %8.2f ms  (%.2fx)  %d levels\n", bestMs[1], bestMs[0] / bestMs[1], pyramid.getNumLevels());
+
+    // Random boxes from a fraction of a texel to several map repeats,
+    // sampled densely, including their borders.
+    const int boxes = 2000, samples = 16;
+    bool contained = true;
+    double sumRange = 0.0;
+    seed = 777u;
+    for( int b = 0; b < boxes; b++ ) {
+        float r[3];
+        for( int i = 0; i < 3; i++ ) {
+            seed = seed * 1664525u + 1013904223u;
+            r[i] = (seed >> 8) / 16777216.0f;
+        }
+        float size = powf(2.0f, -14.0f + 16.0f * r[2]);
+        glm::vec2 lo(4.0f * r[0] - 2.0f, 4.0f * r[1] - 2.0f);
+        glm::vec2 hi = lo + glm::vec2(size, 0.5f * size);
+
+        float minHeight, maxHeight;
+        pyramid.getBounds(lo, hi, minHeight, maxHeight);
+        sumRange += maxHeight - minHeight;
+        for( int q = 0; q <= samples * samples; q++ ) {
+            glm::vec2 st = glm::mix(lo, hi, glm::vec2((float)(q % (samples + 1)) / samples,
+                                                      (float)(q / (samples + 1)) / samples));
+            float h = heightMap.sample(st.x, st.y);
+            if( h < minHeight - 1.0e-6f || h > maxHeight + 1.0e-6f ) contained = false;
+        }
+    }
+    printf("  %d boxes: mean bound range %.3f, samples %s\n", boxes, sumRange / boxes,
+           contained ? "contained" : "OUTSIDE BOUNDS");
+    printf("  %s\n", contained ? "PASSED" : "FAILED");
+    return contained;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Bakes the hemispheres kernel into normal and height maps with the scalar
+// and SSE2 paths, on one thread and on all of them, and checks that the
+// paths agree to within one step of quantisation.
+/////////////////////////////////////////////////////////////////////////////
+static bool benchNormalBake()
+{
+    const int size = 1024;
+    const int samplesPerAxis = 2;
+    Displacement::Params params = { Displacement::HEMISPHERES, 8.0f, 0.4f, NULL, NULL };
+
+    printf("Normal baker: %d x %d texels, %d x %d samples each, %d threads\n",
+           size, size, samplesPerAxis, samplesPerAxis, Parallel::getNumThreads());
+
+    const char *names[3] = { "scalar, 1 thread", "SIMD, 1 thread", "SIMD, threaded" };
+    const bool simd[3] = { false, true, true };
+    const bool threads[3] = { false, false, true };
+    NormalBaker::Maps maps[3];
+    double scalarMs = 0.0;
+    for( int v = 0; v < 3; v++ ) {
+        Stopwatch timer;
+        NormalBaker::bake(params, size, samplesPerAxis, maps[v], simd[v], threads[v]);
+        double ms = timer.elapsedMs();
+        if( v == 0 ) scalarMs = ms;
+        printf("  %-18s %8.2f ms  %7.1f Mtexels/s  (%.2fx)\n", names[v], ms,
+               (double)size * size / (ms * 1000.0), scalarMs / ms);
+    }
+
+    int maxDiff = 0;
+    for( int v = 1; v < 3; v++ ) {
+        for( size_t i = 0; i < maps[0].normalMirror.size(); i++ )
+            maxDiff = std::max(maxDiff, abs((int)maps[v].normalMirror[i] - (int)maps[0].normalMirror[i]));
+        for( size_t i = 0; i < maps[0].height.size(); i++ )
+            maxDiff = std::max(maxDiff, abs((int)maps[v].height[i] - (int)maps[0].height[i]));
+    }
+
+    // The texel at the top of the first mirror points straight up.
+    int centre = size / (2 * (int)params.mirrorTileDensity);
+    const unsigned char *top = &maps[2].normalMirror[4 * ((size_t)centre * size + centre)];
+    bool topUp = top[2] == 255 && top[3] == 255 && abs(top[0] - 128) <= 1 && abs(top[1] - 128) <= 1;
+
+    bool passed = maxDiff <= 1 && topUp;
+    printf("  max difference from scalar %d, mirror top (%d, %d, %d, %d)\n",
+           maxDiff, top[0], top[1], top[2], top[3]);
+    printf("  %s\n", passed ? "PASSED" : "FAILED");
+    return passed;
+}
+
+
+// Solid-angle weighted mean of each channel over the whole cube.
+static glm::vec3 cubeMean(const EnvPrefilter::Level &level)
+{
+    glm::dvec3 sum(0.0);
+    double weightSum = 0.0;
+    for( int f = 0; f < 6; f++ ) {
+        for( int y = 0; y < level.size; y++ ) {
+            for( int x = 0; x < level.size; x++ ) {
+                float u = 2.0f * (x + 0.5f) / level.size - 1.0f, v = 2.0f * (y + 0.5f) / level.size - 1.0f;
+                double sqrLen = 1.0 + u * u + v * v;
+                double w = 1.0 / (sqrLen * sqrt(sqrLen));
+                const float *rgb = &level.faces[f][3 * ((size_t)y * level.size + x)];
+                sum += w * glm::dvec3(rgb[0], rgb[1], rgb[2]);
+                weightSum += w;
+            }
+        }
+    }
+    return glm::vec3(sum / weightSum);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Prefilters a synthetic cubemap (a flat sky with a small bright sun)
+// on one thread and on all of them. Checks that every level keeps the
+// mean radiance of the input and that the blurred sun stays where it is.
+/////////////////////////////////////////////////////////////////////////////
+static bool benchEnvPrefilter()
+{
+    const int size = 128;
+    const glm::vec3 sunDir = glm::normalize(glm::vec3(0.6f, 0.5f, -0.3f));
+    const float sunCos = 0.9995f;  // About 1.8 degrees of radius.
+
+    vector<unsigned char> faceData[6];
+    const unsigned char *faces[6];
+    for( int f = 0; f < 6; f++ ) {
+        faceData[f].resize(3 * size * size);
+        for( int y = 0; y < size; y++ ) {
+            for( int x = 0; x < size; x++ ) {
+                glm::vec3 d = EnvPrefilter::faceDirection(f, (x + 0.5f) / size, (y + 0.5f) / size);
+                bool sun = glm::dot(d, sunDir) > sunCos;
+                unsigned char *rgb = &faceData[f][3 * (y * size + x)];
+                rgb[0] = sun ? 255 : 40;
+                rgb[1] = sun ? 255 : 60;
+                rgb[2] = sun ? 230 : 120;
+            }
+        }
+        faces[f] = &faceData[f][0];
+    }
+
+    printf("Environment prefilter: 6 x %d x %d faces, %d threads\n", size, size, Parallel::getNumThreads());
+
+    vector<EnvPrefilter::Level> levels;
+    double ms[2];
+    for( int threaded = 0; threaded < 2; threaded++ ) {
+        Stopwatch timer;
+        EnvPrefilter::prefilter(faces, size, 3, levels, threaded != 0);
+        ms[threaded] = timer.elapsedMs();
+    }
+    printf("  1 thread  %8.1f ms\n", ms[0]);
+    printf("  threaded  %8.1f ms  (%.2fx)  %d levels\n", ms[1], ms[0] / ms[1], (int)levels.size());
+
+    bool passed = true;
+    glm::vec3 mean0 = cubeMean(levels[0]);
+    for( size_t l = 0; l < levels.size(); l++ ) {
+        const EnvPrefilter::Level &level = levels[l];
+        glm::vec3 mean = cubeMean(level);
+        float error = glm::length(mean - mean0) / glm::length(mean0);
+
+        // Direction of the brightest texel.
+        float brightest = -1.0f;
+        glm::vec3 peakDir(0.0f);
+        for( int f = 0; f < 6; f++ ) {
+            for( int i = 0; i < level.size * level.size; i++ ) {
+                float r = level.faces[f][3 * i];
+                if( r > brightest ) {
+                    brightest = r;
+                    peakDir = EnvPrefilter::faceDirection(f, (i % level.size + 0.5f) / level.size,
+                                                          (i / level.size + 0.5f) / level.size);
+                }
+            }
+        }
+        float peakDegrees = acosf(std::min(glm::dot(peakDir, sunDir), 1.0f)) * 57.29578f;
+        float texelDegrees = 90.0f / level.size;
+
+        // The unfiltered sun is a flat disk, so any texel of it is a peak.
+        // The two smallest levels are too coarse to place it.
+        float sunDegrees = (l == 0) ? acosf(sunCos) * 57.29578f : 0.0f;
+        bool ok = error < 0.02f && (level.size < 4 || peakDegrees < sunDegrees + 1.5f * texelDegrees);
+        passed = passed && ok;
+        printf("  %4d  exponent %9.1f  mean error %6.3f%%  sun %6.2f deg off (texel %.2f deg)%s\n",
+               level.size, EnvPrefilter::phongExponent(level.size), 100.0f * error,
+               peakDegrees, texelDegrees, ok ? "" : "  <--");
+    }
+    printf("  %s\n", passed ? "PASSED" : "FAILED");
+    return passed;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Light binning on a 1080p froxel grid: brute force vs. the per-slice
+// binning, scalar vs. SSE, single vs. multithreaded. Every result must
+// equal the brute force, and every point inside a light's sphere must find
+// the light in the list of its froxel.
+/////////////////////////////////////////////////////////////////////////////
+static bool sameClusters(const LightClusters::Clusters &a, const LightClusters::Clusters &b)
+{
+    return a.cells == b.cells && a.lightIndices == b.lightIndices;
+}
+
+
+static bool benchLightClusters()
+{
+    const int numLights = 1024;
+    const int iterations = 20;
+    LightClusters::Grid grid = { 30, 17, 24, 0.5f, 100.0f, 0.0f, 0.0f };
+    glm::mat4 projMat = glm::perspective(glm::radians(60.0f), 1920.0f / 1080.0f, grid.nearZ, grid.farZ);
+    grid.projScaleX = projMat[0][0];
+    grid.projScaleY = projMat[1][1];
+
+    // Lights spread through the near part of the frustum and a little
+    // beyond its sides.
+    unsigned int seed = 4242u;
+    vector<LightClusters::PointLight> lights(numLights);
+    for( int l = 0; l < numLights; l++ ) {
+        float r[4];
+        for( int i = 0; i < 4; i++ ) {
+            seed = seed * 1664525u + 1013904223u;
+            r[i] = (seed >> 8) / 16777216.0f;
+        }
+        float depth = 1.0f + 60.0f * r[2] * r[2];
+        lights[l].position = glm::vec3((2.4f * r[0] - 1.2f) * depth / grid.projScaleX,
+                                       (2.4f * r[1] - 1.2f) * depth / grid.projScaleY, -depth);
+        lights[l].radius = 0.3f + 2.0f * r[3];
+        lights[l].color = glm::vec3(1.0f);
+    }
+
+    printf("Light clusters: %d lights, %d x %d x %d froxels, %d threads\n", numLights,
+           grid.tilesX, grid.tilesY, grid.slices, Parallel::getNumThreads());
+
+    LightClusters::Clusters reference;
+    Stopwatch bruteTimer;
+    LightClusters::buildBruteForce(grid, lights, reference);
+    double bruteMs = bruteTimer.elapsedMs();
+    printf("  brute force       %8.2f ms  %d indices\n", bruteMs, (int)reference.lightIndices.size());
+
+    struct Config { const char *name; bool simd; bool threads; };
+    const Config configs[4] = {
+        { "scalar, 1 thread ", false, false },
+        { "SSE,    1 thread ", true,  false },
+        { "scalar, threaded ", false, true },
+        { "SSE,    threaded ", true,  true }
+    };
+
+    bool passed = true;
+    LightClusters::Clusters clusters;
+    for( int c = 0; c < 4; c++ ) {
+        double bestMs = 1.0e30;
+        for( int it = 0; it < iterations; it++ ) {
+            Stopwatch timer;
+            LightClusters::build(grid, lights, clusters, configs[c].simd, configs[c].threads);
+            bestMs = std::min(bestMs, timer.elapsedMs());
+        }
+        bool same = sameClusters(clusters, reference);
+        passed = passed && same;
+        printf("  %s %8.3f ms  (%.1fx brute force)  %s\n", configs[c].name, bestMs, bruteMs / bestMs,
+               same ? "matches" : "DIFFERS");
+    }
+
+    // Points inside each sphere, slightly in from its surface at most.
+    const int pointsPerLight = 64;
+    int tested = 0, missing = 0;
+    for( int l = 0; l < numLights; l++ ) {
+        for( int q = 0; q < pointsPerLight; q++ ) {
+            float r[3];
+            for( int i = 0; i < 3; i++ ) {
+                seed = seed * 1664525u + 1013904223u;
+                r[i] = (seed >> 8) / 16777216.0f;
+            }
+            float z = 2.0f * r[0] - 1.0f;
+            float phi = 6.2831853f * r[1];
+            float ring = sqrtf(std::max(1.0f - z * z, 0.0f));
+            glm::vec3 dir(ring * cosf(phi), ring * sinf(phi), z);
+            glm::vec3 p = lights[l].position + (0.999f * lights[l].radius * sqrtf(r[2])) * dir;
+
+            int cluster = LightClusters::clusterOf(grid, p);
+            if( cluster < 0 ) continue;
+            tested++;
+            const unsigned int *list = reference.lightIndices.empty() ? NULL :
+                                       &reference.lightIndices[0] + reference.cells[2 * cluster];
+            if( list == NULL || !std::binary_search(list, list + reference.cells[2 * cluster + 1], (unsigned int)l) )
+                missing++;
+        }
+    }
+    passed = passed && missing == 0;
+    printf("  %d points inside lights, %d not in their froxel's list\n", tested, missing);
+    printf("  %s\n", passed ? "PASSED" : "FAILED");
+    return passed;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Shadow cascades from random views: every point of a view slice, and the
+// casters up to casterDistance towards the light from it, must land inside
+// its cascade, and moving the camera must move the cascades by whole
+// texels only.
+/////////////////////////////////////////////////////////////////////////////
+static bool benchShadowCascades()
+{
+    const int views = 500, pointsPerCascade = 200, count = 3, mapSize = 2048;
+    const float fovY = glm::radians(60.0f), aspect = 16.0f / 9.0f;
+    const float nearZ = 0.5f, farZ = 40.0f, lambda = 0.75f, casterDistance = 20.0f;
+
+    printf("Shadow cascades: %d views, %d cascades of %d x %d texels up to %g units\n",
+           views, count, mapSize, mapSize, farZ);
+
+    unsigned int seed = 99u;
+    int outside = 0, tested = 0, unsnapped = 0;
+    double totalMs = 0.0;
+    float texelSizes[ShadowCascades::MAX_CASCADES] = { 0.0f };
+    for( int v = 0; v < views; v++ ) {
+        float r[8];
+        for( int i = 0; i < 8; i++ ) {
+            seed = seed * 1664525u + 1013904223u;
+            r[i] = (seed >> 8) / 16777216.0f;
+        }
+        glm::vec3 eye = (8.0f + 17.0f * r[0]) * glm::normalize(glm::vec3(r[1] - 0.5f, r[2] - 0.5f, r[3] - 0.5f));
+        glm::vec3 target = glm::vec3(4.0f * r[4] - 2.0f, 4.0f * r[5] - 2.0f, 0.0f);
+        glm::mat4 viewMat = glm::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f));
+        glm::vec3 lightDir = glm::normalize(glm::vec3(r[6] - 0.5f, 0.2f + r[7], 0.3f));
+
+        ShadowCascades::Cascade cascades[ShadowCascades::MAX_CASCADES];
+        Stopwatch timer;
+        ShadowCascades::computeCascades(viewMat, fovY, aspect, nearZ, farZ, lambda, count,
+                                        lightDir, mapSize, casterDistance, cascades);
+        totalMs += timer.elapsedMs();
+
+        glm::mat4 invView = glm::inverse(viewMat);
+        float tanY = tanf(0.5f * fovY);
+        for( int c = 0; c < count; c++ ) {
+            texelSizes[c] = std::max(texelSizes[c], cascades[c].texelSize);
+            for( int q = 0; q < pointsPerCascade; q++ ) {
+                float p[3];
+                for( int i = 0; i < 3; i++ ) {
+                    seed = seed * 1664525u + 1013904223u;
+                    p[i] = (seed >> 8) / 16777216.0f;
+                }
+                // Corners first, then random points.
+                if( q < 8 ) {
+                    p[0] = (float)(q & 1);
+                    p[1] = (float)((q >> 1) & 1);
+                    p[2] = (float)(q >> 2);
+                }
+                float depth = cascades[c].nearZ + (cascades[c].farZ - cascades[c].nearZ) * p[2];
+                glm::vec4 ec((2.0f * p[0] - 1.0f) * tanY * aspect * depth,
+                             (2.0f * p[1] - 1.0f) * tanY * depth, -depth, 1.0f);
+                glm::vec3 wc = glm::vec3(invView * ec);
+                for( int end = 0; end < 2; end++ ) {
+                    glm::vec4 clip = cascades[c].viewProj * glm::vec4(wc + (end * casterDistance) * lightDir, 1.0f);
+                    const float eps = 1.0e-4f;
+                    bool inside = fabsf(clip.x) <= 1.0f + eps && fabsf(clip.y) <= 1.0f + eps &&
+                                  clip.z >= -1.0f - eps && (end == 1 || clip.z <= 1.0f + eps);
+                    if( !inside ) outside++;
+                    tested++;
+                }
+            }
+        }
+
+        // Move the camera without turning it. A fixed point must move by a
+        // whole number of texels in every cascade.
+        glm::mat4 movedView = viewMat * glm::translate(glm::mat4(1.0f), glm::vec3(0.37f * r[0], -0.21f * r[1], 0.11f));
+        ShadowCascades::Cascade moved[ShadowCascades::MAX_CASCADES];
+        ShadowCascades::computeCascades(movedView, fovY, aspect, nearZ, farZ, lambda, count,
+                                        lightDir, mapSize, casterDistance, moved);
+        for( int c = 0; c < count; c++ ) {
+            glm::vec4 a = cascades[c].viewProj * glm::vec4(target, 1.0f);
+            glm::vec4 b = moved[c].viewProj * glm::vec4(target, 1.0f);
+            for( int i = 0; i < 2; i++ ) {
+                float texels = 0.5f * mapSize * (b[i] - a[i]);
+                if( fabsf(texels - floorf(texels + 0.5f)) > 0.02f ) unsnapped++;
+            }
+        }
+    }
+
+    for( int c = 0; c < count; c++ )
+        printf("  cascade %d  texel %.4f units\n", c, texelSizes[c]);
+    printf("  %.4f ms per frame's cascades\n", totalMs / views);
+    printf("  %d of %d slice and caster points outside their cascade\n", outside, tested);
+    printf("  %d of %d cascade moves not whole texels\n", unsnapped, 2 * count * views);
+    bool passed = (outside == 0 && unsnapped == 0);
+    printf("  %s\n", passed ? "PASSED" : "FAILED");
+    return passed;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Anti-aliasing quality and cost. A test image of hard-edged shapes and thin
+// lines, like the wireframe, is sampled once per pixel, at the 2, 4 and 8
+// sample positions of common MSAA hardware, and on a 16 x 16 grid as the
+// reference. FXAA filters the single-sampled image. Its cost is measured at
+// 1920 x 1080.
+/////////////////////////////////////////////////////////////////////////////
+static void aaTestColor(float x, float y, float width, float height, unsigned char *rgba)
+{
+    float u = x / width, v = y / height;
+    float r = 0.2f + 0.3f * u, g = 0.3f + 0.2f * v, b = 0.6f;
+
+    // A square turned by 10 degrees, so its edges are nearly horizontal and
+    // vertical, where aliasing shows most.
+    float cx = 0.3f * width, cy = 0.5f * height, half = 0.25f * height;
+    float ca = cosf(0.1745f), sa = sinf(0.1745f);
+    float sx = ca * (x - cx) + sa * (y - cy), sy = -sa * (x - cx) + ca * (y - cy);
+    if( fabsf(sx) < half && fabsf(sy) < half ) { r = 0.9f; g = 0.8f; b = 0.5f; }
+
+    // A disc.
+    float dx = x - 0.72f * width, dy = y - 0.35f * height;
+    if( dx * dx + dy * dy < 0.04f * height * height ) { r = 0.1f; g = 0.6f; b = 0.2f; }
+
+    // Lines a pixel wide at several angles.
+    for( int i = 0; i < 6; i++ ) {
+        float angle = 0.05f + 0.28f * i;
+        float nx = -sinf(angle), ny = cosf(angle);
+        float ox = 0.55f * width, oy = (0.6f + 0.06f * i) * height;
+        if( fabsf((x - ox) * nx + (y - oy) * ny) < 0.5f && x > ox ) { r = 0.1f; g = 0.1f; b = 0.1f; }
+    }
+
+    rgba[0] = (unsigned char)(255.0f * r + 0.5f);
+    rgba[1] = (unsigned char)(255.0f * g + 0.5f);
+    rgba[2] = (unsigned char)(255.0f * b + 0.5f);
+    rgba[3] = 255;
+}
+
+
+// Averages the test image at the given offsets from each pixel's centre.
+static void aaRender(int width, int height, const float (*offsets)[2], int numSamples, vector<unsigned char> &image)
+{
+    image.resize(4 * (size_t)width * height);
+    Parallel::parallelFor(0, height, 8, [&](int first, int last) {
+        for( int y = first; y < last; y++ ) {
+            for( int x = 0; x < width; x++ ) {
+                float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+                for( int s = 0; s < numSamples; s++ ) {
+                    unsigned char c[4];
+                    aaTestColor(x + 0.5f + offsets[s][0], y + 0.5f + offsets[s][1], (float)width, (float)height, c);
+                    for( int i = 0; i < 4; i++ ) sum[i] += c[i];
+                }
+                unsigned char *p = &image[4 * ((size_t)y * width + x)];
+                for( int i = 0; i < 4; i++ ) p[i] = (unsigned char)(sum[i] / numSamples + 0.5f);
+            }
+        }
+    });
+}
+
+
+static bool benchAntiAliasing()
+{
+    const int width = 640, height = 360, iterations = 10;
+
+    // Sample positions in 1/16 pixel, as on most GPUs.
+    static const float pattern1[1][2] = { { 0, 0 } };
+    static const float pattern2[2][2] = { { 4, 4 }, { -4, -4 } };
+    static const float pattern4[4][2] = { { -2, -6 }, { 6, -2 }, { -6, 2 }, { 2, 6 } };
+    static const float pattern8[8][2] = { { 1, -3 }, { -1, 3 }, { 5, 1 }, { -3, -5 },
+                                          { -5, 5 }, { -7, -1 }, { 3, 7 }, { 7, -7 } };
+    struct Mode { const char *name; const float (*pattern)[2]; int samples; };
+    const Mode modes[4] = {
+        { "1 sample ", pattern1, 1 }, { "MSAA 2x  ", pattern2, 2 }, { "MSAA 4x  ", pattern4, 4 }, { "MSAA 8x  ", pattern8, 8 }
+    };
+
+    printf("Anti-aliasing: %d x %d test image against 16 x 16 supersampling, %d threads\n",
+           width, height, Parallel::getNumThreads());
+
+    const int grid = 16;
+    vector<float> gridOffsets(2 * grid * grid);
+    for( int j = 0; j < grid; j++ ) {
+        for( int i = 0; i < grid; i++ ) {
+            gridOffsets[2 * (j * grid + i)] = (i + 0.5f) / grid - 0.5f;
+            gridOffsets[2 * (j * grid + i) + 1] = (j + 0.5f) / grid - 0.5f;
+        }
+    }
+    vector<unsigned char> reference;
+    aaRender(width, height, (const float (*)[2])&gridOffsets[0], grid * grid, reference);
+
+    bool passed = true;
+    double previousPsnr = 0.0, aliasedPsnr = 0.0;
+    vector<unsigned char> aliased, image;
+    for( int m = 0; m < 4; m++ ) {
+        float offsets[8][2];
+        for( int s = 0; s < modes[m].samples; s++ ) {
+            offsets[s][0] = modes[m].pattern[s][0] / 16.0f;
+            offsets[s][1] = modes[m].pattern[s][1] / 16.0f;
+        }
+        aaRender(width, height, offsets, modes[m].samples, image);
+        double psnr = ImageMetrics::psnr(&image[0], &reference[0], width, height, 4);
+        double ssim = ImageMetrics::ssim(&image[0], &reference[0], width, height, 4);
+        printf("  %s  PSNR %6.2f dB  SSIM %.4f\n", modes[m].name, psnr, ssim);
+        if( m == 0 ) {
+            aliased = image;
+            aliasedPsnr = psnr;
+        }
+        else passed = passed && psnr > previousPsnr;
+        previousPsnr = psnr;
+    }
+
+    Fxaa::Params params = Fxaa::defaultParams();
+    Fxaa::apply(&aliased[0], width, height, &image[0], params, true);
+    double fxaaPsnr = ImageMetrics::psnr(&image[0], &reference[0], width, height, 4);
+    printf("  FXAA       PSNR %6.2f dB  SSIM %.4f\n", fxaaPsnr,
+           ImageMetrics::ssim(&image[0], &reference[0], width, height, 4));
+    passed = passed && fxaaPsnr > aliasedPsnr;
+
+    // Pixels whose whole neighbourhood is one color must come out unchanged.
+    int flat = 0, changed = 0;
+    for( int y = 1; y < height - 1; y++ ) {
+        for( int x = 1; x < width - 1; x++ ) {
+            const unsigned char *c = &aliased[4 * ((size_t)y * width + x)];
+            bool isFlat = true;
+            for( int j = -1; j <= 1 && isFlat; j++ )
+                for( int i = -1; i <= 1 && isFlat; i++ )
+                    isFlat = memcmp(c, &aliased[4 * ((size_t)(y + j) * width + x + i)], 4) == 0;
+            if( !isFlat ) continue;
+            flat++;
+            if( memcmp(c, &image[4 * ((size_t)y * width + x)], 4) != 0 ) changed++;
+        }
+    }
+    passed = passed && changed == 0;
+    printf("  FXAA changed %d of %d pixels in flat areas\n", changed, flat);
+
+    const int bigWidth = 1920, bigHeight = 1080;
+    vector<unsigned char> big, filtered(4 * (size_t)bigWidth * bigHeight);
+    aaRender(bigWidth, bigHeight, pattern1, 1, big);
+    for( int threaded = 0; threaded < 2; threaded++ ) {
+        double bestMs = 1.0e30;
+        for( int it = 0; it < iterations; it++ ) {
+            Stopwatch timer;
+            Fxaa::apply(&big[0], bigWidth, bigHeight, &filtered[0], params, threaded != 0);
+            bestMs = std::min(bestMs, timer.elapsedMs());
+        }
+        printf("  FXAA %d x %d, %s  %8.2f ms\n", bigWidth, bigHeight, threaded ? "threaded" : "1 thread", bestMs);
+    }
+    printf("  %s\n", passed ? "PASSED" : "FAILED");
+    return passed;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Dynamic resolution against a simulated GPU. A frame costs a fixed part
+// plus a part proportional to its pixels, with noise, and its time arrives
+// a few frames late, as from GPU timer queries. The scene goes from light
+// to a close-up three times as expensive and back. Frames over the target
+// are counted once each phase has settled, and against a fixed scale 1.
+/////////////////////////////////////////////////////////////////////////////
+static bool benchDynamicResolution()
+{
+    const float targetMs = 16.7f, fixedMs = 1.5f, noise = 0.08f;
+    const int latency = 3, settleFrames = 30;
+    struct Phase { const char *name; int frames; float pixelMs; };
+    const Phase phases[3] = { { "light    ", 300, 12.0f }, { "close-up ", 300, 35.0f }, { "lighter  ", 300, 8.0f } };
+
+    DynamicResolution::Params params = DynamicResolution::defaultParams(targetMs);
+    DynamicResolution controller(params);
+    printf("Dynamic resolution: target %.1f ms, scale %.2f to %.2f in steps of %.2f, %d frames of latency\n",
+           targetMs, params.minScale, params.maxScale, params.scaleStep, latency);
+
+    unsigned int seed = 7u;
+    vector<double> pendingMs;
+    vector<float> pendingScale;
+    float scale = controller.getScale();
+    int changes = 0, spikeFramesOver = 0;
+    bool passed = true;
+    for( int p = 0; p < 3; p++ ) {
+        int over = 0, fixedOver = 0, settled = 0;
+        double scaleSum = 0.0;
+        for( int f = 0; f < phases[p].frames; f++ ) {
+            seed = seed * 1664525u + 1013904223u;
+            float jitter = 1.0f + noise * (2.0f * (seed >> 8) / 16777216.0f - 1.0f);
+            double ms = (fixedMs + phases[p].pixelMs * scale * scale) * jitter;
+            double fixedScaleMs = (fixedMs + phases[p].pixelMs) * jitter;
+
+            if( f >= settleFrames ) {
+                settled++;
+                scaleSum += scale;
+                if( ms > targetMs ) over++;
+                if( fixedScaleMs > targetMs ) fixedOver++;
+            }
+            else if( p == 1 && ms > targetMs ) spikeFramesOver++;
+
+            pendingMs.push_back(ms);
+            pendingScale.push_back(scale);
+            if( (int)pendingMs.size() > latency ) {
+                float next = controller.update(pendingMs[0], pendingScale[0]);
+                pendingMs.erase(pendingMs.begin());
+                pendingScale.erase(pendingScale.begin());
+                if( next != scale ) changes++;
+                scale = next;
+            }
+        }
+        double averageScale = scaleSum / settled;
+        printf("  %s %5.1f ms at scale 1  avg scale %.3f  over target %3d of %d  (fixed scale 1: %d)\n",
+               phases[p].name, fixedMs + phases[p].pixelMs, averageScale, over, settled, fixedOver);
+        passed = passed && over <= settled / 50;
+        if( p != 1 ) passed = passed && averageScale >= params.maxScale - params.scaleStep;
+    }
+    printf("  %d frames over target entering the close-up, %d scale changes\n", spikeFramesOver, changes);
+    passed = passed && spikeFramesOver <= latency + 2 && changes <= 30;
+    printf("  %s\n", passed ? "PASSED" : "FAILED");
+    return passed;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// SpscQueue between two threads, with items the size of main's frame
+// snapshots: every item must arrive once and in order. Throughput is
+// compared with a std::deque behind a mutex.
+/////////////////////////////////////////////////////////////////////////////
+struct QueueTestItem
+{
+    unsigned int sequence;
+    unsigned int checksum;
+    float payload[22];
+};
+
+
+static QueueTestItem makeQueueTestItem(unsigned int sequence)
+{
+    QueueTestItem item;
+    item.sequence = sequence;
+    item.checksum = sequence * 2654435761u;
+    for( int i = 0; i < 22; i++ ) item.payload[i] = (float)(sequence + i);
+    return item;
+}
+
+
+static bool checkQueueTestItem(const QueueTestItem &item, unsigned int expected)
+{
+    return item.sequence == expected && item.checksum == expected * 2654435761u &&
+           item.payload[21] == (float)(expected + 21);
+}
+
+
+static bool benchSpscQueue()
+{
+    const unsigned int numItems = 2000000;
+    printf("SPSC queue: %u items of %d bytes from one thread to another, %u hardware threads\n",
+           numItems, (int)sizeof(QueueTestItem), std::thread::hardware_concurrency());
+
+    bool passed = true;
+    const size_t capacities[3] = { 2, 64, 1024 };
+    for( int c = 0; c < 3; c++ ) {
+        SpscQueue<QueueTestItem> queue(capacities[c]);
+        Stopwatch timer;
+        std::thread producer([&]() {
+            for( unsigned int i = 0; i < numItems; i++ ) {
+                QueueTestItem item = makeQueueTestItem(i);
+                while( !queue.tryPush(item) ) std::this_thread::yield();
+            }
+        });
+        unsigned int received = 0, wrong = 0;
+        QueueTestItem item;
+        while( received < numItems ) {
+            if( !queue.tryPop(item) ) {
+                std::this_thread::yield();
+                continue;
+            }
+            if( !checkQueueTestItem(item, received) ) wrong++;
+            received++;
+        }
+        producer.join();
+        double ms = timer.elapsedMs();
+        bool empty = !queue.tryPop(item);
+        passed = passed && wrong == 0 && empty;
+        printf("  SpscQueue, capacity %4d   %8.2f ms  %6.1f M items/s  %u out of order%s\n",
+               (int)queue.capacity(), ms, numItems / ms * 1.0e-3, wrong, empty ? "" : ", extra items");
+    }
+
+    // The same through a mutex.
+    {
+        std::deque<QueueTestItem> queue;
+        std::mutex mutex;
+        const size_t capacity = 64;
+        Stopwatch timer;
+        std::thread producer([&]() {
+            for( unsigned int i = 0; i < numItems; i++ ) {
+                QueueTestItem item = makeQueueTestItem(i);
+                for( ;; ) {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if( queue.size() < capacity ) {
+                            queue.push_back(item);
+                            break;
+                        }
+                    }
+                    std::this_thread::yield();
+                }
+            }
+        });
+        unsigned int received = 0, wrong = 0;
+        while( received < numItems ) {
+            QueueTestItem item;
+            bool popped = false;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if( !queue.empty() ) {
+                    item = queue.front();
+                    queue.pop_front();
+                    popped = true;
+                }
+            }
+            if( !popped ) {
+                std::this_thread::yield();
+                continue;
+            }
+            if( !checkQueueTestItem(item, received) ) wrong++;
+            received++;
+        }
+        producer.join();
+        double ms = timer.elapsedMs();
+        printf("  deque + mutex, capacity %d %8.2f ms  %6.1f M items/s\n", (int)capacity, ms, numItems / ms * 1.0e-3);
+    }
+    printf("  %s\n", passed ? "PASSED" : "FAILED");
+    return passed;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// The job system: checks that parallelFor() covers each item once, also
+// when nested, that runAfter() jobs follow their dependencies, and that
+// threads that are not workers can queue and wait at the same time. Then
+// times, at 1 to 64 threads, an even and an uneven loop, teapot generation,
+// and the cost of a parallelFor() of tiny chunks against starting a
+// std::thread per chunk as Parallel::parallelFor() used to.
+/////////////////////////////////////////////////////////////////////////////
+static void spawnParallelFor(int first, int last, int numChunks, const std::function<void (int, int)> &body)
+{
+    int count = last - first;
+    vector<std::thread> threads;
+    for( int c = 0; c < numChunks - 1; c++ )
+        threads.push_back(std::thread(body, first + count * c / numChunks, first + count * (c + 1) / numChunks));
+    body(first + count * (numChunks - 1) / numChunks, last);
+    for( size_t i = 0; i < threads.size(); i++ ) threads[i].join();
+}
+
+
+static float jobWork(int i, int cost)
+{
+    float x = (float)i;
+    for( int k = 0; k < cost; k++ ) x = x * 0.999f + sinf(x);
+    return x;
+}
+
+
+static bool checkJobSystem(JobSystem &jobs)
+{
+    bool passed = true;
+
+    // Every item exactly once, for ranges and chunk sizes of all kinds.
+    const int ranges[4][3] = { { 0, 1, 1 }, { 5, 1000, 1 }, { -300, 100000, 64 }, { 0, 77777, 5000 } };
+    for( int r = 0; r < 4; r++ ) {
+        int first = ranges[r][0], last = ranges[r][1];
+        vector<std::atomic<int> > hits(last - first);
+        for( size_t i = 0; i < hits.size(); i++ ) hits[i].store(0);
+        std::atomic<int> shortChunks(0);
+        jobs.parallelFor(first, last, ranges[r][2], [&](int begin, int end) {
+            if( end - begin < ranges[r][2] && end - begin < last - first ) shortChunks++;
+            for( int i = begin; i < end; i++ ) hits[i - first]++;
+        });
+        for( size_t i = 0; i < hits.size(); i++ ) passed = passed && hits[i].load() == 1;
+        passed = passed && shortChunks.load() == 0;
+    }
+
+    // Nested loops, each inner one waited for inside a job.
+    std::atomic<int> nestedSum(0);
+    jobs.parallelFor(0, 64, 1, [&](int begin, int end) {
+        for( int i = begin; i < end; i++ ) {
+            jobs.parallelFor(0, 1000, 10, [&](int b, int e) { nestedSum += e - b; });
+        }
+    });
+    passed = passed && nestedSum.load() == 64 * 1000;
+
+    // A chain of stages; each job of a stage checks that the previous
+    // stage is complete.
+    const int numStages = 8, jobsPerStage = 50;
+    std::atomic<int> done[numStages];
+    JobSystem::Counter stages[numStages];
+    std::atomic<int> orderErrors(0);
+    for( int s = 0; s < numStages; s++ ) done[s].store(0);
+    for( int s = 0; s < numStages; s++ ) {
+        for( int j = 0; j < jobsPerStage; j++ ) {
+            auto job = [&, s, j]() {
+                if( s > 0 && done[s - 1].load() != jobsPerStage ) orderErrors++;
+                jobWork(j, 200);
+                done[s]++;
+            };
+            if( s == 0 ) jobs.run(job, &stages[0]);
+            else jobs.runAfter(stages[s - 1], job, &stages[s]);
+        }
+    }
+    jobs.wait(stages[numStages - 1]);
+    passed = passed && orderErrors.load() == 0 && done[numStages - 1].load() == jobsPerStage;
+
+    // Threads that are not workers queue and wait on their own counters.
+    std::atomic<int> outsideSum(0);
+    vector<std::thread> outsiders;
+    for( int t = 0; t < 3; t++ ) {
+        outsiders.push_back(std::thread([&]() {
+            for( int round = 0; round < 20; round++ ) {
+                JobSystem::Counter counter;
+                for( int j = 0; j < 10; j++ ) jobs.run([&]() { outsideSum++; }, &counter);
+                jobs.wait(counter);
+            }
+        }));
+    }
+    for( size_t t = 0; t < outsiders.size(); t++ ) outsiders[t].join();
+    passed = passed && outsideSum.load() == 3 * 20 * 10;
+
+    return passed;
+}
+
+
+static bool benchJobSystem()
+{
+    const int numItems = 1 << 16;
+    const int teapotGrid = 128;
+    const int teapotVerts = VBOTeapot::getNumVertices(teapotGrid);
+    const int tinyCalls = 2000, tinyItems = 64;
+    vector<float> out(numItems);
+    vector<float> v(3 * teapotVerts), n(3 * teapotVerts), tc(2 * teapotVerts);
+    vector<unsigned int> el(VBOTeapot::getNumIndices(teapotGrid));
+    glm::mat4 lid = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 1.5f, 0.25f));
+
+    int threads = Parallel::getNumThreads();
+    printf("Job system: %d hardware threads; loops of %d items, teapot grid %d, %d x parallelFor of %d items\n",
+           (int)std::thread::hardware_concurrency(), numItems, teapotGrid, tinyCalls, tinyItems);
+    printf("  threads      even ms   uneven ms   teapot ms   tiny us/call   spawned us/call   checks\n");
+
+    bool passed = true;
+    double base[3] = { 0.0, 0.0, 0.0 };
+    const int threadCounts[7] = { 1, 2, 4, 8, 16, 32, 64 };
+    for( int t = 0; t < 7; t++ ) {
+        Parallel::setNumThreads(threadCounts[t]);
+        JobSystem &jobs = Parallel::getJobSystem();
+        bool checked = checkJobSystem(jobs);
+        passed = passed && checked;
+
+        double ms[3];
+        Stopwatch timer;
+        Parallel::parallelFor(0, numItems, 256, [&](int begin, int end) {
+            for( int i = begin; i < end; i++ ) out[i] = jobWork(i, 64);
+        });
+        ms[0] = timer.elapsedMs();
+
+        // The cost grows with the index, so equal chunks take unequal times.
+        timer.reset();
+        Parallel::parallelFor(0, numItems, 256, [&](int begin, int end) {
+            for( int i = begin; i < end; i++ ) out[i] = jobWork(i, i / 512);
+        });
+        ms[1] = timer.elapsedMs();
+
+        timer.reset();
+        VBOTeapot::generate(teapotGrid, lid, &v[0], &n[0], &tc[0], &el[0], true, true);
+        ms[2] = timer.elapsedMs();
+
+        std::atomic<int> tinySum(0);
+        timer.reset();
+        for( int c = 0; c < tinyCalls; c++ )
+            Parallel::parallelFor(0, tinyItems, 1, [&](int begin, int end) { tinySum += end - begin; });
+        double tinyUs = timer.elapsedMs() * 1000.0 / tinyCalls;
+
+        // Starting threads is slow enough that fewer calls do.
+        int spawnCalls = tinyCalls / 20;
+        timer.reset();
+        for( int c = 0; c < spawnCalls; c++ )
+            spawnParallelFor(0, tinyItems, threadCounts[t], [&](int begin, int end) { tinySum += end - begin; });
+        double spawnUs = timer.elapsedMs() * 1000.0 / spawnCalls;
+        passed = passed && tinySum.load() == (tinyCalls + spawnCalls) * tinyItems;
+
+        if( t == 0 ) for( int k = 0; k < 3; k++ ) base[k] = ms[k];
+        printf("  %4d    %8.2f (%4.1fx) %7.2f (%4.1fx) %7.2f (%4.1fx) %10.2f %15.2f        %s\n", threadCounts[t],
+               ms[0], base[0] / ms[0], ms[1], base[1] / ms[1], ms[2], base[2] / ms[2], tinyUs, spawnUs,
+               checked ? "ok" : "FAILED");
+    }
+    Parallel::setNumThreads(threads);
+    printf("  %s\n", passed ? "PASSED" : "FAILED");
+    return passed;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Transient memory and time of building a large teapot's buffers, the way
+// the generators did it (new[] staging arrays, copied by glBufferData) and
+// the way they do it now (written straight into mapped buffer memory, or
+// into arena scratch when the vertices are reordered afterwards). Heap
+// blocks stand in for the GL buffers; they are allocated and touched
+// beforehand, so the resident size growth is the transient memory alone.
+// Heap pages freed by an earlier flow can be reused by a later one, which
+// then grows less than it would alone; the staged flows run first.
+/////////////////////////////////////////////////////////////////////////////
+struct ArenaBenchBuffers
+{
+    vector<float> v, n, tc;
+    vector<unsigned int> el;
+};
+
+// Reordered like VBOSphere and VBOTorus did before: in the staging arrays.
+static void stagedOptimizedTeapot(int grid, const glm::mat4 &lid, ArenaBenchBuffers &dst)
+{
+    unsigned int nVerts = VBOTeapot::getNumVertices(grid);
+    size_t nIndices = VBOTeapot::getNumIndices(grid);
+    float *v = new float[3 * nVerts];
+    float *n = new float[3 * nVerts];
+    float *tc = new float[2 * nVerts];
+    unsigned int *el = new unsigned int[nIndices];
+    VBOTeapot::generate(grid, lid, v, n, tc, el);
+
+    vector<unsigned int> remap;
+    MeshOptimize::optimizeMesh(el, nIndices, nVerts, remap);
+    MeshOptimize::remapVertexArray(v, 3, nVerts, remap);
+    MeshOptimize::remapVertexArray(n, 3, nVerts, remap);
+    MeshOptimize::remapVertexArray(tc, 2, nVerts, remap);
+
+    memcpy(&dst.v[0], v, 3 * nVerts * sizeof(float));
+    memcpy(&dst.n[0], n, 3 * nVerts * sizeof(float));
+    memcpy(&dst.tc[0], tc, 2 * nVerts * sizeof(float));
+    memcpy(&dst.el[0], el, nIndices * sizeof(unsigned int));
+    delete [] v;
+    delete [] n;
+    delete [] tc;
+    delete [] el;
+}
+
+// Reordered like VBOSphere and VBOTorus do now: generated into scratch and
+// gathered into the mapped buffers.
+static void scratchOptimizedTeapot(int grid, const glm::mat4 &lid, ArenaBenchBuffers &dst)
+{
+    unsigned int nVerts = VBOTeapot::getNumVertices(grid);
+    size_t nIndices = VBOTeapot::getNumIndices(grid);
+    Arena &scratch = Arena::scratch();
+    Arena::Scope scratchScope(scratch);
+    float *v = scratch.allocateArray<float>(3 * nVerts);
+    float *n = scratch.allocateArray<float>(3 * nVerts);
+    float *tc = scratch.allocateArray<float>(2 * nVerts);
+    unsigned int *el = scratch.allocateArray<unsigned int>(nIndices);
+    VBOTeapot::generate(grid, lid, v, n, tc, el);
+
+    vector<unsigned int> remap, order;
+    MeshOptimize::optimizeMesh(el, nIndices, nVerts, remap);
+    MeshOptimize::invertRemap(remap, order);
+    MeshOptimize::gatherVertexArray(v, &dst.v[0], 3, nVerts, order);
+    MeshOptimize::gatherVertexArray(n, &dst.n[0], 3, nVerts, order);
+    MeshOptimize::gatherVertexArray(tc, &dst.tc[0], 2, nVerts, order);
+    IndexBuffer::write(&dst.el[0], IndexBuffer::selectType(nVerts), el, GLsizei(nIndices));
+}
+
+// Like VBOTeapot did before: generated into staging arrays and copied.
+static void stagedTeapot(int grid, const glm::mat4 &lid, ArenaBenchBuffers &dst)
+{
+    unsigned int nVerts = VBOTeapot::getNumVertices(grid);
+    size_t nIndices = VBOTeapot::getNumIndices(grid);
+    float *v = new float[3 * nVerts];
+    float *n = new float[3 * nVerts];
+    float *tc = new float[2 * nVerts];
+    unsigned int *el = new unsigned int[nIndices];
+    VBOTeapot::generate(grid, lid, v, n, tc, el);
+
+    memcpy(&dst.v[0], v, 3 * nVerts * sizeof(float));
+    memcpy(&dst.n[0], n, 3 * nVerts * sizeof(float));
+    memcpy(&dst.tc[0], tc, 2 * nVerts * sizeof(float));
+    memcpy(&dst.el[0], el, nIndices * sizeof(unsigned int));
+    delete [] v;
+    delete [] n;
+    delete [] tc;
+    delete [] el;
+}
+
+// Like VBOTeapot does now: generated into the mapped buffers.
+static void mappedTeapot(int grid, const glm::mat4 &lid, ArenaBenchBuffers &dst)
+{
+    VBOTeapot::generate(grid, lid, &dst.v[0], &dst.n[0], &dst.tc[0], &dst.el[0]);
+}
+
+
+static bool benchArena()
+{
+    const int iterations = 3;
+    glm::mat4 lid = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 1.5f, 0.25f));
+
+    struct Flow
+    {
+        const char *name;
+        int grid;
+        void (*build)(int, const glm::mat4 &, ArenaBenchBuffers &);
+        int compareWith;    // The flow whose output must be the same, or -1.
+    };
+    const Flow flows[4] = {
+        { "in place,  staged   ", 256, stagedTeapot, -1 },
+        { "in place,  mapped   ", 256, mappedTeapot, 0 },
+        { "reordered, staged   ", 128, stagedOptimizedTeapot, -1 },
+        { "reordered, scratch  ", 128, scratchOptimizedTeapot, 2 }
+    };
+
+    printf("Transient geometry memory: teapot grid 256 (%d points), reordered grid 128 (%d points)\n",
+           VBOTeapot::getNumVertices(256), VBOTeapot::getNumVertices(128));
+    printf("  %s\n", ProcessMemory::resetPeak() ? "peak resident size measured per flow"
+                                                : "peak resident size cannot be reset here; growth is since start");
+    printf("  flow                     ms   peak RSS growth   arena peak   output\n");
+
+    bool passed = true;
+    ArenaBenchBuffers outputs[4];
+    for( int f = 0; f < 4; f++ ) {
+        const Flow &flow = flows[f];
+        int nVerts = VBOTeapot::getNumVertices(flow.grid);
+        ArenaBenchBuffers &dst = outputs[f];
+        dst.v.assign(3 * nVerts, 0.0f);
+        dst.n.assign(3 * nVerts, 0.0f);
+        dst.tc.assign(2 * nVerts, 0.0f);
+        dst.el.assign(VBOTeapot::getNumIndices(flow.grid), 0u);
+
+        Arena::scratch().release();
+        ProcessMemory::resetPeak();
+        size_t baseBytes = ProcessMemory::getCurrentResidentBytes();
+        Stopwatch timer;
+        for( int it = 0; it < iterations; it++ ) flow.build(flow.grid, lid, dst);
+        double ms = timer.elapsedMs() / iterations;
+        size_t peakBytes = ProcessMemory::getPeakResidentBytes();
+        double growthMB = (peakBytes > baseBytes ? peakBytes - baseBytes : 0) / (1024.0 * 1024.0);
+        double arenaMB = Arena::scratch().getPeakBytesUsed() / (1024.0 * 1024.0);
+
+        const char *result = "";
+        if( flow.compareWith >= 0 ) {
+            const ArenaBenchBuffers &ref = outputs[flow.compareWith];
+            bool same = dst.v == ref.v && dst.n == ref.n && dst.tc == ref.tc && dst.el == ref.el;
+            passed = passed && same;
+            result = same ? "same" : "DIFFERENT";
+        }
+        printf("  %s %8.1f   %10.1f MB   %7.1f MB   %s\n", flow.name, ms, growthMB, arenaMB, result);
+    }
+    Arena::scratch().release();
+    printf("  %s\n", passed ? "PASSED" : "FAILED");
+    return passed;
+}
+
+
+
+
+struct BenchmarkEntry
+{
+    const char *name;
+    bool (*func)();
+};
+
+static const BenchmarkEntry entries[] = {
+    { "planeupdate", benchPlaneUpdate },
+    { "meshopt",     benchMeshOptimize },
+    { "simplify",    benchSimplify },
+    { "teapot",      benchTeapot },
+    { "teapotpatch", benchTeapotPatch },
+    { "displacement", benchDisplacement },
+    { "heightpyramid", benchHeightPyramid },
+    { "normalbake",  benchNormalBake },
+    { "envprefilter", benchEnvPrefilter },
+    { "lightclusters", benchLightClusters },
+    { "shadowcascades", benchShadowCascades },
+    { "antialiasing", benchAntiAliasing },
+    { "dynres",      benchDynamicResolution },
+    { "spscqueue",   benchSpscQueue },
+    { "jobsystem",   benchJobSystem },
+    { "arena",       benchArena }
+};
+
+static const int numEntries = sizeof(entries) / sizeof(entries[0]);
+
+
+Result run(const char *name) {
+    for( int i = 0; i < numEntries; i++ ) {
+        if( strcmp(name, entries[i].name) == 0 )
+            return entries[i].func() ? PASSED : FAILED;
+    }
+    return UNKNOWN_NAME;
+}
+
+
+void printNames() {
+    for( int i = 0; i < numEntries; i++ )
+        printf("  %s\n", entries[i].name);
+}
+
+} // namespace Benchmarks
@@ -0,0 +1,20 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+// CPU-side micro-benchmarks, run from the command line with
+//     main -cpubench <name>
+// They need no OpenGL context. Most also check their results and print
+// PASSED or FAILED.
+namespace Benchmarks
+{
+    enum Result { PASSED, FAILED, UNKNOWN_NAME };
+
+    // Runs the named benchmark. FAILED if one of its checks failed;
+    // benchmarks without checks always pass.
+    Result run(const char *name);
+
+    // Prints the names accepted by run().
+    void printNames();
+}
+
+#endif // BENCHMARKS_H
@@ -0,0 +1,298 @@
+#include "displacement.h"
+#include "heightpyramid.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace Displacement {
+
+const char *getKernelName(Kernel kernel)
+{
+    switch( kernel ) {
+    case HEMISPHERES: return "hemispheres";
+    case FBM:         return "fbm";
+    case VORONOI:     return "voronoi";
+    case HEIGHTFIELD: return "heightfield";
+    default:          return "unknown";
+    }
+}
+
+
+void HeightMap::set(const unsigned char *data, int w, int h, int channels)
+{
+    width = w;
+    height = h;
+    texels.resize((size_t)w * h);
+    for( size_t i = 0; i < texels.size(); i++ )
+        texels[i] = data[i * channels] / 255.0f;
+}
+
+
+float HeightMap::sample(float s, float t) const
+{
+    if( texels.empty() ) return 0.0f;
+
+    // Texel centres are at (i + 0.5) / width, as in OpenGL.
+    float x = s * width - 0.5f;
+    float y = t * height - 0.5f;
+    float fx = floorf(x), fy = floorf(y);
+    float ax = x - fx, ay = y - fy;
+
+    int x0 = (int)fx % width, y0 = (int)fy % height;
+    if( x0 < 0 ) x0 += width;
+    if( y0 < 0 ) y0 += height;
+    int x1 = (x0 + 1) % width, y1 = (y0 + 1) % height;
+
+    const float *row0 = &texels[(size_t)y0 * width];
+    const float *row1 = &texels[(size_t)y1 * width];
+    float bottom = row0[x0] + ax * (row0[x1] - row0[x0]);
+    float top = row1[x0] + ax * (row1[x1] - row1[x0]);
+    return bottom + ay * (top - bottom);
+}
+
+
+unsigned int hash(int x, int y, unsigned int seed)
+{
+    unsigned int h = (unsigned int)x * 0x8da6b343u ^ (unsigned int)y * 0xd8163841u ^ seed * 0x9e3779b9u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+
+namespace {
+
+float hashToUnit(unsigned int h)
+{
+    return (float)(h >> 8) * (1.0f / 16777216.0f);
+}
+
+
+const Sample WOOD = { 0.0f, glm::vec3(0.0f, 0.0f, 1.0f), false };
+
+
+// Tile-space centre of the mirror of a tile, for the kernels with one
+// hemispherical mirror per tile.
+glm::vec2 mirrorCenter(const Params &params, int tileX, int tileY)
+{
+    glm::vec2 center((float)tileX + 0.5f, (float)tileY + 0.5f);
+    if( params.kernel == VORONOI ) {
+        glm::vec2 jitter = glm::vec2(hashToUnit(hash(tileX, tileY, 0u)),
+                                     hashToUnit(hash(tileX, tileY, 1u))) - glm::vec2(0.5f);
+        center += VORONOI_JITTER * jitter;
+    }
+    return center;
+}
+
+
+Sample hemisphereSample(const Params &params, glm::vec2 x, glm::vec2 center)
+{
+    Sample result = WOOD;
+    glm::vec2 p = x - center;
+    float sqrDist = glm::dot(p, p);
+    float sqrRadius = params.mirrorRadius * params.mirrorRadius;
+    if( sqrDist <= sqrRadius ) {
+        float h = sqrtf(std::max(sqrRadius - sqrDist, 0.0f));
+        result.mirror = true;
+        result.height = h / params.mirrorTileDensity;
+        result.normal = glm::normalize(glm::vec3(p, h));
+    }
+    return result;
+}
+
+
+Sample thresholdSample(const Params &params, float n, glm::vec2 dn)
+{
+    Sample result = WOOD;
+    if( n > 0.5f ) {
+        float scale = 2.0f * params.mirrorRadius;
+        result.mirror = true;
+        result.height = scale * (n - 0.5f) / params.mirrorTileDensity;
+        result.normal = glm::normalize(glm::vec3(-scale * dn, 1.0f));
+    }
+    return result;
+}
+
+
+float valueNoise(glm::vec2 x, unsigned int seed, glm::vec2 &dn)
+{
+    glm::vec2 i = glm::floor(x);
+    glm::vec2 f = x - i;
+    glm::vec2 u = f * f * f * (f * (f * 6.0f - 15.0f) + 10.0f);
+    glm::vec2 du = 30.0f * f * f * (f * (f - 2.0f) + 1.0f);
+
+    int cx = (int)i.x, cy = (int)i.y;
+    float a = hashToUnit(hash(cx, cy, seed));
+    float b = hashToUnit(hash(cx + 1, cy, seed));
+    float d = hashToUnit(hash(cx, cy + 1, seed));
+    float e = hashToUnit(hash(cx + 1, cy + 1, seed));
+
+    float k1 = b - a;
+    float k2 = d - a;
+    float k3 = a - b - d + e;
+    dn = du * glm::vec2(k1 + k3 * u.y, k2 + k3 * u.x);
+    return a + k1 * u.x + k2 * u.y + k3 * u.x * u.y;
+}
+
+} // namespace
+
+
+Sample evaluate(const Params &params, float s, float t)
+{
+    glm::vec2 x = params.mirrorTileDensity * glm::vec2(s, t);
+
+    switch( params.kernel ) {
+    case FBM: {
+        float n = 0.0f;
+        glm::vec2 dn(0.0f);
+        float amplitude = 0.5f;
+        float frequency = 1.0f;
+        float total = 0.0f;
+        for( int octave = 0; octave < FBM_OCTAVES; octave++ ) {
+            glm::vec2 d;
+            n += amplitude * valueNoise(frequency * x, (unsigned int)octave, d);
+            dn += amplitude * frequency * d;
+            total += amplitude;
+            amplitude *= 0.5f;
+            frequency *= 2.0f;
+        }
+        return thresholdSample(params, n / total, dn / total);
+    }
+
+    case VORONOI: {
+        // The nearest mirror can be in a neighbouring tile; the highest one wins.
+        int tileX = (int)floorf(x.x), tileY = (int)floorf(x.y);
+        Sample result = WOOD;
+        for( int j = -1; j <= 1; j++ ) {
+            for( int i = -1; i <= 1; i++ ) {
+                Sample s = hemisphereSample(params, x, mirrorCenter(params, tileX + i, tileY + j));
+                if( s.mirror && (!result.mirror || s.height > result.height) ) result = s;
+            }
+        }
+        return result;
+    }
+
+    case HEIGHTFIELD: {
+        // Central differences one texel apart.
+        const HeightMap *map = params.heightMap;
+        if( map == NULL || map->empty() ) return WOOD;
+        glm::vec2 texel = 1.0f / glm::vec2((float)map->getWidth(), (float)map->getHeight());
+        float n = map->sample(x.x, x.y);
+        float nx = map->sample(x.x + texel.x, x.y) - map->sample(x.x - texel.x, x.y);
+        float ny = map->sample(x.x, x.y + texel.y) - map->sample(x.x, x.y - texel.y);
+        return thresholdSample(params, n, glm::vec2(nx, ny) / (2.0f * texel));
+    }
+
+    default:
+        return hemisphereSample(params, x, mirrorCenter(params, (int)floorf(x.x), (int)floorf(x.y)));
+    }
+}
+
+
+namespace {
+
+bool hasMirrorDisks(const Params &params)
+{
+    return params.kernel == HEMISPHERES || params.kernel == VORONOI;
+}
+
+
+// Bounds of the height map's values over a texture-coordinate box grown by
+// margin. Returns false if there is no pyramid.
+bool heightFieldBounds(const Params &params, glm::vec2 texLo, glm::vec2 texHi, float margin,
+                       float &nMin, float &nMax)
+{
+    if( params.heightPyramid == NULL || params.heightPyramid->getNumLevels() == 0 ) return false;
+    params.heightPyramid->getBounds(params.mirrorTileDensity * (texLo - glm::vec2(margin)),
+                                    params.mirrorTileDensity * (texHi + glm::vec2(margin)),
+                                    nMin, nMax);
+    return true;
+}
+
+
+// Range of tiles whose mirror, grown by margin, can reach the tile-space
+// box [lo, hi].
+bool mirrorTileRange(const Params &params, glm::vec2 lo, glm::vec2 hi, float margin,
+                     glm::ivec2 &first, glm::ivec2 &last)
+{
+    float reach = params.mirrorRadius + margin;
+    if( params.kernel == VORONOI ) reach += 0.5f * VORONOI_JITTER;
+    first = glm::ivec2(glm::floor(lo - glm::vec2(0.5f + reach)));
+    last = glm::ivec2(glm::floor(hi - glm::vec2(0.5f - reach)));
+    glm::ivec2 count = last - first + glm::ivec2(1);
+    return count.x * count.y <= MAX_BOUND_TILES;
+}
+
+} // namespace
+
+
+bool boxMayDisplace(const Params &params, glm::vec2 texLo, glm::vec2 texHi, float margin)
+{
+    if( params.kernel == HEIGHTFIELD ) {
+        float nMin, nMax;
+        return !heightFieldBounds(params, texLo, texHi, margin, nMin, nMax) || nMax > 0.5f;
+    }
+    if( !hasMirrorDisks(params) ) return true;
+
+    glm::vec2 lo = params.mirrorTileDensity * texLo;
+    glm::vec2 hi = params.mirrorTileDensity * texHi;
+    float reach = params.mirrorRadius + params.mirrorTileDensity * margin;
+    glm::ivec2 first, last;
+    if( !mirrorTileRange(params, lo, hi, params.mirrorTileDensity * margin, first, last) ) return true;
+
+    for( int j = first.y; j <= last.y; j++ ) {
+        for( int i = first.x; i <= last.x; i++ ) {
+            glm::vec2 c = mirrorCenter(params, i, j);
+            glm::vec2 d = c - glm::clamp(c, lo, hi);
+            if( glm::dot(d, d) <= reach * reach ) return true;
+        }
+    }
+    return false;
+}
+
+
+bool segmentMayDisplace(const Params &params, glm::vec2 texA, glm::vec2 texB, float margin)
+{
+    if( params.kernel == HEIGHTFIELD )
+        return boxMayDisplace(params, glm::min(texA, texB), glm::max(texA, texB), margin);
+    if( !hasMirrorDisks(params) ) return true;
+
+    // Order the end points so that both patches sharing an edge agree.
+    if( texA.x > texB.x || (texA.x == texB.x && texA.y > texB.y) ) std::swap(texA, texB);
+    glm::vec2 a = params.mirrorTileDensity * texA;
+    glm::vec2 b = params.mirrorTileDensity * texB;
+    float reach = params.mirrorRadius + params.mirrorTileDensity * margin;
+    glm::ivec2 first, last;
+    if( !mirrorTileRange(params, glm::min(a, b), glm::max(a, b), params.mirrorTileDensity * margin, first, last) )
+        return true;
+
+    glm::vec2 ab = b - a;
+    float abLength2 = glm::dot(ab, ab);
+    for( int j = first.y; j <= last.y; j++ ) {
+        for( int i = first.x; i <= last.x; i++ ) {
+            glm::vec2 c = mirrorCenter(params, i, j);
+            float t = (abLength2 > 0.0f) ? glm::clamp(glm::dot(c - a, ab) / abLength2, 0.0f, 1.0f) : 0.0f;
+            glm::vec2 d = c - (a + t * ab);
+            if( glm::dot(d, d) <= reach * reach ) return true;
+        }
+    }
+    return false;
+}
+
+
+float maxHeight(const Params &params, glm::vec2 texLo, glm::vec2 texHi, float margin)
+{
+    // Every kernel peaks at the height of a hemispherical mirror.
+    float peak = params.mirrorRadius / params.mirrorTileDensity;
+    if( params.kernel == HEIGHTFIELD ) {
+        float nMin, nMax;
+        if( !heightFieldBounds(params, texLo, texHi, margin, nMin, nMax) ) return peak;
+        return 2.0f * std::max(nMax - 0.5f, 0.0f) * peak;
+    }
+    return boxMayDisplace(params, texLo, texHi, margin) ? peak : 0.0f;
+}
+
+} // namespace Displacement
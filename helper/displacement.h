@@ -0,0 +1,92 @@
+#ifndef DISPLACEMENT_H
+#define DISPLACEMENT_H
+
+#include <vector>
+using std::vector;
+
+#include <glm/glm.hpp>
+
+class HeightPyramid;
+
+// C++ implementation of the kernels in Displacement.glsl, for tessellating
+// and baking on the CPU and for checking the shaders. The arithmetic
+// follows the GLSL line by line; keep the two in step.
+namespace Displacement
+{
+    // Values of DISPLACEMENT_KERNEL.
+    enum Kernel {
+        HEMISPHERES = 0,
+        FBM         = 1,
+        VORONOI     = 2,
+        HEIGHTFIELD = 3,
+        NUM_KERNELS
+    };
+
+    const int FBM_OCTAVES = 5;
+    const float VORONOI_JITTER = 0.5f;
+
+    const char *getKernelName(Kernel kernel);
+
+    // Single-channel height image in [0, 1], sampled like a GL_LINEAR,
+    // GL_REPEAT texture. Rows go bottom to top, as uploaded to OpenGL.
+    class HeightMap
+    {
+    public:
+        HeightMap() : width(0), height(0) { }
+
+        // Takes the first channel of 8-bit pixel data.
+        void set(const unsigned char *data, int width, int height, int channels);
+
+        int getWidth() const { return width; }
+        int getHeight() const { return height; }
+        bool empty() const { return texels.empty(); }
+
+        // Bilinear sample at texture coordinates (s, t), repeating.
+        float sample(float s, float t) const;
+
+        // Row-major texels, bottom row first.
+        const float *getTexels() const { return &texels[0]; }
+
+    private:
+        int width, height;
+        vector<float> texels;
+    };
+
+    // Uniforms of Displacement.glsl.
+    struct Params
+    {
+        Kernel kernel;
+        float mirrorTileDensity;
+        float mirrorRadius;
+        const HeightMap *heightMap;          // Only used by HEIGHTFIELD.
+        const HeightPyramid *heightPyramid;  // Bounds of heightMap, for the functions below.
+    };
+
+    // See DisplacementSample in Displacement.glsl.
+    struct Sample
+    {
+        float height;
+        glm::vec3 normal;
+        bool mirror;
+    };
+
+    // displacementAt() of Displacement.glsl at texture coordinates (s, t).
+    Sample evaluate(const Params &params, float s, float t);
+
+    // Conservative bounds of Displacement.glsl for choosing tessellation
+    // levels and culling: whether anything in the texture-coordinate box or
+    // segment may be displaced, and the largest height there. Points within
+    // margin (in texture coordinates) of the region count too, which covers
+    // the footprint of mipmapped height-map samples. FBM has no bound;
+    // HEIGHTFIELD needs heightPyramid for one. Regions spanning more than
+    // MAX_BOUND_TILES tiles are not bounded either.
+    const int MAX_BOUND_TILES = 64;
+    bool boxMayDisplace(const Params &params, glm::vec2 texLo, glm::vec2 texHi, float margin = 0.0f);
+    bool segmentMayDisplace(const Params &params, glm::vec2 texA, glm::vec2 texB, float margin = 0.0f);
+    float maxHeight(const Params &params, glm::vec2 texLo, glm::vec2 texHi, float margin = 0.0f);
+
+    // The 32-bit lattice hash shared with the shaders.
+    unsigned int hash(int x, int y, unsigned int seed);
+}
+
+#endif // DISPLACEMENT_H
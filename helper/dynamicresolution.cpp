@@ -0,0 +1,63 @@
+#include "dynamicresolution.h"
+
+#include <cmath>
+#include <algorithm>
+
+DynamicResolution::Params DynamicResolution::defaultParams(float targetMs)
+{
+    Params params;
+    params.targetMs = targetMs;
+    params.headroom = 0.9f;
+    params.minScale = 0.5f;
+    params.maxScale = 1.0f;
+    params.scaleStep = 0.05f;
+    params.smoothing = 0.2f;
+    params.increaseDelay = 10;
+    return params;
+}
+
+DynamicResolution::DynamicResolution(const Params &p) : params(p)
+{
+    // The bounds are rounded inwards to whole steps.
+    minLevel = std::max(1, (int)ceilf(params.minScale / params.scaleStep - 1.0e-3f));
+    maxLevel = std::max(minLevel, (int)floorf(params.maxScale / params.scaleStep + 1.0e-3f));
+    reset(params.maxScale);
+}
+
+void DynamicResolution::reset(float scale)
+{
+    level = (int)floorf(scale / params.scaleStep + 1.0e-3f);
+    level = std::min(std::max(level, minLevel), maxLevel);
+    averageCost = -1.0;
+    framesWithRoom = 0;
+}
+
+float DynamicResolution::update(double gpuMs, float frameScale)
+{
+    if( !(gpuMs > 0.0) || !(frameScale > 0.0f) ) return getScale();
+
+    double cost = gpuMs / ((double)frameScale * frameScale);
+    if( averageCost < 0.0 ) averageCost = cost;
+    else averageCost += params.smoothing * (cost - averageCost);
+
+    // A frame over the average is believed at once, one under it only
+    // through the average.
+    double expectedCost = std::max(averageCost, cost);
+    double idealScale = sqrt(params.headroom * params.targetMs / expectedCost);
+    int idealLevel = (int)floor(idealScale / params.scaleStep + 1.0e-3);
+    idealLevel = std::min(std::max(idealLevel, minLevel), maxLevel);
+
+    if( idealLevel < level ) {
+        level = idealLevel;
+        framesWithRoom = 0;
+    }
+    else if( idealLevel > level ) {
+        if( ++framesWithRoom >= params.increaseDelay ) {
+            level++;
+            framesWithRoom = 0;
+        }
+    }
+    else framesWithRoom = 0;
+
+    return getScale();
+}
@@ -0,0 +1,52 @@
+#ifndef DYNAMICRESOLUTION_H
+#define DYNAMICRESOLUTION_H
+
+// Chooses the render resolution, as a scale of the window's width and
+// height, from the GPU times of finished frames, so that frames take about
+// a target time. A frame's time is taken to be proportional to the pixels
+// drawn, i.e. to the scale squared; the tessellation follows the pixels
+// too, since its edge lengths are measured in them.
+//
+// The scale is a multiple of scaleStep, so render targets are reallocated
+// only when it changes. It drops as soon as one frame is over the budget,
+// and rises one step at a time, only after increaseDelay frames in a row
+// had room for it, so it does not oscillate on noisy timings.
+//
+// Pure CPU logic; the caller measures the frames and resizes its targets.
+class DynamicResolution
+{
+public:
+    struct Params
+    {
+        float targetMs;      // GPU time per frame to stay under.
+        float headroom;      // Fraction of targetMs aimed at, in (0, 1].
+        float minScale;      // Bounds of the scale, in (0, 1].
+        float maxScale;
+        float scaleStep;     // The scale is a multiple of this.
+        float smoothing;     // Weight of the newest frame in the average cost, in (0, 1].
+        int increaseDelay;   // Frames in a row with room for a step up before taking it.
+    };
+
+    static Params defaultParams(float targetMs);
+
+    explicit DynamicResolution(const Params &params);
+
+    // Forgets all timings and starts over at the given scale.
+    void reset(float scale);
+
+    // Feeds the GPU time of a finished frame and the scale it was drawn at,
+    // which GPU timer latency may make older than getScale(). Returns the
+    // scale for the next frame.
+    float update(double gpuMs, float frameScale);
+
+    float getScale() const { return level * params.scaleStep; }
+    const Params &getParams() const { return params; }
+
+private:
+    Params params;
+    int level, minLevel, maxLevel;  // Scales in steps.
+    double averageCost;             // Average ms per frame at scale 1, or < 0 before the first frame.
+    int framesWithRoom;
+};
+
+#endif // DYNAMICRESOLUTION_H
@@ -0,0 +1,208 @@
+#include "envprefilter.h"
+#include "parallel.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace EnvPrefilter {
+
+namespace {
+
+const float PI_F = 3.14159265f;
+
+// Lobe weights below this fraction of the peak are dropped.
+const float LOBE_CUTOFF = 1.0e-3f;
+
+
+// Point (u, v) in [-1, 1]^2 of a face on the cube of half-width 1. Also
+// valid outside the face, on the extension of its plane.
+glm::vec3 facePlanePoint(int face, float u, float v)
+{
+    switch( face ) {
+    case 0:  return glm::vec3( 1.0f, -v, -u);
+    case 1:  return glm::vec3(-1.0f, -v,  u);
+    case 2:  return glm::vec3( u,  1.0f,  v);
+    case 3:  return glm::vec3( u, -1.0f, -v);
+    case 4:  return glm::vec3( u, -v,  1.0f);
+    default: return glm::vec3(-u, -v, -1.0f);
+    }
+}
+
+
+const float *texelAt(const Level &level, const glm::vec3 &d)
+{
+    int face;
+    float s, t;
+    directionToFace(d, face, s, t);
+    int x = std::min((int)(s * level.size), level.size - 1);
+    int y = std::min((int)(t * level.size), level.size - 1);
+    return &level.faces[face][3 * ((size_t)y * level.size + x)];
+}
+
+
+// Halves each face with a 2x2 box filter.
+void downsample(const Level &src, Level &dst)
+{
+    dst.size = std::max(1, src.size / 2);
+    for( int f = 0; f < 6; f++ ) {
+        dst.faces[f].resize(3 * (size_t)dst.size * dst.size);
+        for( int y = 0; y < dst.size; y++ ) {
+            const float *row0 = &src.faces[f][3 * (size_t)(2 * y) * src.size];
+            const float *row1 = &src.faces[f][3 * (size_t)(2 * y + 1) * src.size];
+            float *out = &dst.faces[f][3 * (size_t)y * dst.size];
+            for( int x = 0; x < dst.size; x++ ) {
+                for( int c = 0; c < 3; c++ ) {
+                    out[3 * x + c] = 0.25f * (row0[6 * x + c] + row0[6 * x + 3 + c] +
+                                              row1[6 * x + c] + row1[6 * x + 3 + c]);
+                }
+            }
+        }
+    }
+}
+
+
+// Filters one row of dst from src, which has twice its resolution. Lobes
+// narrower than 45 degrees are integrated over a window of the plane of
+// the texel's own face, which reaches onto the neighbouring faces; wider
+// ones over all of src. Both weight samples by their solid angle.
+void filterRow(const Level &src, Level &dst, int face, int y)
+{
+    const float exponent = phongExponent(dst.size);
+    const float cutoffCos = powf(LOBE_CUTOFF, 1.0f / exponent);
+    const float cutoffAngle = acosf(cutoffCos);
+    const float step = 2.0f / src.size;
+
+    for( int x = 0; x < dst.size; x++ ) {
+        float u0 = 2.0f * (x + 0.5f) / dst.size - 1.0f;
+        float v0 = 2.0f * (y + 0.5f) / dst.size - 1.0f;
+        glm::vec3 d0 = glm::normalize(facePlanePoint(face, u0, v0));
+
+        glm::vec3 sum(0.0f);
+        float weightSum = 0.0f;
+        if( cutoffAngle < 0.25f * PI_F ) {
+            // Plane distance covering the cone where the face is most oblique.
+            int radius = (int)ceilf(tanf(cutoffAngle) * (1.0f + u0 * u0 + v0 * v0) / step);
+            for( int b = -radius - 1; b <= radius; b++ ) {
+                for( int a = -radius - 1; a <= radius; a++ ) {
+                    float u = u0 + (a + 0.5f) * step, v = v0 + (b + 0.5f) * step;
+                    float sqrLen = 1.0f + u * u + v * v;
+                    glm::vec3 d = facePlanePoint(face, u, v) / sqrtf(sqrLen);
+                    float c = glm::dot(d, d0);
+                    if( c < cutoffCos ) continue;
+                    float w = powf(c, exponent) / (sqrLen * sqrtf(sqrLen));
+                    const float *rgb = texelAt(src, d);
+                    sum += w * glm::vec3(rgb[0], rgb[1], rgb[2]);
+                    weightSum += w;
+                }
+            }
+        }
+        else {
+            for( int f = 0; f < 6; f++ ) {
+                for( int j = 0; j < src.size; j++ ) {
+                    for( int i = 0; i < src.size; i++ ) {
+                        float u = (i + 0.5f) * step - 1.0f, v = (j + 0.5f) * step - 1.0f;
+                        float sqrLen = 1.0f + u * u + v * v;
+                        glm::vec3 d = facePlanePoint(f, u, v) / sqrtf(sqrLen);
+                        float c = glm::dot(d, d0);
+                        if( c < cutoffCos ) continue;
+                        float w = powf(c, exponent) / (sqrLen * sqrtf(sqrLen));
+                        const float *rgb = &src.faces[f][3 * ((size_t)j * src.size + i)];
+                        sum += w * glm::vec3(rgb[0], rgb[1], rgb[2]);
+                        weightSum += w;
+                    }
+                }
+            }
+        }
+
+        float *out = &dst.faces[face][3 * ((size_t)y * dst.size + x)];
+        glm::vec3 mean = (weightSum > 0.0f) ? sum / weightSum : glm::vec3(0.0f);
+        out[0] = mean.x;
+        out[1] = mean.y;
+        out[2] = mean.z;
+    }
+}
+
+} // namespace
+
+
+glm::vec3 faceDirection(int face, float s, float t)
+{
+    return glm::normalize(facePlanePoint(face, 2.0f * s - 1.0f, 2.0f * t - 1.0f));
+}
+
+
+void directionToFace(const glm::vec3 &d, int &face, float &s, float &t)
+{
+    glm::vec3 a = glm::abs(d);
+    float sc, tc, ma;
+    if( a.x >= a.y && a.x >= a.z ) {
+        face = (d.x >= 0.0f) ? 0 : 1;
+        sc = (d.x >= 0.0f) ? -d.z : d.z;
+        tc = -d.y;
+        ma = a.x;
+    }
+    else if( a.y >= a.z ) {
+        face = (d.y >= 0.0f) ? 2 : 3;
+        sc = d.x;
+        tc = (d.y >= 0.0f) ? d.z : -d.z;
+        ma = a.y;
+    }
+    else {
+        face = (d.z >= 0.0f) ? 4 : 5;
+        sc = (d.z >= 0.0f) ? d.x : -d.x;
+        tc = -d.y;
+        ma = a.z;
+    }
+    s = 0.5f * (sc / ma + 1.0f);
+    t = 0.5f * (tc / ma + 1.0f);
+}
+
+
+float phongExponent(int size)
+{
+    // A cos^n lobe has an angular standard deviation of about 1 / sqrt(n);
+    // make it one texel, which spans (pi / 2) / size radians.
+    float texelsPerRadian = 2.0f * size / PI_F;
+    return std::max(texelsPerRadian * texelsPerRadian, 1.0f);
+}
+
+
+void prefilter(const unsigned char *const faces[6], int size, int channels,
+               vector<Level> &levels, bool useThreads)
+{
+    levels.clear();
+    if( size <= 0 || (size & (size - 1)) != 0 ) return;
+
+    // Box-filtered copies of the input are the sources of the levels.
+    vector<Level> sources(1);
+    sources[0].size = size;
+    for( int f = 0; f < 6; f++ ) {
+        sources[0].faces[f].resize(3 * (size_t)size * size);
+        for( size_t i = 0; i < (size_t)size * size; i++ ) {
+            for( int c = 0; c < 3; c++ )
+                sources[0].faces[f][3 * i + c] = faces[f][channels * i + (channels >= 3 ? c : 0)] / 255.0f;
+        }
+    }
+    while( sources.back().size > 1 ) {
+        sources.push_back(Level());
+        downsample(sources[sources.size() - 2], sources.back());
+    }
+
+    levels.resize(sources.size());
+    levels[0] = sources[0];
+    for( size_t l = 1; l < levels.size(); l++ ) {
+        Level &dst = levels[l];
+        const Level &src = sources[l - 1];
+        dst.size = sources[l].size;
+        for( int f = 0; f < 6; f++ )
+            dst.faces[f].resize(3 * (size_t)dst.size * dst.size);
+
+        int rows = 6 * dst.size;
+        Parallel::parallelFor(0, rows, useThreads ? 1 : rows, [&](int first, int last) {
+            for( int r = first; r < last; r++ )
+                filterRow(src, dst, r / dst.size, r % dst.size);
+        });
+    }
+}
+
+} // namespace EnvPrefilter
@@ -0,0 +1,44 @@
+#ifndef ENVPREFILTER_H
+#define ENVPREFILTER_H
+
+#include <vector>
+using std::vector;
+
+#include <glm/glm.hpp>
+
+// Prefilters an environment cubemap for glossy and minified reflections.
+// Each mip level is the environment convolved with a normalised Phong lobe
+// about the lookup direction, with an exponent chosen so that the lobe is
+// about one texel of that level wide. A shader can then pick the level
+// from the angle its reflection vector sweeps per pixel and get an
+// alias-free average instead of a few scattered texels.
+//
+// Faces are in OpenGL order (+X, -X, +Y, -Y, +Z, -Z) and addressed as in
+// the OpenGL specification, with row 0 at t = 0, i.e. in the order the
+// rows are uploaded with glTexImage2D().
+namespace EnvPrefilter
+{
+    struct Level
+    {
+        int size;               // Width and height of each face in texels.
+        vector<float> faces[6]; // RGB, row by row.
+    };
+
+    // Unit direction through the point (s, t) in [0, 1]^2 of a face.
+    glm::vec3 faceDirection(int face, float s, float t);
+
+    // The face hit by direction d and the point (s, t) on it.
+    void directionToFace(const glm::vec3 &d, int &face, float &s, float &t);
+
+    // Phong exponent of the lobe of a level size texels wide.
+    float phongExponent(int size);
+
+    // Builds the whole mip chain, down to 1x1, from 8-bit faces with
+    // channels components per texel (the first three are used). The first
+    // level is the input. The size must be a power of two. Rows of all six
+    // faces are spread across threads.
+    void prefilter(const unsigned char *const faces[6], int size, int channels,
+                   vector<Level> &levels, bool useThreads = true);
+}
+
+#endif // ENVPREFILTER_H
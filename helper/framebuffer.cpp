@@ -0,0 +1,131 @@
+#include "framebuffer.h"
+
+Framebuffer::Framebuffer() : fbo(0), depthBuffer(0), width(0), height(0), numColors(0), samples(0)
+{
+    for( int i = 0; i < MAX_COLORS; i++ ) colorTextures[i] = colorBuffers[i] = 0;
+}
+
+Framebuffer::~Framebuffer()
+{
+    destroy();
+}
+
+void Framebuffer::destroy()
+{
+    if( fbo != 0 ) glDeleteFramebuffers(1, &fbo);
+    if( depthBuffer != 0 ) glDeleteRenderbuffers(1, &depthBuffer);
+    for( int i = 0; i < MAX_COLORS; i++ ) {
+        if( colorTextures[i] != 0 ) glDeleteTextures(1, &colorTextures[i]);
+        if( colorBuffers[i] != 0 ) glDeleteRenderbuffers(1, &colorBuffers[i]);
+        colorTextures[i] = colorBuffers[i] = 0;
+    }
+    fbo = 0;
+    depthBuffer = 0;
+    width = height = numColors = samples = 0;
+}
+
+bool Framebuffer::create(int w, int h, const GLenum *colorFormats, int n, int s)
+{
+    destroy();
+    if( w <= 0 || h <= 0 || n < 0 || n > MAX_COLORS || s < 1 ) return false;
+
+    GLint prevFramebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prevFramebuffer);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+    GLenum drawBuffers[MAX_COLORS];
+    for( int i = 0; i < n; i++ ) {
+        drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+        if( s > 1 ) {
+            glGenRenderbuffers(1, &colorBuffers[i]);
+            glBindRenderbuffer(GL_RENDERBUFFER, colorBuffers[i]);
+            glRenderbufferStorageMultisample(GL_RENDERBUFFER, s, colorFormats[i], w, h);
+            glBindRenderbuffer(GL_RENDERBUFFER, 0);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, drawBuffers[i], GL_RENDERBUFFER, colorBuffers[i]);
+            continue;
+        }
+        glGenTextures(1, &colorTextures[i]);
+        glBindTexture(GL_TEXTURE_2D, colorTextures[i]);
+        glTexStorage2D(GL_TEXTURE_2D, 1, colorFormats[i], w, h);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, drawBuffers[i], GL_TEXTURE_2D, colorTextures[i], 0);
+    }
+
+    glGenRenderbuffers(1, &depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    if( s > 1 ) glRenderbufferStorageMultisample(GL_RENDERBUFFER, s, GL_DEPTH_COMPONENT24, w, h);
+    else glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+
+    if( n > 0 ) glDrawBuffers(n, drawBuffers);
+    else glDrawBuffer(GL_NONE);
+
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, prevFramebuffer);
+    if( !complete ) {
+        destroy();
+        return false;
+    }
+
+    width = w;
+    height = h;
+    numColors = n;
+    samples = s;
+    return true;
+}
+
+bool Framebuffer::matches(int w, int h, int s) const
+{
+    return fbo != 0 && width == w && height == h && samples == s;
+}
+
+void Framebuffer::bind() const
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, width, height);
+}
+
+void Framebuffer::resolveTo(const Framebuffer &dst) const
+{
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, dst.fbo);
+
+    // A blit writes to every draw buffer, so attachments go one at a time.
+    int n = (numColors < dst.numColors) ? numColors : dst.numColors;
+    for( int i = 0; i < n; i++ ) {
+        glReadBuffer(GL_COLOR_ATTACHMENT0 + i);
+        glDrawBuffer(GL_COLOR_ATTACHMENT0 + i);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
+    GLenum drawBuffers[MAX_COLORS];
+    for( int i = 0; i < dst.numColors; i++ ) drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    if( dst.numColors > 0 ) glDrawBuffers(dst.numColors, drawBuffers);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, dst.fbo);
+}
+
+void Framebuffer::resolveTo(GLuint dstFBO) const
+{
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, dstFBO);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, dstFBO);
+}
+
+void Framebuffer::stretchTo(GLuint dstFBO, int dstWidth, int dstHeight) const
+{
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, dstFBO);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, dstWidth, dstHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_FRAMEBUFFER, dstFBO);
+}
@@ -0,0 +1,72 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "gldecl.h"
+
+// An off-screen render target: up to MAX_COLORS color textures of the
+// given internal formats, which later passes can read, and a 24-bit depth
+// buffer. Needs a current OpenGL context.
+//
+//     GLenum formats[2] = { GL_RGBA8, GL_R16F };
+//     target.create(width, height, formats, 2);
+//     target.bind();  ...draw...
+//
+// A multisampled target has renderbuffers instead of textures, which
+// cannot be read directly: resolveTo() averages its samples into a
+// single-sampled target or the window.
+class Framebuffer
+{
+public:
+    static const int MAX_COLORS = 4;
+
+    Framebuffer();
+    ~Framebuffer();
+
+    // Replaces the attachments. Returns false, leaving the target empty, if
+    // the framebuffer is incomplete, e.g. with more samples than
+    // GL_MAX_SAMPLES.
+    bool create(int width, int height, const GLenum *colorFormats, int numColors,
+                int samples = 1);
+    void destroy();
+
+    // True if created at this size and sample count, so it can be kept.
+    bool matches(int width, int height, int samples = 1) const;
+
+    // Binds for drawing to all color attachments and sets the viewport to
+    // cover the target.
+    void bind() const;
+
+    // Resolves every color attachment into the same attachment of dst,
+    // which must be single-sampled and as large. Leaves dst bound.
+    void resolveTo(const Framebuffer &dst) const;
+
+    // Resolves the first color attachment into the draw buffers of the
+    // framebuffer object fbo, 0 for the window, at the same size. Leaves
+    // fbo bound.
+    void resolveTo(GLuint fbo) const;
+
+    // Stretches the first color attachment, which must be single-sampled,
+    // over dstWidth x dstHeight pixels of the framebuffer object fbo with
+    // bilinear filtering. Leaves fbo bound.
+    void stretchTo(GLuint fbo, int dstWidth, int dstHeight) const;
+
+    GLuint getID() const { return fbo; }
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getNumColors() const { return numColors; }
+    int getSamples() const { return samples; }
+    // 0 if multisampled.
+    GLuint getColorTexture(int i) const { return colorTextures[i]; }
+
+private:
+    GLuint fbo;
+    GLuint colorTextures[MAX_COLORS];
+    GLuint colorBuffers[MAX_COLORS];  // Multisampled instead of colorTextures.
+    GLuint depthBuffer;
+    int width, height, numColors, samples;
+
+    Framebuffer(const Framebuffer &);
+    Framebuffer &operator=(const Framebuffer &);
+};
+
+#endif // FRAMEBUFFER_H
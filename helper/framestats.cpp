@@ -0,0 +1,37 @@
+#include "framestats.h"
+
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+
+double FrameStats::minimum() const {
+    if( samples.empty() ) return 0.0;
+    return *std::min_element(samples.begin(), samples.end());
+}
+
+double FrameStats::maximum() const {
+    if( samples.empty() ) return 0.0;
+    return *std::max_element(samples.begin(), samples.end());
+}
+
+double FrameStats::average() const {
+    if( samples.empty() ) return 0.0;
+    double sum = 0.0;
+    for( size_t i = 0; i < samples.size(); i++ ) sum += samples[i];
+    return sum / samples.size();
+}
+
+double FrameStats::percentile(double p) const {
+    if( samples.empty() ) return 0.0;
+    vector<double> sorted(samples);
+    std::sort(sorted.begin(), sorted.end());
+    int rank = int(ceil(p / 100.0 * sorted.size()));
+    if( rank < 1 ) rank = 1;
+    if( rank > int(sorted.size()) ) rank = int(sorted.size());
+    return sorted[rank - 1];
+}
+
+void FrameStats::print(const char *label) const {
+    printf("%-12s n=%-5d min %7.3f  avg %7.3f  p50 %7.3f  p95 %7.3f  p99 %7.3f  max %7.3f ms\n",
+           label, count(), minimum(), average(), percentile(50.0), percentile(95.0), percentile(99.0), maximum());
+}
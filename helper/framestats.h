@@ -0,0 +1,29 @@
+#ifndef FRAMESTATS_H
+#define FRAMESTATS_H
+
+#include <vector>
+using std::vector;
+
+// Collects per-frame timings (in milliseconds) and summarizes them.
+class FrameStats
+{
+private:
+    vector<double> samples;
+
+public:
+    void clear() { samples.clear(); }
+    void addSample(double ms) { samples.push_back(ms); }
+
+    int count() const { return int(samples.size()); }
+    double minimum() const;
+    double maximum() const;
+    double average() const;
+
+    // Nearest-rank percentile, p in [0, 100]. 0 when there are no samples.
+    double percentile(double p) const;
+
+    // One line: count, min, avg, p50, p95, p99 and max, prefixed by label.
+    void print(const char *label) const;
+};
+
+#endif // FRAMESTATS_H
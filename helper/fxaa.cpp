@@ -0,0 +1,200 @@
+#include "fxaa.h"
+#include "parallel.h"
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+using std::vector;
+
+namespace Fxaa {
+
+namespace {
+
+// Steps along the edge, in pixels. The later ones are longer, so long
+// edges are followed at a bounded cost.
+const int NUM_SEARCH_STEPS = 12;
+const float searchSteps[NUM_SEARCH_STEPS] = { 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.5f, 2.0f, 2.0f, 2.0f, 2.0f, 4.0f, 8.0f };
+
+
+class Image
+{
+public:
+    Image(const unsigned char *rgba, const float *lumas, int width, int height)
+        : rgba(rgba), lumas(lumas), width(width), height(height) {}
+
+    float lumaAt(int x, int y) const
+    {
+        x = std::min(std::max(x, 0), width - 1);
+        y = std::min(std::max(y, 0), height - 1);
+        return lumas[(size_t)y * width + x];
+    }
+
+    // Bilinear luma at (u, v), in pixels, with pixel centres at + 0.5. Luma
+    // is linear in the color, so this equals the luma of the bilinear color
+    // that the shader computes.
+    float sampleLuma(float u, float v) const
+    {
+        int x0, y0;
+        float tx, ty;
+        weights(u, v, x0, y0, tx, ty);
+        float top = lumaAt(x0, y0) + (lumaAt(x0 + 1, y0) - lumaAt(x0, y0)) * tx;
+        float bottom = lumaAt(x0, y0 + 1) + (lumaAt(x0 + 1, y0 + 1) - lumaAt(x0, y0 + 1)) * tx;
+        return top + (bottom - top) * ty;
+    }
+
+    void sampleColor(float u, float v, unsigned char *out) const
+    {
+        int x0, y0;
+        float tx, ty;
+        weights(u, v, x0, y0, tx, ty);
+        const unsigned char *c00 = texel(x0, y0), *c10 = texel(x0 + 1, y0);
+        const unsigned char *c01 = texel(x0, y0 + 1), *c11 = texel(x0 + 1, y0 + 1);
+        for( int i = 0; i < 4; i++ ) {
+            float top = c00[i] + (c10[i] - c00[i]) * tx;
+            float bottom = c01[i] + (c11[i] - c01[i]) * tx;
+            out[i] = (unsigned char)(top + (bottom - top) * ty + 0.5f);
+        }
+    }
+
+private:
+    const unsigned char *rgba;
+    const float *lumas;
+    int width, height;
+
+    const unsigned char *texel(int x, int y) const
+    {
+        x = std::min(std::max(x, 0), width - 1);
+        y = std::min(std::max(y, 0), height - 1);
+        return rgba + 4 * ((size_t)y * width + x);
+    }
+
+    static void weights(float u, float v, int &x0, int &y0, float &tx, float &ty)
+    {
+        float fx = u - 0.5f, fy = v - 0.5f;
+        x0 = (int)floorf(fx);
+        y0 = (int)floorf(fy);
+        tx = fx - x0;
+        ty = fy - y0;
+    }
+};
+
+
+void filterPixel(const Image &image, int x, int y, const Params &params, unsigned char *out)
+{
+    float lumaM = image.lumaAt(x, y);
+    float lumaN = image.lumaAt(x, y - 1), lumaS = image.lumaAt(x, y + 1);
+    float lumaW = image.lumaAt(x - 1, y), lumaE = image.lumaAt(x + 1, y);
+    float u = x + 0.5f, v = y + 0.5f;
+
+    float lumaMax = std::max(std::max(lumaM, std::max(lumaN, lumaS)), std::max(lumaW, lumaE));
+    float lumaMin = std::min(std::min(lumaM, std::min(lumaN, lumaS)), std::min(lumaW, lumaE));
+    float range = lumaMax - lumaMin;
+    if( range < std::max(params.edgeThresholdMin, lumaMax * params.edgeThreshold) ) {
+        image.sampleColor(u, v, out);
+        return;
+    }
+
+    float lumaNW = image.lumaAt(x - 1, y - 1), lumaNE = image.lumaAt(x + 1, y - 1);
+    float lumaSW = image.lumaAt(x - 1, y + 1), lumaSE = image.lumaAt(x + 1, y + 1);
+
+    // A lone bright or dark pixel differs from the average of its
+    // neighbourhood by much of the range, and is blurred into it.
+    float lumaAverage = (2.0f * (lumaN + lumaS + lumaW + lumaE) + (lumaNW + lumaNE + lumaSW + lumaSE)) / 12.0f;
+    float subpixel = std::min(fabsf(lumaAverage - lumaM) / range, 1.0f);
+    subpixel = (3.0f - 2.0f * subpixel) * subpixel * subpixel;
+    float subpixelOffset = subpixel * subpixel * params.subpixelBlend;
+
+    // An edge runs along the direction with the smaller second derivative
+    // across it.
+    float horizontal = fabsf(lumaNW + lumaSW - 2.0f * lumaW) + 2.0f * fabsf(lumaN + lumaS - 2.0f * lumaM) +
+                       fabsf(lumaNE + lumaSE - 2.0f * lumaE);
+    float vertical = fabsf(lumaNW + lumaNE - 2.0f * lumaN) + 2.0f * fabsf(lumaW + lumaE - 2.0f * lumaM) +
+                     fabsf(lumaSW + lumaSE - 2.0f * lumaS);
+    bool isHorizontal = (horizontal >= vertical);
+
+    // The pixel across the edge is the neighbour on the steeper side.
+    float luma1 = isHorizontal ? lumaN : lumaW;
+    float luma2 = isHorizontal ? lumaS : lumaE;
+    float gradient1 = luma1 - lumaM, gradient2 = luma2 - lumaM;
+    bool side1 = fabsf(gradient1) >= fabsf(gradient2);
+    float gradientScaled = 0.25f * std::max(fabsf(gradient1), fabsf(gradient2));
+    float stepLength = side1 ? -1.0f : 1.0f;
+    float lumaLocalAverage = 0.5f * ((side1 ? luma1 : luma2) + lumaM);
+
+    // Follow the edge, halfway between the two pixels, until the luma there
+    // moves off the average of the two by a quarter of the gradient.
+    float edgeU = u, edgeV = v;
+    if( isHorizontal ) edgeV += 0.5f * stepLength;
+    else edgeU += 0.5f * stepLength;
+    float stepU = isHorizontal ? 1.0f : 0.0f, stepV = isHorizontal ? 0.0f : 1.0f;
+
+    float u1 = edgeU, v1 = edgeV, u2 = edgeU, v2 = edgeV;
+    float lumaEnd1 = 0.0f, lumaEnd2 = 0.0f;
+    bool reached1 = false, reached2 = false;
+    for( int i = 0; i < NUM_SEARCH_STEPS && !(reached1 && reached2); i++ ) {
+        if( !reached1 ) {
+            u1 -= stepU * searchSteps[i];
+            v1 -= stepV * searchSteps[i];
+            lumaEnd1 = image.sampleLuma(u1, v1) - lumaLocalAverage;
+            reached1 = fabsf(lumaEnd1) >= gradientScaled;
+        }
+        if( !reached2 ) {
+            u2 += stepU * searchSteps[i];
+            v2 += stepV * searchSteps[i];
+            lumaEnd2 = image.sampleLuma(u2, v2) - lumaLocalAverage;
+            reached2 = fabsf(lumaEnd2) >= gradientScaled;
+        }
+    }
+
+    float distance1 = isHorizontal ? (u - u1) : (v - v1);
+    float distance2 = isHorizontal ? (u2 - u) : (v2 - v);
+    bool nearer1 = distance1 < distance2;
+    float edgeOffset = 0.5f - std::min(distance1, distance2) / (distance1 + distance2);
+
+    // Only blend towards the end whose luma changes the right way for a
+    // step of the staircase; the other end is where the next step begins.
+    bool centerBelow = lumaM < lumaLocalAverage;
+    bool correct = ((nearer1 ? lumaEnd1 : lumaEnd2) < 0.0f) != centerBelow;
+    float offset = std::max(correct ? edgeOffset : 0.0f, subpixelOffset);
+
+    if( isHorizontal ) v += offset * stepLength;
+    else u += offset * stepLength;
+    image.sampleColor(u, v, out);
+}
+
+} // namespace
+
+
+Params defaultParams()
+{
+    Params params;
+    params.edgeThreshold = 0.125f;
+    params.edgeThresholdMin = 0.0312f;
+    params.subpixelBlend = 0.75f;
+    return params;
+}
+
+
+float luma(const unsigned char *rgba)
+{
+    return (0.299f * rgba[0] + 0.587f * rgba[1] + 0.114f * rgba[2]) / 255.0f;
+}
+
+
+void apply(const unsigned char *src, int width, int height, unsigned char *dst,
+           const Params &params, bool useThreads)
+{
+    if( width <= 0 || height <= 0 ) return;
+
+    vector<float> lumas((size_t)width * height);
+    for( size_t i = 0; i < lumas.size(); i++ ) lumas[i] = luma(src + 4 * i);
+
+    Image image(src, &lumas[0], width, height);
+    Parallel::parallelFor(0, height, useThreads ? 16 : height, [&](int first, int last) {
+        for( int y = first; y < last; y++ )
+            for( int x = 0; x < width; x++ )
+                filterPixel(image, x, y, params, dst + 4 * ((size_t)y * width + x));
+    });
+}
+
+} // namespace Fxaa
@@ -0,0 +1,36 @@
+#ifndef FXAA_H
+#define FXAA_H
+
+// FXAA-style anti-aliasing of a finished image, after Lottes' FXAA 3.11
+// "quality" filter. A pixel is on an edge when the luma contrast of it and
+// its four neighbours is high. The edge is then followed both ways along
+// its length to where the contrast ends, and the pixel is re-sampled
+// across the edge, further the nearer it is to the end of the staircase
+// step. Fxaa.fs.glsl is the same filter on the GPU. This is its reference,
+// and lets the filter be measured against supersampled images.
+//
+// Images are 8-bit RGBA, row by row. Sampling between pixel centres is
+// bilinear and clamps at the borders, like a GL_LINEAR texture with
+// GL_CLAMP_TO_EDGE.
+namespace Fxaa
+{
+    struct Params
+    {
+        float edgeThreshold;     // Least contrast that is an edge, relative to the brightest luma.
+        float edgeThresholdMin;  // Least contrast that is an edge at all, so dark areas are skipped.
+        float subpixelBlend;     // Smoothing of features a pixel wide, 0 (off) to 1.
+    };
+
+    // Same values as the uniforms' defaults in Fxaa.fs.glsl.
+    Params defaultParams();
+
+    // Luma that edges are detected on, in [0, 1].
+    float luma(const unsigned char *rgba);
+
+    // Filters src into dst, which must not overlap it. Rows are spread
+    // across threads if useThreads.
+    void apply(const unsigned char *src, int width, int height, unsigned char *dst,
+               const Params &params, bool useThreads);
+}
+
+#endif // FXAA_H
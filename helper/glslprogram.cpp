@@ -113,6 +113,13 @@ throw( GLSLProgramException )
     }
   }
 
+  compileShader(loadSource(fileName), type, fileName);
+}
+
+
+string GLSLProgram::loadSource( const char * fileName )
+throw( GLSLProgramException )
+{
   ifstream inFile( fileName, ios::in );
   if( !inFile ) {
     string message = string("Unable to open: ") + fileName;
@@ -123,8 +130,7 @@ throw( GLSLProgramException )
   std::stringstream code;
   code << inFile.rdbuf();
   inFile.close();
-
-  compileShader(code.str(), type, fileName);
+  return code.str();
 }
 
 
@@ -142,7 +148,8 @@ throw(GLSLProgramException)
 
   GLuint shaderHandle = glCreateShader(type);
 
-  const char * c_code = source.c_str();
+  string code = insertPreamble(source);
+  const char * c_code = code.c_str();
   glShaderSource( shaderHandle, 1, &c_code, NULL );
 
   // Compile the shader
@@ -180,6 +187,38 @@ throw(GLSLProgramException)
 }
 
 
+void GLSLProgram::setPreamble( const string & text )
+{
+  preamble = text;
+}
+
+
+string GLSLProgram::insertPreamble( const string & source )
+{
+  if( preamble.empty() ) return source;
+
+  // The preamble has to follow #version, which must come before anything
+  // else but comments. Restore the line numbering (and source string 0, in
+  // case the preamble switched it with #line to number an inserted library)
+  // afterwards so compiler messages still point into the original file.
+  size_t versionPos = source.find("#version");
+  if( versionPos == string::npos ) return preamble + "\n#line 1 0\n" + source;
+
+  size_t lineEnd = source.find('\n', versionPos);
+  if( lineEnd == string::npos ) return source + "\n" + preamble;
+
+  int nextLine = 2;
+  for( size_t i = 0; i < lineEnd; i++ )
+    if( source[i] == '\n' ) nextLine++;
+
+  std::ostringstream result;
+  result << source.substr(0, lineEnd + 1) << preamble;
+  if( preamble[preamble.size() - 1] != '\n' ) result << "\n";
+  result << "#line " << nextLine << " 0\n" << source.substr(lineEnd + 1);
+  return result.str();
+}
+
+
 void GLSLProgram::link() throw(GLSLProgramException)
 {
   if( linked ) return;
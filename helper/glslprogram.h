@@ -45,11 +45,13 @@ class GLSLProgram
   private:
     int  handle;
     bool linked;
+    string preamble;
     std::map<string, int> uniformLocations;
 
     GLint  getUniformLocation(const char * name );
     bool fileExists( const string & fileName );
     string getExtension( const char * fileName );
+    string insertPreamble( const string & source );
 
     // Make these private in order to make the object non-copyable
     GLSLProgram( const GLSLProgram & other ) { }
@@ -59,6 +61,14 @@ class GLSLProgram
     GLSLProgram();
     ~GLSLProgram();
 
+    // Text inserted right after the #version line of every shader compiled
+    // from now on, e.g. "#define QUAD_PATCHES\n". This is how permutations
+    // of one set of shader files are built.
+    void   setPreamble( const string & text );
+
+    // Reads a whole shader (or shader library) source file.
+    static string loadSource( const char * fileName ) throw (GLSLProgramException);
+
     void   compileShader( const char *fileName ) throw (GLSLProgramException);
     void   compileShader( const char * fileName, GLSLShader::GLSLShaderType type ) throw (GLSLProgramException);
     void   compileShader( const string & source, GLSLShader::GLSLShaderType type, 
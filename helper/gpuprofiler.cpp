@@ -0,0 +1,202 @@
+#include "gpuprofiler.h"
+
+#include <cstdio>
+
+GpuProfiler::GpuProfiler() : currentFrame(0)
+{
+    countFragments = GLEW_ARB_pipeline_statistics_query != 0;
+    for( int i = 0; i < LATENCY; i++ ) {
+        frames[i].fragmentQuery = 0;
+        frames[i].pending = false;
+    }
+}
+
+GpuProfiler::~GpuProfiler()
+{
+    for( int i = 0; i < LATENCY; i++ ) {
+        for( size_t s = 0; s < frames[i].scopes.size(); s++ ) {
+            freeQueries.push_back(frames[i].scopes[s].startQuery);
+            freeQueries.push_back(frames[i].scopes[s].endQuery);
+        }
+        if( frames[i].fragmentQuery != 0 ) freeQueries.push_back(frames[i].fragmentQuery);
+    }
+    if( !freeQueries.empty() )
+        glDeleteQueries(GLsizei(freeQueries.size()), &freeQueries[0]);
+}
+
+GLuint GpuProfiler::allocQuery()
+{
+    if( freeQueries.empty() ) {
+        GLuint q;
+        glGenQueries(1, &q);
+        return q;
+    }
+    GLuint q = freeQueries.back();
+    freeQueries.pop_back();
+    return q;
+}
+
+void GpuProfiler::collect(Frame &frame)
+{
+    // Scope timings of one frame are summed by name, so a scope entered
+    // several times per frame gives one sample.
+    map<string, double> frameTotals;
+    for( size_t s = 0; s < frame.scopes.size(); s++ ) {
+        Scope &scope = frame.scopes[s];
+        if( scope.ended ) {
+            GLuint64 start = 0, end = 0;
+            glGetQueryObjectui64v(scope.startQuery, GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(scope.endQuery, GL_QUERY_RESULT, &end);
+            frameTotals[scope.name] += (end - start) * 1.0e-6;
+        }
+        freeQueries.push_back(scope.startQuery);
+        freeQueries.push_back(scope.endQuery);
+    }
+    for( map<string, double>::iterator it = frameTotals.begin(); it != frameTotals.end(); ++it )
+        stats[it->first].addSample(it->second);
+
+    if( frame.fragmentQuery != 0 ) {
+        GLuint64 fragments = 0;
+        glGetQueryObjectui64v(frame.fragmentQuery, GL_QUERY_RESULT, &fragments);
+        fragmentStats.addSample((double)fragments);
+        freeQueries.push_back(frame.fragmentQuery);
+        frame.fragmentQuery = 0;
+    }
+
+    frame.scopes.clear();
+    frame.pending = false;
+}
+
+void GpuProfiler::beginFrame()
+{
+    // The oldest frame in the ring is LATENCY - 1 frames old; its results
+    // are almost always ready by now.
+    Frame &frame = frames[currentFrame];
+    if( frame.pending ) collect(frame);
+    openScopes.clear();
+
+    if( countFragments ) {
+        frame.fragmentQuery = allocQuery();
+        glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, frame.fragmentQuery);
+    }
+}
+
+void GpuProfiler::beginScope(const char *name)
+{
+    Frame &frame = frames[currentFrame];
+    Scope scope;
+    scope.name = name;
+    scope.startQuery = allocQuery();
+    scope.endQuery = allocQuery();
+    scope.ended = false;
+    glQueryCounter(scope.startQuery, GL_TIMESTAMP);
+    openScopes.push_back(int(frame.scopes.size()));
+    frame.scopes.push_back(scope);
+}
+
+void GpuProfiler::endScope()
+{
+    if( openScopes.empty() ) {
+        fprintf(stderr, "Error: GpuProfiler::endScope() without beginScope().\n");
+        return;
+    }
+    Scope &scope = frames[currentFrame].scopes[openScopes.back()];
+    openScopes.pop_back();
+    glQueryCounter(scope.endQuery, GL_TIMESTAMP);
+    scope.ended = true;
+}
+
+void GpuProfiler::endFrame()
+{
+    while( !openScopes.empty() ) endScope();
+    if( frames[currentFrame].fragmentQuery != 0 ) glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+    frames[currentFrame].pending = true;
+    currentFrame = (currentFrame + 1) % LATENCY;
+}
+
+void GpuProfiler::flush()
+{
+    for( int i = 1; i <= LATENCY; i++ ) {
+        Frame &frame = frames[(currentFrame + i) % LATENCY];
+        if( frame.pending ) collect(frame);
+    }
+}
+
+void GpuProfiler::reset()
+{
+    flush();
+    stats.clear();
+    fragmentStats.clear();
+}
+
+const FrameStats *GpuProfiler::getStats(const char *name) const
+{
+    map<string, FrameStats>::const_iterator it = stats.find(name);
+    return (it == stats.end()) ? NULL : &it->second;
+}
+
+const FrameStats *GpuProfiler::getFragmentStats() const
+{
+    return countFragments ? &fragmentStats : NULL;
+}
+
+void GpuProfiler::print() const
+{
+    for( map<string, FrameStats>::const_iterator it = stats.begin(); it != stats.end(); ++it )
+        it->second.print(it->first.c_str());
+
+    if( countFragments && fragmentStats.count() > 0 ) {
+        printf("%-12s n=%-5d min %7.3f  avg %7.3f  p50 %7.3f  p95 %7.3f  max %7.3f M invocations\n",
+               "gpu frags", fragmentStats.count(), fragmentStats.minimum() * 1.0e-6,
+               fragmentStats.average() * 1.0e-6, fragmentStats.percentile(50.0) * 1.0e-6,
+               fragmentStats.percentile(95.0) * 1.0e-6, fragmentStats.maximum() * 1.0e-6);
+    }
+}
+
+
+GpuFrameTimer::GpuFrameTimer() : nextFrame(0)
+{
+    glGenQueries(LATENCY, queries);
+    for( int i = 0; i < LATENCY; i++ ) frameNumbers[i] = -1;
+}
+
+GpuFrameTimer::~GpuFrameTimer()
+{
+    glDeleteQueries(LATENCY, queries);
+}
+
+void GpuFrameTimer::begin()
+{
+    // Restarting a query discards a result that was never polled.
+    int slot = nextFrame % LATENCY;
+    frameNumbers[slot] = -1;
+    glBeginQuery(GL_TIME_ELAPSED, queries[slot]);
+}
+
+void GpuFrameTimer::end()
+{
+    glEndQuery(GL_TIME_ELAPSED);
+    frameNumbers[nextFrame % LATENCY] = nextFrame;
+    nextFrame++;
+}
+
+bool GpuFrameTimer::poll(double &ms, int &frame)
+{
+    // Finished queries of older frames than the newest are dropped.
+    int newest = -1;
+    for( int i = 0; i < LATENCY; i++ ) {
+        if( frameNumbers[i] < 0 ) continue;
+        GLint available = 0;
+        glGetQueryObjectiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if( available && (newest < 0 || frameNumbers[i] > frameNumbers[newest]) ) newest = i;
+    }
+    if( newest < 0 ) return false;
+
+    GLuint64 ns = 0;
+    glGetQueryObjectui64v(queries[newest], GL_QUERY_RESULT, &ns);
+    ms = ns * 1.0e-6;
+    frame = frameNumbers[newest];
+    for( int i = 0; i < LATENCY; i++ )
+        if( frameNumbers[i] >= 0 && frameNumbers[i] <= frame ) frameNumbers[i] = -1;
+    return true;
+}
@@ -0,0 +1,118 @@
+#ifndef GPUPROFILER_H
+#define GPUPROFILER_H
+
+#include "gldecl.h"
+#include "framestats.h"
+
+#include <map>
+#include <string>
+#include <vector>
+using std::map;
+using std::string;
+using std::vector;
+
+// GPU timing of named scopes within a frame, from GL_TIMESTAMP queries.
+// Where ARB_pipeline_statistics_query is available it also counts the
+// fragment shader invocations of whole frames. Results are read back
+// LATENCY frames later, so the CPU never waits for the GPU. Scopes may
+// nest. Needs a current OpenGL context.
+//
+//     profiler.beginFrame();
+//     profiler.beginScope("planes");  ...draw...  profiler.endScope();
+//     profiler.endFrame();
+class GpuProfiler
+{
+public:
+    static const int LATENCY = 4;
+
+    GpuProfiler();
+    ~GpuProfiler();
+
+    void beginFrame();
+    void beginScope(const char *name);
+    void endScope();
+    void endFrame();
+
+    // Blocks until every issued query is available and collects it.
+    void flush();
+
+    // Drops all collected timings.
+    void reset();
+
+    // Timings of one scope, one sample per frame. NULL if never seen.
+    const FrameStats *getStats(const char *name) const;
+
+    // Fragment shader invocations per frame. NULL if they are not counted.
+    const FrameStats *getFragmentStats() const;
+
+    // FrameStats::print() for every scope, in name order, then the
+    // fragment counts.
+    void print() const;
+
+private:
+    struct Scope
+    {
+        string name;
+        GLuint startQuery, endQuery;
+        bool ended;
+    };
+
+    struct Frame
+    {
+        vector<Scope> scopes;
+        GLuint fragmentQuery;       // 0 if fragments are not counted.
+        bool pending;
+    };
+
+    Frame frames[LATENCY];
+    int currentFrame;
+    vector<int> openScopes;         // Indices into the current frame's scopes.
+    vector<GLuint> freeQueries;
+    map<string, FrameStats> stats;
+    bool countFragments;
+    FrameStats fragmentStats;
+
+    GLuint allocQuery();
+    void collect(Frame &frame);
+
+    GpuProfiler(const GpuProfiler &);
+    GpuProfiler &operator=(const GpuProfiler &);
+};
+
+
+// GPU time of whole frames, for feedback within the frame loop: results are
+// polled without blocking and come back a frame or more late. Needs a
+// current OpenGL context.
+//
+//     timer.begin();  ...draw...  timer.end();
+//     if (timer.poll(ms, frame)) ...frame's time was ms...
+class GpuFrameTimer
+{
+public:
+    static const int LATENCY = GpuProfiler::LATENCY;
+
+    GpuFrameTimer();
+    ~GpuFrameTimer();
+
+    // Frames are numbered from 0 in the order they begin.
+    void begin();
+    void end();
+
+    // Number of the frame begun and not yet ended, or else of the next.
+    int getCurrentFrame() const { return nextFrame; }
+
+    // The GPU time and number of the newest finished frame not returned
+    // before. False if none has finished. Frames are dropped if more than
+    // LATENCY are in flight.
+    bool poll(double &ms, int &frame);
+
+private:
+    GLuint queries[LATENCY];
+    int frameNumbers[LATENCY];   // -1 if the query holds no frame.
+    int nextFrame;
+
+    GpuFrameTimer(const GpuFrameTimer &);
+    GpuFrameTimer &operator=(const GpuFrameTimer &);
+};
+
+#endif // GPUPROFILER_H
@@ -0,0 +1,120 @@
+#include "heightpyramid.h"
+#include "parallel.h"
+
+#include <cmath>
+#include <algorithm>
+#include <utility>
+
+static bool isPowerOfTwo(int n)
+{
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
+
+void HeightPyramid::build(const Displacement::HeightMap &map, bool useThreads)
+{
+    mapWidth = map.getWidth();
+    mapHeight = map.getHeight();
+    levels.clear();
+    if( map.empty() ) return;
+
+    const float *texels = map.getTexels();
+    const int w = mapWidth, h = mapHeight;
+    const int minRowsPerTask = useThreads ? 16 : h;
+
+    if( !isPowerOfTwo(w) || !isPowerOfTwo(h) ) {
+        // Only the bounds of the whole map.
+        Level top;
+        top.width = 1;
+        top.height = 1;
+        top.minMax.resize(2);
+        top.minMax[0] = *std::min_element(texels, texels + (size_t)w * h);
+        top.minMax[1] = *std::max_element(texels, texels + (size_t)w * h);
+        levels.push_back(top);
+        return;
+    }
+
+    Level base;
+    base.width = w;
+    base.height = h;
+    base.minMax.resize(2 * (size_t)w * h);
+    Parallel::parallelFor(0, h, minRowsPerTask, [&](int rowBegin, int rowEnd) {
+        for( int y = rowBegin; y < rowEnd; y++ ) {
+            const float *row0 = texels + (size_t)y * w;
+            const float *row1 = texels + (size_t)((y + 1) % h) * w;
+            float *out = &base.minMax[2 * (size_t)y * w];
+            for( int x = 0; x < w; x++ ) {
+                int x1 = (x + 1) % w;
+                float a = row0[x], b = row0[x1], c = row1[x], d = row1[x1];
+                out[2 * x] = std::min(std::min(a, b), std::min(c, d));
+                out[2 * x + 1] = std::max(std::max(a, b), std::max(c, d));
+            }
+        }
+    });
+
+    levels.push_back(std::move(base));
+    while( levels.back().width > 1 || levels.back().height > 1 ) {
+        const Level &child = levels.back();
+        Level parent;
+        parent.width = std::max(1, child.width / 2);
+        parent.height = std::max(1, child.height / 2);
+        parent.minMax.resize(2 * (size_t)parent.width * parent.height);
+
+        // A dimension that is already 1 maps cell 0 onto cell 0.
+        const int stepX = (child.width > 1) ? 2 : 1;
+        const int stepY = (child.height > 1) ? 2 : 1;
+        Parallel::parallelFor(0, parent.height, useThreads ? std::max(1, 4096 / parent.width) : parent.height,
+                              [&](int rowBegin, int rowEnd) {
+            for( int y = rowBegin; y < rowEnd; y++ ) {
+                const float *row0 = &child.minMax[2 * (size_t)(stepY * y) * child.width];
+                const float *row1 = &child.minMax[2 * (size_t)(stepY * y + stepY - 1) * child.width];
+                float *out = &parent.minMax[2 * (size_t)y * parent.width];
+                for( int x = 0; x < parent.width; x++ ) {
+                    int x0 = stepX * x, x1 = stepX * x + stepX - 1;
+                    out[2 * x] = std::min(std::min(row0[2 * x0], row0[2 * x1]),
+                                          std::min(row1[2 * x0], row1[2 * x1]));
+                    out[2 * x + 1] = std::max(std::max(row0[2 * x0 + 1], row0[2 * x1 + 1]),
+                                              std::max(row1[2 * x0 + 1], row1[2 * x1 + 1]));
+                }
+            }
+        });
+        levels.push_back(std::move(parent));
+    }
+}
+
+
+void HeightPyramid::getBounds(glm::vec2 lo, glm::vec2 hi, float &minHeight, float &maxHeight) const
+{
+    minHeight = 0.0f;
+    maxHeight = 1.0f;
+    if( levels.empty() ) return;
+
+    // Level-0 cell c lies between texel centres c and c + 1.
+    glm::vec2 mapSize((float)mapWidth, (float)mapHeight);
+    glm::vec2 a = lo * mapSize - glm::vec2(0.5f);
+    glm::vec2 b = hi * mapSize - glm::vec2(0.5f);
+
+    int numLevels = (int)levels.size();
+    for( int level = 0; level < numLevels; level++ ) {
+        const Level &l = levels[level];
+        glm::ivec2 size(l.width, l.height);
+        glm::vec2 scale = glm::vec2(size) / mapSize;
+        glm::ivec2 first = glm::ivec2(glm::floor(a * scale));
+        glm::ivec2 span = glm::ivec2(glm::floor(b * scale)) - first;
+        bool fits = (span.x <= 1 || size.x <= 2) && (span.y <= 1 || size.y <= 2);
+        if( !fits && level < numLevels - 1 ) continue;
+
+        minHeight = 1.0f;
+        maxHeight = 0.0f;
+        for( int j = 0; j <= std::min(span.y, 1); j++ ) {
+            for( int i = 0; i <= std::min(span.x, 1); i++ ) {
+                glm::ivec2 c = first + glm::ivec2(i, j);
+                c -= size * glm::ivec2(glm::floor(glm::vec2(c) / glm::vec2(size)));
+                const float *cell = &l.minMax[2 * ((size_t)c.y * l.width + c.x)];
+                minHeight = std::min(minHeight, cell[0]);
+                maxHeight = std::max(maxHeight, cell[1]);
+            }
+        }
+        return;
+    }
+}
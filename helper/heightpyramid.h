@@ -0,0 +1,51 @@
+#ifndef HEIGHTPYRAMID_H
+#define HEIGHTPYRAMID_H
+
+#include <vector>
+using std::vector;
+
+#include <glm/glm.hpp>
+
+#include "displacement.h"
+
+// Min/max mip pyramid of a height map, for bounding the displacement of a
+// whole patch with a few texel fetches. Level 0 has one cell per bilinear
+// footprint: cell (i, j) holds the min and max of texels (i, j) to
+// (i + 1, j + 1), wrapping, so it bounds every filtered sample taken
+// between those texel centres. Each further level halves the size like an
+// OpenGL mip chain, so the pyramid uploads as an RG32F mipmapped texture.
+// Maps whose sizes are not powers of two get a single 1x1 level holding
+// the bounds of the whole map.
+class HeightPyramid
+{
+public:
+    HeightPyramid() : mapWidth(0), mapHeight(0) { }
+
+    // Rebuilds the pyramid from a height map, one row of cells per task.
+    void build(const Displacement::HeightMap &map, bool useThreads = true);
+
+    int getNumLevels() const { return (int)levels.size(); }
+    int getLevelWidth(int level) const { return levels[level].width; }
+    int getLevelHeight(int level) const { return levels[level].height; }
+
+    // Interleaved (min, max) pairs of a level, row by row.
+    const float *getLevelData(int level) const { return &levels[level].minMax[0]; }
+
+    // Bounds of the map's bilinear samples over the box [lo, hi] in
+    // texture coordinates, repeating. The same lookup as
+    // heightPyramidBounds() in Displacement.glsl: at most 2x2 cells of the
+    // finest level whose cells are large enough.
+    void getBounds(glm::vec2 lo, glm::vec2 hi, float &minHeight, float &maxHeight) const;
+
+private:
+    struct Level
+    {
+        int width, height;
+        vector<float> minMax;
+    };
+
+    int mapWidth, mapHeight;
+    vector<Level> levels;
+};
+
+#endif // HEIGHTPYRAMID_H
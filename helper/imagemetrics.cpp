@@ -0,0 +1,81 @@
+#include "imagemetrics.h"
+
+#include <cmath>
+#include <vector>
+using std::vector;
+
+namespace ImageMetrics {
+
+double meanSquaredError(const unsigned char *a, const unsigned char *b,
+                        int width, int height, int channels)
+{
+    size_t n = (size_t)width * height * channels;
+    if( n == 0 ) return 0.0;
+    double sum = 0.0;
+    for( size_t i = 0; i < n; i++ ) {
+        double d = (double)a[i] - (double)b[i];
+        sum += d * d;
+    }
+    return sum / n;
+}
+
+
+double psnr(const unsigned char *a, const unsigned char *b,
+            int width, int height, int channels)
+{
+    double mse = meanSquaredError(a, b, width, height, channels);
+    if( mse <= 0.0 ) return MAX_PSNR;
+    double p = 10.0 * log10(255.0 * 255.0 / mse);
+    return (p < MAX_PSNR) ? p : MAX_PSNR;
+}
+
+
+// Rec. 601 luma of every pixel. Single-channel images are used as is.
+static void luma(const unsigned char *img, int width, int height, int channels, vector<double> &out)
+{
+    out.resize((size_t)width * height);
+    for( size_t i = 0; i < out.size(); i++ ) {
+        const unsigned char *p = img + i * channels;
+        out[i] = (channels >= 3) ? 0.299 * p[0] + 0.587 * p[1] + 0.114 * p[2] : p[0];
+    }
+}
+
+
+double ssim(const unsigned char *a, const unsigned char *b,
+            int width, int height, int channels)
+{
+    const int WINDOW = 8;
+    const double C1 = (0.01 * 255.0) * (0.01 * 255.0);
+    const double C2 = (0.03 * 255.0) * (0.03 * 255.0);
+
+    vector<double> ya, yb;
+    luma(a, width, height, channels, ya);
+    luma(b, width, height, channels, yb);
+
+    double total = 0.0;
+    int windows = 0;
+    for( int y0 = 0; y0 + WINDOW <= height; y0 += WINDOW ) {
+        for( int x0 = 0; x0 + WINDOW <= width; x0 += WINDOW ) {
+            double sa = 0.0, sb = 0.0, saa = 0.0, sbb = 0.0, sab = 0.0;
+            for( int y = y0; y < y0 + WINDOW; y++ ) {
+                for( int x = x0; x < x0 + WINDOW; x++ ) {
+                    double va = ya[(size_t)y * width + x];
+                    double vb = yb[(size_t)y * width + x];
+                    sa += va; sb += vb;
+                    saa += va * va; sbb += vb * vb; sab += va * vb;
+                }
+            }
+            const double n = WINDOW * WINDOW;
+            double ma = sa / n, mb = sb / n;
+            double va = saa / n - ma * ma;
+            double vb = sbb / n - mb * mb;
+            double cov = sab / n - ma * mb;
+            total += ((2.0 * ma * mb + C1) * (2.0 * cov + C2)) /
+                     ((ma * ma + mb * mb + C1) * (va + vb + C2));
+            windows++;
+        }
+    }
+    return (windows > 0) ? total / windows : 1.0;
+}
+
+} // namespace ImageMetrics
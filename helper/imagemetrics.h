@@ -0,0 +1,23 @@
+#ifndef IMAGEMETRICS_H
+#define IMAGEMETRICS_H
+
+// Full-reference image quality metrics for 8-bit images of equal size,
+// with channels interleaved per pixel (e.g. RGBA as read by glReadPixels).
+namespace ImageMetrics
+{
+    // Mean squared error over all channels, in 8-bit units squared.
+    double meanSquaredError(const unsigned char *a, const unsigned char *b,
+                            int width, int height, int channels);
+
+    // Peak signal-to-noise ratio in dB. Identical images give MAX_PSNR.
+    const double MAX_PSNR = 100.0;
+    double psnr(const unsigned char *a, const unsigned char *b,
+                int width, int height, int channels);
+
+    // Mean structural similarity (Wang et al. 2004) of the luma, over
+    // non-overlapping 8x8 windows. 1.0 means identical.
+    double ssim(const unsigned char *a, const unsigned char *b,
+                int width, int height, int channels);
+}
+
+#endif // IMAGEMETRICS_H
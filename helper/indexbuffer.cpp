@@ -0,0 +1,70 @@
+#include "indexbuffer.h"
+#include "mappedbuffer.h"
+
+#include <cstring>
+
+namespace IndexBuffer {
+
+static bool allowByteIndices = false;
+
+
+void setAllowByteIndices(bool allow) {
+    allowByteIndices = allow;
+}
+
+
+GLenum selectType(GLuint numVertices) {
+    if( allowByteIndices && numVertices <= 0x100 ) return GL_UNSIGNED_BYTE;
+    if( numVertices <= 0x10000 ) return GL_UNSIGNED_SHORT;
+    return GL_UNSIGNED_INT;
+}
+
+
+GLsizeiptr typeSize(GLenum type) {
+    switch( type ) {
+    case GL_UNSIGNED_BYTE:
+        return sizeof(GLubyte);
+    case GL_UNSIGNED_SHORT:
+        return sizeof(GLushort);
+    default:
+        return sizeof(GLuint);
+    }
+}
+
+
+template <typename T>
+static void writeAs(T *dst, const GLuint *indices, GLsizei count)
+{
+    for( GLsizei i = 0; i < count; i++ ) dst[i] = (T)indices[i];
+}
+
+
+void write(void *dst, GLenum type, const GLuint *indices, GLsizei count) {
+    if( type == GL_UNSIGNED_BYTE )
+        writeAs(static_cast<GLubyte *>(dst), indices, count);
+    else if( type == GL_UNSIGNED_SHORT )
+        writeAs(static_cast<GLushort *>(dst), indices, count);
+    else if( count > 0 )
+        memcpy(dst, indices, count * sizeof(GLuint));
+}
+
+
+GLenum upload(GLuint bufferHandle, const GLuint *indices, GLsizei count,
+              GLuint numVertices, GLenum usage)
+{
+    GLenum type = selectType(numVertices);
+
+    if( type == GL_UNSIGNED_INT ) {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferHandle);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * sizeof(GLuint), indices, usage);
+    }
+    else {
+        MappedBuffer buffer(GL_ELEMENT_ARRAY_BUFFER, bufferHandle, count * typeSize(type), usage);
+        write(buffer.getData(), type, indices, count);
+        buffer.unmap();
+    }
+
+    return type;
+}
+
+} // namespace IndexBuffer
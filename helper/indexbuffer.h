@@ -0,0 +1,35 @@
+#ifndef INDEXBUFFER_H
+#define INDEXBUFFER_H
+
+#include "gldecl.h"
+
+// Shared element-buffer builder for the Drawables. Generators produce
+// 32-bit indices; upload() stores them in the narrowest type that can
+// address the mesh's vertices and returns that type for glDrawElements.
+namespace IndexBuffer
+{
+    // GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, whichever is
+    // the smallest that can index numVertices vertices.
+    GLenum selectType(GLuint numVertices);
+
+    // Size in bytes of one index of the given type.
+    GLsizeiptr typeSize(GLenum type);
+
+    // 8-bit indices are not natively supported by some GPUs, whose
+    // drivers then convert the buffer behind our back. They are off by
+    // default, so meshes of up to 256 vertices also get 16-bit indices.
+    void setAllowByteIndices(bool allow);
+
+    // Writes count indices converted to type to dst, in order, so dst may
+    // be mapped buffer memory.
+    void write(void *dst, GLenum type, const GLuint *indices, GLsizei count);
+
+    // Binds bufferHandle to GL_ELEMENT_ARRAY_BUFFER (so it is recorded in
+    // the currently bound VAO, if any), uploads count indices converted to
+    // selectType(numVertices), and returns that type. Converted indices are
+    // written straight into the mapped buffer.
+    GLenum upload(GLuint bufferHandle, const GLuint *indices, GLsizei count,
+                  GLuint numVertices, GLenum usage = GL_STATIC_DRAW);
+}
+
+#endif // INDEXBUFFER_H
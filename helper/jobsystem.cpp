@@ -0,0 +1,329 @@
+#include "jobsystem.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace {
+
+// The system whose worker the calling thread is, if any, and its index.
+thread_local const JobSystem *currentSystem = NULL;
+thread_local int currentIndex = -1;
+
+// Picks the first victim of a steal.
+thread_local unsigned int stealSeed = 1;
+
+// Rounds of failed searches for a job before a worker goes to sleep.
+const int IDLE_SPINS = 64;
+
+} // namespace
+
+
+struct JobSystem::Job
+{
+    Job(const std::function<void ()> &fn, Counter *counter) : fn(fn), counter(counter) {}
+
+    std::function<void ()> fn;
+    Counter *counter;
+};
+
+
+// A worker thread and its deque: a ring of job pointers between top and
+// bottom. The owner pushes and pops at the bottom without locking; thieves
+// take from the top with a compare-and-swap, which also settles a race
+// for the last job with the owner. After Le et al., "Correct and Efficient
+// Work-Stealing for Weak Memory Models".
+class JobSystem::Worker
+{
+public:
+    Worker() : top(0), bottom(0)
+    {
+        for( int i = 0; i < CAPACITY; i++ ) slots[i].store(NULL, std::memory_order_relaxed);
+    }
+
+    std::thread thread;
+
+    // Owner only. False if the deque is full.
+    bool push(Job *job)
+    {
+        long long b = bottom.load(std::memory_order_relaxed);
+        long long t = top.load(std::memory_order_acquire);
+        if( b - t >= CAPACITY ) return false;
+        slots[b & (CAPACITY - 1)].store(job, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Owner only. The newest job, or NULL.
+    Job *pop()
+    {
+        long long b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long long t = top.load(std::memory_order_relaxed);
+        if( t > b ) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return NULL;
+        }
+        Job *job = slots[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+        if( t == b ) {
+            // The last job: thieves may be after it too.
+            if( !top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed) )
+                job = NULL;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    // Any thread. The oldest job, or NULL if there is none or another
+    // thread took it first.
+    Job *steal()
+    {
+        long long t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long long b = bottom.load(std::memory_order_acquire);
+        if( t >= b ) return NULL;
+        Job *job = slots[t & (CAPACITY - 1)].load(std::memory_order_acquire);
+        if( !top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed) )
+            return NULL;
+        return job;
+    }
+
+    bool isEmpty() const
+    {
+        return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+    }
+
+private:
+    static const int CAPACITY = 4096;   // A power of two.
+
+    // Thieves write top and the owner bottom; each on a cache line of its own.
+    std::atomic<long long> top;
+    char topPadding[64];
+    std::atomic<long long> bottom;
+    char bottomPadding[64];
+    std::atomic<Job *> slots[CAPACITY];
+};
+
+
+JobSystem::JobSystem(int numThreads) : numSharedJobs(0), numSleeping(0), stopping(false)
+{
+    for( int i = 1; i < numThreads; i++ ) workers.push_back(new Worker());
+    for( size_t i = 0; i < workers.size(); i++ )
+        workers[i]->thread = std::thread(&JobSystem::workerMain, this, int(i));
+}
+
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping.store(true);
+        wakeCondition.notify_all();
+    }
+    // Workers steal from each other's deques until they stop, so no deque
+    // goes before all of them have.
+    for( size_t i = 0; i < workers.size(); i++ ) workers[i]->thread.join();
+    for( size_t i = 0; i < workers.size(); i++ ) delete workers[i];
+}
+
+
+void JobSystem::run(const std::function<void ()> &fn, Counter *counter)
+{
+    if( counter != NULL ) counter->count.fetch_add(1, std::memory_order_relaxed);
+    push(new Job(fn, counter));
+}
+
+
+void JobSystem::runAfter(Counter &dependency, const std::function<void ()> &fn, Counter *counter)
+{
+    if( counter != NULL ) counter->count.fetch_add(1, std::memory_order_relaxed);
+    Job *job = new Job(fn, counter);
+    {
+        std::lock_guard<std::mutex> lock(dependency.mutex);
+        if( dependency.count.load(std::memory_order_acquire) != 0 ) {
+            dependency.continuations.push_back(job);
+            return;
+        }
+    }
+    push(job);
+}
+
+
+void JobSystem::wait(Counter &counter)
+{
+    int self = currentWorker();
+    while( !counter.isDone() ) {
+        Job *job = findJob(self);
+        if( job != NULL ) execute(job);
+        else std::this_thread::yield();
+    }
+
+    // The thread that brought the count to zero may still hold the mutex;
+    // let it go before the caller may destroy the counter.
+    std::lock_guard<std::mutex> lock(counter.mutex);
+}
+
+
+void JobSystem::parallelFor(int first, int last, int minChunk,
+                            const std::function<void (int, int)> &body)
+{
+    int count = last - first;
+    if( count <= 0 ) return;
+    if( minChunk < 1 ) minChunk = 1;
+
+    // About four chunks per thread, so threads that finish early find some
+    // left to steal when chunks take unequal times.
+    int grain = std::max(minChunk, count / (4 * getNumThreads()));
+    if( workers.empty() || count < 2 * grain ) {
+        body(first, last);
+        return;
+    }
+
+    Counter counter;
+    splitRange(first, last, grain, body, counter);
+    wait(counter);
+}
+
+
+void JobSystem::splitRange(int begin, int end, int grain, const std::function<void (int, int)> &body,
+                           Counter &counter)
+{
+    // Queue the upper half and carry on with the lower one, so the chunks
+    // are between grain and 2 * grain items.
+    while( end - begin >= 2 * grain ) {
+        int mid = begin + (end - begin) / 2;
+        int upperEnd = end;
+        run([this, mid, upperEnd, grain, &body, &counter]() {
+            splitRange(mid, upperEnd, grain, body, counter);
+        }, &counter);
+        end = mid;
+    }
+    body(begin, end);
+}
+
+
+void JobSystem::push(Job *job)
+{
+    int self = currentWorker();
+    if( self >= 0 ) {
+        // A full deque is a lot of jobs queued already; run this one now.
+        if( !workers[self]->push(job) ) {
+            execute(job);
+            return;
+        }
+    }
+    else {
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        sharedJobs.push_back(job);
+        numSharedJobs.fetch_add(1);
+    }
+
+    // Pairs with the fence in workerMain(): either the worker going to
+    // sleep sees the job, or this sees it sleeping.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if( numSleeping.load(std::memory_order_relaxed) > 0 ) {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wakeCondition.notify_one();
+    }
+}
+
+
+JobSystem::Job *JobSystem::findJob(int self)
+{
+    if( self >= 0 ) {
+        Job *job = workers[self]->pop();
+        if( job != NULL ) return job;
+    }
+
+    if( numSharedJobs.load(std::memory_order_relaxed) > 0 ) {
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        if( !sharedJobs.empty() ) {
+            Job *job = sharedJobs.front();
+            sharedJobs.pop_front();
+            numSharedJobs.fetch_sub(1);
+            return job;
+        }
+    }
+
+    int n = int(workers.size());
+    if( n == 0 ) return NULL;
+    stealSeed = stealSeed * 1664525u + 1013904223u;
+    int start = int((stealSeed >> 16) % unsigned(n));
+    for( int i = 0; i < n; i++ ) {
+        int victim = (start + i) % n;
+        if( victim == self ) continue;
+        Job *job = workers[victim]->steal();
+        if( job != NULL ) return job;
+    }
+    return NULL;
+}
+
+
+bool JobSystem::hasQueuedJobs() const
+{
+    if( numSharedJobs.load(std::memory_order_relaxed) > 0 ) return true;
+    for( size_t i = 0; i < workers.size(); i++ )
+        if( !workers[i]->isEmpty() ) return true;
+    return false;
+}
+
+
+void JobSystem::execute(Job *job)
+{
+    job->fn();
+    Counter *counter = job->counter;
+    delete job;
+    if( counter != NULL ) finish(*counter);
+}
+
+
+void JobSystem::finish(Counter &counter)
+{
+    std::vector<Job *> ready;
+    {
+        std::lock_guard<std::mutex> lock(counter.mutex);
+        if( counter.count.fetch_sub(1, std::memory_order_acq_rel) == 1 )
+            ready.swap(counter.continuations);
+    }
+    // The counter may be gone from here on.
+    for( size_t i = 0; i < ready.size(); i++ ) push(ready[i]);
+}
+
+
+void JobSystem::workerMain(int index)
+{
+    currentSystem = this;
+    currentIndex = index;
+    stealSeed = 2654435761u * unsigned(index + 1);
+
+    int idleRounds = 0;
+    while( !stopping.load(std::memory_order_relaxed) ) {
+        Job *job = findJob(index);
+        if( job != NULL ) {
+            execute(job);
+            idleRounds = 0;
+            continue;
+        }
+        if( ++idleRounds < IDLE_SPINS ) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        numSleeping.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if( !stopping.load() && !hasQueuedJobs() ) wakeCondition.wait(lock);
+        numSleeping.fetch_sub(1);
+        idleRounds = 0;
+    }
+
+    currentSystem = NULL;
+    currentIndex = -1;
+}
+
+
+int JobSystem::currentWorker() const
+{
+    return (currentSystem == this) ? currentIndex : -1;
+}
@@ -0,0 +1,101 @@
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// A pool of worker threads that run jobs: small functions queued with
+// run(). Each worker has a work-stealing deque (Chase-Lev): it pushes and
+// pops jobs at the bottom of its own, and idle workers steal from the top
+// of the others'. Jobs queued by threads that are not workers, such as the
+// main thread, go through a shared queue instead.
+//
+// A Counter counts unfinished jobs. wait() runs queued jobs on the calling
+// thread until the counter reaches zero, so a thread waiting for work it
+// queued helps with it, and jobs may wait on jobs of their own. runAfter()
+// holds a job back until a counter reaches zero, for chains of dependent
+// work.
+//
+// Every job must have been waited for before the system is destroyed.
+class JobSystem
+{
+private:
+    struct Job;
+    class Worker;
+
+public:
+    class Counter
+    {
+    public:
+        Counter() : count(0) {}
+
+        bool isDone() const { return count.load(std::memory_order_acquire) == 0; }
+
+    private:
+        friend class JobSystem;
+
+        std::atomic<int> count;
+        std::mutex mutex;                 // Guards the decrement to zero and continuations.
+        std::vector<Job *> continuations; // Jobs of runAfter() waiting for zero.
+
+        Counter(const Counter &);
+        Counter &operator=(const Counter &);
+    };
+
+    // numThreads counts the thread calling wait() too, so numThreads - 1
+    // workers are started.
+    explicit JobSystem(int numThreads);
+    ~JobSystem();
+
+    int getNumThreads() const { return int(workers.size()) + 1; }
+
+    // Queues fn. If counter is not NULL, it counts the job until fn returns.
+    void run(const std::function<void ()> &fn, Counter *counter = NULL);
+
+    // Queues fn once dependency has reached zero; at once if it has. Jobs
+    // counted by dependency after it reaches zero do not hold fn back.
+    void runAfter(Counter &dependency, const std::function<void ()> &fn, Counter *counter = NULL);
+
+    // Runs queued jobs on the calling thread until counter is zero.
+    void wait(Counter &counter);
+
+    // Splits [first, last) into contiguous chunks of at least minChunk items
+    // and calls body(chunkBegin, chunkEnd) on each chunk as a job. Ranges
+    // are halved recursively, so idle workers steal large halves rather than
+    // many small chunks. Returns when all chunks are done.
+    void parallelFor(int first, int last, int minChunk,
+                     const std::function<void (int, int)> &body);
+
+private:
+    std::vector<Worker *> workers;
+
+    // Jobs queued by threads that are not workers of this system.
+    std::mutex sharedMutex;
+    std::deque<Job *> sharedJobs;
+    std::atomic<int> numSharedJobs;
+
+    // Idle workers sleep on wakeCondition.
+    std::mutex sleepMutex;
+    std::condition_variable wakeCondition;
+    std::atomic<int> numSleeping;
+    std::atomic<bool> stopping;
+
+    void push(Job *job);
+    Job *findJob(int self);
+    bool hasQueuedJobs() const;
+    void execute(Job *job);
+    void finish(Counter &counter);
+    void workerMain(int index);
+    void splitRange(int begin, int end, int grain, const std::function<void (int, int)> &body,
+                    Counter &counter);
+    int currentWorker() const;
+
+    JobSystem(const JobSystem &);
+    JobSystem &operator=(const JobSystem &);
+};
+
+#endif // JOBSYSTEM_H
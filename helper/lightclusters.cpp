@@ -0,0 +1,215 @@
+#include "lightclusters.h"
+#include "parallel.h"
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LIGHTCLUSTERS_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace LightClusters {
+
+namespace {
+
+float sliceDepth(const Grid &grid, int slice)
+{
+    return grid.nearZ * powf(grid.farZ / grid.nearZ, (float)slice / grid.slices);
+}
+
+
+// Eye-space extent along x or y of tile i of n, between eye distances d0
+// and d1. The tile's edges are lines through the eye, so the extremes are
+// at one end or the other.
+void tileExtent(int i, int n, float projScale, float d0, float d1, float &lo, float &hi)
+{
+    float ndc0 = -1.0f + 2.0f * i / n;
+    float ndc1 = -1.0f + 2.0f * (i + 1) / n;
+    lo = std::min(ndc0 * d0, ndc0 * d1) / projScale;
+    hi = std::max(ndc1 * d0, ndc1 * d1) / projScale;
+}
+
+
+// Distance from p to [lo, hi].
+inline float axisDistance(float p, float lo, float hi)
+{
+    return std::max(lo - p, 0.0f) + std::max(p - hi, 0.0f);
+}
+
+
+// Lights of one slice, as (tile, light) pairs in increasing light order,
+// with the list lengths counted into the slice's cells. Distances are
+// summed as ((dx^2 + dy^2) + dz^2) in both paths and in buildBruteForce(),
+// so all three agree exactly at the sphere's edge.
+void binSlice(const Grid &grid, const vector<PointLight> &lights, int slice, bool useSimd,
+              vector<unsigned int> &pairs, unsigned int *cells)
+{
+    const int tilesX = grid.tilesX, tilesY = grid.tilesY;
+    const int paddedX = (tilesX + 3) & ~3;
+    const float d0 = sliceDepth(grid, slice), d1 = sliceDepth(grid, slice + 1);
+
+    vector<float> colLo(paddedX, 0.0f), colHi(paddedX, 0.0f), dx2(paddedX);
+    vector<float> rowLo(tilesY), rowHi(tilesY);
+    for( int x = 0; x < tilesX; x++ )
+        tileExtent(x, tilesX, grid.projScaleX, d0, d1, colLo[x], colHi[x]);
+    for( int y = 0; y < tilesY; y++ )
+        tileExtent(y, tilesY, grid.projScaleY, d0, d1, rowLo[y], rowHi[y]);
+
+    pairs.clear();
+    for( size_t l = 0; l < lights.size(); l++ ) {
+        const PointLight &light = lights[l];
+        const float r2 = light.radius * light.radius;
+        float dz = axisDistance(light.position.z, -d1, -d0);
+        float dz2 = dz * dz;
+        if( dz2 > r2 ) continue;
+
+#ifdef LIGHTCLUSTERS_USE_SSE2
+        if( useSimd ) {
+            const __m128 px = _mm_set1_ps(light.position.x);
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 dz2v = _mm_set1_ps(dz2);
+            const __m128 r2v = _mm_set1_ps(r2);
+            for( int y = 0; y < tilesY; y++ ) {
+                float dy = axisDistance(light.position.y, rowLo[y], rowHi[y]);
+                float dy2 = dy * dy;
+                if( dy2 + dz2 > r2 ) continue;
+                const __m128 dy2v = _mm_set1_ps(dy2);
+                for( int x = 0; x < paddedX; x += 4 ) {
+                    __m128 dx = _mm_add_ps( _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&colLo[x]), px), zero),
+                                            _mm_max_ps(_mm_sub_ps(px, _mm_loadu_ps(&colHi[x])), zero) );
+                    __m128 d2 = _mm_add_ps( _mm_add_ps(_mm_mul_ps(dx, dx), dy2v), dz2v );
+                    int mask = _mm_movemask_ps( _mm_cmple_ps(d2, r2v) );
+                    if( x + 4 > tilesX ) mask &= (1 << (tilesX - x)) - 1;
+                    while( mask != 0 ) {
+                        int k = 0;
+                        while( !(mask & (1 << k)) ) k++;
+                        mask &= ~(1 << k);
+                        unsigned int tile = (unsigned int)(y * tilesX + x + k);
+                        pairs.push_back(tile);
+                        pairs.push_back((unsigned int)l);
+                        cells[2 * tile + 1]++;
+                    }
+                }
+            }
+            continue;
+        }
+#endif
+        for( int x = 0; x < tilesX; x++ ) {
+            float dx = axisDistance(light.position.x, colLo[x], colHi[x]);
+            dx2[x] = dx * dx;
+        }
+        for( int y = 0; y < tilesY; y++ ) {
+            float dy = axisDistance(light.position.y, rowLo[y], rowHi[y]);
+            float dy2 = dy * dy;
+            if( dy2 + dz2 > r2 ) continue;
+            for( int x = 0; x < tilesX; x++ ) {
+                if( (dx2[x] + dy2) + dz2 > r2 ) continue;
+                unsigned int tile = (unsigned int)(y * tilesX + x);
+                pairs.push_back(tile);
+                pairs.push_back((unsigned int)l);
+                cells[2 * tile + 1]++;
+            }
+        }
+    }
+}
+
+} // namespace
+
+
+int clusterOf(const Grid &grid, const glm::vec3 &p)
+{
+    float depth = -p.z;
+    if( !(depth >= grid.nearZ && depth < grid.farZ) ) return -1;
+
+    float ndcX = p.x * grid.projScaleX / depth;
+    float ndcY = p.y * grid.projScaleY / depth;
+    int x = (int)floorf(0.5f * (ndcX + 1.0f) * grid.tilesX);
+    int y = (int)floorf(0.5f * (ndcY + 1.0f) * grid.tilesY);
+    if( x < 0 || x >= grid.tilesX || y < 0 || y >= grid.tilesY ) return -1;
+
+    int slice = (int)floorf(logf(depth / grid.nearZ) / logf(grid.farZ / grid.nearZ) * grid.slices);
+    slice = std::min(std::max(slice, 0), grid.slices - 1);
+    return (slice * grid.tilesY + y) * grid.tilesX + x;
+}
+
+
+void clusterBounds(const Grid &grid, int x, int y, int slice, glm::vec3 &lo, glm::vec3 &hi)
+{
+    float d0 = sliceDepth(grid, slice), d1 = sliceDepth(grid, slice + 1);
+    tileExtent(x, grid.tilesX, grid.projScaleX, d0, d1, lo.x, hi.x);
+    tileExtent(y, grid.tilesY, grid.projScaleY, d0, d1, lo.y, hi.y);
+    lo.z = -d1;
+    hi.z = -d0;
+}
+
+
+void build(const Grid &grid, const vector<PointLight> &lights, Clusters &clusters,
+           bool useSimd, bool useThreads)
+{
+    const int tilesPerSlice = grid.tilesX * grid.tilesY;
+    clusters.cells.assign(2 * (size_t)numClusters(grid), 0);
+    clusters.lightIndices.clear();
+    if( numClusters(grid) <= 0 ) return;
+
+    // Each slice owns its cells, so the tasks write to disjoint memory.
+    vector<vector<unsigned int> > pairs(grid.slices);
+    Parallel::parallelFor(0, grid.slices, useThreads ? 1 : grid.slices, [&](int first, int last) {
+        for( int s = first; s < last; s++ )
+            binSlice(grid, lights, s, useSimd, pairs[s], &clusters.cells[2 * (size_t)s * tilesPerSlice]);
+    });
+
+    vector<size_t> sliceOffsets(grid.slices);
+    size_t total = 0;
+    for( int s = 0; s < grid.slices; s++ ) {
+        sliceOffsets[s] = total;
+        total += pairs[s].size() / 2;
+    }
+    clusters.lightIndices.resize(total);
+
+    // Counting sort of each slice's pairs by tile. It keeps the light order.
+    Parallel::parallelFor(0, grid.slices, useThreads ? 1 : grid.slices, [&](int first, int last) {
+        vector<unsigned int> cursor(tilesPerSlice);
+        for( int s = first; s < last; s++ ) {
+            unsigned int *cells = &clusters.cells[2 * (size_t)s * tilesPerSlice];
+            unsigned int offset = (unsigned int)sliceOffsets[s];
+            for( int t = 0; t < tilesPerSlice; t++ ) {
+                cells[2 * t] = offset;
+                cursor[t] = offset;
+                offset += cells[2 * t + 1];
+            }
+            const vector<unsigned int> &p = pairs[s];
+            for( size_t i = 0; i < p.size(); i += 2 )
+                clusters.lightIndices[cursor[p[i]]++] = p[i + 1];
+        }
+    });
+}
+
+
+void buildBruteForce(const Grid &grid, const vector<PointLight> &lights, Clusters &clusters)
+{
+    clusters.cells.assign(2 * (size_t)numClusters(grid), 0);
+    clusters.lightIndices.clear();
+
+    int c = 0;
+    for( int s = 0; s < grid.slices; s++ ) {
+        for( int y = 0; y < grid.tilesY; y++ ) {
+            for( int x = 0; x < grid.tilesX; x++, c++ ) {
+                glm::vec3 lo, hi;
+                clusterBounds(grid, x, y, s, lo, hi);
+                clusters.cells[2 * c] = (unsigned int)clusters.lightIndices.size();
+                for( size_t l = 0; l < lights.size(); l++ ) {
+                    const glm::vec3 &p = lights[l].position;
+                    float dx = axisDistance(p.x, lo.x, hi.x);
+                    float dy = axisDistance(p.y, lo.y, hi.y);
+                    float dz = axisDistance(p.z, lo.z, hi.z);
+                    if( (dx * dx + dy * dy) + dz * dz <= lights[l].radius * lights[l].radius )
+                        clusters.lightIndices.push_back((unsigned int)l);
+                }
+                clusters.cells[2 * c + 1] = (unsigned int)clusters.lightIndices.size() - clusters.cells[2 * c];
+            }
+        }
+    }
+}
+
+} // namespace LightClusters
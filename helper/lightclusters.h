@@ -0,0 +1,66 @@
+#ifndef LIGHTCLUSTERS_H
+#define LIGHTCLUSTERS_H
+
+#include <vector>
+using std::vector;
+
+#include <glm/glm.hpp>
+
+// Clustered forward shading: the view frustum is cut into a grid of
+// froxels (screen tiles times depth slices) and every point light is
+// listed in the froxels its sphere of influence touches, so a fragment
+// only loops over the lights of its own froxel.
+//
+// Screen tiles split NDC x and y evenly. Slices split the eye distance
+// exponentially between nearZ and farZ, so that froxels stay roughly
+// cubical. Each froxel is tested as its eye-space bounding box, which is
+// conservative. ProcDispMap.fs.glsl finds its froxel the same way as
+// clusterOf().
+namespace LightClusters
+{
+    // A point light in eye space. Its contribution falls to zero at radius.
+    struct PointLight
+    {
+        glm::vec3 position;
+        float radius;
+        glm::vec3 color;
+    };
+
+    struct Grid
+    {
+        int tilesX, tilesY, slices;
+        float nearZ, farZ;              // Eye distances covered by the slices.
+        float projScaleX, projScaleY;   // projMat[0][0] and projMat[1][1] of a symmetric perspective.
+    };
+
+    // Light lists of all froxels, x fastest, then y, then slice.
+    struct Clusters
+    {
+        // Two per froxel: the offset of its list in lightIndices, and its
+        // length. Laid out as an array of uvec2 for a std430 buffer.
+        vector<unsigned int> cells;
+
+        // Indices into the light array, each list in increasing order.
+        vector<unsigned int> lightIndices;
+    };
+
+    inline int numClusters(const Grid &grid) { return grid.tilesX * grid.tilesY * grid.slices; }
+
+    // Index of the froxel holding eye-space point p, or -1 if it lies
+    // outside the grid.
+    int clusterOf(const Grid &grid, const glm::vec3 &p);
+
+    // Eye-space bounding box of froxel (x, y, slice).
+    void clusterBounds(const Grid &grid, int x, int y, int slice, glm::vec3 &lo, glm::vec3 &hi);
+
+    // Bins the lights, one slice per task. useSimd tests four tiles of a
+    // row against a light at a time with SSE2.
+    void build(const Grid &grid, const vector<PointLight> &lights, Clusters &clusters,
+               bool useSimd = true, bool useThreads = true);
+
+    // Reference binning: every light against clusterBounds() of every
+    // froxel. Gives the same lists as build().
+    void buildBruteForce(const Grid &grid, const vector<PointLight> &lights, Clusters &clusters);
+}
+
+#endif // LIGHTCLUSTERS_H
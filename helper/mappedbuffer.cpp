@@ -0,0 +1,60 @@
+#include "mappedbuffer.h"
+
+#include <cstdio>
+
+MappedBuffer::MappedBuffer() : target(0), handle(0), bytes(0), data(NULL), mapped(false)
+{
+}
+
+
+MappedBuffer::MappedBuffer(GLenum target, GLuint handle, GLsizeiptr bytes, GLenum usage)
+    : target(0), handle(0), bytes(0), data(NULL), mapped(false)
+{
+    map(target, handle, bytes, usage);
+}
+
+
+MappedBuffer::~MappedBuffer()
+{
+    unmap();
+}
+
+
+void *MappedBuffer::map(GLenum bufferTarget, GLuint bufferHandle, GLsizeiptr size, GLenum usage)
+{
+    unmap();
+    target = bufferTarget;
+    handle = bufferHandle;
+    bytes = size;
+
+    glBindBuffer(target, handle);
+    glBufferData(target, bytes, NULL, usage);
+    data = (bytes > 0) ? glMapBufferRange(target, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT)
+                       : NULL;
+    mapped = (data != NULL);
+    if( !mapped ) {
+        staging.resize(bytes > 0 ? (size_t)bytes : 1);
+        data = &staging[0];
+    }
+    return data;
+}
+
+
+bool MappedBuffer::unmap()
+{
+    if( data == NULL ) return true;
+
+    bool intact = true;
+    glBindBuffer(target, handle);
+    if( mapped ) {
+        intact = (glUnmapBuffer(target) == GL_TRUE);
+        if( !intact ) fprintf(stderr, "Warning: Buffer %u lost its contents while mapped.\n", handle);
+    }
+    else {
+        if( bytes > 0 ) glBufferSubData(target, 0, bytes, data);
+        std::vector<char>().swap(staging);
+    }
+    data = NULL;
+    mapped = false;
+    return intact;
+}
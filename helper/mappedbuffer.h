@@ -0,0 +1,56 @@
+#ifndef MAPPEDBUFFER_H
+#define MAPPEDBUFFER_H
+
+#include "gldecl.h"
+
+#include <vector>
+
+// The storage of a buffer object, mapped with glMapBufferRange() so that a
+// generator writes its data straight into it, instead of into an array
+// that glBufferData() then copies. Needs a current OpenGL context.
+//
+//     MappedBuffer positions(GL_ARRAY_BUFFER, handle, bytes);
+//     generate(positions.getArray<float>());
+//     positions.unmap();
+//
+// The memory may be uncached and write-combined: write it in order, and
+// do not read it. If the driver cannot map the buffer, getData() is an
+// array of our own instead, which unmap() uploads with glBufferSubData().
+class MappedBuffer
+{
+public:
+    MappedBuffer();
+
+    // map() at once.
+    MappedBuffer(GLenum target, GLuint handle, GLsizeiptr bytes, GLenum usage = GL_STATIC_DRAW);
+
+    // unmap() if still mapped.
+    ~MappedBuffer();
+
+    // Binds handle to target, gives it bytes of new storage with the given
+    // usage, and maps all of it for writing. Returns getData().
+    void *map(GLenum target, GLuint handle, GLsizeiptr bytes, GLenum usage = GL_STATIC_DRAW);
+
+    // Binds the buffer again and ends writing; getData() is NULL after.
+    // Returns false if the driver lost the contents while they were mapped,
+    // which it may on a display mode change; they are undefined then.
+    bool unmap();
+
+    void *getData() const { return data; }
+
+    template <typename T>
+    T *getArray() const { return static_cast<T *>(data); }
+
+private:
+    GLenum target;
+    GLuint handle;
+    GLsizeiptr bytes;
+    void *data;
+    bool mapped;                // False while data is staging.
+    std::vector<char> staging;
+
+    MappedBuffer(const MappedBuffer &);
+    MappedBuffer &operator=(const MappedBuffer &);
+};
+
+#endif // MAPPEDBUFFER_H
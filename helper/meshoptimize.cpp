@@ -0,0 +1,231 @@
+#include "meshoptimize.h"
+
+#include <vector>
+#include <cstring>
+
+namespace MeshOptimize {
+
+CacheStats analyzeVertexCache(const unsigned int *indices, size_t indexCount,
+                              unsigned int numVertices, int cacheSize)
+{
+    CacheStats stats = { 0.0f, 0.0f };
+    if( indexCount < 3 || numVertices == 0 ) return stats;
+
+    // FIFO cache: a vertex is a hit if it was pushed within the last
+    // cacheSize misses.
+    vector<size_t> pushedAt(numVertices, 0);
+    vector<bool> referenced(numVertices, false);
+    size_t misses = 0;
+    unsigned int numReferenced = 0;
+
+    for( size_t i = 0; i < indexCount; i++ ) {
+        unsigned int v = indices[i];
+        if( !referenced[v] ) {
+            referenced[v] = true;
+            numReferenced++;
+        }
+        if( pushedAt[v] == 0 || misses + 1 - pushedAt[v] > (size_t)cacheSize ) {
+            misses++;
+            pushedAt[v] = misses;
+        }
+    }
+
+    stats.acmr = (float)misses / (float)(indexCount / 3);
+    stats.atvr = (float)misses / (float)numReferenced;
+    return stats;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Tipsify.
+/////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct TipsifyState
+{
+    vector<unsigned int> adjOffset;     // Vertex -> first entry in adjTriangles.
+    vector<unsigned int> adjTriangles;  // Triangles using each vertex.
+    vector<int> liveTriangles;          // Not-yet-emitted triangles per vertex.
+    vector<int> cacheTime;              // Time stamp of last cache entry per vertex.
+    vector<bool> emitted;               // Per triangle.
+    vector<unsigned int> deadEnd;       // Stack of recently used vertices.
+    unsigned int cursor;                // Next vertex for the linear scan.
+    int time;
+};
+
+int skipDeadEnd(TipsifyState &st, unsigned int numVertices)
+{
+    while( !st.deadEnd.empty() ) {
+        unsigned int d = st.deadEnd.back();
+        st.deadEnd.pop_back();
+        if( st.liveTriangles[d] > 0 ) return (int)d;
+    }
+    while( st.cursor < numVertices ) {
+        unsigned int v = st.cursor++;
+        if( st.liveTriangles[v] > 0 ) return (int)v;
+    }
+    return -1;
+}
+
+int getNextVertex(TipsifyState &st, const vector<unsigned int> &candidates,
+                  unsigned int numVertices, int cacheSize)
+{
+    int best = -1;
+    int bestPriority = -1;
+    for( size_t i = 0; i < candidates.size(); i++ ) {
+        unsigned int v = candidates[i];
+        if( st.liveTriangles[v] <= 0 ) continue;
+
+        // Prefer the vertex that entered the cache longest ago but will
+        // still be in it after its remaining triangles are emitted.
+        int priority = 0;
+        int age = st.time - st.cacheTime[v];
+        if( age + 2 * st.liveTriangles[v] <= cacheSize ) priority = age;
+        if( priority > bestPriority ) {
+            bestPriority = priority;
+            best = (int)v;
+        }
+    }
+    if( best == -1 ) best = skipDeadEnd(st, numVertices);
+    return best;
+}
+
+} // namespace
+
+
+void optimizeVertexCache(unsigned int *indices, size_t indexCount,
+                         unsigned int numVertices, int cacheSize)
+{
+    size_t numTriangles = indexCount / 3;
+    if( numTriangles == 0 || numVertices == 0 ) return;
+
+    TipsifyState st;
+
+    // Vertex -> triangle adjacency in compressed form.
+    st.liveTriangles.assign(numVertices, 0);
+    for( size_t i = 0; i < numTriangles * 3; i++ )
+        st.liveTriangles[indices[i]]++;
+
+    st.adjOffset.assign(numVertices + 1, 0);
+    for( unsigned int v = 0; v < numVertices; v++ )
+        st.adjOffset[v + 1] = st.adjOffset[v] + st.liveTriangles[v];
+
+    st.adjTriangles.resize(numTriangles * 3);
+    vector<unsigned int> fill(st.adjOffset.begin(), st.adjOffset.end() - 1);
+    for( size_t t = 0; t < numTriangles; t++ ) {
+        for( int k = 0; k < 3; k++ ) {
+            unsigned int v = indices[3 * t + k];
+            st.adjTriangles[fill[v]++] = (unsigned int)t;
+        }
+    }
+
+    st.cacheTime.assign(numVertices, 0);
+    st.emitted.assign(numTriangles, false);
+    st.cursor = 0;
+    st.time = cacheSize + 1;
+
+    vector<unsigned int> output;
+    output.reserve(numTriangles * 3);
+    vector<unsigned int> candidates;
+
+    int fanVertex = skipDeadEnd(st, numVertices);
+    while( fanVertex >= 0 ) {
+        candidates.clear();
+
+        // Emit every remaining triangle around the fanning vertex.
+        for( unsigned int a = st.adjOffset[fanVertex]; a < st.adjOffset[fanVertex + 1]; a++ ) {
+            unsigned int t = st.adjTriangles[a];
+            if( st.emitted[t] ) continue;
+            for( int k = 0; k < 3; k++ ) {
+                unsigned int v = indices[3 * t + k];
+                output.push_back(v);
+                st.deadEnd.push_back(v);
+                candidates.push_back(v);
+                st.liveTriangles[v]--;
+                if( st.time - st.cacheTime[v] > cacheSize ) {
+                    st.cacheTime[v] = st.time;
+                    st.time++;
+                }
+            }
+            st.emitted[t] = true;
+        }
+
+        fanVertex = getNextVertex(st, candidates, numVertices, cacheSize);
+    }
+
+    memcpy(indices, &output[0], output.size() * sizeof(unsigned int));
+}
+
+
+void optimizeVertexFetch(unsigned int *indices, size_t indexCount,
+                         unsigned int numVertices, vector<unsigned int> &remap)
+{
+    const unsigned int UNASSIGNED = 0xFFFFFFFFu;
+    remap.assign(numVertices, UNASSIGNED);
+
+    unsigned int next = 0;
+    for( size_t i = 0; i < indexCount; i++ ) {
+        unsigned int v = indices[i];
+        if( remap[v] == UNASSIGNED ) remap[v] = next++;
+        indices[i] = remap[v];
+    }
+
+    for( unsigned int v = 0; v < numVertices; v++ ) {
+        if( remap[v] == UNASSIGNED ) remap[v] = next++;
+    }
+}
+
+
+void optimizeMesh(unsigned int *indices, size_t indexCount, unsigned int numVertices,
+                  vector<unsigned int> &remap, CacheStats *before, CacheStats *after)
+{
+    if( before != NULL ) *before = analyzeVertexCache(indices, indexCount, numVertices);
+    optimizeVertexCache(indices, indexCount, numVertices);
+    optimizeVertexFetch(indices, indexCount, numVertices, remap);
+    if( after != NULL ) *after = analyzeVertexCache(indices, indexCount, numVertices);
+}
+
+
+void remapVertexArray(float *data, int components, unsigned int numVertices,
+                      const vector<unsigned int> &remap)
+{
+    if( remap.size() != numVertices ) return;
+    vector<float> reordered(data, data + (size_t)components * numVertices);
+    for( unsigned int v = 0; v < numVertices; v++ ) {
+        memcpy(data + (size_t)remap[v] * components, &reordered[(size_t)v * components],
+               components * sizeof(float));
+    }
+}
+
+
+void invertRemap(const vector<unsigned int> &remap, vector<unsigned int> &order)
+{
+    order.resize(remap.size());
+    for( size_t v = 0; v < remap.size(); v++ ) order[remap[v]] = (unsigned int)v;
+}
+
+
+void gatherVertexArray(const float *src, float *dst, int components, unsigned int numVertices,
+                       const vector<unsigned int> &order)
+{
+    if( order.size() != numVertices ) return;
+    for( unsigned int v = 0; v < numVertices; v++ ) {
+        const float *from = src + (size_t)order[v] * components;
+        for( int c = 0; c < components; c++ ) *dst++ = from[c];
+    }
+}
+
+
+void buildVertexTriangles(const unsigned int *indices, size_t indexCount, unsigned int numVertices,
+                          vector<unsigned int> &start, vector<unsigned int> &triangles)
+{
+    start.assign((size_t)numVertices + 1, 0);
+    for( size_t i = 0; i < indexCount; i++ ) start[indices[i] + 1]++;
+    for( unsigned int v = 0; v < numVertices; v++ ) start[v + 1] += start[v];
+    triangles.resize(indexCount);
+    vector<unsigned int> cursor(start.begin(), start.end() - 1);
+    for( size_t i = 0; i < indexCount; i++ ) triangles[cursor[indices[i]]++] = (unsigned int)(i / 3);
+}
+
+} // namespace MeshOptimize
@@ -0,0 +1,81 @@
+#ifndef MESHOPTIMIZE_H
+#define MESHOPTIMIZE_H
+
+#include <cstddef>
+#include <vector>
+using std::vector;
+
+// CPU-side index and vertex reordering for triangle meshes. Nothing here
+// touches OpenGL, so it can be run and checked without a context.
+namespace MeshOptimize
+{
+    // Post-transform cache efficiency of an index list, measured with a
+    // simulated FIFO cache.
+    //   acmr: average cache misses per triangle (0.5 is the ideal for a
+    //         large regular mesh, 3.0 means no reuse at all).
+    //   atvr: average transforms per referenced vertex (1.0 is ideal).
+    struct CacheStats
+    {
+        float acmr;
+        float atvr;
+    };
+
+    // Default cache size used for both simulation and optimization.
+    const int DEFAULT_CACHE_SIZE = 16;
+
+    CacheStats analyzeVertexCache(const unsigned int *indices, size_t indexCount,
+                                  unsigned int numVertices, int cacheSize = DEFAULT_CACHE_SIZE);
+
+    // Reorders the triangles of an indexed triangle list in place with
+    // Tipsify (Sander, Nehab and Barczak, "Fast Triangle Reordering for
+    // Vertex Locality and Reduced Overdraw", 2007). Linear time.
+    void optimizeVertexCache(unsigned int *indices, size_t indexCount,
+                             unsigned int numVertices, int cacheSize = DEFAULT_CACHE_SIZE);
+
+    // Renumbers vertices in the order the index list first uses them, so
+    // vertex fetches walk memory forwards. Rewrites the indices in place
+    // and fills remap with remap[oldIndex] = newIndex. Unreferenced
+    // vertices are moved to the end.
+    void optimizeVertexFetch(unsigned int *indices, size_t indexCount,
+                             unsigned int numVertices, vector<unsigned int> &remap);
+
+    // Both passes above, with the cache statistics before and after.
+    // Returns the remap table to apply to every vertex attribute.
+    void optimizeMesh(unsigned int *indices, size_t indexCount, unsigned int numVertices,
+                      vector<unsigned int> &remap,
+                      CacheStats *before = NULL, CacheStats *after = NULL);
+
+    // Applies a remap table to an interleaved float array with the given
+    // number of components per vertex.
+    void remapVertexArray(float *data, int components, unsigned int numVertices,
+                          const vector<unsigned int> &remap);
+
+    // The inverse of a remap table: order[newIndex] = oldIndex.
+    void invertRemap(const vector<unsigned int> &remap, vector<unsigned int> &order);
+
+    // Writes the vertices of src to dst in the order of an inverted remap
+    // table, i.e. src remapped. dst is written front to back and never
+    // read, so it may be mapped buffer memory.
+    void gatherVertexArray(const float *src, float *dst, int components, unsigned int numVertices,
+                           const vector<unsigned int> &order);
+
+    // For each vertex, the triangles using it, in order: those of vertex v
+    // are triangles[start[v]] to triangles[start[v + 1] - 1]. Gathering
+    // from them lets each vertex be summed by one thread, in the order a
+    // serial scatter over the triangles would add them.
+    void buildVertexTriangles(const unsigned int *indices, size_t indexCount, unsigned int numVertices,
+                              vector<unsigned int> &start, vector<unsigned int> &triangles);
+
+    // Applies a remap table to a per-vertex attribute vector.
+    template <typename T>
+    void remapVertices(vector<T> &attribute, const vector<unsigned int> &remap)
+    {
+        if( attribute.size() != remap.size() ) return;
+        vector<T> reordered(attribute.size());
+        for( size_t i = 0; i < attribute.size(); i++ )
+            reordered[remap[i]] = attribute[i];
+        attribute.swap(reordered);
+    }
+}
+
+#endif // MESHOPTIMIZE_H
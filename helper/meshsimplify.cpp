@@ -0,0 +1,375 @@
+#include "meshsimplify.h"
+#include "parallel.h"
+
+#include <cmath>
+#include <cfloat>
+#include <queue>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+namespace MeshSimplify {
+
+namespace {
+
+// Symmetric 4x4 matrix of the quadric, upper triangle only.
+struct Quadric
+{
+    double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+
+    void clear() { a2 = ab = ac = ad = b2 = bc = bd = c2 = cd = d2 = 0.0; }
+
+    void addPlane(double a, double b, double c, double d, double w) {
+        a2 += w*a*a; ab += w*a*b; ac += w*a*c; ad += w*a*d;
+        b2 += w*b*b; bc += w*b*c; bd += w*b*d;
+        c2 += w*c*c; cd += w*c*d;
+        d2 += w*d*d;
+    }
+
+    void add(const Quadric &q) {
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+        b2 += q.b2; bc += q.bc; bd += q.bd;
+        c2 += q.c2; cd += q.cd;
+        d2 += q.d2;
+    }
+
+    // Sum of squared distances from p to the accumulated planes.
+    double evaluate(const float *p) const {
+        double x = p[0], y = p[1], z = p[2];
+        double e = a2*x*x + 2.0*ab*x*y + 2.0*ac*x*z + 2.0*ad*x
+                 + b2*y*y + 2.0*bc*y*z + 2.0*bd*y
+                 + c2*z*z + 2.0*cd*z
+                 + d2;
+        return (e > 0.0) ? e : 0.0;
+    }
+};
+
+// A candidate collapse of vertex 'from' onto vertex 'to'. The versions are
+// those of both vertices when the entry was pushed; the entry is stale once
+// either changes.
+struct Collapse
+{
+    double cost;
+    unsigned int from, to;
+    unsigned int fromVersion, toVersion;
+
+    bool operator>(const Collapse &other) const { return cost > other.cost; }
+};
+
+void cross(const float *a, const float *b, const float *c, double *n) {
+    double e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+    double e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+    n[0] = e1[1]*e2[2] - e1[2]*e2[1];
+    n[1] = e1[2]*e2[0] - e1[0]*e2[2];
+    n[2] = e1[0]*e2[1] - e1[1]*e2[0];
+}
+
+// Triangle soup plus a vertex -> triangle incidence table. Incidence lists
+// may hold triangles that have since died or no longer use the vertex;
+// they are filtered on use and compacted after each collapse.
+class Simplifier
+{
+public:
+    Simplifier(const float *positions, unsigned int numVertices,
+               const unsigned int *indices, size_t indexCount);
+
+    // Collapses edges, cheapest first, until at most targets.back() indices
+    // remain or the next collapse would exceed maxError. Calls
+    // onTarget(k) each time the live index count first drops to targets[k].
+    void run(const vector<size_t> &targets, float maxError,
+             const std::function<void (size_t)> &onTarget);
+
+    size_t liveIndexCount() const { return 3 * liveTriangles; }
+    float error() const { return (float)sqrt(maxCost); }
+    void snapshot(vector<unsigned int> &out) const;
+
+private:
+    const float *pos;
+    vector<unsigned int> tris;
+    vector<bool> triAlive;
+    vector< vector<unsigned int> > vertTris;
+    vector<Quadric> quadrics;
+    vector<unsigned int> version;
+    vector<bool> vertAlive;
+    std::priority_queue<Collapse, vector<Collapse>, std::greater<Collapse> > heap;
+    size_t liveTriangles;
+    double maxCost;
+
+    bool uses(unsigned int t, unsigned int v) const {
+        return triAlive[t] && (tris[3*t] == v || tris[3*t+1] == v || tris[3*t+2] == v);
+    }
+    void neighbours(unsigned int v, vector<unsigned int> &out) const;
+    void pushEdge(unsigned int a, unsigned int b);
+    bool isValid(unsigned int from, unsigned int to);
+    void collapse(unsigned int from, unsigned int to);
+};
+
+
+Simplifier::Simplifier(const float *positions, unsigned int numVertices,
+                       const unsigned int *indices, size_t indexCount) :
+    pos(positions), tris(indices, indices + indexCount / 3 * 3),
+    vertTris(numVertices), quadrics(numVertices), version(numVertices, 0),
+    vertAlive(numVertices, true), liveTriangles(0), maxCost(0.0)
+{
+    size_t numTriangles = tris.size() / 3;
+    triAlive.assign(numTriangles, false);
+    for( unsigned int v = 0; v < numVertices; v++ ) quadrics[v].clear();
+
+    for( size_t t = 0; t < numTriangles; t++ ) {
+        unsigned int i0 = tris[3*t], i1 = tris[3*t+1], i2 = tris[3*t+2];
+        if( i0 == i1 || i1 == i2 || i0 == i2 ) continue;
+
+        double n[3];
+        cross(pos + 3*i0, pos + 3*i1, pos + 3*i2, n);
+        double len = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+        if( len == 0.0 ) continue;
+        n[0] /= len; n[1] /= len; n[2] /= len;
+        double d = -(n[0]*pos[3*i0] + n[1]*pos[3*i0+1] + n[2]*pos[3*i0+2]);
+
+        triAlive[t] = true;
+        liveTriangles++;
+        for( int k = 0; k < 3; k++ ) {
+            quadrics[tris[3*t+k]].addPlane(n[0], n[1], n[2], d, 1.0);
+            vertTris[tris[3*t+k]].push_back((unsigned int)t);
+        }
+    }
+
+    // Boundary edges (used by one triangle only) get a plane perpendicular
+    // to their triangle, so open borders resist being pulled inwards.
+    for( size_t t = 0; t < numTriangles; t++ ) {
+        if( !triAlive[t] ) continue;
+        for( int k = 0; k < 3; k++ ) {
+            unsigned int a = tris[3*t+k], b = tris[3*t+(k+1)%3];
+            int shared = 0;
+            for( size_t i = 0; i < vertTris[a].size(); i++ )
+                if( uses(vertTris[a][i], b) ) shared++;
+            if( shared != 1 ) continue;
+
+            double n[3], e[3], p[3];
+            cross(pos + 3*tris[3*t], pos + 3*tris[3*t+1], pos + 3*tris[3*t+2], n);
+            for( int c = 0; c < 3; c++ ) e[c] = pos[3*b+c] - pos[3*a+c];
+            p[0] = e[1]*n[2] - e[2]*n[1];
+            p[1] = e[2]*n[0] - e[0]*n[2];
+            p[2] = e[0]*n[1] - e[1]*n[0];
+            double len = sqrt(p[0]*p[0] + p[1]*p[1] + p[2]*p[2]);
+            if( len == 0.0 ) continue;
+            p[0] /= len; p[1] /= len; p[2] /= len;
+            double d = -(p[0]*pos[3*a] + p[1]*pos[3*a+1] + p[2]*pos[3*a+2]);
+            quadrics[a].addPlane(p[0], p[1], p[2], d, 1.0);
+            quadrics[b].addPlane(p[0], p[1], p[2], d, 1.0);
+        }
+    }
+
+    for( size_t t = 0; t < numTriangles; t++ ) {
+        if( !triAlive[t] ) continue;
+        for( int k = 0; k < 3; k++ ) {
+            unsigned int a = tris[3*t+k], b = tris[3*t+(k+1)%3];
+            if( a < b ) pushEdge(a, b);
+        }
+    }
+}
+
+
+void Simplifier::neighbours(unsigned int v, vector<unsigned int> &out) const {
+    out.clear();
+    for( size_t i = 0; i < vertTris[v].size(); i++ ) {
+        unsigned int t = vertTris[v][i];
+        if( !uses(t, v) ) continue;
+        for( int k = 0; k < 3; k++ )
+            if( tris[3*t+k] != v ) out.push_back(tris[3*t+k]);
+    }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+
+void Simplifier::pushEdge(unsigned int a, unsigned int b) {
+    Quadric q = quadrics[a];
+    q.add(quadrics[b]);
+    double costAB = q.evaluate(pos + 3*b);   // a moves onto b
+    double costBA = q.evaluate(pos + 3*a);   // b moves onto a
+
+    Collapse c;
+    if( costAB <= costBA ) { c.cost = costAB; c.from = a; c.to = b; }
+    else                   { c.cost = costBA; c.from = b; c.to = a; }
+    c.fromVersion = version[c.from];
+    c.toVersion = version[c.to];
+    heap.push(c);
+}
+
+
+bool Simplifier::isValid(unsigned int from, unsigned int to) {
+    // Link condition: the only vertices adjacent to both endpoints must be
+    // the apexes of the triangles on the edge, or the collapse would pinch
+    // the surface into a non-manifold shape.
+    vector<unsigned int> nFrom, nTo;
+    neighbours(from, nFrom);
+    neighbours(to, nTo);
+    if( !std::binary_search(nFrom.begin(), nFrom.end(), to) ) return false;
+
+    size_t common = 0;
+    for( size_t i = 0, j = 0; i < nFrom.size() && j < nTo.size(); ) {
+        if( nFrom[i] < nTo[j] ) i++;
+        else if( nTo[j] < nFrom[i] ) j++;
+        else { common++; i++; j++; }
+    }
+    size_t edgeTriangles = 0;
+    for( size_t i = 0; i < vertTris[from].size(); i++ )
+        if( uses(vertTris[from][i], from) && uses(vertTris[from][i], to) ) edgeTriangles++;
+    if( common != edgeTriangles ) return false;
+
+    // The triangles that survive must not flip or degenerate.
+    for( size_t i = 0; i < vertTris[from].size(); i++ ) {
+        unsigned int t = vertTris[from][i];
+        if( !uses(t, from) || uses(t, to) ) continue;
+
+        const float *p[3], *q[3];
+        for( int k = 0; k < 3; k++ ) {
+            p[k] = pos + 3*tris[3*t+k];
+            q[k] = (tris[3*t+k] == from) ? pos + 3*to : p[k];
+        }
+        double before[3], after[3];
+        cross(p[0], p[1], p[2], before);
+        cross(q[0], q[1], q[2], after);
+        double d = before[0]*after[0] + before[1]*after[1] + before[2]*after[2];
+        double lenBefore = sqrt(before[0]*before[0] + before[1]*before[1] + before[2]*before[2]);
+        double lenAfter = sqrt(after[0]*after[0] + after[1]*after[1] + after[2]*after[2]);
+        if( d <= 0.2 * lenBefore * lenAfter ) return false;
+    }
+    return true;
+}
+
+
+void Simplifier::collapse(unsigned int from, unsigned int to) {
+    for( size_t i = 0; i < vertTris[from].size(); i++ ) {
+        unsigned int t = vertTris[from][i];
+        if( !uses(t, from) ) continue;
+        if( uses(t, to) ) {
+            triAlive[t] = false;
+            liveTriangles--;
+        } else {
+            for( int k = 0; k < 3; k++ )
+                if( tris[3*t+k] == from ) tris[3*t+k] = to;
+            vertTris[to].push_back(t);
+        }
+    }
+    vector<unsigned int>().swap(vertTris[from]);
+    vertAlive[from] = false;
+    quadrics[to].add(quadrics[from]);
+    version[to]++;
+
+    vector<unsigned int> &list = vertTris[to];
+    size_t kept = 0;
+    for( size_t i = 0; i < list.size(); i++ )
+        if( uses(list[i], to) ) list[kept++] = list[i];
+    list.resize(kept);
+
+    vector<unsigned int> ring;
+    neighbours(to, ring);
+    for( size_t i = 0; i < ring.size(); i++ )
+        pushEdge(to, ring[i]);
+}
+
+
+void Simplifier::run(const vector<size_t> &targets, float maxError,
+                     const std::function<void (size_t)> &onTarget)
+{
+    double maxErrorSq = (double)maxError * (double)maxError;
+    size_t next = 0;
+    while( next < targets.size() && liveIndexCount() <= targets[next] ) onTarget(next++);
+
+    while( next < targets.size() && !heap.empty() ) {
+        Collapse c = heap.top();
+        heap.pop();
+        if( !vertAlive[c.from] || !vertAlive[c.to] ) continue;
+        if( version[c.from] != c.fromVersion || version[c.to] != c.toVersion ) continue;
+        if( c.cost > maxErrorSq ) break;
+        if( !isValid(c.from, c.to) ) continue;
+
+        collapse(c.from, c.to);
+        if( c.cost > maxCost ) maxCost = c.cost;
+
+        while( next < targets.size() && liveIndexCount() <= targets[next] ) onTarget(next++);
+    }
+}
+
+
+void Simplifier::snapshot(vector<unsigned int> &out) const {
+    for( size_t t = 0; t < triAlive.size(); t++ ) {
+        if( !triAlive[t] ) continue;
+        out.push_back(tris[3*t]);
+        out.push_back(tris[3*t+1]);
+        out.push_back(tris[3*t+2]);
+    }
+}
+
+} // namespace
+
+
+float simplify(const float *positions, unsigned int numVertices,
+               const unsigned int *indices, size_t indexCount,
+               size_t targetIndexCount, float maxError,
+               vector<unsigned int> &result)
+{
+    Simplifier s(positions, numVertices, indices, indexCount);
+    vector<size_t> targets(1, targetIndexCount);
+    s.run(targets, maxError, [](size_t) {});
+    result.clear();
+    s.snapshot(result);
+    return s.error();
+}
+
+
+void buildLODChain(const float *positions, unsigned int numVertices,
+                   const unsigned int *indices, size_t indexCount,
+                   vector<unsigned int> &lodIndices, vector<LODLevel> &levels,
+                   int maxLevels, float reduction)
+{
+    lodIndices.assign(indices, indices + indexCount / 3 * 3);
+    levels.clear();
+    LODLevel base = { 0, (unsigned int)lodIndices.size(), 0.0f };
+    levels.push_back(base);
+
+    vector<size_t> targets;
+    double target = (double)lodIndices.size();
+    for( int i = 1; i < maxLevels; i++ ) {
+        target *= reduction;
+        targets.push_back((size_t)target / 3 * 3);
+    }
+
+    Simplifier s(positions, numVertices, indices, indexCount);
+    auto addLevel = [&](size_t) {
+        const LODLevel &prev = levels.back();
+        if( s.liveIndexCount() == 0 || s.liveIndexCount() > prev.indexCount * 9 / 10 ) return;
+        LODLevel level = { (unsigned int)lodIndices.size(), (unsigned int)s.liveIndexCount(), s.error() };
+        s.snapshot(lodIndices);
+        levels.push_back(level);
+    };
+    s.run(targets, FLT_MAX, addLevel);
+
+    // The queue ran dry before the last target: keep what was reached.
+    if( (int)levels.size() < maxLevels ) addLevel(0);
+}
+
+
+void buildLODChains(vector<MeshLODJob> &jobs, int maxLevels, float reduction)
+{
+    Parallel::parallelFor(0, (int)jobs.size(), 1, [&](int begin, int end) {
+        for( int i = begin; i < end; i++ ) {
+            MeshLODJob &job = jobs[i];
+            buildLODChain(job.positions, job.numVertices, job.indices, job.indexCount,
+                          job.lodIndices, job.levels, maxLevels, reduction);
+        }
+    });
+}
+
+
+int selectLevel(const vector<LODLevel> &levels, float pixelsPerUnit, float maxPixelError)
+{
+    for( int i = (int)levels.size() - 1; i > 0; i-- ) {
+        if( levels[i].error * pixelsPerUnit <= maxPixelError ) return i;
+    }
+    return 0;
+}
+
+} // namespace MeshSimplify
@@ -0,0 +1,64 @@
+#ifndef MESHSIMPLIFY_H
+#define MESHSIMPLIFY_H
+
+#include <cstddef>
+#include <vector>
+using std::vector;
+
+// Quadric error metric (Garland and Heckbert, "Surface Simplification Using
+// Quadric Error Metrics", 1997) edge-collapse simplification. Collapses
+// always move one endpoint onto the other, so every level of detail indexes
+// the original vertex array and a whole LOD chain fits in one element
+// buffer. Like MeshOptimize, nothing here touches OpenGL.
+namespace MeshSimplify
+{
+    // One level of a LOD chain: a range of the chain's index list and the
+    // geometric error of that level in object-space units.
+    struct LODLevel
+    {
+        unsigned int indexOffset;
+        unsigned int indexCount;
+        float error;
+    };
+
+    // Simplifies an indexed triangle list until at most targetIndexCount
+    // indices remain or no collapse below maxError is left. positions holds
+    // numVertices xyz triples. Writes the remaining triangles to result and
+    // returns the error reached.
+    float simplify(const float *positions, unsigned int numVertices,
+                   const unsigned int *indices, size_t indexCount,
+                   size_t targetIndexCount, float maxError,
+                   vector<unsigned int> &result);
+
+    // Builds up to maxLevels levels, each with about reduction times the
+    // triangles of the one before, in a single simplification pass. Level 0
+    // is the input itself. lodIndices receives all levels back to back.
+    // Stops early when a level would not remove at least 10% of the
+    // triangles of the previous one.
+    void buildLODChain(const float *positions, unsigned int numVertices,
+                       const unsigned int *indices, size_t indexCount,
+                       vector<unsigned int> &lodIndices, vector<LODLevel> &levels,
+                       int maxLevels = 6, float reduction = 0.5f);
+
+    // Input and output of one mesh for buildLODChains().
+    struct MeshLODJob
+    {
+        const float *positions;
+        unsigned int numVertices;
+        const unsigned int *indices;
+        size_t indexCount;
+
+        vector<unsigned int> lodIndices;
+        vector<LODLevel> levels;
+    };
+
+    // buildLODChain() on every job, one mesh per worker thread.
+    void buildLODChains(vector<MeshLODJob> &jobs, int maxLevels = 6, float reduction = 0.5f);
+
+    // Index of the coarsest level whose error projects to at most
+    // maxPixelError pixels, given the number of pixels one object-space
+    // unit covers on screen at the mesh's distance.
+    int selectLevel(const vector<LODLevel> &levels, float pixelsPerUnit, float maxPixelError = 1.0f);
+}
+
+#endif // MESHSIMPLIFY_H
@@ -0,0 +1,202 @@
+#include "normalbaker.h"
+#include "parallel.h"
+
+#include <cmath>
+#include <algorithm>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NORMALBAKER_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace NormalBaker {
+
+namespace {
+
+// Sums of the samples of one texel.
+struct TexelSum
+{
+    float nx, ny, nz;
+    float height;
+    float mirror;
+};
+
+
+unsigned char toByte(float x)
+{
+    return (unsigned char)(255.0f * std::min(std::max(x, 0.0f), 1.0f) + 0.5f);
+}
+
+
+// Shared by both paths, so that they differ only in the order of the sums.
+void storeTexel(const TexelSum &sum, int numSamples, float heightScale, Maps &maps, int x, int y)
+{
+    float len = sqrtf(sum.nx * sum.nx + sum.ny * sum.ny + sum.nz * sum.nz);
+    float inv = (len > 0.0f) ? 1.0f / len : 0.0f;
+    size_t i = (size_t)y * maps.size + x;
+    unsigned char *rgba = &maps.normalMirror[4 * i];
+    rgba[0] = toByte(0.5f * sum.nx * inv + 0.5f);
+    rgba[1] = toByte(0.5f * sum.ny * inv + 0.5f);
+    rgba[2] = toByte(0.5f * sum.nz * inv + 0.5f);
+    rgba[3] = toByte(sum.mirror / numSamples);
+    maps.height[i] = toByte(sum.height / (numSamples * heightScale));
+}
+
+
+void bakeBlockScalar(const Displacement::Params &params, int samplesPerAxis, Maps &maps,
+                     int x0, int y0, int x1, int y1)
+{
+    const int numSamples = samplesPerAxis * samplesPerAxis;
+    const float texelSize = 1.0f / maps.size;
+    const float step = texelSize / samplesPerAxis;
+
+    for( int y = y0; y < y1; y++ ) {
+        for( int x = x0; x < x1; x++ ) {
+            TexelSum sum = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+            for( int b = 0; b < samplesPerAxis; b++ ) {
+                float t = y * texelSize + (b + 0.5f) * step;
+                for( int a = 0; a < samplesPerAxis; a++ ) {
+                    float s = x * texelSize + (a + 0.5f) * step;
+                    Displacement::Sample d = Displacement::evaluate(params, s, t);
+                    sum.nx += d.normal.x;
+                    sum.ny += d.normal.y;
+                    sum.nz += d.normal.z;
+                    sum.height += d.height;
+                    if( d.mirror ) sum.mirror += 1.0f;
+                }
+            }
+            storeTexel(sum, numSamples, maps.heightScale, maps, x, y);
+        }
+    }
+}
+
+
+#ifdef NORMALBAKER_USE_SSE2
+inline __m128 floor4(__m128 x)
+{
+    __m128 t = _mm_cvtepi32_ps( _mm_cvttps_epi32(x) );
+    return _mm_sub_ps( t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.0f)) );
+}
+
+
+// Hemispheres kernel, four texels of a row at a time. The same arithmetic
+// as hemisphereSample() in displacement.cpp.
+void bakeBlockSSE(const Displacement::Params &params, int samplesPerAxis, Maps &maps,
+                  int x0, int y0, int x1, int y1)
+{
+    const int numSamples = samplesPerAxis * samplesPerAxis;
+    const float texelSize = 1.0f / maps.size;
+    const float step = texelSize / samplesPerAxis;
+    const float density = params.mirrorTileDensity;
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 sqrRadius = _mm_set1_ps(params.mirrorRadius * params.mirrorRadius);
+    const __m128 invDensity = _mm_set1_ps(1.0f / density);
+
+    for( int y = y0; y < y1; y++ ) {
+        int x = x0;
+        for( ; x + 4 <= x1; x += 4 ) {
+            __m128 nx = zero, ny = zero, nz = zero, height = zero, mirror = zero;
+            __m128 texelS = _mm_set_ps((x + 3) * texelSize, (x + 2) * texelSize,
+                                       (x + 1) * texelSize, x * texelSize);
+            for( int b = 0; b < samplesPerAxis; b++ ) {
+                float tileY = density * (y * texelSize + (b + 0.5f) * step);
+                __m128 py = _mm_set1_ps(tileY - (floorf(tileY) + 0.5f));
+                __m128 pySqr = _mm_mul_ps(py, py);
+                for( int a = 0; a < samplesPerAxis; a++ ) {
+                    __m128 tileX = _mm_mul_ps( _mm_set1_ps(density),
+                                               _mm_add_ps(texelS, _mm_set1_ps((a + 0.5f) * step)) );
+                    __m128 px = _mm_sub_ps( tileX, _mm_add_ps(floor4(tileX), half) );
+                    __m128 sqrDist = _mm_add_ps( _mm_mul_ps(px, px), pySqr );
+                    __m128 inside = _mm_cmple_ps(sqrDist, sqrRadius);
+                    __m128 h = _mm_sqrt_ps( _mm_max_ps(_mm_sub_ps(sqrRadius, sqrDist), zero) );
+                    __m128 invLen = _mm_div_ps( one, _mm_sqrt_ps(_mm_add_ps(sqrDist, _mm_mul_ps(h, h))) );
+
+                    // Outside the disk the normal is (0, 0, 1) and the height 0.
+                    nx = _mm_add_ps( nx, _mm_and_ps(inside, _mm_mul_ps(px, invLen)) );
+                    ny = _mm_add_ps( ny, _mm_and_ps(inside, _mm_mul_ps(py, invLen)) );
+                    nz = _mm_add_ps( nz, _mm_or_ps( _mm_and_ps(inside, _mm_mul_ps(h, invLen)),
+                                                    _mm_andnot_ps(inside, one) ) );
+                    height = _mm_add_ps( height, _mm_and_ps(inside, _mm_mul_ps(h, invDensity)) );
+                    mirror = _mm_add_ps( mirror, _mm_and_ps(inside, one) );
+                }
+            }
+
+            float nxs[4], nys[4], nzs[4], heights[4], mirrors[4];
+            _mm_storeu_ps(nxs, nx);
+            _mm_storeu_ps(nys, ny);
+            _mm_storeu_ps(nzs, nz);
+            _mm_storeu_ps(heights, height);
+            _mm_storeu_ps(mirrors, mirror);
+            for( int k = 0; k < 4; k++ ) {
+                TexelSum sum = { nxs[k], nys[k], nzs[k], heights[k], mirrors[k] };
+                storeTexel(sum, numSamples, maps.heightScale, maps, x + k, y);
+            }
+        }
+
+        bakeBlockScalar(params, samplesPerAxis, maps, x, y, x1, y + 1);
+    }
+}
+#endif
+
+} // namespace
+
+
+void bake(const Displacement::Params &params, int size, int samplesPerAxis, Maps &maps,
+          bool useSimd, bool useThreads)
+{
+    maps.size = size;
+    maps.normalMirror.assign(4 * (size_t)size * size, 0);
+    maps.height.assign((size_t)size * size, 0);
+    maps.heightScale = params.mirrorRadius / params.mirrorTileDensity;
+    if( size <= 0 || samplesPerAxis <= 0 ) return;
+
+    std::function<void (int, int, int, int)> kernel;
+#ifdef NORMALBAKER_USE_SSE2
+    if( useSimd && params.kernel == Displacement::HEMISPHERES ) {
+        kernel = [&](int x0, int y0, int x1, int y1) {
+            bakeBlockSSE(params, samplesPerAxis, maps, x0, y0, x1, y1);
+        };
+    }
+#endif
+    if( !kernel ) {
+        kernel = [&](int x0, int y0, int x1, int y1) {
+            bakeBlockScalar(params, samplesPerAxis, maps, x0, y0, x1, y1);
+        };
+    }
+
+    const int blocksPerSide = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    Parallel::parallelFor(0, blocksPerSide * blocksPerSide, useThreads ? 1 : blocksPerSide * blocksPerSide,
+                          [&](int first, int last) {
+        for( int block = first; block < last; block++ ) {
+            int x0 = (block % blocksPerSide) * BLOCK_SIZE;
+            int y0 = (block / blocksPerSide) * BLOCK_SIZE;
+            kernel(x0, y0, std::min(x0 + BLOCK_SIZE, size), std::min(y0 + BLOCK_SIZE, size));
+        }
+    });
+}
+
+
+bool writePNG(const Maps &maps, const char *normalFile, const char *heightFile)
+{
+    const int size = maps.size;
+    if( size <= 0 ) return false;
+
+    // Flip to top row first.
+    vector<unsigned char> rgba(maps.normalMirror.size());
+    vector<unsigned char> r(maps.height.size());
+    for( int y = 0; y < size; y++ ) {
+        std::copy(&maps.normalMirror[4 * (size_t)y * size], &maps.normalMirror[4 * (size_t)(y + 1) * size],
+                  &rgba[4 * (size_t)(size - 1 - y) * size]);
+        std::copy(&maps.height[(size_t)y * size], &maps.height[(size_t)(y + 1) * size],
+                  &r[(size_t)(size - 1 - y) * size]);
+    }
+    return stbi_write_png(normalFile, size, size, 4, &rgba[0], 4 * size) != 0 &&
+           stbi_write_png(heightFile, size, size, 1, &r[0], size) != 0;
+}
+
+} // namespace NormalBaker
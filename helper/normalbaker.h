@@ -0,0 +1,47 @@
+#ifndef NORMALBAKER_H
+#define NORMALBAKER_H
+
+#include <vector>
+using std::vector;
+
+#include "displacement.h"
+
+// Bakes a displacement kernel into textures for normal mapping, so that
+// distant surfaces can be shaded as if displaced without tessellating them.
+// The bake covers texture coordinates [0, 1] x [0, 1] with texel centres
+// where OpenGL puts them, so the maps repeat seamlessly when
+// MirrorTileDensity is a whole number.
+namespace NormalBaker
+{
+    struct Maps
+    {
+        int size;  // Width and height in texels.
+
+        // RGBA8. RGB is the tangent-space normal mapped from [-1, 1] to
+        // [0, 255], A the fraction of the texel that is mirror.
+        vector<unsigned char> normalMirror;
+
+        // R8 height, as a fraction of heightScale.
+        vector<unsigned char> height;
+
+        // Largest height of the kernel, in texture-coordinate units.
+        float heightScale;
+    };
+
+    // Texels are baked in square blocks of this size, one block per task.
+    const int BLOCK_SIZE = 64;
+
+    // Bakes params at size x size texels, averaging samplesPerAxis^2
+    // samples per texel. Rows go bottom to top, as uploaded to OpenGL.
+    // useSimd evaluates four texels at a time with SSE2 where the kernel
+    // allows it (hemispheres only); the other kernels go through
+    // Displacement::evaluate().
+    void bake(const Displacement::Params &params, int size, int samplesPerAxis, Maps &maps,
+              bool useSimd = true, bool useThreads = true);
+
+    // Writes the two maps as PNG files, top row first like other images.
+    // Returns false if either file cannot be written.
+    bool writePNG(const Maps &maps, const char *normalFile, const char *heightFile);
+}
+
+#endif // NORMALBAKER_H
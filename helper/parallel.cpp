@@ -0,0 +1,52 @@
+#include "parallel.h"
+#include "jobsystem.h"
+
+#include <thread>
+#include <mutex>
+
+namespace Parallel {
+
+static int numThreadsOverride = 0;
+
+static std::mutex jobSystemMutex;
+static JobSystem *jobSystem = NULL;
+
+
+int getNumThreads() {
+    if( numThreadsOverride > 0 ) return numThreadsOverride;
+    int n = (int)std::thread::hardware_concurrency();
+    return (n > 0) ? n : 1;
+}
+
+
+void setNumThreads(int numThreads) {
+    numThreadsOverride = (numThreads > 0) ? numThreads : 0;
+}
+
+
+JobSystem &getJobSystem() {
+    std::lock_guard<std::mutex> lock(jobSystemMutex);
+    int n = getNumThreads();
+    if( jobSystem == NULL || jobSystem->getNumThreads() != n ) {
+        delete jobSystem;
+        jobSystem = new JobSystem(n);
+    }
+    return *jobSystem;
+}
+
+
+void parallelFor(int first, int last, int minChunk,
+                 const std::function<void (int, int)> & body)
+{
+    if( last - first <= 0 ) return;
+    if( minChunk < 1 ) minChunk = 1;
+
+    // Work that fits one chunk does not touch the job system.
+    if( last - first < 2 * minChunk ) {
+        body(first, last);
+        return;
+    }
+    getJobSystem().parallelFor(first, last, minChunk, body);
+}
+
+} // namespace Parallel
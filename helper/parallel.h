@@ -0,0 +1,29 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <functional>
+
+class JobSystem;
+
+namespace Parallel
+{
+    // Number of threads parallelFor() spreads its work across.
+    int getNumThreads();
+
+    // Overrides the thread count. Pass 0 to go back to the hardware default.
+    // Not while jobs of getJobSystem() are running: it starts a new one.
+    void setNumThreads(int numThreads);
+
+    // The process's job system, with getNumThreads() threads. Started on
+    // first use and kept, with its workers asleep when there is no work.
+    JobSystem &getJobSystem();
+
+    // Splits [first, last) into contiguous chunks of at least minChunk items
+    // and calls body(chunkBegin, chunkEnd) on each chunk in parallel.
+    // Returns when all chunks are done. The calling thread does work too.
+    // Runs on getJobSystem(), so it may be called from its jobs.
+    void parallelFor(int first, int last, int minChunk,
+                     const std::function<void (int, int)> & body);
+}
+
+#endif // PARALLEL_H
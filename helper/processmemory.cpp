@@ -0,0 +1,89 @@
+#include "processmemory.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <cstdio>
+#include <cstring>
+#endif
+
+namespace ProcessMemory {
+
+#if defined(_WIN32)
+
+namespace {
+
+bool getCounters(PROCESS_MEMORY_COUNTERS &counters)
+{
+    return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) != 0;
+}
+
+} // namespace
+
+size_t getCurrentResidentBytes()
+{
+    PROCESS_MEMORY_COUNTERS counters;
+    return getCounters(counters) ? size_t(counters.WorkingSetSize) : 0;
+}
+
+size_t getPeakResidentBytes()
+{
+    PROCESS_MEMORY_COUNTERS counters;
+    return getCounters(counters) ? size_t(counters.PeakWorkingSetSize) : 0;
+}
+
+bool resetPeak()
+{
+    return false;
+}
+
+#else
+
+namespace {
+
+// A "Name:   1234 kB" line of /proc/self/status, in bytes.
+size_t readStatus(const char *name)
+{
+    FILE *file = fopen("/proc/self/status", "r");
+    if( file == NULL ) return 0;
+
+    size_t bytes = 0;
+    size_t nameLength = strlen(name);
+    char line[256];
+    while( fgets(line, sizeof(line), file) != NULL ) {
+        if( strncmp(line, name, nameLength) == 0 && line[nameLength] == ':' ) {
+            unsigned long long kb = 0;
+            if( sscanf(line + nameLength + 1, "%llu", &kb) == 1 ) bytes = size_t(kb) * 1024;
+            break;
+        }
+    }
+    fclose(file);
+    return bytes;
+}
+
+} // namespace
+
+size_t getCurrentResidentBytes()
+{
+    return readStatus("VmRSS");
+}
+
+size_t getPeakResidentBytes()
+{
+    return readStatus("VmHWM");
+}
+
+bool resetPeak()
+{
+    // Writing 5 to clear_refs resets VmHWM to the current VmRSS (Linux 4.0+).
+    FILE *file = fopen("/proc/self/clear_refs", "w");
+    if( file == NULL ) return false;
+    bool ok = fputs("5", file) >= 0;
+    ok = (fclose(file) == 0) && ok;
+    return ok;
+}
+
+#endif
+
+} // namespace ProcessMemory
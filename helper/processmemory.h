@@ -0,0 +1,22 @@
+#ifndef PROCESSMEMORY_H
+#define PROCESSMEMORY_H
+
+#include <cstddef>
+
+// The resident set size (physical memory in use) of this process, for
+// measuring what loading and generating geometry costs in memory. Zero
+// where the platform gives no figure.
+namespace ProcessMemory
+{
+    size_t getCurrentResidentBytes();
+
+    // Highest resident size since the process started or the last
+    // resetPeak() that worked.
+    size_t getPeakResidentBytes();
+
+    // Starts the peak over from the current size, so the peak of one
+    // piece of work can be read. False if the platform cannot.
+    bool resetPeak();
+}
+
+#endif // PROCESSMEMORY_H
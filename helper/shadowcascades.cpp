@@ -0,0 +1,85 @@
+#include "shadowcascades.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace ShadowCascades {
+
+void computeSplits(float nearZ, float farZ, int count, float lambda, float *splitFar)
+{
+    for( int i = 1; i <= count; i++ ) {
+        float f = (float)i / count;
+        float logSplit = nearZ * powf(farZ / nearZ, f);
+        float uniformSplit = nearZ + (farZ - nearZ) * f;
+        splitFar[i - 1] = lambda * logSplit + (1.0f - lambda) * uniformSplit;
+    }
+    splitFar[count - 1] = farZ;
+}
+
+
+Cascade fitCascade(const glm::mat4 &viewMat, float fovY, float aspect,
+                   float sliceNear, float sliceFar, const glm::vec3 &lightDir,
+                   int mapSize, float casterDistance)
+{
+    // A corner of the slice at eye depth d is sqrt(k) * d off the view
+    // axis. The smallest sphere through the near and far corners is centred
+    // on the axis where they are equally far, unless that is beyond the far
+    // plane, in which case the far corners alone decide.
+    float tanY = tanf(0.5f * fovY);
+    float tanX = tanY * aspect;
+    float k = tanX * tanX + tanY * tanY;
+    float centerDepth = 0.5f * (sliceNear + sliceFar) * (1.0f + k);
+    float radius;
+    if( centerDepth >= sliceFar ) {
+        centerDepth = sliceFar;
+        radius = sliceFar * sqrtf(k);
+    }
+    else {
+        float dz = sliceFar - centerDepth;
+        radius = sqrtf(dz * dz + k * sliceFar * sliceFar);
+    }
+    glm::vec3 center = glm::vec3(glm::inverse(viewMat) * glm::vec4(0.0f, 0.0f, -centerDepth, 1.0f));
+
+    // The light's view only rotates, so that moving the camera moves the
+    // sphere's centre across it and the snapping below is meaningful.
+    glm::vec3 up = (fabsf(lightDir.y) > 0.99f) ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), -lightDir, up);
+    glm::vec3 lc = glm::vec3(lightView * glm::vec4(center, 1.0f));
+
+    // Snap to whole texels. The map is one texel wider than the sphere, so
+    // the snapped square still holds it.
+    float texel = 2.0f * radius / (mapSize - 1);
+    float halfWidth = 0.5f * texel * mapSize;
+    lc.x = floorf(lc.x / texel + 0.5f) * texel;
+    lc.y = floorf(lc.y / texel + 0.5f) * texel;
+
+    glm::mat4 lightProj = glm::ortho(lc.x - halfWidth, lc.x + halfWidth, lc.y - halfWidth, lc.y + halfWidth,
+                                     -(lc.z + radius + casterDistance), -(lc.z - radius));
+
+    Cascade cascade;
+    cascade.viewProj = lightProj * lightView;
+    cascade.nearZ = sliceNear;
+    cascade.farZ = sliceFar;
+    cascade.texelSize = texel;
+    return cascade;
+}
+
+
+void computeCascades(const glm::mat4 &viewMat, float fovY, float aspect,
+                     float nearZ, float farZ, float lambda, int count,
+                     const glm::vec3 &lightDir, int mapSize, float casterDistance,
+                     Cascade *cascades)
+{
+    count = std::min(std::max(count, 1), MAX_CASCADES);
+    float splitFar[MAX_CASCADES];
+    computeSplits(nearZ, farZ, count, lambda, splitFar);
+    for( int i = 0; i < count; i++ ) {
+        float sliceNear = (i == 0) ? nearZ : splitFar[i - 1];
+        cascades[i] = fitCascade(viewMat, fovY, aspect, sliceNear, splitFar[i], lightDir,
+                                 mapSize, casterDistance);
+    }
+}
+
+} // namespace ShadowCascades
@@ -0,0 +1,44 @@
+#ifndef SHADOWCASCADES_H
+#define SHADOWCASCADES_H
+
+#include <glm/glm.hpp>
+
+// Cascaded shadow maps for a directional light. The view frustum up to a
+// shadow distance is cut into slices, and each slice gets an orthographic
+// light projection of its own around the slice's bounding sphere, so near
+// slices get more texels per unit than far ones.
+//
+// The sphere's radius does not change as the camera turns, and its centre
+// is snapped to whole texels of the light's view, so the shadow edges of
+// still objects stay put when the camera moves.
+namespace ShadowCascades
+{
+    const int MAX_CASCADES = 4;
+
+    struct Cascade
+    {
+        glm::mat4 viewProj;  // World space to the cascade's clip space.
+        float nearZ, farZ;   // Eye distances of the view slice it covers.
+        float texelSize;     // World-space width of one shadow-map texel.
+    };
+
+    // Far ends of count slices of [nearZ, farZ], blending logarithmic
+    // (lambda = 1) and uniform (lambda = 0) spacing.
+    void computeSplits(float nearZ, float farZ, int count, float lambda, float *splitFar);
+
+    // Light projection around the view slice [sliceNear, sliceFar] of a
+    // symmetric perspective camera. lightDir points from the scene towards
+    // the light, in world space. Casters up to casterDistance beyond the
+    // sphere towards the light are kept in front of the near plane.
+    Cascade fitCascade(const glm::mat4 &viewMat, float fovY, float aspect,
+                       float sliceNear, float sliceFar, const glm::vec3 &lightDir,
+                       int mapSize, float casterDistance);
+
+    // All cascades at once: count slices of [nearZ, farZ].
+    void computeCascades(const glm::mat4 &viewMat, float fovY, float aspect,
+                         float nearZ, float farZ, float lambda, int count,
+                         const glm::vec3 &lightDir, int mapSize, float casterDistance,
+                         Cascade *cascades);
+}
+
+#endif // SHADOWCASCADES_H
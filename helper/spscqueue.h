@@ -0,0 +1,69 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// A bounded lock-free queue from exactly one producer thread to exactly
+// one consumer thread. Items are copied in and out, so T should be small
+// and plain, e.g. a snapshot of some state.
+//
+// The producer owns tail and the consumer owns head; each only reads the
+// other's, and keeps its last reading so that most calls touch no shared
+// cache line but its own. The capacity is rounded up to a power of two.
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity) : head(0), cachedTail(0), tail(0), cachedHead(0)
+    {
+        size_t size = 1;
+        while( size < capacity ) size *= 2;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    size_t capacity() const { return slots.size(); }
+
+    // Producer only. False if the queue is full.
+    bool tryPush(const T &item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if( t - cachedHead == slots.size() ) {
+            cachedHead = head.load(std::memory_order_acquire);
+            if( t - cachedHead == slots.size() ) return false;
+        }
+        slots[t & mask] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. False if the queue is empty.
+    bool tryPop(T &item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if( h == cachedTail ) {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if( h == cachedTail ) return false;
+        }
+        item = slots[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+
+    // What each thread writes is on a cache line of its own.
+    alignas(64) std::atomic<size_t> head;   // Consumer's.
+    size_t cachedTail;
+    alignas(64) std::atomic<size_t> tail;   // Producer's.
+    size_t cachedHead;
+
+    SpscQueue(const SpscQueue &);
+    SpscQueue &operator=(const SpscQueue &);
+};
+
+#endif // SPSCQUEUE_H
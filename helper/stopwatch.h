@@ -0,0 +1,25 @@
+#ifndef STOPWATCH_H
+#define STOPWATCH_H
+
+#include <chrono>
+
+// Wall-clock timer for CPU-side measurements.
+class Stopwatch
+{
+private:
+    std::chrono::high_resolution_clock::time_point startTime;
+
+public:
+    Stopwatch() { reset(); }
+
+    void reset() { startTime = std::chrono::high_resolution_clock::now(); }
+
+    // Milliseconds since construction or the last reset().
+    double elapsedMs() const {
+        std::chrono::duration<double, std::milli> d =
+            std::chrono::high_resolution_clock::now() - startTime;
+        return d.count();
+    }
+};
+
+#endif // STOPWATCH_H
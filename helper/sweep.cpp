@@ -0,0 +1,69 @@
+#include "sweep.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+namespace Sweep {
+
+bool parseList(const char *text, vector<float> &values)
+{
+    vector<float> parsed;
+    const char *p = text;
+    while( *p != '\0' ) {
+        char *end;
+        double v = strtod(p, &end);
+        if( end == p ) return false;
+        parsed.push_back((float)v);
+        p = end;
+        if( *p == ',' ) p++;
+        else if( *p != '\0' ) return false;
+    }
+    if( parsed.empty() ) return false;
+    values.swap(parsed);
+    return true;
+}
+
+
+static bool dominates(const Result &a, const Result &b)
+{
+    bool noWorse = a.triangles <= b.triangles && a.gpuMs <= b.gpuMs && a.psnr >= b.psnr;
+    bool better = a.triangles < b.triangles || a.gpuMs < b.gpuMs || a.psnr > b.psnr;
+    return noWorse && better;
+}
+
+
+void markParetoFront(vector<Result> &results)
+{
+    for( size_t i = 0; i < results.size(); i++ ) {
+        results[i].pareto = true;
+        for( size_t j = 0; j < results.size() && results[i].pareto; j++ ) {
+            if( j != i && dominates(results[j], results[i]) ) results[i].pareto = false;
+        }
+    }
+}
+
+
+static bool byPsnr(const Result &a, const Result &b)
+{
+    return a.psnr > b.psnr;
+}
+
+
+void printTable(const vector<Result> &results)
+{
+    vector<Result> sorted(results);
+    std::stable_sort(sorted.begin(), sorted.end(), byPsnr);
+
+    printf("%6s %8s %7s %5s %4s %6s %12s %9s %8s %7s  %s\n",
+           "tess", "density", "radius", "divs", "lod", "morph", "triangles", "gpu ms", "PSNR", "SSIM", "pareto");
+    for( size_t i = 0; i < sorted.size(); i++ ) {
+        const Result &r = sorted[i];
+        printf("%6g %8g %7g %5d %4s %6g %12.0f %9.3f %8.2f %7.4f  %s\n",
+               r.tessEdgePixelLength, r.mirrorTileDensity, r.mirrorRadius, r.planeDivisions,
+               r.featureLOD ? "on" : "off", r.lodMorph,
+               r.triangles, r.gpuMs, r.psnr, r.ssim, r.pareto ? "*" : "");
+    }
+}
+
+} // namespace Sweep
@@ -0,0 +1,42 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <vector>
+using std::vector;
+
+// Bookkeeping for parameter sweeps: parsing value lists, and reducing the
+// measured combinations to a Pareto table of quality against cost. The
+// rendering and measuring is done by the application.
+namespace Sweep
+{
+    // One measured parameter combination, averaged over the sweep's views.
+    struct Result
+    {
+        float tessEdgePixelLength;
+        float mirrorTileDensity;
+        float mirrorRadius;
+        int planeDivisions;
+        bool featureLOD;    // Displacement-aware tessellation levels.
+        float lodMorph;     // Tile pixels where displacement starts to fade, or 0 for off.
+
+        double triangles;   // Primitives generated per frame.
+        double gpuMs;       // GPU time per frame.
+        double psnr;        // Against the reference image, in dB.
+        double ssim;
+
+        bool pareto;        // Set by markParetoFront().
+    };
+
+    // Parses a comma-separated list of numbers such as "5,10,20" into
+    // values. Returns false (and leaves values alone) if text is malformed.
+    bool parseList(const char *text, vector<float> &values);
+
+    // Sets pareto on every result that no other result beats on one of
+    // triangles, GPU time and PSNR without being worse on the others.
+    void markParetoFront(vector<Result> &results);
+
+    // Prints all results from best to worst PSNR, marking the Pareto front.
+    void printTable(const vector<Result> &results);
+}
+
+#endif // SWEEP_H
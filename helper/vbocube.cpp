@@ -1,5 +1,6 @@
 #include "vbocube.h"
 #include "glutils.h"
+#include "indexbuffer.h"
 #include "gldecl.h"
 
 #include <cstdio>
@@ -138,13 +139,12 @@ VBOCube::VBOCube()
     glVertexAttribPointer( (GLuint)2, 2, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
     glEnableVertexAttribArray(2);  // texture coords
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle[3]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 36 * sizeof(GLuint), el, GL_STATIC_DRAW);
+    indexType = IndexBuffer::upload(handle[3], el, 36, 24);
 
     glBindVertexArray(0);
 }
 
 void VBOCube::render() const {
     glBindVertexArray(vaoHandle);
-    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
+    glDrawElements(GL_TRIANGLES, 36, indexType, ((GLubyte *)NULL + (0)));
 }
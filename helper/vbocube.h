@@ -8,6 +8,7 @@ class VBOCube : public Drawable
 
 private:
     unsigned int vaoHandle;
+    unsigned int indexType;   // GL_UNSIGNED_BYTE, _SHORT or _INT.
 
 public:
     VBOCube();
@@ -1,49 +1,72 @@
 #include "vbomesh.h"
 #include "glutils.h"
+#include "indexbuffer.h"
+#include "meshoptimize.h"
 #include "gldecl.h"
+#include "parallel.h"
 
 #include <cstdlib>
+#include <cmath>
 #include <iostream>
 using std::cout;
 using std::cerr;
 using std::endl;
 #include <fstream>
 using std::ifstream;
+#include <iterator>
 #include <sstream>
 using std::istringstream;
 
-VBOMesh::VBOMesh(const char * fileName, bool center, bool loadTc, bool genTangents) :
-        reCenterMesh(center), loadTex(loadTc), genTang(genTangents)
+VBOMesh::VBOMesh(const char * fileName, bool center, bool loadTc, bool genTangents, bool genLOD) :
+        reCenterMesh(center), loadTex(loadTc), genTang(genTangents), genLODs(genLOD), currentLOD(0)
 {
     loadOBJ(fileName);
 }
 
 void VBOMesh::render() const {
+    const MeshSimplify::LODLevel & lod = lods[currentLOD];
     glBindVertexArray(vaoHandle);
-    glDrawElements(GL_TRIANGLES, 3 * faces, GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
+    glDrawElements(GL_TRIANGLES, lod.indexCount, indexType,
+                   ((GLubyte *)NULL + lod.indexOffset * IndexBuffer::typeSize(indexType)));
 }
 
-void VBOMesh::loadOBJ( const char * fileName ) {
-
-    vector <vec3> points;
-    vector <vec3> normals;
-    vector <vec2> texCoords;
-    vector <GLuint> faces;
+void VBOMesh::setLOD( int level ) {
+    if( level < 0 ) level = 0;
+    if( level >= int(lods.size()) ) level = int(lods.size()) - 1;
+    currentLOD = level;
+}
 
-    int nFaces = 0;
+void VBOMesh::selectLOD( float distance, float fovy, int viewportHeight, float maxPixelError ) {
+    if( distance <= 0.0f ) {
+        currentLOD = 0;
+        return;
+    }
+    float pixelsPerUnit = viewportHeight / (2.0f * distance * tanf(0.5f * fovy));
+    currentLOD = MeshSimplify::selectLevel(lods, pixelsPerUnit, maxPixelError);
+}
 
-    ifstream objStream( fileName, std::ios::in );
+// The lists of one run of lines of an OBJ file.
+struct VBOMesh::OBJChunk
+{
+    OBJChunk() : nFaces(0) {}
 
-    if( !objStream ) {
-        cerr << "Unable to open OBJ file: " << fileName << endl;
-        exit(1);
-    }
+    vector<vec3> points;
+    vector<vec3> normals;
+    vector<vec2> texCoords;
+    vector<GLuint> faces;
+    int nFaces;
+};
 
+void VBOMesh::parseOBJChunk( const string & text, size_t begin, size_t end, OBJChunk & chunk ) {
     string line, token;
     vector<int> face;
 
-    getline( objStream, line );
-    while( !objStream.eof() ) {
+    while( begin < end ) {
+        size_t lineEnd = text.find('\n', begin);
+        if( lineEnd == string::npos || lineEnd > end ) lineEnd = end;
+        line.assign(text, begin, lineEnd - begin);
+        begin = lineEnd + 1;
+
         trimString(line);
         if( line.length( ) > 0 && line.at(0) != '#' ) {
             istringstream lineStream( line );
@@ -53,18 +76,18 @@ void VBOMesh::loadOBJ( const char * fileName ) {
             if (token == "v" ) {
                 float x, y, z;
                 lineStream >> x >> y >> z;
-                points.push_back( vec3(x,y,z) );
+                chunk.points.push_back( vec3(x,y,z) );
             } else if (token == "vt" && loadTex) {
                 // Process texture coordinate
                 float s,t;
                 lineStream >> s >> t;
-                texCoords.push_back( vec2(s,t) );
+                chunk.texCoords.push_back( vec2(s,t) );
             } else if (token == "vn" ) {
                 float x, y, z;
                 lineStream >> x >> y >> z;
-                normals.push_back( vec3(x,y,z) );
+                chunk.normals.push_back( vec3(x,y,z) );
             } else if (token == "f" ) {
-                nFaces++;
+                chunk.nFaces++;
 
                 // Process face
                 face.clear();
@@ -111,28 +134,80 @@ void VBOMesh::loadOBJ( const char * fileName ) {
                     int v1 = face[1];
                     int v2 = face[2];
                     // First face
-                    faces.push_back(v0);
-                    faces.push_back(v1);
-                    faces.push_back(v2);
+                    chunk.faces.push_back(v0);
+                    chunk.faces.push_back(v1);
+                    chunk.faces.push_back(v2);
                     for( GLuint i = 3; i < face.size(); i++ ) {
                         v1 = v2;
                         v2 = face[i];
-                        faces.push_back(v0);
-                        faces.push_back(v1);
-                        faces.push_back(v2);
+                        chunk.faces.push_back(v0);
+                        chunk.faces.push_back(v1);
+                        chunk.faces.push_back(v2);
                     }
                 } else {
-                    faces.push_back(face[0]);
-                    faces.push_back(face[1]);
-                    faces.push_back(face[2]);
+                    chunk.faces.push_back(face[0]);
+                    chunk.faces.push_back(face[1]);
+                    chunk.faces.push_back(face[2]);
                 }
             }
         }
-        getline( objStream, line );
     }
+}
 
+void VBOMesh::loadOBJ( const char * fileName ) {
+
+    vector <vec3> points;
+    vector <vec3> normals;
+    vector <vec2> texCoords;
+    vector <GLuint> faces;
+
+    int nFaces = 0;
+
+    ifstream objStream( fileName, std::ios::in | std::ios::binary );
+
+    if( !objStream ) {
+        cerr << "Unable to open OBJ file: " << fileName << endl;
+        exit(1);
+    }
+
+    string text( (std::istreambuf_iterator<char>(objStream)), std::istreambuf_iterator<char>() );
     objStream.close();
 
+    // Parse runs of whole lines as parallel jobs. Face indices are absolute,
+    // so the runs' lists are simply appended in order.
+    const size_t bytesPerChunk = 256 * 1024;
+    vector<size_t> chunkBegin(1, 0);
+    while( chunkBegin.back() < text.size() ) {
+        size_t next = chunkBegin.back() + bytesPerChunk;
+        next = (next < text.size()) ? text.find('\n', next) : string::npos;
+        chunkBegin.push_back( (next == string::npos) ? text.size() : next + 1 );
+    }
+    int nChunks = int(chunkBegin.size()) - 1;
+    vector<OBJChunk> chunks(nChunks);
+    Parallel::parallelFor(0, nChunks, 1, [&](int first, int last) {
+        for( int c = first; c < last; c++ )
+            parseOBJChunk(text, chunkBegin[c], chunkBegin[c + 1], chunks[c]);
+    });
+
+    size_t nPoints = 0, nNormals = 0, nTexCoords = 0, nIndices = 0;
+    for( int c = 0; c < nChunks; c++ ) {
+        nPoints += chunks[c].points.size();
+        nNormals += chunks[c].normals.size();
+        nTexCoords += chunks[c].texCoords.size();
+        nIndices += chunks[c].faces.size();
+    }
+    points.reserve(nPoints);
+    normals.reserve(nNormals);
+    texCoords.reserve(nTexCoords);
+    faces.reserve(nIndices);
+    for( int c = 0; c < nChunks; c++ ) {
+        points.insert(points.end(), chunks[c].points.begin(), chunks[c].points.end());
+        normals.insert(normals.end(), chunks[c].normals.begin(), chunks[c].normals.end());
+        texCoords.insert(texCoords.end(), chunks[c].texCoords.begin(), chunks[c].texCoords.end());
+        faces.insert(faces.end(), chunks[c].faces.begin(), chunks[c].faces.end());
+        nFaces += chunks[c].nFaces;
+    }
+
     if( normals.size() == 0 ) {
         generateAveragedNormals(points,normals,faces);
     }
@@ -146,7 +221,34 @@ void VBOMesh::loadOBJ( const char * fileName ) {
         center(points);
     }
 
-    storeVBO(points, normals, texCoords, tangents, faces);
+    // Reorder triangles for the post-transform cache, then renumber the
+    // vertices in first-use order.
+    MeshOptimize::CacheStats before, after;
+    vector<GLuint> remap;
+    MeshOptimize::optimizeMesh(faces.data(), faces.size(), GLuint(points.size()), remap, &before, &after);
+    MeshOptimize::remapVertices(points, remap);
+    MeshOptimize::remapVertices(normals, remap);
+    MeshOptimize::remapVertices(texCoords, remap);
+    MeshOptimize::remapVertices(tangents, remap);
+
+    // Coarser levels are appended to the same index list and share the
+    // vertex array. Each gets its own cache ordering.
+    vector<GLuint> elements;
+    if( genLODs ) {
+        MeshSimplify::buildLODChain((const float *)points.data(), GLuint(points.size()), faces.data(), faces.size(),
+                                    elements, lods);
+        for( size_t i = 1; i < lods.size(); i++ ) {
+            MeshOptimize::optimizeVertexCache(&elements[lods[i].indexOffset], lods[i].indexCount,
+                                              GLuint(points.size()));
+        }
+    } else {
+        elements = faces;
+        MeshSimplify::LODLevel full = { 0, GLuint(faces.size()), 0.0f };
+        lods.assign(1, full);
+    }
+    currentLOD = 0;
+
+    storeVBO(points, normals, texCoords, tangents, elements);
 
     cout << "Loaded mesh from: " << fileName << endl;
     cout << " " << points.size() << " points" << endl;
@@ -155,6 +257,12 @@ void VBOMesh::loadOBJ( const char * fileName ) {
     cout << " " << normals.size() << " normals" << endl;
     cout << " " << tangents.size() << " tangents " << endl;
     cout << " " << texCoords.size() << " texture coordinates." << endl;
+    cout << " ACMR " << before.acmr << " -> " << after.acmr
+         << ", ATVR " << before.atvr << " -> " << after.atvr << endl;
+    for( size_t i = 1; i < lods.size(); i++ ) {
+        cout << " LOD " << i << ": " << lods[i].indexCount / 3 << " triangles, error "
+             << lods[i].error << endl;
+    }
 }
 
 void VBOMesh::center( vector<vec3> & points ) {
@@ -191,27 +299,32 @@ void VBOMesh::generateAveragedNormals(
         vector<vec3> & normals,
         const vector<GLuint> & faces )
 {
-    for( GLuint i = 0; i < points.size(); i++ ) {
-        normals.push_back(vec3(0.0f));
-    }
-
-    for( GLuint i = 0; i < faces.size(); i += 3) {
-        const vec3 & p1 = points[faces[i]];
-        const vec3 & p2 = points[faces[i+1]];
-        const vec3 & p3 = points[faces[i+2]];
-
-        vec3 a = p2 - p1;
-        vec3 b = p3 - p1;
-        vec3 n = glm::normalize(glm::cross(a,b));
-
-        normals[faces[i]] += n;
-        normals[faces[i+1]] += n;
-        normals[faces[i+2]] += n;
-    }
-
-    for( GLuint i = 0; i < normals.size(); i++ ) {
-        normals[i] = glm::normalize(normals[i]);
-    }
+    int nVerts = int(points.size());
+    int nTris = int(faces.size() / 3);
+    normals.assign(nVerts, vec3(0.0f));
+
+    vector<vec3> faceNormals(nTris);
+    Parallel::parallelFor(0, nTris, 4096, [&](int first, int last) {
+        for( int t = first; t < last; t++ ) {
+            const vec3 & p1 = points[faces[3*t]];
+            const vec3 & p2 = points[faces[3*t+1]];
+            const vec3 & p3 = points[faces[3*t+2]];
+
+            vec3 a = p2 - p1;
+            vec3 b = p3 - p1;
+            faceNormals[t] = glm::normalize(glm::cross(a,b));
+        }
+    });
+
+    vector<GLuint> faceStart, faceList;
+    MeshOptimize::buildVertexTriangles(faces.data(), faces.size(), nVerts, faceStart, faceList);
+    Parallel::parallelFor(0, nVerts, 4096, [&](int first, int last) {
+        for( int v = first; v < last; v++ ) {
+            vec3 n(0.0f);
+            for( GLuint i = faceStart[v]; i < faceStart[v + 1]; i++ ) n += faceNormals[faceList[i]];
+            normals[v] = glm::normalize(n);
+        }
+    });
 }
 
 void VBOMesh::generateTangents(
@@ -221,58 +334,53 @@ void VBOMesh::generateTangents(
         const vector<vec2> & texCoords,
         vector<vec4> & tangents)
 {
-    vector<vec3> tan1Accum;
-    vector<vec3> tan2Accum;
-
-    for( GLuint i = 0; i < points.size(); i++ ) {
-        tan1Accum.push_back(vec3(0.0f));
-        tan2Accum.push_back(vec3(0.0f));
-        tangents.push_back(vec4(0.0f));
-    }
-
-    // Compute the tangent vector
-    for( GLuint i = 0; i < faces.size(); i += 3 )
-    {
-        const vec3 &p1 = points[faces[i]];
-        const vec3 &p2 = points[faces[i+1]];
-        const vec3 &p3 = points[faces[i+2]];
-
-        const vec2 &tc1 = texCoords[faces[i]];
-        const vec2 &tc2 = texCoords[faces[i+1]];
-        const vec2 &tc3 = texCoords[faces[i+2]];
-
-        vec3 q1 = p2 - p1;
-        vec3 q2 = p3 - p1;
-        float s1 = tc2.x - tc1.x, s2 = tc3.x - tc1.x;
-        float t1 = tc2.y - tc1.y, t2 = tc3.y - tc1.y;
-        float r = 1.0f / (s1 * t2 - s2 * t1);
-        vec3 tan1( (t2*q1.x - t1*q2.x) * r,
-                   (t2*q1.y - t1*q2.y) * r,
-                   (t2*q1.z - t1*q2.z) * r);
-        vec3 tan2( (s1*q2.x - s2*q1.x) * r,
-                   (s1*q2.y - s2*q1.y) * r,
-                   (s1*q2.z - s2*q1.z) * r);
-        tan1Accum[faces[i]] += tan1;
-        tan1Accum[faces[i+1]] += tan1;
-        tan1Accum[faces[i+2]] += tan1;
-        tan2Accum[faces[i]] += tan2;
-        tan2Accum[faces[i+1]] += tan2;
-        tan2Accum[faces[i+2]] += tan2;
-    }
-
-    for( GLuint i = 0; i < points.size(); ++i )
-    {
-        const vec3 &n = normals[i];
-        vec3 &t1 = tan1Accum[i];
-        vec3 &t2 = tan2Accum[i];
+    int nVerts = int(points.size());
+    int nTris = int(faces.size() / 3);
+    tangents.assign(nVerts, vec4(0.0f));
+
+    // Compute the tangent vectors of each triangle
+    vector<vec3> faceTan1(nTris), faceTan2(nTris);
+    Parallel::parallelFor(0, nTris, 4096, [&](int first, int last) {
+        for( int t = first; t < last; t++ ) {
+            const vec3 &p1 = points[faces[3*t]];
+            const vec3 &p2 = points[faces[3*t+1]];
+            const vec3 &p3 = points[faces[3*t+2]];
+
+            const vec2 &tc1 = texCoords[faces[3*t]];
+            const vec2 &tc2 = texCoords[faces[3*t+1]];
+            const vec2 &tc3 = texCoords[faces[3*t+2]];
+
+            vec3 q1 = p2 - p1;
+            vec3 q2 = p3 - p1;
+            float s1 = tc2.x - tc1.x, s2 = tc3.x - tc1.x;
+            float t1 = tc2.y - tc1.y, t2 = tc3.y - tc1.y;
+            float r = 1.0f / (s1 * t2 - s2 * t1);
+            faceTan1[t] = vec3( (t2*q1.x - t1*q2.x) * r,
+                                (t2*q1.y - t1*q2.y) * r,
+                                (t2*q1.z - t1*q2.z) * r);
+            faceTan2[t] = vec3( (s1*q2.x - s2*q1.x) * r,
+                                (s1*q2.y - s2*q1.y) * r,
+                                (s1*q2.z - s2*q1.z) * r);
+        }
+    });
+
+    vector<GLuint> faceStart, faceList;
+    MeshOptimize::buildVertexTriangles(faces.data(), faces.size(), nVerts, faceStart, faceList);
+    Parallel::parallelFor(0, nVerts, 4096, [&](int first, int last) {
+        for( int v = first; v < last; v++ ) {
+            vec3 t1(0.0f), t2(0.0f);
+            for( GLuint i = faceStart[v]; i < faceStart[v + 1]; i++ ) {
+                t1 += faceTan1[faceList[i]];
+                t2 += faceTan2[faceList[i]];
+            }
+            const vec3 &n = normals[v];
 
-        // Gram-Schmidt orthogonalize
-        tangents[i] = vec4(glm::normalize( t1 - (glm::dot(n,t1) * n) ), 0.0f);
-        // Store handedness in w
-        tangents[i].w = (glm::dot( glm::cross(n,t1), t2 ) < 0.0f) ? -1.0f : 1.0f;
-    }
-    tan1Accum.clear();
-    tan2Accum.clear();
+            // Gram-Schmidt orthogonalize
+            tangents[v] = vec4(glm::normalize( t1 - (glm::dot(n,t1) * n) ), 0.0f);
+            // Store handedness in w
+            tangents[v].w = (glm::dot( glm::cross(n,t1), t2 ) < 0.0f) ? -1.0f : 1.0f;
+        }
+    });
 }
 
 void VBOMesh::storeVBO( const vector<vec3> & points,
@@ -282,54 +390,22 @@ void VBOMesh::storeVBO( const vector<vec3> & points,
                         const vector<GLuint> &elements )
 {
     GLuint nVerts  = GLuint(points.size());
-    faces = GLuint(elements.size() / 3);
-
-    float * v = new float[3 * nVerts];
-    float * n = new float[3 * nVerts];
-    float * tc = NULL;
-    float * tang = NULL;
+    faces = lods[0].indexCount / 3;
 
-    if(texCoords.size() > 0) {
-        tc = new float[ 2 * nVerts];
-        if( tangents.size() > 0 )
-            tang = new float[4*nVerts];
-    }
+    // The vectors hold tightly packed floats already, so they are
+    // uploaded as they are, without copies. data() rather than &v[0],
+    // which is undefined for an empty mesh.
+    static_assert(sizeof(vec3) == 3 * sizeof(float) && sizeof(vec2) == 2 * sizeof(float) &&
+                  sizeof(vec4) == 4 * sizeof(float), "glm vectors must be packed floats");
+    bool hasTc = texCoords.size() > 0;
+    bool hasTang = hasTc && tangents.size() > 0;
 
-    unsigned int *el = new unsigned int[elements.size()];
-
-    int idx = 0, tcIdx = 0, tangIdx = 0;
-    for( GLuint i = 0; i < nVerts; ++i )
-    {
-        v[idx] = points[i].x;
-        v[idx+1] = points[i].y;
-        v[idx+2] = points[i].z;
-        n[idx] = normals[i].x;
-        n[idx+1] = normals[i].y;
-        n[idx+2] = normals[i].z;
-        idx += 3;
-        if( tc != NULL ) {
-            tc[tcIdx] = texCoords[i].x;
-            tc[tcIdx+1] = texCoords[i].y;
-            tcIdx += 2;
-        }
-        if( tang != NULL ) {
-            tang[tangIdx] = tangents[i].x;
-            tang[tangIdx+1] = tangents[i].y;
-            tang[tangIdx+2] = tangents[i].z;
-            tang[tangIdx+3] = tangents[i].w;
-            tangIdx += 4;
-        }
-    }
-    for( unsigned int i = 0; i < elements.size(); ++i )
-    {
-        el[i] = elements[i];
-    }
     glGenVertexArrays( 1, &vaoHandle );
     glBindVertexArray(vaoHandle);
 
     int nBuffers = 3;
-    if( tc != NULL ) nBuffers++;
-    if( tang != NULL ) nBuffers++;
+    if( hasTc ) nBuffers++;
+    if( hasTang ) nBuffers++;
     GLuint elementBuffer = nBuffers - 1;
 
     GLuint handle[5];
@@ -337,39 +413,31 @@ void VBOMesh::storeVBO( const vector<vec3> & points,
     glGenBuffers(nBuffers, handle);
 
     glBindBuffer(GL_ARRAY_BUFFER, handle[bufIdx++]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * nVerts) * sizeof(float), v, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, (3 * nVerts) * sizeof(float), points.data(), GL_STATIC_DRAW);
     glVertexAttribPointer( (GLuint)0, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
     glEnableVertexAttribArray(0);  // Vertex position
 
     glBindBuffer(GL_ARRAY_BUFFER, handle[bufIdx++]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * nVerts) * sizeof(float), n, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, (3 * nVerts) * sizeof(float), normals.data(), GL_STATIC_DRAW);
     glVertexAttribPointer( (GLuint)1, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
     glEnableVertexAttribArray(1);  // Vertex normal
 
-    if( tc != NULL ) {
+    if( hasTc ) {
         glBindBuffer(GL_ARRAY_BUFFER, handle[bufIdx++]);
-        glBufferData(GL_ARRAY_BUFFER, (2 * nVerts) * sizeof(float), tc, GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, (2 * nVerts) * sizeof(float), texCoords.data(), GL_STATIC_DRAW);
         glVertexAttribPointer( (GLuint)2, 2, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
         glEnableVertexAttribArray(2);  // Texture coords
     }
-    if( tang != NULL ) {
+    if( hasTang ) {
         glBindBuffer(GL_ARRAY_BUFFER, handle[bufIdx++]);
-        glBufferData(GL_ARRAY_BUFFER, (4 * nVerts) * sizeof(float), tang, GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, (4 * nVerts) * sizeof(float), tangents.data(), GL_STATIC_DRAW);
         glVertexAttribPointer( (GLuint)3, 4, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
         glEnableVertexAttribArray(3);  // Tangent vector
     }
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle[elementBuffer]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 3 * faces * sizeof(unsigned int), el, GL_STATIC_DRAW);
+    indexType = IndexBuffer::upload(handle[elementBuffer], elements.data(), GLsizei(elements.size()), nVerts);
 
     glBindVertexArray(0);
-
-    // Clean up
-    delete [] v;
-    delete [] n;
-    if( tc != NULL ) delete [] tc;
-    if( tang != NULL ) delete [] tang;
-    delete [] el;
 }
 
 void VBOMesh::trimString( string & str ) {
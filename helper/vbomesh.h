@@ -14,6 +14,7 @@ using glm::vec4;
 using std::string;
 
 #include "gldecl.h"
+#include "meshsimplify.h"
 
 
 class VBOMesh : public Drawable
@@ -21,10 +22,19 @@ class VBOMesh : public Drawable
 private:
     GLuint faces;
     GLuint vaoHandle;
+    GLenum indexType;
 
-    bool reCenterMesh, loadTex, genTang;
+    bool reCenterMesh, loadTex, genTang, genLODs;
+
+    // Levels of detail as ranges of the element buffer; level 0 is the
+    // full mesh. Meshes loaded without LODs have just that one level.
+    vector<MeshSimplify::LODLevel> lods;
+    int currentLOD;
+
+    struct OBJChunk;
 
     void trimString( string & str );
+    void parseOBJChunk( const string & text, size_t begin, size_t end, OBJChunk & chunk );
     void storeVBO( const vector<vec3> & points,
                             const vector<vec3> & normals,
                             const vector<vec2> &texCoords,
@@ -43,10 +53,22 @@ private:
     void center(vector<vec3> &);
 
 public:
-    VBOMesh( const char * fileName, bool reCenterMesh = false, bool loadTc = false, bool genTangents = false );
+    VBOMesh( const char * fileName, bool reCenterMesh = false, bool loadTc = false, bool genTangents = false,
+             bool genLODs = false );
 
+    // Draws the triangles of the current level of detail.
     void render() const;
 
+    int getNumLODs() const { return int(lods.size()); }
+    int getLOD() const { return currentLOD; }
+    void setLOD( int level );
+
+    // Picks the coarsest level whose simplification error stays within
+    // maxPixelError pixels on screen, for a mesh at the given view-space
+    // distance under a perspective projection with vertical field of view
+    // fovy (radians) into a viewport viewportHeight pixels tall.
+    void selectLOD( float distance, float fovy, int viewportHeight, float maxPixelError = 1.0f );
+
     void loadOBJ( const char * fileName );
 };
 
@@ -1,6 +1,9 @@
 #include "vbomeshadj.h"
 #include "glutils.h"
+#include "indexbuffer.h"
+#include "meshoptimize.h"
 #include "gldecl.h"
+#include "parallel.h"
 
 #include <cstdlib>
 #include <iostream>
@@ -9,11 +12,13 @@ using std::cerr;
 using std::endl;
 #include <fstream>
 using std::ifstream;
+#include <iterator>
 #include <sstream>
 using std::istringstream;
 
-#include <map>
-using std::map;
+#include <utility>
+#include <unordered_map>
+using std::unordered_map;
 
 VBOMeshAdj::VBOMeshAdj(const char * fileName, bool center)
 {
@@ -22,243 +27,300 @@ VBOMeshAdj::VBOMeshAdj(const char * fileName, bool center)
 
 void VBOMeshAdj::render() const {
     glBindVertexArray(vaoHandle);
-    glDrawElements(GL_TRIANGLES_ADJACENCY, 6 * faces, GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
+    glDrawElements(GL_TRIANGLES_ADJACENCY, 6 * faces, indexType, ((GLubyte *)NULL + (0)));
 }
 
-void VBOMeshAdj::determineAdjacency(vector<GLuint> &el)
+namespace {
+
+// The last two triangles, in triangle order, that used an edge, with the
+// vertex opposite the edge in each. prev is the last one before the
+// triangle last; a triangle of -1 is none.
+struct EdgeUse
 {
-    // Elements with adjacency info
-    vector<GLuint> elAdj;
-
-    // Copy and make room for adjacency info
-    for( GLuint i = 0; i < el.size(); i+=3)
-    {
-        elAdj.push_back(el[i]);
-        elAdj.push_back(-1);
-        elAdj.push_back(el[i+1]);
-        elAdj.push_back(-1);
-        elAdj.push_back(el[i+2]);
-        elAdj.push_back(-1);
-    }
+    EdgeUse() : lastTri(-1), lastOpp(0), prevTri(-1), prevOpp(0) {}
+
+    int lastTri;
+    GLuint lastOpp;
+    int prevTri;
+    GLuint prevOpp;
+};
+
+// Both orientations of an edge give the same key.
+inline unsigned long long edgeKey( GLuint a, GLuint b ) {
+    if( a > b ) std::swap(a, b);
+    return ((unsigned long long)a << 32) | b;
+}
 
-    // Find matching edges
-    for( GLuint i = 0; i < elAdj.size(); i+=6)
-    {
-        // A triangle
-        int a1 = elAdj[i];
-        int b1 = elAdj[i+2];
-        int c1 = elAdj[i+4];
-
-        // Scan subsequent triangles
-        for(GLuint j = i+6; j < elAdj.size(); j+=6)
-        {
-            int a2 = elAdj[j];
-            int b2 = elAdj[j+2];
-            int c2 = elAdj[j+4];
-
-            // Edge 1 == Edge 1
-            if( (a1 == a2 && b1 == b2) || (a1 == b2 && b1 == a2) )
-            {
-                elAdj[i+1] = c2;
-                elAdj[j+1] = c1;
-            }
-            // Edge 1 == Edge 2
-            if( (a1 == b2 && b1 == c2) || (a1 == c2 && b1 == b2) )
-            {
-                elAdj[i+1] = a2;
-                elAdj[j+3] = c1;
-            }
-            // Edge 1 == Edge 3
-            if ( (a1 == c2 && b1 == a2) || (a1 == a2 && b1 == c2) )
-            {
-                elAdj[i+1] = b2;
-                elAdj[j+5] = c1;
-            }
-            // Edge 2 == Edge 1
-            if( (b1 == a2 && c1 == b2) || (b1 == b2 && c1 == a2) )
-            {
-                elAdj[i+3] = c2;
-                elAdj[j+1] = a1;
-            }
-            // Edge 2 == Edge 2
-            if( (b1 == b2 && c1 == c2) || (b1 == c2 && c1 == b2) )
-            {
-                elAdj[i+3] = a2;
-                elAdj[j+3] = a1;
-            }
-            // Edge 2 == Edge 3
-            if( (b1 == c2 && c1 == a2) || (b1 == a2 && c1 == c2) )
-            {
-                elAdj[i+3] = b2;
-                elAdj[j+5] = a1;
-            }
-            // Edge 3 == Edge 1
-            if( (c1 == a2 && a1 == b2) || (c1 == b2 && a1 == a2) )
-            {
-                elAdj[i+5] = c2;
-                elAdj[j+1] = b1;
-            }
-            // Edge 3 == Edge 2
-            if( (c1 == b2 && a1 == c2) || (c1 == c2 && a1 == b2) )
-            {
-                elAdj[i+5] = a2;
-                elAdj[j+3] = b1;
+// Which of nParts edge maps holds the edge with the given key.
+inline int edgePart( unsigned long long key, int nParts ) {
+    return int(((key * 0x9E3779B97F4A7C15ull) >> 32) % unsigned(nParts));
+}
+
+} // namespace
+
+void VBOMeshAdj::determineAdjacency(vector<GLuint> &el)
+{
+    int nTris = int(el.size() / 3);
+
+    // Edge i of a triangle runs from its vertex i to vertex i + 1. Each edge
+    // gets the opposite vertex of the last other triangle sharing it, which
+    // is what the old pairwise scan left after later matches overwrote
+    // earlier ones.
+    //
+    // The edges are hashed into one map per thread, each map holding the
+    // edges whose hash falls in its part. Every part scans all triangles in
+    // order, so the maps need no merging and the result does not depend on
+    // the thread count.
+    int nParts = Parallel::getNumThreads();
+    vector< unordered_map<unsigned long long, EdgeUse> > edges(nParts);
+    Parallel::parallelFor(0, nParts, 1, [&](int first, int last) {
+        for( int part = first; part < last; part++ ) {
+            unordered_map<unsigned long long, EdgeUse> & map = edges[part];
+            map.reserve(size_t(nTris) * 3 / 2 / nParts + 1);
+            for( int t = 0; t < nTris; t++ ) {
+                for( int i = 0; i < 3; i++ ) {
+                    unsigned long long key = edgeKey(el[3*t + i], el[3*t + (i+1)%3]);
+                    if( edgePart(key, nParts) != part ) continue;
+
+                    EdgeUse & use = map[key];
+                    if( use.lastTri != t ) {
+                        use.prevTri = use.lastTri;
+                        use.prevOpp = use.lastOpp;
+                        use.lastTri = t;
+                    }
+                    use.lastOpp = el[3*t + (i+2)%3];
+                }
             }
-            // Edge 3 == Edge 3
-            if( (c1 == c2 && a1 == a2) || (c1 == a2 && a1 == c2) )
-            {
-                elAdj[i+5] = b2;
-                elAdj[j+5] = b1;
+        }
+    });
+
+    // Elements with adjacency info: each vertex followed by the vertex
+    // across the edge it starts.
+    vector<GLuint> elAdj(2 * el.size());
+    Parallel::parallelFor(0, nTris, 4096, [&](int first, int last) {
+        for( int t = first; t < last; t++ ) {
+            for( int i = 0; i < 3; i++ ) {
+                unsigned long long key = edgeKey(el[3*t + i], el[3*t + (i+1)%3]);
+                const EdgeUse & use = edges[edgePart(key, nParts)].find(key)->second;
+
+                elAdj[6*t + 2*i] = el[3*t + i];
+                if( use.lastTri != t )
+                    elAdj[6*t + 2*i + 1] = use.lastOpp;
+                else if( use.prevTri != -1 )
+                    elAdj[6*t + 2*i + 1] = use.prevOpp;
+                else
+                    // An outside edge: use the triangle's own opposite vertex
+                    elAdj[6*t + 2*i + 1] = el[3*t + (i+2)%3];
             }
         }
-    }
+    });
 
-    // Look for any outside edges
-    for( GLuint i = 0; i < elAdj.size(); i+=6)
-    {
-        if( elAdj[i+1] == -1 ) elAdj[i+1] = elAdj[i+4];
-        if( elAdj[i+3] == -1 ) elAdj[i+3] = elAdj[i];
-        if( elAdj[i+5] == -1 ) elAdj[i+5] = elAdj[i+2];
-    }
+    el.swap(elAdj);
+}
 
-    // Copy all data back into el
-    el = elAdj;
+// The lists of one run of lines of an OBJ file.
+struct VBOMeshAdj::OBJChunk
+{
+    OBJChunk() : nFaces(0) {}
+
+    vector<vec3> points;
+    vector<vec3> normals;
+    vector<vec2> texCoords;
+    vector<GLuint> faces, faceTC;
+    int nFaces;
+};
+
+void VBOMeshAdj::parseOBJChunk( const string & text, size_t begin, size_t end, OBJChunk & chunk ) {
+    string line, token;
+
+    while( begin < end ) {
+        size_t lineEnd = text.find('\n', begin);
+        if( lineEnd == string::npos || lineEnd > end ) lineEnd = end;
+        line.assign(text, begin, lineEnd - begin);
+        begin = lineEnd + 1;
+
+        trimString(line);
+        if( line.length( ) > 0 && line.at(0) != '#' ) {
+            istringstream lineStream( line );
+
+            lineStream >> token;
+
+            if (token == "v" ) {
+                float x, y, z;
+                lineStream >> x >> y >> z;
+                chunk.points.push_back( vec3(x,y,z) );
+            } else if (token == "vt" ) {
+                // Process texture coordinate
+                float s,t;
+                lineStream >> s >> t;
+                chunk.texCoords.push_back( vec2(s,t) );
+            } else if (token == "vn" ) {
+                float x, y, z;
+                lineStream >> x >> y >> z;
+                chunk.normals.push_back( vec3(x,y,z) );
+            } else if (token == "f" ) {
+                chunk.nFaces++;
+
+                // Process face
+                size_t slash1, slash2;
+                int faceVerts = 0;
+                while( lineStream.good() ) {
+                    faceVerts++;
+                    string vertString;
+                    lineStream >> vertString;
+                    int pIndex = -1, nIndex = -1 , tcIndex = -1;
+
+                    slash1 = vertString.find("/");
+                    if( slash1 == string::npos ){
+                        pIndex = atoi( vertString.c_str() ) - 1 ;
+                    } else {
+                        slash2 = vertString.find("/", slash1 + 1 );
+                        pIndex = atoi( vertString.substr(0,slash1).c_str() ) - 1;
+                        if( slash2 == string::npos || slash2 > slash1 + 1) {
+                            tcIndex =
+                                atoi( vertString.substr(slash1 + 1, slash2).c_str() ) - 1;
+                        }
+                        if( slash2 != string::npos )
+                            nIndex =
+                                atoi( vertString.substr(slash2 + 1,string::npos).c_str() ) - 1;
+                    }
+                    if( pIndex == -1 ) {
+                        printf("Missing point index!!!");
+                    } else {
+                        chunk.faces.push_back(pIndex);
+                    }
+                    if( tcIndex != -1 ) chunk.faceTC.push_back(tcIndex);
+
+                    if ( nIndex != -1 && nIndex != pIndex ) {
+                        printf("Normal and point indices are not consistent.\n");
+                    }
+                }
+                if( faceVerts != 3 ) {
+                    printf("Found non-triangular face.\n");
+                }
+            }
+        }
+    }
 }
 
 void VBOMeshAdj::loadOBJ( const char * fileName, bool reCenterMesh ) {
 
-  vector <vec3> p;
-  vector <vec3> n;
-  vector <vec2> tc;         // Holds tex coords from OBJ file
-  vector <GLuint> faces, faceTC;
-
-  int nFaces = 0;
-
-  ifstream objStream( fileName, std::ios::in );
-
-  if( !objStream ) {
-    cerr << "Unable to open OBJ file: " << fileName << endl;
-    exit(1);
-  }
-
-  cout << "Loading OBJ mesh: " << fileName << endl;
-  string line, token;
-
-  getline( objStream, line );
-  while( !objStream.eof() ) {
-    trimString(line);
-    if( line.length( ) > 0 && line.at(0) != '#' ) {
-      istringstream lineStream( line );
-
-      lineStream >> token;
-
-      if (token == "v" ) {
-        float x, y, z;
-        lineStream >> x >> y >> z;
-        p.push_back( vec3(x,y,z) );
-      } else if (token == "vt" ) {
-        // Process texture coordinate
-        float s,t;
-        lineStream >> s >> t;
-        tc.push_back( vec2(s,t) );
-      } else if (token == "vn" ) {
-        float x, y, z;
-        lineStream >> x >> y >> z;
-        n.push_back( vec3(x,y,z) );
-      } else if (token == "f" ) {
-        nFaces++;
-
-        // Process face
-        size_t slash1, slash2;
-        int faceVerts = 0;
-        while( lineStream.good() ) {
-          faceVerts++;
-          string vertString;
-          lineStream >> vertString;
-          int pIndex = -1, nIndex = -1 , tcIndex = -1;
-
-          slash1 = vertString.find("/");
-          if( slash1 == string::npos ){
-            pIndex = atoi( vertString.c_str() ) - 1 ;
-          } else {
-            slash2 = vertString.find("/", slash1 + 1 );
-            pIndex = atoi( vertString.substr(0,slash1).c_str() ) - 1;
-            if( slash2 == string::npos || slash2 > slash1 + 1) {
-              tcIndex =
-                atoi( vertString.substr(slash1 + 1, slash2).c_str() ) - 1;
+    vector <vec3> p;
+    vector <vec3> n;
+    vector <vec2> tc;         // Holds tex coords from OBJ file
+    vector <GLuint> faces, faceTC;
+
+    int nFaces = 0;
+
+    ifstream objStream( fileName, std::ios::in | std::ios::binary );
+
+    if( !objStream ) {
+        cerr << "Unable to open OBJ file: " << fileName << endl;
+        exit(1);
+    }
+
+    cout << "Loading OBJ mesh: " << fileName << endl;
+    string text( (std::istreambuf_iterator<char>(objStream)), std::istreambuf_iterator<char>() );
+    objStream.close();
+
+    // Parse runs of whole lines as parallel jobs. Face indices are absolute,
+    // so the runs' lists are simply appended in order.
+    const size_t bytesPerChunk = 256 * 1024;
+    vector<size_t> chunkBegin(1, 0);
+    while( chunkBegin.back() < text.size() ) {
+        size_t next = chunkBegin.back() + bytesPerChunk;
+        next = (next < text.size()) ? text.find('\n', next) : string::npos;
+        chunkBegin.push_back( (next == string::npos) ? text.size() : next + 1 );
+    }
+    int nChunks = int(chunkBegin.size()) - 1;
+    vector<OBJChunk> chunks(nChunks);
+    Parallel::parallelFor(0, nChunks, 1, [&](int first, int last) {
+        for( int c = first; c < last; c++ )
+            parseOBJChunk(text, chunkBegin[c], chunkBegin[c + 1], chunks[c]);
+    });
+
+    size_t nPoints = 0, nNormals = 0, nTexCoords = 0, nIndices = 0, nTcIndices = 0;
+    for( int c = 0; c < nChunks; c++ ) {
+        nPoints += chunks[c].points.size();
+        nNormals += chunks[c].normals.size();
+        nTexCoords += chunks[c].texCoords.size();
+        nIndices += chunks[c].faces.size();
+        nTcIndices += chunks[c].faceTC.size();
+    }
+    p.reserve(nPoints);
+    n.reserve(nNormals);
+    tc.reserve(nTexCoords);
+    faces.reserve(nIndices);
+    faceTC.reserve(nTcIndices);
+    for( int c = 0; c < nChunks; c++ ) {
+        p.insert(p.end(), chunks[c].points.begin(), chunks[c].points.end());
+        n.insert(n.end(), chunks[c].normals.begin(), chunks[c].normals.end());
+        tc.insert(tc.end(), chunks[c].texCoords.begin(), chunks[c].texCoords.end());
+        faces.insert(faces.end(), chunks[c].faces.begin(), chunks[c].faces.end());
+        faceTC.insert(faceTC.end(), chunks[c].faceTC.begin(), chunks[c].faceTC.end());
+        nFaces += chunks[c].nFaces;
+    }
+
+    // 2nd pass, re-do the lists to make the indices consistent. It stays
+    // serial: which corners get duplicated points depends on face order.
+    // A file without a texture coordinate on every corner gets none.
+    vector<vec2> texCoords;
+    if( faceTC.size() == faces.size() && faces.size() > 0 ) {
+        texCoords.assign(p.size(), vec2(0.0f));
+        vector<int> pToTex(p.size(), -1);
+        for( GLuint i = 0; i < faces.size(); i++ ) {
+            int point = faces[i];
+            int texCoord = faceTC[i];
+            if( pToTex[point] == -1 ) {
+                pToTex[point] = texCoord;
+                texCoords[point] = tc[texCoord];
+            } else if( texCoord != pToTex[point] ) {
+                p.push_back( p[point] );  // Dup the point
+                texCoords.push_back( tc[texCoord] );
+                faces[i] = GLuint(p.size() - 1);
             }
-            if( slash2 != string::npos )
-              nIndex =
-                atoi( vertString.substr(slash2 + 1,string::npos).c_str() ) - 1;
-          }
-          if( pIndex == -1 ) {
-            printf("Missing point index!!!");
-          } else {
-            faces.push_back(pIndex);
-          }
-          if( tcIndex != -1 ) faceTC.push_back(tcIndex);
-
-          if ( nIndex != -1 && nIndex != pIndex ) {
-            printf("Normal and point indices are not consistent.\n");
-          }
         }
-        if( faceVerts != 3 ) {
-          printf("Found non-triangular face.\n");
-        }
-      }
     }
-    getline( objStream, line );
-  }
-
-  objStream.close();
-
-  // 2nd pass, re-do the lists to make the indices consistent
-  vector<vec2> texCoords;
-  for( GLuint i = 0; i < p.size(); i++ ) texCoords.push_back(vec2(0.0f));
-  std::map<int, int> pToTex;
-  for( GLuint i = 0; i < faces.size(); i++ ) {
-    int point = faces[i];
-    int texCoord = faceTC[i];
-    std::map<int, int>::iterator it = pToTex.find(point);
-    if( it == pToTex.end() ) {
-      pToTex[point] = texCoord;
-      texCoords[point] = tc[texCoord];
-    } else {
-      if( texCoord != it->second ) {
-        p.push_back( p[point] );  // Dup the point
-        texCoords.push_back( tc[texCoord] );
-        faces[i] = GLuint(p.size() - 1);
-      }
+
+    if( n.size() == 0 ) {
+        cout << "Generating normal vectors" << endl;
+        generateAveragedNormals(p,n,faces);
+    }
+
+    vector<vec4> tangents;
+    if( texCoords.size() > 0 ) {
+        cout << "Generating tangents" << endl;
+        generateTangents(p,n,faces,texCoords,tangents);
+    }
+
+    if( reCenterMesh ) {
+        center(p);
     }
-  }
-
-  if( n.size() == 0 ) {
-    cout << "Generating normal vectors" << endl;
-    generateAveragedNormals(p,n,faces);
-  }
-
-  vector<vec4> tangents;
-  if( texCoords.size() > 0 ) {
-    cout << "Generating tangents" << endl;
-    generateTangents(p,n,faces,texCoords,tangents);
-  }
-
-  if( reCenterMesh ) {
-    center(p);
-  }
-
-  // Determine the adjacency information
-  cout << "Determining mesh adjacencies" << endl;
-  determineAdjacency(faces);
-
-  storeVBO(p, n, texCoords, tangents, faces);
-
-  cout << "Loaded mesh from: " << fileName << endl;
-  cout << " " << p.size() << " points" << endl;
-  cout << " " << nFaces << " faces" << endl;
-  cout << " " << n.size() << " normals" << endl;
-  cout << " " << tangents.size() << " tangents " << endl;
-  cout << " " << texCoords.size() << " texture coordinates." << endl;
+
+    // Optimize the plain triangle list; the adjacency list built from it
+    // keeps the same triangle and vertex order.
+    MeshOptimize::CacheStats before, after;
+    vector<GLuint> remap;
+    MeshOptimize::optimizeMesh(faces.data(), faces.size(), GLuint(p.size()), remap, &before, &after);
+    MeshOptimize::remapVertices(p, remap);
+    MeshOptimize::remapVertices(n, remap);
+    MeshOptimize::remapVertices(texCoords, remap);
+    MeshOptimize::remapVertices(tangents, remap);
+
+    // Determine the adjacency information
+    cout << "Determining mesh adjacencies" << endl;
+    determineAdjacency(faces);
+
+    storeVBO(p, n, texCoords, tangents, faces);
+
+    cout << "Loaded mesh from: " << fileName << endl;
+    cout << " " << p.size() << " points" << endl;
+    cout << " " << nFaces << " faces" << endl;
+    cout << " " << n.size() << " normals" << endl;
+    cout << " " << tangents.size() << " tangents " << endl;
+    cout << " " << texCoords.size() << " texture coordinates." << endl;
+    cout << " ACMR " << before.acmr << " -> " << after.acmr
+         << ", ATVR " << before.atvr << " -> " << after.atvr << endl;
 }
 
 void VBOMeshAdj::center( vector<vec3> & points ) {
@@ -295,27 +357,32 @@ void VBOMeshAdj::generateAveragedNormals(
         vector<vec3> & normals,
         const vector<GLuint> & faces )
 {
-    for( GLuint i = 0; i < points.size(); i++ ) {
-        normals.push_back(vec3(0.0f));
-    }
-
-    for( GLuint i = 0; i < faces.size(); i += 3) {
-        const vec3 & p1 = points[faces[i]];
-        const vec3 & p2 = points[faces[i+1]];
-        const vec3 & p3 = points[faces[i+2]];
-
-        vec3 a = p2 - p1;
-        vec3 b = p3 - p1;
-        vec3 n = glm::normalize(glm::cross(a,b));
-
-        normals[faces[i]] += n;
-        normals[faces[i+1]] += n;
-        normals[faces[i+2]] += n;
-    }
-
-    for( GLuint i = 0; i < normals.size(); i++ ) {
-        normals[i] = glm::normalize(normals[i]);
-    }
+    int nVerts = int(points.size());
+    int nTris = int(faces.size() / 3);
+    normals.assign(nVerts, vec3(0.0f));
+
+    vector<vec3> faceNormals(nTris);
+    Parallel::parallelFor(0, nTris, 4096, [&](int first, int last) {
+        for( int t = first; t < last; t++ ) {
+            const vec3 & p1 = points[faces[3*t]];
+            const vec3 & p2 = points[faces[3*t+1]];
+            const vec3 & p3 = points[faces[3*t+2]];
+
+            vec3 a = p2 - p1;
+            vec3 b = p3 - p1;
+            faceNormals[t] = glm::normalize(glm::cross(a,b));
+        }
+    });
+
+    vector<GLuint> faceStart, faceList;
+    MeshOptimize::buildVertexTriangles(faces.data(), faces.size(), nVerts, faceStart, faceList);
+    Parallel::parallelFor(0, nVerts, 4096, [&](int first, int last) {
+        for( int v = first; v < last; v++ ) {
+            vec3 n(0.0f);
+            for( GLuint i = faceStart[v]; i < faceStart[v + 1]; i++ ) n += faceNormals[faceList[i]];
+            normals[v] = glm::normalize(n);
+        }
+    });
 }
 
 void VBOMeshAdj::generateTangents(
@@ -325,58 +392,53 @@ void VBOMeshAdj::generateTangents(
         const vector<vec2> & texCoords,
         vector<vec4> & tangents)
 {
-    vector<vec3> tan1Accum;
-    vector<vec3> tan2Accum;
-
-    for( GLuint i = 0; i < points.size(); i++ ) {
-        tan1Accum.push_back(vec3(0.0f));
-        tan2Accum.push_back(vec3(0.0f));
-        tangents.push_back(vec4(0.0f));
-    }
-
-    // Compute the tangent vector
-    for( GLuint i = 0; i < faces.size(); i += 3 )
-    {
-        const vec3 &p1 = points[faces[i]];
-        const vec3 &p2 = points[faces[i+1]];
-        const vec3 &p3 = points[faces[i+2]];
-
-        const vec2 &tc1 = texCoords[faces[i]];
-        const vec2 &tc2 = texCoords[faces[i+1]];
-        const vec2 &tc3 = texCoords[faces[i+2]];
-
-        vec3 q1 = p2 - p1;
-        vec3 q2 = p3 - p1;
-        float s1 = tc2.x - tc1.x, s2 = tc3.x - tc1.x;
-        float t1 = tc2.y - tc1.y, t2 = tc3.y - tc1.y;
-        float r = 1.0f / (s1 * t2 - s2 * t1);
-        vec3 tan1( (t2*q1.x - t1*q2.x) * r,
-                   (t2*q1.y - t1*q2.y) * r,
-                   (t2*q1.z - t1*q2.z) * r);
-        vec3 tan2( (s1*q2.x - s2*q1.x) * r,
-                   (s1*q2.y - s2*q1.y) * r,
-                   (s1*q2.z - s2*q1.z) * r);
-        tan1Accum[faces[i]] += tan1;
-        tan1Accum[faces[i+1]] += tan1;
-        tan1Accum[faces[i+2]] += tan1;
-        tan2Accum[faces[i]] += tan2;
-        tan2Accum[faces[i+1]] += tan2;
-        tan2Accum[faces[i+2]] += tan2;
-    }
-
-    for( GLuint i = 0; i < points.size(); ++i )
-    {
-        const vec3 &n = normals[i];
-        vec3 &t1 = tan1Accum[i];
-        vec3 &t2 = tan2Accum[i];
+    int nVerts = int(points.size());
+    int nTris = int(faces.size() / 3);
+    tangents.assign(nVerts, vec4(0.0f));
+
+    // Compute the tangent vectors of each triangle
+    vector<vec3> faceTan1(nTris), faceTan2(nTris);
+    Parallel::parallelFor(0, nTris, 4096, [&](int first, int last) {
+        for( int t = first; t < last; t++ ) {
+            const vec3 &p1 = points[faces[3*t]];
+            const vec3 &p2 = points[faces[3*t+1]];
+            const vec3 &p3 = points[faces[3*t+2]];
+
+            const vec2 &tc1 = texCoords[faces[3*t]];
+            const vec2 &tc2 = texCoords[faces[3*t+1]];
+            const vec2 &tc3 = texCoords[faces[3*t+2]];
+
+            vec3 q1 = p2 - p1;
+            vec3 q2 = p3 - p1;
+            float s1 = tc2.x - tc1.x, s2 = tc3.x - tc1.x;
+            float t1 = tc2.y - tc1.y, t2 = tc3.y - tc1.y;
+            float r = 1.0f / (s1 * t2 - s2 * t1);
+            faceTan1[t] = vec3( (t2*q1.x - t1*q2.x) * r,
+                                (t2*q1.y - t1*q2.y) * r,
+                                (t2*q1.z - t1*q2.z) * r);
+            faceTan2[t] = vec3( (s1*q2.x - s2*q1.x) * r,
+                                (s1*q2.y - s2*q1.y) * r,
+                                (s1*q2.z - s2*q1.z) * r);
+        }
+    });
+
+    vector<GLuint> faceStart, faceList;
+    MeshOptimize::buildVertexTriangles(faces.data(), faces.size(), nVerts, faceStart, faceList);
+    Parallel::parallelFor(0, nVerts, 4096, [&](int first, int last) {
+        for( int v = first; v < last; v++ ) {
+            vec3 t1(0.0f), t2(0.0f);
+            for( GLuint i = faceStart[v]; i < faceStart[v + 1]; i++ ) {
+                t1 += faceTan1[faceList[i]];
+                t2 += faceTan2[faceList[i]];
+            }
+            const vec3 &n = normals[v];
 
-        // Gram-Schmidt orthogonalize
-        tangents[i] = vec4(glm::normalize( t1 - (glm::dot(n,t1) * n) ), 0.0f);
-        // Store handedness in w
-        tangents[i].w = (glm::dot( glm::cross(n,t1), t2 ) < 0.0f) ? -1.0f : 1.0f;
-    }
-    tan1Accum.clear();
-    tan2Accum.clear();
+            // Gram-Schmidt orthogonalize
+            tangents[v] = vec4(glm::normalize( t1 - (glm::dot(n,t1) * n) ), 0.0f);
+            // Store handedness in w
+            tangents[v].w = (glm::dot( glm::cross(n,t1), t2 ) < 0.0f) ? -1.0f : 1.0f;
+        }
+    });
 }
 
 void VBOMeshAdj::storeVBO( const vector<vec3> & points,
@@ -388,48 +450,18 @@ void VBOMeshAdj::storeVBO( const vector<vec3> & points,
     GLuint nVerts  = GLuint(points.size());
     faces = GLuint(elements.size() / 6);
 
-    float * v = new float[3 * nVerts];
-    float * n = new float[3 * nVerts];
-    float * tc = NULL;
-    float * tang = NULL;
-
-    if(texCoords.size() > 0 && tangents.size() > 0) {
-        tc = new float[ 2 * nVerts];
-        tang = new float[4*nVerts];
-    }
+    // The vectors hold tightly packed floats already, so they are
+    // uploaded as they are, without copies.
+    static_assert(sizeof(vec3) == 3 * sizeof(float) && sizeof(vec2) == 2 * sizeof(float) &&
+                  sizeof(vec4) == 4 * sizeof(float), "glm vectors must be packed floats");
+    bool hasTc = texCoords.size() > 0 && tangents.size() > 0;
 
-    unsigned int *el = new unsigned int[elements.size()];
-    int idx = 0, tcIdx = 0, tangIdx = 0;
-    for( GLuint i = 0; i < nVerts; ++i )
-    {
-        v[idx] = points[i].x;
-        v[idx+1] = points[i].y;
-        v[idx+2] = points[i].z;
-        n[idx] = normals[i].x;
-        n[idx+1] = normals[i].y;
-        n[idx+2] = normals[i].z;
-        idx += 3;
-        if( tc != NULL ) {
-            tang[tangIdx] = tangents[i].x;
-            tang[tangIdx+1] = tangents[i].y;
-            tang[tangIdx+2] = tangents[i].z;
-            tang[tangIdx+3] = tangents[i].w;
-            tangIdx += 4;
-            tc[tcIdx] = texCoords[i].x;
-            tc[tcIdx+1] = texCoords[i].y;
-            tcIdx += 2;
-        }
-    }
-    for( unsigned int i = 0; i < elements.size(); ++i )
-    {
-        el[i] = elements[i];
-    }
     glGenVertexArrays( 1, &vaoHandle );
     glBindVertexArray(vaoHandle);
 
     int nBuffers = 5;
     GLuint elementBuffer = 4;
-    if( tc == NULL ) {
+    if( !hasTc ) {
         nBuffers = 3;
         elementBuffer = 2;
     }
@@ -438,39 +470,30 @@ void VBOMeshAdj::storeVBO( const vector<vec3> & points,
     glGenBuffers(nBuffers, handle);
 
     glBindBuffer(GL_ARRAY_BUFFER, handle[0]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * nVerts) * sizeof(float), v, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, (3 * nVerts) * sizeof(float), points.data(), GL_STATIC_DRAW);
     glVertexAttribPointer( (GLuint)0, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
     glEnableVertexAttribArray(0);  // Vertex position
 
     glBindBuffer(GL_ARRAY_BUFFER, handle[1]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * nVerts) * sizeof(float), n, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, (3 * nVerts) * sizeof(float), normals.data(), GL_STATIC_DRAW);
     glVertexAttribPointer( (GLuint)1, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
     glEnableVertexAttribArray(1);  // Vertex normal
 
-    if( tc != NULL ) {
+    if( hasTc ) {
         glBindBuffer(GL_ARRAY_BUFFER, handle[2]);
-        glBufferData(GL_ARRAY_BUFFER, (2 * nVerts) * sizeof(float), tc, GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, (2 * nVerts) * sizeof(float), texCoords.data(), GL_STATIC_DRAW);
         glVertexAttribPointer( (GLuint)2, 2, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
         glEnableVertexAttribArray(2);  // Texture coords
 
         glBindBuffer(GL_ARRAY_BUFFER, handle[3]);
-        glBufferData(GL_ARRAY_BUFFER, (4 * nVerts) * sizeof(float), tang, GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, (4 * nVerts) * sizeof(float), tangents.data(), GL_STATIC_DRAW);
         glVertexAttribPointer( (GLuint)3, 4, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
         glEnableVertexAttribArray(3);  // Tangent vector
     }
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle[elementBuffer]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * faces * sizeof(unsigned int), el, GL_STATIC_DRAW);
+    indexType = IndexBuffer::upload(handle[elementBuffer], elements.data(), 6 * faces, nVerts);
 
     glBindVertexArray(0);
-
-    delete [] v;
-    delete [] n;
-    if( tc != NULL ) {
-        delete [] tc;
-        delete [] tang;
-    }
-    delete [] el;
     printf("End storeVBO\n");
 }
 
@@ -21,8 +21,12 @@ class VBOMeshAdj : public Drawable
 private:
     GLuint faces;
     GLuint vaoHandle;
+    GLenum indexType;
+
+    struct OBJChunk;
 
     void trimString( string & str );
+    void parseOBJChunk( const string & text, size_t begin, size_t end, OBJChunk & chunk );
     void determineAdjacency(
             vector<GLuint> & el
             );
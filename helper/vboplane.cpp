@@ -1,5 +1,6 @@
 #include "vboplane.h"
 #include "glutils.h"
+#include "indexbuffer.h"
 #include "gldecl.h"
 
 #include <cstdio>
@@ -76,8 +77,7 @@ VBOPlane::VBOPlane(float xsize, float zsize, int xdivs, int zdivs, float smax, f
     glVertexAttribPointer( (GLuint)2, 2, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
     glEnableVertexAttribArray(2);  // Texture coords
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle[3]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * xdivs * zdivs * sizeof(unsigned int), el, GL_STATIC_DRAW);
+    indexType = IndexBuffer::upload(handle[3], el, 6 * xdivs * zdivs, (xdivs+1) * (zdivs+1));
 
     glBindVertexArray(0);
     
@@ -89,5 +89,5 @@ VBOPlane::VBOPlane(float xsize, float zsize, int xdivs, int zdivs, float smax, f
 
 void VBOPlane::render() const {
     glBindVertexArray(vaoHandle);
-    glDrawElements(GL_TRIANGLES, 6 * faces, GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
+    glDrawElements(GL_TRIANGLES, 6 * faces, indexType, ((GLubyte *)NULL + (0)));
 }
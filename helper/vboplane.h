@@ -7,6 +7,7 @@ class VBOPlane : public Drawable
 {
 private:
     unsigned int vaoHandle;
+    unsigned int indexType;   // GL_UNSIGNED_BYTE, _SHORT or _INT.
     int faces;
 
 public:
@@ -1,17 +1,57 @@
 #include "vboplanepatches.h"
+#include "parallel.h"
 #include "glutils.h"
+#include "indexbuffer.h"
+#include "mappedbuffer.h"
+#include "arena.h"
 #include "gldecl.h"
 
 #include <cstdio>
 #include <cmath>
+#include <algorithm>
 
-VBOPlanePatches::VBOPlanePatches(float xsize, float zsize, int xdivs, int zdivs, float smax, float tmax)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PLANEPATCHES_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+VBOPlanePatches::VBOPlanePatches(float xsize, float zsize, int xdivs, int zdivs, float smax, float tmax,
+                                 PatchType patchType, bool dynamic) :
+        xdivs(xdivs), zdivs(zdivs), dynamic(dynamic)
 {
     faces = xdivs * zdivs;
-    float * v = new float[3 * (xdivs + 1) * (zdivs + 1)];
-    float * n = new float[3 * (xdivs + 1) * (zdivs + 1)];
-    float * tex = new float[2 * (xdivs + 1) * (zdivs + 1)];
-    unsigned int * el = new unsigned int[6 * xdivs * zdivs];
+    patchVertices = (patchType == QUAD_PATCHES) ? 4 : 3;
+    indicesPerFace = (patchType == QUAD_PATCHES) ? 4 : 6;
+    int nVerts = (xdivs + 1) * (zdivs + 1);
+    GLenum usage = dynamic ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW;
+
+    unsigned int handle[4];
+    glGenBuffers(4, handle);
+    posHandle = handle[0];
+    normHandle = handle[1];
+
+    glGenVertexArrays( 1, &vaoHandle );
+    glBindVertexArray(vaoHandle);
+
+    // Vertices are written straight into the mapped buffers, except the
+    // positions and normals of dynamic planes, which go into the CPU copies
+    // they keep anyway and are uploaded from there. Indices are narrowed on
+    // upload, so they go to scratch memory first.
+    MappedBuffer vBuffer, nBuffer, texBuffer;
+    float * v, * n;
+    if( dynamic ) {
+        positions.resize(3 * nVerts);
+        normals.resize(3 * nVerts);
+        v = &positions[0];
+        n = &normals[0];
+    } else {
+        v = static_cast<float *>(vBuffer.map(GL_ARRAY_BUFFER, handle[0], 3 * nVerts * sizeof(float), usage));
+        n = static_cast<float *>(nBuffer.map(GL_ARRAY_BUFFER, handle[1], 3 * nVerts * sizeof(float), usage));
+    }
+    float * tex = static_cast<float *>(texBuffer.map(GL_ARRAY_BUFFER, handle[2], 2 * nVerts * sizeof(float)));
+
+    Arena::Scope scratchScope(Arena::scratch());
+    unsigned int * el = Arena::scratch().allocateArray<unsigned int>(indicesPerFace * xdivs * zdivs);
 
     float x2 = xsize / 2.0f;
     float z2 = zsize / 2.0f;
@@ -44,52 +84,276 @@ VBOPlanePatches::VBOPlanePatches(float xsize, float zsize, int xdivs, int zdivs,
         rowStart = i * (xdivs+1);
         nextRowStart = (i+1) * (xdivs+1);
         for( int j = 0; j < xdivs; j++ ) {
-            el[idx] = rowStart + j;
-            el[idx+1] = nextRowStart + j;
-            el[idx+2] = nextRowStart + j + 1;
-            el[idx+3] = rowStart + j;
-            el[idx+4] = nextRowStart + j + 1;
-            el[idx+5] = rowStart + j + 1;
-            idx += 6;
+            if( patchType == QUAD_PATCHES ) {
+                el[idx] = rowStart + j;
+                el[idx+1] = rowStart + j + 1;
+                el[idx+2] = nextRowStart + j + 1;
+                el[idx+3] = nextRowStart + j;
+                idx += 4;
+            } else {
+                el[idx] = rowStart + j;
+                el[idx+1] = nextRowStart + j;
+                el[idx+2] = nextRowStart + j + 1;
+                el[idx+3] = rowStart + j;
+                el[idx+4] = nextRowStart + j + 1;
+                el[idx+5] = rowStart + j + 1;
+                idx += 6;
+            }
         }
     }
 
-    unsigned int handle[4];
-    glGenBuffers(4, handle);
-
-    glGenVertexArrays( 1, &vaoHandle );
-    glBindVertexArray(vaoHandle);
+    if( dynamic ) {
+        restX.resize(nVerts);
+        restZ.resize(nVerts);
+        for( int i = 0; i < nVerts; i++ ) {
+            restX[i] = v[3*i];
+            restZ[i] = v[3*i+2];
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, handle[0]);
+        glBufferData(GL_ARRAY_BUFFER, 3 * nVerts * sizeof(float), v, usage);
+        glBindBuffer(GL_ARRAY_BUFFER, handle[1]);
+        glBufferData(GL_ARRAY_BUFFER, 3 * nVerts * sizeof(float), n, usage);
+    } else {
+        vBuffer.unmap();
+        nBuffer.unmap();
+    }
+    texBuffer.unmap();
 
     glBindBuffer(GL_ARRAY_BUFFER, handle[0]);
-    glBufferData(GL_ARRAY_BUFFER, 3 * (xdivs+1) * (zdivs+1) * sizeof(float), v, GL_STATIC_DRAW);
     glVertexAttribPointer( (GLuint)0, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
     glEnableVertexAttribArray(0);  // Vertex position
 
     glBindBuffer(GL_ARRAY_BUFFER, handle[1]);
-    glBufferData(GL_ARRAY_BUFFER, 3 * (xdivs+1) * (zdivs+1) * sizeof(float), n, GL_STATIC_DRAW);
     glVertexAttribPointer( (GLuint)1, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
     glEnableVertexAttribArray(1);  // Vertex normal
 
     glBindBuffer(GL_ARRAY_BUFFER, handle[2]);
-    glBufferData(GL_ARRAY_BUFFER, 2 * (xdivs+1) * (zdivs+1) * sizeof(float), tex, GL_STATIC_DRAW);
     glVertexAttribPointer( (GLuint)2, 2, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
     glEnableVertexAttribArray(2);  // Texture coords
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle[3]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * xdivs * zdivs * sizeof(unsigned int), el, GL_STATIC_DRAW);
+    indexType = IndexBuffer::upload(handle[3], el, indicesPerFace * xdivs * zdivs, nVerts);
 
     glBindVertexArray(0);
-    
-    delete [] v;
-    delete [] n;
-    delete [] tex;
-    delete [] el;
 }
 
 
 void VBOPlanePatches::render() const {
     glBindVertexArray(vaoHandle);
-    glPatchParameteri(GL_PATCH_VERTICES, 3);
-    glDrawElements(GL_PATCHES, 6 * faces, GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
+    glPatchParameteri(GL_PATCH_VERTICES, patchVertices);
+    glDrawElements(GL_PATCHES, indicesPerFace * faces, indexType, ((GLubyte *)NULL + (0)));
     //glDrawElements(GL_TRIANGLES, 6 * faces, GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
 }
+
+
+void VBOPlanePatches::updateControlPoints(const float *v, const float *n, int firstVertex, int numVertices)
+{
+    int nVerts = getNumVertices();
+    if( firstVertex < 0 ) {
+        numVertices += firstVertex;
+        firstVertex = 0;
+    }
+    numVertices = std::min(numVertices, nVerts - firstVertex);
+    if( numVertices <= 0 ) return;
+
+    GLintptr offset = 3 * firstVertex * sizeof(float);
+    GLsizeiptr size = 3 * numVertices * sizeof(float);
+
+    if( v != NULL ) {
+        if( dynamic && v != &positions[3 * firstVertex] )
+            std::copy(v, v + 3 * numVertices, positions.begin() + 3 * firstVertex);
+        glBindBuffer(GL_ARRAY_BUFFER, posHandle);
+        glBufferSubData(GL_ARRAY_BUFFER, offset, size, v);
+    }
+    if( n != NULL ) {
+        if( dynamic && n != &normals[3 * firstVertex] )
+            std::copy(n, n + 3 * numVertices, normals.begin() + 3 * firstVertex);
+        glBindBuffer(GL_ARRAY_BUFFER, normHandle);
+        glBufferSubData(GL_ARRAY_BUFFER, offset, size, n);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+void VBOPlanePatches::animateWaves(const PlaneWave *waves, int numWaves, float time,
+                                   int firstRow, int numRows)
+{
+    if( !dynamic ) {
+        fprintf(stderr, "Error: animateWaves() called on a static VBOPlanePatches.\n");
+        return;
+    }
+
+    int rows = getNumRows();
+    if( firstRow < 0 ) firstRow = 0;
+    if( numRows < 0 || firstRow + numRows > rows ) numRows = rows - firstRow;
+    if( numRows <= 0 ) return;
+
+    int rowVerts = getVerticesPerRow();
+    int first = firstRow * rowVerts;
+    int last = (firstRow + numRows) * rowVerts;
+
+    evaluateWaves(waves, numWaves, time, &restX[0], &restZ[0], &positions[0], &normals[0], first, last);
+    updateControlPoints(&positions[3 * first], &normals[3 * first], first, last - first);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Wave kernel.
+//
+// sin() is replaced by an odd polynomial on [-pi/2, pi/2] after range
+// reduction, so the scalar and SSE paths compute the same thing and the
+// SSE path needs no library calls. Max error is about 4e-6.
+/////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const float PI_F = 3.14159265358979f;
+const float HALF_PI_F = 1.57079632679490f;
+const float TWO_PI_F = 6.28318530717959f;
+const float INV_TWO_PI_F = 0.159154943091895f;
+
+const float SIN_C3 = -1.0f / 6.0f;
+const float SIN_C5 = 1.0f / 120.0f;
+const float SIN_C7 = -1.0f / 5040.0f;
+const float SIN_C9 = 1.0f / 362880.0f;
+
+inline float polySin(float x)
+{
+    float r = x - floorf(x * INV_TWO_PI_F + 0.5f) * TWO_PI_F;
+    if( r > HALF_PI_F ) r = PI_F - r;
+    else if( r < -HALF_PI_F ) r = -PI_F - r;
+    float r2 = r * r;
+    return r * (1.0f + r2 * (SIN_C3 + r2 * (SIN_C5 + r2 * (SIN_C7 + r2 * SIN_C9))));
+}
+
+void evaluateWavesScalar(const PlaneWave *waves, int numWaves, float time,
+                         const float *restX, const float *restZ,
+                         float *v, float *n, int first, int last)
+{
+    for( int i = first; i < last; i++ ) {
+        float x = restX[i], z = restZ[i];
+        float y = 0.0f, dydx = 0.0f, dydz = 0.0f;
+        for( int w = 0; w < numWaves; w++ ) {
+            const PlaneWave &wave = waves[w];
+            float phase = wave.kx * x + wave.kz * z + wave.speed * time;
+            float s = polySin(phase);
+            float c = polySin(phase + HALF_PI_F);
+            y += wave.amplitude * s;
+            dydx += wave.amplitude * wave.kx * c;
+            dydz += wave.amplitude * wave.kz * c;
+        }
+        float invLen = 1.0f / sqrtf(dydx * dydx + 1.0f + dydz * dydz);
+        v[3*i] = x;
+        v[3*i+1] = y;
+        v[3*i+2] = z;
+        n[3*i] = -dydx * invLen;
+        n[3*i+1] = invLen;
+        n[3*i+2] = -dydz * invLen;
+    }
+}
+
+#ifdef PLANEPATCHES_USE_SSE2
+inline __m128 polySin4(__m128 x)
+{
+    const __m128 pi = _mm_set1_ps(PI_F);
+    const __m128 halfPi = _mm_set1_ps(HALF_PI_F);
+    const __m128 negHalfPi = _mm_set1_ps(-HALF_PI_F);
+
+    __m128 k = _mm_cvtepi32_ps( _mm_cvtps_epi32( _mm_mul_ps(x, _mm_set1_ps(INV_TWO_PI_F)) ) );
+    __m128 r = _mm_sub_ps( x, _mm_mul_ps(k, _mm_set1_ps(TWO_PI_F)) );
+
+    __m128 gt = _mm_cmpgt_ps(r, halfPi);
+    r = _mm_or_ps( _mm_and_ps(gt, _mm_sub_ps(pi, r)), _mm_andnot_ps(gt, r) );
+    __m128 lt = _mm_cmplt_ps(r, negHalfPi);
+    r = _mm_or_ps( _mm_and_ps(lt, _mm_sub_ps(_mm_setzero_ps(), _mm_add_ps(pi, r))), _mm_andnot_ps(lt, r) );
+
+    __m128 r2 = _mm_mul_ps(r, r);
+    __m128 p = _mm_add_ps( _mm_set1_ps(SIN_C7), _mm_mul_ps(r2, _mm_set1_ps(SIN_C9)) );
+    p = _mm_add_ps( _mm_set1_ps(SIN_C5), _mm_mul_ps(r2, p) );
+    p = _mm_add_ps( _mm_set1_ps(SIN_C3), _mm_mul_ps(r2, p) );
+    p = _mm_add_ps( _mm_set1_ps(1.0f), _mm_mul_ps(r2, p) );
+    return _mm_mul_ps(r, p);
+}
+
+void evaluateWavesSSE(const PlaneWave *waves, int numWaves, float time,
+                      const float *restX, const float *restZ,
+                      float *v, float *n, int first, int last)
+{
+    const __m128 halfPi = _mm_set1_ps(HALF_PI_F);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 negZero = _mm_set1_ps(-0.0f);
+
+    int i = first;
+    for( ; i + 4 <= last; i += 4 ) {
+        __m128 x = _mm_loadu_ps(restX + i);
+        __m128 z = _mm_loadu_ps(restZ + i);
+        __m128 y = _mm_setzero_ps();
+        __m128 dydx = _mm_setzero_ps();
+        __m128 dydz = _mm_setzero_ps();
+
+        for( int w = 0; w < numWaves; w++ ) {
+            const PlaneWave &wave = waves[w];
+            __m128 phase = _mm_add_ps( _mm_add_ps( _mm_mul_ps(_mm_set1_ps(wave.kx), x),
+                                                   _mm_mul_ps(_mm_set1_ps(wave.kz), z) ),
+                                       _mm_set1_ps(wave.speed * time) );
+            __m128 s = polySin4(phase);
+            __m128 c = polySin4( _mm_add_ps(phase, halfPi) );
+            __m128 ac = _mm_mul_ps(_mm_set1_ps(wave.amplitude), c);
+            y = _mm_add_ps( y, _mm_mul_ps(_mm_set1_ps(wave.amplitude), s) );
+            dydx = _mm_add_ps( dydx, _mm_mul_ps(_mm_set1_ps(wave.kx), ac) );
+            dydz = _mm_add_ps( dydz, _mm_mul_ps(_mm_set1_ps(wave.kz), ac) );
+        }
+
+        __m128 lenSqr = _mm_add_ps( _mm_add_ps(_mm_mul_ps(dydx, dydx), _mm_mul_ps(dydz, dydz)), one );
+        __m128 invLen = _mm_div_ps( one, _mm_sqrt_ps(lenSqr) );
+        __m128 nx = _mm_xor_ps( _mm_mul_ps(dydx, invLen), negZero );
+        __m128 nz = _mm_xor_ps( _mm_mul_ps(dydz, invLen), negZero );
+
+        // Interleave into the xyz layout of the vertex buffers.
+        float ys[4], nxs[4], nys[4], nzs[4];
+        _mm_storeu_ps(ys, y);
+        _mm_storeu_ps(nxs, nx);
+        _mm_storeu_ps(nys, invLen);
+        _mm_storeu_ps(nzs, nz);
+        for( int k = 0; k < 4; k++ ) {
+            float *vk = v + 3 * (i + k);
+            float *nk = n + 3 * (i + k);
+            vk[0] = restX[i + k];
+            vk[1] = ys[k];
+            vk[2] = restZ[i + k];
+            nk[0] = nxs[k];
+            nk[1] = nys[k];
+            nk[2] = nzs[k];
+        }
+    }
+
+    evaluateWavesScalar(waves, numWaves, time, restX, restZ, v, n, i, last);
+}
+#endif
+
+} // namespace
+
+
+void VBOPlanePatches::evaluateWaves(const PlaneWave *waves, int numWaves, float time,
+                                    const float *restX, const float *restZ,
+                                    float *v, float *n, int first, int last,
+                                    bool useSimd, bool useThreads)
+{
+    std::function<void (int, int)> kernel;
+#ifdef PLANEPATCHES_USE_SSE2
+    if( useSimd ) {
+        kernel = [=](int begin, int end) {
+            evaluateWavesSSE(waves, numWaves, time, restX, restZ, v, n, begin, end);
+        };
+    }
+#endif
+    if( !kernel ) {
+        kernel = [=](int begin, int end) {
+            evaluateWavesScalar(waves, numWaves, time, restX, restZ, v, n, begin, end);
+        };
+    }
+
+    if( useThreads )
+        Parallel::parallelFor(first, last, 16384, kernel);
+    else
+        kernel(first, last);
+}
@@ -3,16 +3,72 @@
 
 #include "drawable.h"
 
+#include <vector>
+using std::vector;
+
+// One travelling sine wave used to animate the plane's control points:
+// y += amplitude * sin(kx * x + kz * z + speed * time).
+struct PlaneWave
+{
+    float amplitude;
+    float kx, kz;    // Wave vector in the xz-plane (radians per unit length).
+    float speed;     // Angular frequency (radians per second).
+};
+
 class VBOPlanePatches : public Drawable
 {
+public:
+    // TRIANGLE_PATCHES splits every grid cell into two 3-vertex patches.
+    // QUAD_PATCHES makes every cell one 4-vertex patch, with its corners
+    // in (u,v) order (0,0), (1,0), (1,1), (0,1) for a quads-domain TES.
+    enum PatchType { TRIANGLE_PATCHES, QUAD_PATCHES };
+
 private:
     unsigned int vaoHandle;
+    unsigned int indexType;   // GL_UNSIGNED_BYTE, _SHORT or _INT.
+    unsigned int posHandle, normHandle;
     int faces;
+    int patchVertices;     // 3 or 4.
+    int indicesPerFace;    // 6 or 4.
+    int xdivs, zdivs;
+    bool dynamic;
+
+    // CPU copies kept only for dynamic planes. The rest positions are
+    // stored as separate x and z arrays so the wave kernel can read them
+    // four at a time.
+    vector<float> restX, restZ;
+    vector<float> positions, normals;
 
 public:
-    VBOPlanePatches(float xsize, float zsize, int xdivs, int zdivs, float smax = 1.0f, float tmax = 1.0f);
+    VBOPlanePatches(float xsize, float zsize, int xdivs, int zdivs, float smax = 1.0f, float tmax = 1.0f,
+                    PatchType patchType = TRIANGLE_PATCHES, bool dynamic = false);
 
     void render() const;
+
+    int getPatchVertices() const { return patchVertices; }
+
+    int getNumVertices() const { return (xdivs + 1) * (zdivs + 1); }
+    int getNumRows() const { return zdivs + 1; }
+    int getVerticesPerRow() const { return xdivs + 1; }
+
+    // Replaces the positions and normals (3 floats each per vertex) of
+    // vertices [firstVertex, firstVertex + numVertices) and uploads only
+    // that range. Either pointer may be NULL to leave that attribute alone.
+    void updateControlPoints(const float *v, const float *n, int firstVertex, int numVertices);
+
+    // Displaces grid rows [firstRow, firstRow + numRows) by the sum of the
+    // given waves at the given time and uploads only those rows.
+    // numRows < 0 means "to the last row". Requires a dynamic plane.
+    void animateWaves(const PlaneWave *waves, int numWaves, float time,
+                      int firstRow = 0, int numRows = -1);
+
+    // CPU kernel behind animateWaves(). Evaluates vertices [first, last)
+    // of the rest pose (restX, restZ) into interleaved xyz positions and
+    // normals, in parallel and using SSE when available.
+    static void evaluateWaves(const PlaneWave *waves, int numWaves, float time,
+                              const float *restX, const float *restZ,
+                              float *v, float *n, int first, int last,
+                              bool useSimd = true, bool useThreads = true);
 };
 
 #endif // VBOPLANEPATCHES_H
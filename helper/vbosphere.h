@@ -8,6 +8,7 @@ class VBOSphere : public Drawable
 {
 private:
     unsigned int vaoHandle;
+    unsigned int indexType;   // GL_UNSIGNED_BYTE, _SHORT or _INT.
     GLuint nVerts, elements;
 	float radius;
 	GLuint slices, stacks;
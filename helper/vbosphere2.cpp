@@ -1,5 +1,6 @@
 #include "vbosphere2.h"
 #include "glutils.h"
+#include "indexbuffer.h"
 #include "gldecl.h"
 
 #include <cstdio>
@@ -40,8 +41,7 @@ VBOSphere2::VBOSphere2(float rad, GLuint sl, GLuint st) :
     glBindBuffer(GL_ARRAY_BUFFER, handle[2]);
     glBufferData(GL_ARRAY_BUFFER, (2 * nVerts) * sizeof(float), tex, GL_STATIC_DRAW);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle[3]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, elements * sizeof(unsigned int), el, GL_STATIC_DRAW);
+    indexType = IndexBuffer::upload(handle[3], el, elements, nVerts);
 
     delete [] v;
     delete [] n;
@@ -73,7 +73,7 @@ VBOSphere2::VBOSphere2(float rad, GLuint sl, GLuint st) :
 
 void VBOSphere2::render() const {
     glBindVertexArray(vaoHandle);
-    glDrawElements(GL_TRIANGLES, elements, GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
+    glDrawElements(GL_TRIANGLES, elements, indexType, ((GLubyte *)NULL + (0)));
 }
 
 
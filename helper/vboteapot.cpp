@@ -1,9 +1,21 @@
 #include "vboteapot.h"
 #include "teapotdata.h"
+#include "parallel.h"
 #include "glutils.h"
+#include "indexbuffer.h"
+#include "mappedbuffer.h"
+#include "arena.h"
 #include "gldecl.h"
 
 #include <cstdio>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEAPOT_USE_SSE2
+#include <emmintrin.h>
+#endif
 
 #include <glm/gtc/matrix_transform.hpp>
 using glm::mat4;
@@ -13,10 +25,6 @@ VBOTeapot::VBOTeapot(int grid, const mat4 & lidTransform)
 {
     int verts = 32 * (grid + 1) * (grid + 1);
     faces = grid * grid * 32;
-    float * v = new float[ verts * 3 ];
-    float * n = new float[ verts * 3 ];
-    float * tc = new float[ verts * 2 ];
-    unsigned int * el = new unsigned int[faces * 6];
 
     glGenVertexArrays( 1, &vaoHandle );
     glBindVertexArray(vaoHandle);
@@ -24,35 +32,52 @@ VBOTeapot::VBOTeapot(int grid, const mat4 & lidTransform)
     unsigned int handle[4];
     glGenBuffers(4, handle);
 
-    generatePatches( v, n, tc, el, grid );
-    moveLid(grid, v, lidTransform);
+    // generate() only writes, so it fills the mapped buffers directly. Its
+    // 32-bit indices go straight in too when that is the index type, and
+    // otherwise to scratch memory that IndexBuffer::upload() narrows.
+    MappedBuffer vBuffer(GL_ARRAY_BUFFER, handle[0], (3 * verts) * sizeof(float));
+    MappedBuffer nBuffer(GL_ARRAY_BUFFER, handle[1], (3 * verts) * sizeof(float));
+    MappedBuffer tcBuffer(GL_ARRAY_BUFFER, handle[2], (2 * verts) * sizeof(float));
+    MappedBuffer elBuffer;
+    Arena::Scope scratchScope(Arena::scratch());
+    indexType = IndexBuffer::selectType(verts);
+    unsigned int * el = (indexType == GL_UNSIGNED_INT)
+        ? static_cast<unsigned int *>(elBuffer.map(GL_ELEMENT_ARRAY_BUFFER, handle[3], (6 * faces) * sizeof(GLuint)))
+        : Arena::scratch().allocateArray<unsigned int>(6 * faces);
+
+    generate(grid, lidTransform, vBuffer.getArray<float>(), nBuffer.getArray<float>(),
+             tcBuffer.getArray<float>(), el);
+
+    vBuffer.unmap();
+    nBuffer.unmap();
+    tcBuffer.unmap();
+    if( indexType == GL_UNSIGNED_INT )
+        elBuffer.unmap();
+    else
+        IndexBuffer::upload(handle[3], el, 6 * faces, verts);
 
     glBindBuffer(GL_ARRAY_BUFFER, handle[0]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * verts) * sizeof(float), v, GL_STATIC_DRAW);
     glVertexAttribPointer( (GLuint)0, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
     glEnableVertexAttribArray(0);  // Vertex position
 
     glBindBuffer(GL_ARRAY_BUFFER, handle[1]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * verts) * sizeof(float), n, GL_STATIC_DRAW);
     glVertexAttribPointer( (GLuint)1, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
     glEnableVertexAttribArray(1);  // Vertex normal
 
     glBindBuffer(GL_ARRAY_BUFFER, handle[2]);
-    glBufferData(GL_ARRAY_BUFFER, (2 * verts) * sizeof(float), tc, GL_STATIC_DRAW);
     glVertexAttribPointer( (GLuint)2, 2, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
     glEnableVertexAttribArray(2);  // texture coords
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle[3]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * faces * sizeof(unsigned int), el, GL_STATIC_DRAW);
-
-    delete [] v;
-    delete [] n;
-    delete [] el;
-    delete [] tc;
-
     glBindVertexArray(0);
 }
 
+void VBOTeapot::generateReference(int grid, const mat4 &lidTransform,
+                                  float *v, float *n, float *tc, unsigned int *el)
+{
+    generatePatches( v, n, tc, el, grid );
+    moveLid(grid, v, lidTransform);
+}
+
 void VBOTeapot::generatePatches(float * v, float * n, float * tc, unsigned int* el, int grid) {
     float * B = new float[4*(grid+1)];  // Pre-computed Bernstein basis functions
     float * dB = new float[4*(grid+1)]; // Pre-computed derivitives of basis functions
@@ -269,7 +294,259 @@ vec3 VBOTeapot::evaluateNormal( int gridU, int gridV, float *B, float *dB, vec3
     return norm;
 }
 
+
+/////////////////////////////////////////////////////////////////////////////
+// Batched evaluator.
+//
+// Each sample row (fixed u) first collapses the 4x4 control net to the
+// four control points of the row's curve in v and of its u-derivative,
+// then evaluates those cubics at every v sample, four samples per SSE
+// register. The transposed basis tables make the four samples' weights
+// contiguous.
+/////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// One of the 32 patches, as generatePatches() builds them: a patch of
+// Teapot::patchdata, possibly mirrored in x and/or y.
+struct PatchInstance
+{
+    int patchNum;
+    bool reverseV;
+    float sx, sy;
+    bool invertNormal;
+};
+
+int buildPatchInstances(PatchInstance *out)
+{
+    int count = 0;
+    for( int patchNum = 0; patchNum < 10; patchNum++ ) {
+        bool reflectX = patchNum < 6;   // The handle and spout are only mirrored in y.
+        PatchInstance original = { patchNum, false, 1.0f, 1.0f, true };
+        out[count++] = original;
+        if( reflectX ) {
+            PatchInstance rx = { patchNum, true, -1.0f, 1.0f, false };
+            out[count++] = rx;
+        }
+        PatchInstance ry = { patchNum, true, 1.0f, -1.0f, false };
+        out[count++] = ry;
+        if( reflectX ) {
+            PatchInstance rxy = { patchNum, false, -1.0f, -1.0f, true };
+            out[count++] = rxy;
+        }
+    }
+    return count;
+}
+
+// Control points of one patch, already mirrored and (for the lid) moved,
+// plus the factor that makes cross(du, dv) point the way the reference
+// normals do.
+struct PreparedPatch
+{
+    float cp[4][4][3];
+    float normalSign;
+};
+
+struct RowCurves
+{
+    float c[4][3];   // The row's curve in v.
+    float d[4][3];   // Its derivative in u.
+};
+
+inline void rowCurves(const PreparedPatch &patch, const float *Bu, const float *dBu, RowCurves &rc)
+{
+    for( int k = 0; k < 4; k++ ) {
+        for( int c = 0; c < 3; c++ ) {
+            rc.c[k][c] = Bu[0] * patch.cp[0][k][c] + Bu[1] * patch.cp[1][k][c]
+                       + Bu[2] * patch.cp[2][k][c] + Bu[3] * patch.cp[3][k][c];
+            rc.d[k][c] = dBu[0] * patch.cp[0][k][c] + dBu[1] * patch.cp[1][k][c]
+                       + dBu[2] * patch.cp[2][k][c] + dBu[3] * patch.cp[3][k][c];
+        }
+    }
+}
+
+void evaluateRowScalar(const RowCurves &rc, float normalSign, const float *Bt, const float *dBt,
+                       int stride, int first, int last, float *v, float *n)
+{
+    for( int j = first; j < last; j++ ) {
+        float p[3], du[3], dv[3];
+        for( int c = 0; c < 3; c++ ) {
+            p[c] = du[c] = dv[c] = 0.0f;
+            for( int k = 0; k < 4; k++ ) {
+                p[c] += Bt[k * stride + j] * rc.c[k][c];
+                du[c] += Bt[k * stride + j] * rc.d[k][c];
+                dv[c] += dBt[k * stride + j] * rc.c[k][c];
+            }
+        }
+        float nx = du[1] * dv[2] - du[2] * dv[1];
+        float ny = du[2] * dv[0] - du[0] * dv[2];
+        float nz = du[0] * dv[1] - du[1] * dv[0];
+        float len = sqrtf(nx * nx + ny * ny + nz * nz);
+        float scale = (len != 0.0f) ? normalSign / len : normalSign;
+
+        v[3*j] = p[0];
+        v[3*j+1] = p[1];
+        v[3*j+2] = p[2];
+        n[3*j] = nx * scale;
+        n[3*j+1] = ny * scale;
+        n[3*j+2] = nz * scale;
+    }
+}
+
+#ifdef TEAPOT_USE_SSE2
+void evaluateRowSSE(const RowCurves &rc, float normalSign, const float *Bt, const float *dBt,
+                    int stride, int first, int last, float *v, float *n)
+{
+    int j = first;
+    for( ; j + 4 <= last; j += 4 ) {
+        __m128 p[3], du[3], dv[3];
+        for( int c = 0; c < 3; c++ )
+            p[c] = du[c] = dv[c] = _mm_setzero_ps();
+
+        for( int k = 0; k < 4; k++ ) {
+            __m128 b = _mm_loadu_ps(Bt + k * stride + j);
+            __m128 db = _mm_loadu_ps(dBt + k * stride + j);
+            for( int c = 0; c < 3; c++ ) {
+                __m128 cc = _mm_set1_ps(rc.c[k][c]);
+                p[c] = _mm_add_ps( p[c], _mm_mul_ps(b, cc) );
+                du[c] = _mm_add_ps( du[c], _mm_mul_ps(b, _mm_set1_ps(rc.d[k][c])) );
+                dv[c] = _mm_add_ps( dv[c], _mm_mul_ps(db, cc) );
+            }
+        }
+
+        __m128 nx = _mm_sub_ps( _mm_mul_ps(du[1], dv[2]), _mm_mul_ps(du[2], dv[1]) );
+        __m128 ny = _mm_sub_ps( _mm_mul_ps(du[2], dv[0]), _mm_mul_ps(du[0], dv[2]) );
+        __m128 nz = _mm_sub_ps( _mm_mul_ps(du[0], dv[1]), _mm_mul_ps(du[1], dv[0]) );
+        __m128 len = _mm_sqrt_ps( _mm_add_ps( _mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)),
+                                              _mm_mul_ps(nz, nz) ) );
+        // Degenerate normals (at the poles of the lid and bottom) stay zero.
+        __m128 sign = _mm_set1_ps(normalSign);
+        __m128 nonZero = _mm_cmpneq_ps(len, _mm_setzero_ps());
+        __m128 scale = _mm_or_ps( _mm_and_ps(nonZero, _mm_div_ps(sign, len)), _mm_andnot_ps(nonZero, sign) );
+
+        // Interleave into the xyz layout of the vertex buffers.
+        float px[4], py[4], pz[4], nxs[4], nys[4], nzs[4];
+        _mm_storeu_ps(px, p[0]);
+        _mm_storeu_ps(py, p[1]);
+        _mm_storeu_ps(pz, p[2]);
+        _mm_storeu_ps(nxs, _mm_mul_ps(nx, scale));
+        _mm_storeu_ps(nys, _mm_mul_ps(ny, scale));
+        _mm_storeu_ps(nzs, _mm_mul_ps(nz, scale));
+        for( int k = 0; k < 4; k++ ) {
+            float *vk = v + 3 * (j + k);
+            float *nk = n + 3 * (j + k);
+            vk[0] = px[k];
+            vk[1] = py[k];
+            vk[2] = pz[k];
+            nk[0] = nxs[k];
+            nk[1] = nys[k];
+            nk[2] = nzs[k];
+        }
+    }
+
+    evaluateRowScalar(rc, normalSign, Bt, dBt, stride, j, last, v, n);
+}
+#endif
+
+} // namespace
+
+
+void VBOTeapot::generate(int grid, const mat4 &lidTransform,
+                         float *v, float *n, float *tc, unsigned int *el,
+                         bool useSimd, bool useThreads)
+{
+    const int stride = grid + 1;
+    const int vertsPerPatch = stride * stride;
+
+    // Basis functions, indexed [sample][k] for u and transposed to
+    // [k][sample] for v.
+    std::vector<float> B(4 * stride), dB(4 * stride), Bt(4 * stride), dBt(4 * stride);
+    computeBasisFunctions(&B[0], &dB[0], grid);
+    for( int j = 0; j < stride; j++ ) {
+        for( int k = 0; k < 4; k++ ) {
+            Bt[k * stride + j] = B[j * 4 + k];
+            dBt[k * stride + j] = dB[j * 4 + k];
+        }
+    }
+
+    PatchInstance instances[32];
+    int numPatches = buildPatchInstances(instances);
+
+    // Patches 12 to 19 are the four copies of the two lid patches.
+    const mat3 lidLinear(lidTransform);
+    const float lidSign = (glm::determinant(lidLinear) < 0.0f) ? -1.0f : 1.0f;
+
+    PreparedPatch patches[32];
+    for( int p = 0; p < numPatches; p++ ) {
+        const PatchInstance &inst = instances[p];
+        vec3 cp[4][4];
+        getPatch(inst.patchNum, cp, inst.reverseV);
+        bool lid = (p >= 12 && p < 20);
+        for( int a = 0; a < 4; a++ ) {
+            for( int b = 0; b < 4; b++ ) {
+                vec3 q(inst.sx * cp[a][b].x, inst.sy * cp[a][b].y, cp[a][b].z);
+                if( lid ) q = vec3(lidTransform * vec4(q, 1.0f));
+                patches[p].cp[a][b][0] = q.x;
+                patches[p].cp[a][b][1] = q.y;
+                patches[p].cp[a][b][2] = q.z;
+            }
+        }
+        // Mirroring the control points flips cross(du, dv) once per axis.
+        float sign = inst.sx * inst.sy * (inst.invertNormal ? -1.0f : 1.0f);
+        patches[p].normalSign = lid ? sign * lidSign : sign;
+    }
+
+#ifdef TEAPOT_USE_SSE2
+    const bool simd = useSimd;
+#endif
+    const float tcFactor = 1.0f / grid;
+
+    // One work item per sample row of one patch.
+    auto kernel = [&](int begin, int end) {
+        for( int item = begin; item < end; item++ ) {
+            int p = item / stride;
+            int i = item % stride;
+            int base = p * vertsPerPatch + i * stride;
+
+            RowCurves rc;
+            rowCurves(patches[p], &B[i * 4], &dB[i * 4], rc);
+#ifdef TEAPOT_USE_SSE2
+            if( simd )
+                evaluateRowSSE(rc, patches[p].normalSign, &Bt[0], &dBt[0], stride, 0, stride,
+                               v + 3 * base, n + 3 * base);
+            else
+#endif
+                evaluateRowScalar(rc, patches[p].normalSign, &Bt[0], &dBt[0], stride, 0, stride,
+                                  v + 3 * base, n + 3 * base);
+
+            for( int j = 0; j < stride; j++ ) {
+                tc[2 * (base + j)] = i * tcFactor;
+                tc[2 * (base + j) + 1] = j * tcFactor;
+            }
+
+            if( i == grid ) continue;
+            unsigned int *e = el + p * 6 * grid * grid + i * 6 * grid;
+            unsigned int iStart = base, nextiStart = base + stride;
+            for( int j = 0; j < grid; j++ ) {
+                e[0] = iStart + j;
+                e[1] = nextiStart + j + 1;
+                e[2] = nextiStart + j;
+                e[3] = iStart + j;
+                e[4] = iStart + j + 1;
+                e[5] = nextiStart + j + 1;
+                e += 6;
+            }
+        }
+    };
+
+    int numItems = numPatches * stride;
+    if( useThreads )
+        Parallel::parallelFor(0, numItems, std::max(1, 4096 / stride), kernel);
+    else
+        kernel(0, numItems);
+}
+
 void VBOTeapot::render() const {
     glBindVertexArray(vaoHandle);
-    glDrawElements(GL_TRIANGLES, 6 * faces, GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
+    glDrawElements(GL_TRIANGLES, 6 * faces, indexType, ((GLubyte *)NULL + (0)));
 }
@@ -11,29 +11,49 @@ class VBOTeapot : public Drawable
 {
 private:
     unsigned int vaoHandle;
+    unsigned int indexType;   // GL_UNSIGNED_BYTE, _SHORT or _INT.
     unsigned int faces;
 
-    void generatePatches(float * v, float * n, float *tc, unsigned int* el, int grid);
-    void buildPatchReflect(int patchNum,
+    static void generatePatches(float * v, float * n, float *tc, unsigned int* el, int grid);
+    static void buildPatchReflect(int patchNum,
                            float *B, float *dB,
                            float *v, float *n, float *, unsigned int *el,
                            int &index, int &elIndex, int &, int grid,
                            bool reflectX, bool reflectY);
-    void buildPatch(vec3 patch[][4],
+    static void buildPatch(vec3 patch[][4],
                     float *B, float *dB,
                     float *v, float *n,float *, unsigned int *el,
                     int &index, int &elIndex, int &, int grid, mat3 reflect, bool invertNormal);
-    void getPatch( int patchNum, vec3 patch[][4], bool reverseV );
+    static void getPatch( int patchNum, vec3 patch[][4], bool reverseV );
 
-    void computeBasisFunctions( float * B, float * dB, int grid );
-    vec3 evaluate( int gridU, int gridV, float *B, vec3 patch[][4] );
-    vec3 evaluateNormal( int gridU, int gridV, float *B, float *dB, vec3 patch[][4] );
-    void moveLid(int,float *,const glm::mat4 &);
+    static void computeBasisFunctions( float * B, float * dB, int grid );
+    static vec3 evaluate( int gridU, int gridV, float *B, vec3 patch[][4] );
+    static vec3 evaluateNormal( int gridU, int gridV, float *B, float *dB, vec3 patch[][4] );
+    static void moveLid(int,float *,const glm::mat4 &);
 
 public:
     VBOTeapot(int grid, const glm::mat4& lidTransform);
 
     void render() const;
+
+    // Number of vertices and indices generate() writes for a given grid.
+    static int getNumVertices(int grid) { return 32 * (grid + 1) * (grid + 1); }
+    static int getNumIndices(int grid) { return 32 * 6 * grid * grid; }
+
+    // Evaluates all 32 patches on a (grid+1) x (grid+1) sample grid into
+    // positions and normals (3 floats per vertex), texture coordinates
+    // (2 floats) and triangle indices. Sample rows of all patches are spread
+    // over the worker threads and evaluated four at a time with SSE when
+    // available. The lid transform is applied to the lid's control points,
+    // which gives the same surface as transforming the evaluated points.
+    static void generate(int grid, const glm::mat4 &lidTransform,
+                         float *v, float *n, float *tc, unsigned int *el,
+                         bool useSimd = true, bool useThreads = true);
+
+    // The original point-by-point evaluator, kept as the reference that
+    // generate() is checked and benchmarked against.
+    static void generateReference(int grid, const glm::mat4 &lidTransform,
+                                  float *v, float *n, float *tc, unsigned int *el);
 };
 
 #endif // VBOTEAPOT_H
@@ -32,6 +32,47 @@ VBOTeapotPatch::VBOTeapotPatch()
     glBindVertexArray(0);
 }
 
+void VBOTeapotPatch::getControlPoints(float *v) {
+    generatePatches(v);
+}
+
+// Position and partial derivatives of one patch, as evaluatePatch() in the
+// TES computes them.
+static void evaluatePatch(const float *cp, float u, float v, vec3 &pos, vec3 &du, vec3 &dv)
+{
+    float su = 1.0f - u, sv = 1.0f - v;
+    float bu[4] = { su * su * su, 3.0f * su * su * u, 3.0f * su * u * u, u * u * u };
+    float dbu[4] = { -3.0f * su * su, 3.0f * su * su - 6.0f * su * u, 6.0f * su * u - 3.0f * u * u, 3.0f * u * u };
+    float bv[4] = { sv * sv * sv, 3.0f * sv * sv * v, 3.0f * sv * v * v, v * v * v };
+    float dbv[4] = { -3.0f * sv * sv, 3.0f * sv * sv - 6.0f * sv * v, 6.0f * sv * v - 3.0f * v * v, 3.0f * v * v };
+
+    pos = du = dv = vec3(0.0f);
+    for( int i = 0; i < 4; i++ ) {
+        for( int j = 0; j < 4; j++ ) {
+            vec3 p(cp[3 * (4 * i + j)], cp[3 * (4 * i + j) + 1], cp[3 * (4 * i + j) + 2]);
+            pos += bu[i] * bv[j] * p;
+            du += dbu[i] * bv[j] * p;
+            dv += bu[i] * dbv[j] * p;
+        }
+    }
+}
+
+void VBOTeapotPatch::evaluate(const float *cp, float u, float v, vec3 &position, vec3 &normal)
+{
+    vec3 du, dv;
+    evaluatePatch(cp, u, v, position, du, dv);
+
+    // Where a patch edge collapses to a point the normal is taken a little
+    // way inside, as in the TES.
+    normal = glm::cross(du, dv);
+    if( glm::dot(normal, normal) < 1.0e-12f ) {
+        vec3 innerPos;
+        evaluatePatch(cp, u + (0.5f - u) * 1.0e-3f, v + (0.5f - v) * 1.0e-3f, innerPos, du, dv);
+        normal = glm::cross(du, dv);
+    }
+    normal = glm::normalize(normal);
+}
+
 void VBOTeapotPatch::generatePatches(float * v) {
     int idx = 0;
 
@@ -12,18 +12,30 @@ class VBOTeapotPatch : public Drawable
 private:
     unsigned int vaoHandle;
 
-    void generatePatches(float * v);
-    void buildPatchReflect(int patchNum,
+    static void generatePatches(float * v);
+    static void buildPatchReflect(int patchNum,
                            float *v, int &index,
                            bool reflectX, bool reflectY);
-    void buildPatch(vec3 patch[][4],
+    static void buildPatch(vec3 patch[][4],
                     float *v, int &index, mat3 reflect);
-    void getPatch( int patchNum, vec3 patch[][4], bool reverseV );
+    static void getPatch( int patchNum, vec3 patch[][4], bool reverseV );
 
 public:
     VBOTeapotPatch();
 
+    // Draws the 32 patches of 16 control points each as GL_PATCHES, for
+    // the TeapotPatch tessellation shaders.
     void render() const;
+
+    static const int NUM_PATCHES = 32;
+
+    // Writes the 32 * 16 control points (xyz) in the order render() draws
+    // them: point (i, j) of patch p is at index 16 * p + 4 * i + j.
+    static void getControlPoints(float *v);
+
+    // CPU reference of TeapotPatch.tes.glsl: position and unit normal of a
+    // patch's 16 control points (xyz, as above) at (u, v) in [0,1]^2.
+    static void evaluate(const float *cp, float u, float v, vec3 &position, vec3 &normal);
 };
 
 #endif // VBOTEAPOTPATCH_H
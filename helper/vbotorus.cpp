@@ -1,5 +1,9 @@
 #include "vbotorus.h"
 #include "glutils.h"
+#include "indexbuffer.h"
+#include "meshoptimize.h"
+#include "mappedbuffer.h"
+#include "arena.h"
 #include "gldecl.h"
 
 #include <cstdio>
@@ -13,38 +17,37 @@ VBOTorus::VBOTorus(float outerRadius, float innerRadius, int nsides, int nrings)
     faces = sides * rings;
     int nVerts  = sides * (rings+1);   // One extra ring to duplicate first ring
 
-    // Verts
-    float * v = new float[3 * nVerts];
-    // Normals
-    float * n = new float[3 * nVerts];
-    // Tex coords
-    float * tex = new float[2 * nVerts];
-    // Elements
-    unsigned int * el = new unsigned int[6 * faces];
+    // The vertices are generated into scratch memory, since reordering
+    // them reads them back, and then written to the mapped buffers in
+    // their final order.
+    Arena & scratch = Arena::scratch();
+    Arena::Scope scratchScope(scratch);
+    float * v = scratch.allocateArray<float>(3 * nVerts);
+    float * n = scratch.allocateArray<float>(3 * nVerts);
+    float * tex = scratch.allocateArray<float>(2 * nVerts);
+    unsigned int * el = scratch.allocateArray<unsigned int>(6 * faces);
 
     // Generate the vertex data
     generateVerts(v, n, tex, el, outerRadius, innerRadius);
 
+    // Reorder for the post-transform cache and first-use vertex order
+    vector<unsigned int> remap, order;
+    MeshOptimize::optimizeMesh(el, 6 * faces, nVerts, remap);
+    MeshOptimize::invertRemap(remap, order);
+
     // Create and populate the buffer objects
     unsigned int handle[4];
     glGenBuffers(4, handle);
 
-    glBindBuffer(GL_ARRAY_BUFFER, handle[0]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * nVerts) * sizeof(float), v, GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ARRAY_BUFFER, handle[1]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * nVerts) * sizeof(float), n, GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ARRAY_BUFFER, handle[2]);
-    glBufferData(GL_ARRAY_BUFFER, (2 * nVerts) * sizeof(float), tex, GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle[3]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * faces * sizeof(unsigned int), el, GL_STATIC_DRAW);
+    const float * attributes[3] = { v, n, tex };
+    const int components[3] = { 3, 3, 2 };
+    for( int a = 0; a < 3; a++ ) {
+        MappedBuffer buffer(GL_ARRAY_BUFFER, handle[a], (components[a] * nVerts) * sizeof(float));
+        MeshOptimize::gatherVertexArray(attributes[a], buffer.getArray<float>(), components[a], nVerts, order);
+        buffer.unmap();
+    }
 
-    delete [] v;
-    delete [] n;
-    delete [] el;
-    delete [] tex;
+    indexType = IndexBuffer::upload(handle[3], el, 6 * faces, nVerts);
 
     // Create the VAO
     glGenVertexArrays( 1, &vaoHandle );
@@ -69,7 +72,7 @@ VBOTorus::VBOTorus(float outerRadius, float innerRadius, int nsides, int nrings)
 
 void VBOTorus::render() const {
     glBindVertexArray(vaoHandle);
-    glDrawElements(GL_TRIANGLES, 6 * faces, GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
+    glDrawElements(GL_TRIANGLES, 6 * faces, indexType, ((GLubyte *)NULL + (0)));
 }
 
 void VBOTorus::generateVerts(float * verts, float * norms, float * tex,
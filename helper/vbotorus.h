@@ -7,6 +7,7 @@ class VBOTorus : public Drawable
 {
 private:
     unsigned int vaoHandle;
+    unsigned int indexType;   // GL_UNSIGNED_BYTE, _SHORT or _INT.
     int faces, rings, sides;
 
     void generateVerts(float * , float * ,float *, unsigned int *,
@@ -4,6 +4,14 @@
 #include <cstdlib>
 #include <cstdio>
 #include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 using namespace std;
 
 #include <GL/glew.h>
@@ -17,15 +25,198 @@ using namespace std;
 #include "helper/trackball.h"
 #include "helper/glslprogram.h"
 #include "helper/vboplanepatches.h"
-
-// Shader program.
-GLSLProgram shaderProg;
-
-// The rectangular plane made of a 2D array of triangle patches.
-Drawable *planePatches = NULL;
-
-// Texture objects.
-GLuint texObjID[2] = { 0, 0 };
+#include "helper/vboteapotpatch.h"
+#include "helper/displacement.h"
+#include "helper/heightpyramid.h"
+#include "helper/normalbaker.h"
+#include "helper/envprefilter.h"
+#include "helper/lightclusters.h"
+#include "helper/shadowcascades.h"
+#include "helper/framebuffer.h"
+#include "helper/dynamicresolution.h"
+#include "helper/benchmarks.h"
+#include "helper/framestats.h"
+#include "helper/gpuprofiler.h"
+#include "helper/imagemetrics.h"
+#include "helper/sweep.h"
+#include "helper/stopwatch.h"
+#include "helper/spscqueue.h"
+#include "helper/parallel.h"
+#include "helper/jobsystem.h"
+#include "helper/processmemory.h"
+
+// Permutations of the ProcDispMap shader program. Each bit turns on a
+// preprocessor symbol in the shaders, so variants are selected at compile
+// time instead of by branching at run time.
+enum ProgramPermutation {
+    PERM_QUAD_PATCHES = 1 << 0,  // Quad patches instead of triangle patches.
+    PERM_TEAPOT       = 1 << 1,  // TeapotPatch vertex and tessellation shaders.
+    PERM_KERNEL_SHIFT = 2,       // Bits 2 and 3 hold the Displacement::Kernel,
+    PERM_KERNEL_MASK  = 3 << PERM_KERNEL_SHIFT, // which becomes DISPLACEMENT_KERNEL.
+    PERM_FEATURE_LOD  = 1 << 4,  // Tessellate only where the kernel displaces.
+    PERM_LOD_MORPH    = 1 << 5,  // Fade displacement out into normal perturbation with distance.
+    PERM_DEPTH_ONLY   = 1 << 6,  // Depth pre-pass: no geometry shader and an empty fragment shader.
+    PERM_CLUSTERED_LIGHTS = 1 << 7, // Point lights from the froxel grid on the wood.
+    PERM_SHADOWS      = 1 << 8   // Cascaded shadow maps of the directional light on the wood.
+};
+
+// Bits that only change shading, and so are left out of the depth-only
+// permutations.
+const unsigned int PERM_SHADING_MASK = PERM_CLUSTERED_LIGHTS | PERM_SHADOWS;
+
+// Displacement kernels, shared by the stages that displace or shade.
+const char *displacementLibraryFile = "Displacement.glsl";
+
+// Fragment shader of the PERM_DEPTH_ONLY permutations.
+const char *depthOnlyFragmentShaderFile = "DepthOnly.fs.glsl";
+
+// Compiled permutations, keyed by permutation bits.
+map<unsigned int, GLSLProgram *> programCache;
+
+// Shader program currently in use.
+GLSLProgram *shaderProg = NULL;
+
+// The skybox: a full-screen triangle at the far plane showing the
+// environment cubemap.
+const char *skyboxVertexShaderFile = "Skybox.vs.glsl";
+const char *skyboxFragmentShaderFile = "Skybox.fs.glsl";
+GLSLProgram *skyboxProg = NULL;
+
+// Full-screen triangles have no vertex buffers, but core profile draws
+// need a vertex array object bound.
+GLuint emptyVAO = 0;
+
+// How the wireframe is laid over the scene. INLINE blends it in
+// ProcDispMap.fs.glsl. COMPOSITED draws the scene into sceneTarget, whose
+// second render target holds each pixel's distance to the nearest edge,
+// and blends the lines in a full-screen pass; showing and hiding them then
+// changes a uniform of that pass, not the scene's program. With MSAA the
+// distances are averaged when resolved, which thins the lines along
+// silhouettes against the sky.
+enum WireframeOverlay { WIREFRAME_INLINE, WIREFRAME_COMPOSITED };
+WireframeOverlay wireframeOverlay = WIREFRAME_INLINE;
+Framebuffer *sceneTarget = NULL;
+const char *fullScreenVertexShaderFile = "FullScreen.vs.glsl";
+const char *wireframeCompositeShaderFile = "WireframeComposite.fs.glsl";
+GLSLProgram *wireframeCompositeProg = NULL;
+
+// Anti-aliasing. With msaaSamples above 1 the scene is drawn into a
+// multisampled sceneTarget and resolved with glBlitFramebuffer, into
+// resolveTarget if a later pass reads it or straight into the window
+// otherwise. useFXAA filters the finished image with Fxaa.fs.glsl on its
+// way to the window instead of, or as well as, MSAA. postTarget holds the
+// composited wireframe for FXAA to read.
+int msaaSamples = 1;
+int maxMsaaSamples = 8;  // GL_MAX_SAMPLES, up to 8.
+bool useFXAA = false;
+Framebuffer *resolveTarget = NULL;
+Framebuffer *postTarget = NULL;
+const char *fxaaShaderFile = "Fxaa.fs.glsl";
+GLSLProgram *fxaaProg = NULL;
+
+// Dynamic resolution. The scene is drawn at renderScale times the window's
+// width and height, renderWidth x renderHeight, and stretched over the
+// window at the end. With useDynamicResolution the scale is chosen each
+// frame by dynamicResolution from the GPU times of earlier frames, which
+// gpuFrameTimer measures. The TCS measures edges in the scaled pixels, so the
+// tessellation coarsens with the resolution. scaledTarget holds the last
+// pass's output when it is stretched afterwards.
+bool useDynamicResolution = false;
+float dynamicResolutionTargetMs = 16.7f;
+DynamicResolution *dynamicResolution = NULL;
+GpuFrameTimer *gpuFrameTimer = NULL;
+float frameScales[GpuFrameTimer::LATENCY];  // renderScale of the frames in flight.
+float renderScale = 1.0f;
+int renderWidth = 1024;
+int renderHeight = 768;
+Framebuffer *scaledTarget = NULL;
+
+// Opaque geometry is drawn first and the skybox last, where the depth test
+// leaves only the pixels nothing covers. Drawing it first instead, as a
+// background with depth testing off, shades every pixel of it and is kept
+// for comparison.
+bool drawSkyboxFirst = false;
+
+// Toggle a depth-only pass over the walls and the teapot before the shaded
+// pass, which then tests with GL_EQUAL and so runs the fragment shader once
+// per pixel however many tessellated surfaces overlap it.
+bool useDepthPrepass = false;
+
+// The rectangular plane made of a 2D array of triangle patches, or of quad
+// patches (one patch per grid cell), with planeDivisions cells per side.
+// Created on first use by GetPlanePatches() and kept, keyed by
+// planeDivisions * 2 + (1 for quads), so switching back and forth is free.
+int planeDivisions = 5;
+map<int, VBOPlanePatches *> planeCache;
+
+// Toggle between triangle and quad patches.
+bool useQuadPatches = false;
+
+// Toggle displacement-aware tessellation levels (FEATURE_LOD).
+bool useFeatureLOD = false;
+
+// Toggle fading the displacement out with distance (LOD_MORPH). It is full
+// where a mirror tile spans morphFullTilePixels pixels on screen and gone
+// at half of that, below which patches get tessellation level 1.
+bool useLodMorph = false;
+float morphFullTilePixels = 32.0f;
+
+// Point lights around the cube, lighting the wood through clustered
+// forward shading (CLUSTERED_LIGHTS). Every frame they are binned into a
+// froxel grid of clusterTilePixels-pixel screen tiles and clusterSlices
+// depth slices, and the lights and lists go to shader storage buffers.
+bool usePointLights = false;
+int numPointLights = 32;
+vector<LightClusters::PointLight> pointLights;  // World space.
+const int clusterTilePixels = 64;
+const int clusterSlices = 24;
+LightClusters::Clusters lightClusters;
+GLuint lightBufferIDs[3] = { 0, 0, 0 };  // Lights, cells and indices, at bindings 0, 1 and 2.
+
+// Cascaded shadow maps of the directional light (SHADOWS). The casters are
+// drawn with the PERM_DEPTH_ONLY programs, at the view's displacement but
+// with tessellation levels scaled by shadowTessLevelScale, into one layer
+// of a depth texture array per cascade, bound to Texture Unit 4.
+bool useShadows = false;
+float shadowTessLevelScale = 0.25f;
+const int shadowMapSize = 2048;
+const int numShadowCascades = 3;
+const float shadowDistance = 40.0f;        // Eye distance the cascades reach.
+const float shadowSplitLambda = 0.75f;     // 1 for logarithmic splits, 0 for uniform.
+const float shadowCasterDistance = 20.0f;  // How far towards the light casters are kept.
+ShadowCascades::Cascade shadowCascades[ShadowCascades::MAX_CASCADES];
+GLuint shadowMapTexID = 0;
+GLuint shadowFBO = 0;
+
+// The teapot as 32 bicubic Bezier patches, evaluated in the TES.
+VBOTeapotPatch *teapotPatch = NULL;
+
+// Toggle the teapot in the middle of the room.
+bool showTeapot = false;
+
+// Displacement kernel of the walls' material. The teapot's material always
+// has hemispherical mirrors.
+Displacement::Kernel wallKernel = Displacement::HEMISPHERES;
+
+// Waves that animate the plane's control points when animation is on.
+const PlaneWave planeWaves[2] = {
+    { 0.03f, 6.2832f, 0.0f, 2.0f },
+    { 0.02f, 3.1416f, 6.2832f, 3.0f }
+};
+
+// Height map of the heightfield kernel, and its min/max pyramid, which the
+// TCS reads to bound the displacement of a patch.
+const char *heightMapFile = "images/heightmap.png";
+Displacement::HeightMap heightMap;
+HeightPyramid heightPyramid;
+
+// Toggle between the environment cubemap prefiltered with Phong lobes and
+// the one with box-filtered mipmaps. The mirrors pick a level of either
+// from how fast their reflection vector changes across pixels.
+bool usePrefilteredEnvMap = true;
+
+// Texture objects. Index 4 is the prefiltered environment cubemap.
+GLuint texObjID[5] = { 0, 0, 0, 0, 0 };
 
 
 // Light info. Must be a point light.
@@ -34,6 +225,11 @@ const glm::vec3 lightAmbient  = glm::vec3(0.2f, 0.2f, 0.2f);
 const glm::vec3 lightDiffuse  = glm::vec3(1.0f, 1.0f, 1.0f);
 const glm::vec3 lightSpecular = glm::vec3(1.0f, 1.0f, 1.0f);
 
+// The projection. The froxel slices span its near and far planes.
+const float cameraFovY = 60.0f;  // Degrees.
+const float cameraNear = 0.5f;
+const float cameraFar = 100.0f;
+
 
 // For rendering window and viewport size.
 int winWidth = 1024;    // Window width in pixels.
@@ -43,6 +239,45 @@ int winHeight = 768;    // Window height in pixels.
 // Toggle between wireframe and no wireframe.
 bool showWireframe = true;
 
+// Toggle the wave animation of the plane's control points.
+bool animatePlane = false;
+
+// Tessellation and mirror parameters. Can be set from the command line.
+float tessEdgePixelLength = 20.0f;  // Desired pixel length of tessellated edges.
+float mirrorTileDensity = 3.0f;     // (0.0, inf)
+float mirrorRadius = 0.4f;          // In tile space; (0.0, 0.5]
+
+// Benchmark mode: no vsync, a scripted camera and frame-time statistics.
+bool benchmarkMode = false;
+int benchmarkFrames = 1200;       // Measured frames over the whole camera path.
+int benchmarkWarmupFrames = 60;   // Frames drawn at the start of the path before measuring.
+vector<float> benchmarkDepthPrepass(1, 0.0f);  // The path is run once per value, 0 or 1 for useDepthPrepass,
+vector<float> benchmarkMsaaSamples(1, 1.0f);   // and per value of msaaSamples for each.
+
+// GPU timing of the draw calls. Only created in benchmark mode.
+GpuProfiler *gpuProfiler = NULL;
+
+// Sweep mode: every combination of the parameter lists given on the command
+// line is rendered off-screen from a few fixed views, timed, and compared
+// with a reference image. The lists hold the single current value otherwise.
+bool sweepMode = false;
+vector<float> sweepTessEdgePixelLengths(1, tessEdgePixelLength);
+vector<float> sweepMirrorTileDensities(1, mirrorTileDensity);
+vector<float> sweepMirrorRadii(1, mirrorRadius);
+vector<float> sweepPlaneDivisions(1, (float)planeDivisions);
+vector<float> sweepFeatureLOD(1, 0.0f);  // 0 or 1 for useFeatureLOD.
+vector<float> sweepLodMorph(1, 0.0f);    // morphFullTilePixels, or 0 for LOD_MORPH off.
+const int sweepFramesPerView = 10;     // Timed frames per combination and view.
+const float sweepReferenceTessPixels = 1.0f;  // TessEdgePixelLength of the reference images.
+
+// Bake mode: the walls' displacement is baked into normal and height maps
+// of bakeSize x bakeSize texels, written to these files, without opening
+// a window.
+int bakeSize = 0;
+const int bakeSamplesPerAxis = 4;
+const char *bakedNormalFile = "images/baked_normal.png";
+const char *bakedHeightFile = "images/baked_height.png";
+
 // For trackball.
 double prevMouseX, prevMouseY;
 bool mouseLeftPressed;
@@ -54,6 +289,124 @@ float cam_eye[3], cam_lookat[3], cam_up[3];
 const float initial_cam_eye[3] = { 0.0f, 0.0f, 20.0f };  // World coordinates.
 const float initial_cam_lookat[3] = { 0.0f, 0.0f, 0.0f };  // World coordinates.
 
+// Everything that input changes, as one frame is to be drawn with it. The
+// GLFW callbacks, on the main thread, edit only inputState. Copies of it
+// are handed to whichever thread draws, which copies them into the
+// globals above with ApplySnapshot() before each frame. Benchmark and
+// sweep modes set the globals themselves.
+struct FrameSnapshot
+{
+    float cam_curr_quat[4];
+    float cam_eye[3], cam_lookat[3], cam_up[3];
+    int winWidth, winHeight;
+    bool showWireframe, animatePlane, showTeapot;
+    bool useFeatureLOD, useLodMorph, useQuadPatches, usePrefilteredEnvMap;
+    bool drawSkyboxFirst, useDepthPrepass, usePointLights, useShadows;
+    bool useFXAA, useDynamicResolution;
+    WireframeOverlay wireframeOverlay;
+    Displacement::Kernel wallKernel;
+    int msaaSamples;
+    bool quit;  // The render thread stops at this snapshot.
+};
+FrameSnapshot inputState;
+
+// Render thread. With useRenderThread the main thread only handles events
+// and passes a snapshot of inputState after each batch of them through
+// snapshotQueue. The render thread owns the GL context and draws with the
+// newest snapshot, so input is handled even while a frame takes long.
+bool useRenderThread = true;
+SpscQueue<FrameSnapshot> snapshotQueue(64);
+
+// The render thread sleeps on snapshotArrived while it has nothing to
+// draw. The main thread takes snapshotMutex after each push before
+// signalling, so a push cannot slip in between the render thread finding
+// the queue empty and going to sleep.
+std::mutex snapshotMutex;
+std::condition_variable snapshotArrived;
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Copy the globals that input changes into a snapshot, and back.
+/////////////////////////////////////////////////////////////////////////////
+static void CaptureSnapshot(FrameSnapshot &snapshot)
+{
+    memcpy(snapshot.cam_curr_quat, cam_curr_quat, sizeof(cam_curr_quat));
+    memcpy(snapshot.cam_eye, cam_eye, sizeof(cam_eye));
+    memcpy(snapshot.cam_lookat, cam_lookat, sizeof(cam_lookat));
+    memcpy(snapshot.cam_up, cam_up, sizeof(cam_up));
+    snapshot.winWidth = winWidth;
+    snapshot.winHeight = winHeight;
+    snapshot.showWireframe = showWireframe;
+    snapshot.animatePlane = animatePlane;
+    snapshot.showTeapot = showTeapot;
+    snapshot.useFeatureLOD = useFeatureLOD;
+    snapshot.useLodMorph = useLodMorph;
+    snapshot.useQuadPatches = useQuadPatches;
+    snapshot.usePrefilteredEnvMap = usePrefilteredEnvMap;
+    snapshot.drawSkyboxFirst = drawSkyboxFirst;
+    snapshot.useDepthPrepass = useDepthPrepass;
+    snapshot.usePointLights = usePointLights;
+    snapshot.useShadows = useShadows;
+    snapshot.useFXAA = useFXAA;
+    snapshot.useDynamicResolution = useDynamicResolution;
+    snapshot.wireframeOverlay = wireframeOverlay;
+    snapshot.wallKernel = wallKernel;
+    snapshot.msaaSamples = msaaSamples;
+    snapshot.quit = false;
+}
+
+
+static void ApplySnapshot(const FrameSnapshot &snapshot)
+{
+    // Dynamic resolution starts again from the full resolution.
+    if (snapshot.useDynamicResolution && !useDynamicResolution) dynamicResolution->reset(1.0f);
+
+    memcpy(cam_curr_quat, snapshot.cam_curr_quat, sizeof(cam_curr_quat));
+    memcpy(cam_eye, snapshot.cam_eye, sizeof(cam_eye));
+    memcpy(cam_lookat, snapshot.cam_lookat, sizeof(cam_lookat));
+    memcpy(cam_up, snapshot.cam_up, sizeof(cam_up));
+    winWidth = snapshot.winWidth;
+    winHeight = snapshot.winHeight;
+    showWireframe = snapshot.showWireframe;
+    animatePlane = snapshot.animatePlane;
+    showTeapot = snapshot.showTeapot;
+    useFeatureLOD = snapshot.useFeatureLOD;
+    useLodMorph = snapshot.useLodMorph;
+    useQuadPatches = snapshot.useQuadPatches;
+    usePrefilteredEnvMap = snapshot.usePrefilteredEnvMap;
+    drawSkyboxFirst = snapshot.drawSkyboxFirst;
+    useDepthPrepass = snapshot.useDepthPrepass;
+    usePointLights = snapshot.usePointLights;
+    useShadows = snapshot.useShadows;
+    useFXAA = snapshot.useFXAA;
+    useDynamicResolution = snapshot.useDynamicResolution;
+    wireframeOverlay = snapshot.wireframeOverlay;
+    wallKernel = snapshot.wallKernel;
+    msaaSamples = snapshot.msaaSamples;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Returns the plane with the given number of cells per side and patch
+// type, creating it on first use.
+/////////////////////////////////////////////////////////////////////////////
+static VBOPlanePatches *GetPlanePatches(int divisions, bool quads)
+{
+    int key = divisions * 2 + (quads ? 1 : 0);
+    map<int, VBOPlanePatches *>::iterator it = planeCache.find(key);
+    if (it != planeCache.end()) return it->second;
+
+    Stopwatch timer;
+    VBOPlanePatches *plane = new VBOPlanePatches(1.0, 1.0, divisions, divisions, 1.0f, 1.0f,
+        quads ? VBOPlanePatches::QUAD_PATCHES : VBOPlanePatches::TRIANGLE_PATCHES, true);
+    printf("Plane: %dx%d %s patches in %.1f ms\n", divisions, divisions,
+        quads ? "quad" : "triangle", timer.elapsedMs());
+    planeCache[key] = plane;
+    return plane;
+}
+
 
 
 /////////////////////////////////////////////////////////////////////////////
@@ -61,120 +414,494 @@ const float initial_cam_lookat[3] = { 0.0f, 0.0f, 0.0f };  // World coordinates.
 /////////////////////////////////////////////////////////////////////////////
 static void RenderObjects(const glm::mat4 &viewMat, const glm::mat4 &projMat)
 {
+    VBOPlanePatches *planePatches = GetPlanePatches(planeDivisions, useQuadPatches);
+
     const float cubeWidth = 10.0f;
     const float cubeHalfWidth = cubeWidth / 2.0f;
 
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, texObjID[0]);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texObjID[usePrefilteredEnvMap ? 4 : 0]);
 
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, texObjID[1]);
 
-    //shaderProg.setUniform("MatlAmbient", glm::vec3(0.75f, 0.75f, 1.0f));
-    //shaderProg.setUniform("MatlDiffuse", glm::vec3(0.75f, 0.75f, 1.0f));
-    shaderProg.setUniform("MatlSpecular", glm::vec3(1.0f, 1.0f, 1.0f));
-    shaderProg.setUniform("MatlShininess", 16.0f);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, texObjID[2]);
+
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, texObjID[3]);
+
+    //shaderProg->setUniform("MatlAmbient", glm::vec3(0.75f, 0.75f, 1.0f));
+    //shaderProg->setUniform("MatlDiffuse", glm::vec3(0.75f, 0.75f, 1.0f));
+    shaderProg->setUniform("MatlSpecular", glm::vec3(1.0f, 1.0f, 1.0f));
+    shaderProg->setUniform("MatlShininess", 16.0f);
+
+    // The six walls, each the unit plane moved out to one side of the cube.
+    glm::mat4 wallMats[6];
+    wallMats[0] = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, cubeHalfWidth, 0.0f));    // +y
+    wallMats[1] = glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -cubeHalfWidth, 0.0f)),
+                              glm::radians(180.0f), glm::vec3(1.0f, 0.0f, 0.0f));          // -y
+    wallMats[2] = glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(cubeHalfWidth, 0.0f, 0.0f)),
+                              glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));          // +x
+    wallMats[3] = glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(-cubeHalfWidth, 0.0f, 0.0f)),
+                              glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));           // -x
+    wallMats[4] = glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, cubeHalfWidth)),
+                              glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));           // +z
+    wallMats[5] = glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -cubeHalfWidth)),
+                              glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));          // -z
+
+    // Nearest wall first, so the depth test rejects the hidden fragments of
+    // the walls behind it before their expensive shading runs.
+    pair<float, int> order[6];
+    for (int w = 0; w < 6; w++) {
+        glm::vec4 ecCenter = viewMat * wallMats[w] * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        order[w] = make_pair(-ecCenter.z, w);
+    }
+    sort(order, order + 6);
 
-    {   // +y
-        glm::mat4 modelMat = glm::mat4(1.0f);
-        modelMat = glm::translate(modelMat, glm::vec3(0.0f, cubeHalfWidth, 0.0f));
-        modelMat = glm::scale(modelMat, glm::vec3(cubeWidth));
+    for (int i = 0; i < 6; i++) {
+        glm::mat4 modelMat = glm::scale(wallMats[order[i].second], glm::vec3(cubeWidth));
 
         glm::mat4 modelViewMat = viewMat * modelMat;
         glm::mat4 modelViewProjMat = projMat * modelViewMat;
         glm::mat3 normalMat = glm::transpose(glm::inverse(glm::mat3(modelViewMat)));
 
-        shaderProg.setUniform("ModelViewMatrix", modelViewMat);
-        shaderProg.setUniform("ModelViewProjMatrix", modelViewProjMat);
-        shaderProg.setUniform("NormalMatrix", normalMat);
+        shaderProg->setUniform("ModelViewMatrix", modelViewMat);
+        shaderProg->setUniform("ModelViewProjMatrix", modelViewProjMat);
+        shaderProg->setUniform("NormalMatrix", normalMat);
 
         planePatches->render();
     }
+}
 
-    {   // -y
-        glm::mat4 modelMat = glm::mat4(1.0f);
-        modelMat = glm::translate(modelMat, glm::vec3(0.0f, -cubeHalfWidth, 0.0f));
-        modelMat = glm::rotate(modelMat, glm::radians(180.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-        modelMat = glm::scale(modelMat, glm::vec3(cubeWidth));
 
-        glm::mat4 modelViewMat = viewMat * modelMat;
-        glm::mat4 modelViewProjMat = projMat * modelViewMat;
-        glm::mat3 normalMat = glm::transpose(glm::inverse(glm::mat3(modelViewMat)));
 
-        shaderProg.setUniform("ModelViewMatrix", modelViewMat);
-        shaderProg.setUniform("ModelViewProjMatrix", modelViewProjMat);
-        shaderProg.setUniform("NormalMatrix", normalMat);
+/////////////////////////////////////////////////////////////////////////////
+// Draw the skybox with the environment cubemap on Texture Unit 0. Drawn
+// last, it only passes the depth test where the depth buffer still holds
+// the cleared 1.0.
+/////////////////////////////////////////////////////////////////////////////
+static void RenderSkybox(const glm::mat4 &viewMat, const glm::mat4 &projMat, bool last)
+{
+    skyboxProg->use();
+    skyboxProg->setUniform("InvViewRotation", glm::transpose(glm::mat3(viewMat)));
+    skyboxProg->setUniform("InvProjScale", glm::vec2(1.0f / projMat[0][0], 1.0f / projMat[1][1]));
 
-        planePatches->render();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texObjID[usePrefilteredEnvMap ? 4 : 0]);
+
+    if (last) {
+        glDepthFunc(GL_LEQUAL);
+        glDepthMask(GL_FALSE);
+    }
+    else {
+        glDisable(GL_DEPTH_TEST);
     }
 
-    {   // +x
-        glm::mat4 modelMat = glm::mat4(1.0f);
-        modelMat = glm::translate(modelMat, glm::vec3(cubeHalfWidth, 0.0f, 0.0f));
-        modelMat = glm::rotate(modelMat, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-        modelMat = glm::scale(modelMat, glm::vec3(cubeWidth));
+    glBindVertexArray(emptyVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
 
-        glm::mat4 modelViewMat = viewMat * modelMat;
-        glm::mat4 modelViewProjMat = projMat * modelViewMat;
-        glm::mat3 normalMat = glm::transpose(glm::inverse(glm::mat3(modelViewMat)));
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    glEnable(GL_DEPTH_TEST);
+}
 
-        shaderProg.setUniform("ModelViewMatrix", modelViewMat);
-        shaderProg.setUniform("ModelViewProjMatrix", modelViewProjMat);
-        shaderProg.setUniform("NormalMatrix", normalMat);
 
-        planePatches->render();
+
+/////////////////////////////////////////////////////////////////////////////
+// Draw the teapot in the middle of the room. The current program must be
+// the PERM_TEAPOT permutation.
+/////////////////////////////////////////////////////////////////////////////
+static void RenderTeapot(const glm::mat4 &viewMat, const glm::mat4 &projMat)
+{
+    shaderProg->setUniform("MatlSpecular", glm::vec3(1.0f, 1.0f, 1.0f));
+    shaderProg->setUniform("MatlShininess", 16.0f);
+
+    // The teapot data is z-up with its base at z = 0 and is about 3 units tall.
+    glm::mat4 modelMat = glm::mat4(1.0f);
+    modelMat = glm::scale(modelMat, glm::vec3(1.5f));
+    modelMat = glm::rotate(modelMat, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+    modelMat = glm::translate(modelMat, glm::vec3(0.0f, 0.0f, -1.5f));
+
+    glm::mat4 modelViewMat = viewMat * modelMat;
+    glm::mat4 modelViewProjMat = projMat * modelViewMat;
+    glm::mat3 normalMat = glm::transpose(glm::inverse(glm::mat3(modelViewMat)));
+
+    shaderProg->setUniform("ModelViewMatrix", modelViewMat);
+    shaderProg->setUniform("ModelViewProjMatrix", modelViewProjMat);
+    shaderProg->setUniform("NormalMatrix", normalMat);
+
+    teapotPatch->render();
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Returns the ProcDispMap program for the given permutation bits,
+// compiling and linking it on first use.
+/////////////////////////////////////////////////////////////////////////////
+static GLSLProgram *GetProcDispMapProgram(unsigned int permutation)
+{
+    map<unsigned int, GLSLProgram *>::iterator it = programCache.find(permutation);
+    if (it != programCache.end()) return it->second;
+
+    char kernelDefine[64];
+    sprintf(kernelDefine, "#define DISPLACEMENT_KERNEL %u\n",
+            (permutation & PERM_KERNEL_MASK) >> PERM_KERNEL_SHIFT);
+
+    string defines;
+    if (permutation & PERM_QUAD_PATCHES) defines += "#define QUAD_PATCHES\n";
+    if (permutation & PERM_FEATURE_LOD) defines += "#define FEATURE_LOD\n";
+    if (permutation & PERM_LOD_MORPH) defines += "#define LOD_MORPH\n";
+    if (permutation & PERM_CLUSTERED_LIGHTS) defines += "#define CLUSTERED_LIGHTS\n";
+    if (permutation & PERM_SHADOWS) defines += "#define SHADOWS\n";
+    defines += kernelDefine;
+
+    // The teapot has its own front end (16-point Bezier patches) and shares
+    // the geometry and fragment shaders.
+    bool teapot = (permutation & PERM_TEAPOT) != 0;
+
+    // The depth pre-pass keeps the front end, so its positions are the same,
+    // and drops the stages that only feed shading.
+    bool depthOnly = (permutation & PERM_DEPTH_ONLY) != 0;
+
+    GLSLProgram *prog = new GLSLProgram();
+    try {
+        // The displacement library goes into the stages that call it, as
+        // source string 1 so compiler messages can be told apart.
+        string withLibrary = defines + "#line 1 1\n" + GLSLProgram::loadSource(displacementLibraryFile);
+
+        prog->setPreamble(defines);
+        prog->compileShader(teapot ? "TeapotPatch.vs.glsl" : "ProcDispMap.vs.glsl", GLSLShader::VERTEX);
+        prog->setPreamble(teapot ? defines : withLibrary);
+        prog->compileShader(teapot ? "TeapotPatch.tcs.glsl" : "ProcDispMap.tcs.glsl", GLSLShader::TESS_CONTROL);
+        prog->compileShader(teapot ? "TeapotPatch.tes.glsl" : "ProcDispMap.tes.glsl", GLSLShader::TESS_EVALUATION);
+        if (depthOnly) {
+            prog->setPreamble(defines);
+            prog->compileShader(depthOnlyFragmentShaderFile, GLSLShader::FRAGMENT);
+        }
+        else {
+            prog->setPreamble(defines);
+            prog->compileShader("ProcDispMap.gs.glsl", GLSLShader::GEOMETRY);
+            prog->setPreamble(withLibrary);
+            prog->compileShader("ProcDispMap.fs.glsl", GLSLShader::FRAGMENT);
+        }
+        prog->link();
+        prog->validate();
+    }
+    catch (GLSLProgramException &e) {
+        fprintf(stderr, "Error: %s.\n", e.what());
+        exit(EXIT_FAILURE);
     }
 
-    {   // -x
-        glm::mat4 modelMat = glm::mat4(1.0f);
-        modelMat = glm::translate(modelMat, glm::vec3(-cubeHalfWidth, 0.0f, 0.0f));
-        modelMat = glm::rotate(modelMat, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-        modelMat = glm::scale(modelMat, glm::vec3(cubeWidth));
+    programCache[permutation] = prog;
+    return prog;
+}
 
-        glm::mat4 modelViewMat = viewMat * modelMat;
-        glm::mat4 modelViewProjMat = projMat * modelViewMat;
-        glm::mat3 normalMat = glm::transpose(glm::inverse(glm::mat3(modelViewMat)));
 
-        shaderProg.setUniform("ModelViewMatrix", modelViewMat);
-        shaderProg.setUniform("ModelViewProjMatrix", modelViewProjMat);
-        shaderProg.setUniform("NormalMatrix", normalMat);
 
-        planePatches->render();
+/////////////////////////////////////////////////////////////////////////////
+// Create numPointLights coloured lights in a shell around the cube, the
+// same ones every run.
+/////////////////////////////////////////////////////////////////////////////
+static void SetUpPointLights()
+{
+    pointLights.resize(numPointLights);
+    unsigned int seed = 2024u;
+    for (int l = 0; l < numPointLights; l++) {
+        float r[5];
+        for (int i = 0; i < 5; i++) {
+            seed = seed * 1664525u + 1013904223u;
+            r[i] = (seed >> 8) / 16777216.0f;
+        }
+        float z = 2.0f * r[0] - 1.0f;
+        float phi = 6.2831853f * r[1];
+        float ring = sqrt(max(1.0f - z * z, 0.0f));
+        glm::vec3 dir(ring * cos(phi), ring * sin(phi), z);
+        pointLights[l].position = (6.0f + 3.0f * r[2]) * dir;
+        pointLights[l].radius = 3.0f + 2.0f * r[3];
+
+        // Saturated hues.
+        glm::vec3 hue = glm::vec3(0.0f, 1.0f / 3.0f, 2.0f / 3.0f) + r[4];
+        pointLights[l].color = 0.8f * (0.5f + 0.5f * glm::cos(6.2831853f * hue));
     }
+}
 
-    {   // +z
-        glm::mat4 modelMat = glm::mat4(1.0f);
-        modelMat = glm::translate(modelMat, glm::vec3(0.0f, 0.0f, cubeHalfWidth));
-        modelMat = glm::rotate(modelMat, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-        modelMat = glm::scale(modelMat, glm::vec3(cubeWidth));
 
-        glm::mat4 modelViewMat = viewMat * modelMat;
-        glm::mat4 modelViewProjMat = projMat * modelViewMat;
-        glm::mat3 normalMat = glm::transpose(glm::inverse(glm::mat3(modelViewMat)));
+// The froxel grid for the render resolution and projection.
+static LightClusters::Grid GetClusterGrid(const glm::mat4 &projMat)
+{
+    LightClusters::Grid grid = {
+        max(1, (renderWidth + clusterTilePixels - 1) / clusterTilePixels),
+        max(1, (renderHeight + clusterTilePixels - 1) / clusterTilePixels),
+        clusterSlices, cameraNear, cameraFar, projMat[0][0], projMat[1][1]
+    };
+    return grid;
+}
 
-        shaderProg.setUniform("ModelViewMatrix", modelViewMat);
-        shaderProg.setUniform("ModelViewProjMatrix", modelViewProjMat);
-        shaderProg.setUniform("NormalMatrix", normalMat);
 
-        planePatches->render();
+// Replaces the contents of a shader storage buffer and binds it. The
+// buffer never becomes empty, since an empty buffer cannot be bound.
+static void UploadStorageBuffer(GLuint bufferID, GLuint binding, const void *data, size_t bytes)
+{
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferID);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, max(bytes, (size_t)16), NULL, GL_STREAM_DRAW);
+    if (bytes > 0) glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, data);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, bufferID);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Bin the point lights, in eye space, into the froxel grid and upload the
+// lights, the froxels' offsets and counts, and the index lists.
+/////////////////////////////////////////////////////////////////////////////
+static void UpdateLightClusters(const glm::mat4 &viewMat, const glm::mat4 &projMat)
+{
+    vector<LightClusters::PointLight> ecLights(pointLights);
+    vector<glm::vec4> lightData(2 * pointLights.size());
+    for (size_t l = 0; l < pointLights.size(); l++) {
+        ecLights[l].position = glm::vec3(viewMat * glm::vec4(pointLights[l].position, 1.0f));
+        lightData[2 * l] = glm::vec4(ecLights[l].position, ecLights[l].radius);
+        lightData[2 * l + 1] = glm::vec4(ecLights[l].color, 1.0f);
     }
 
-    {   // -z
-        glm::mat4 modelMat = glm::mat4(1.0f);
-        modelMat = glm::translate(modelMat, glm::vec3(0.0f, 0.0f, -cubeHalfWidth));
-        modelMat = glm::rotate(modelMat, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-        modelMat = glm::scale(modelMat, glm::vec3(cubeWidth));
+    LightClusters::build(GetClusterGrid(projMat), ecLights, lightClusters);
 
-        glm::mat4 modelViewMat = viewMat * modelMat;
-        glm::mat4 modelViewProjMat = projMat * modelViewMat;
-        glm::mat3 normalMat = glm::transpose(glm::inverse(glm::mat3(modelViewMat)));
+    const vector<unsigned int> &cells = lightClusters.cells;
+    const vector<unsigned int> &indices = lightClusters.lightIndices;
+    UploadStorageBuffer(lightBufferIDs[0], 0, lightData.empty() ? NULL : &lightData[0],
+                        lightData.size() * sizeof(glm::vec4));
+    UploadStorageBuffer(lightBufferIDs[1], 1, cells.empty() ? NULL : &cells[0],
+                        cells.size() * sizeof(unsigned int));
+    UploadStorageBuffer(lightBufferIDs[2], 2, indices.empty() ? NULL : &indices[0],
+                        indices.size() * sizeof(unsigned int));
+}
 
-        shaderProg.setUniform("ModelViewMatrix", modelViewMat);
-        shaderProg.setUniform("ModelViewProjMatrix", modelViewProjMat);
-        shaderProg.setUniform("NormalMatrix", normalMat);
 
-        planePatches->render();
+
+/////////////////////////////////////////////////////////////////////////////
+// Set the uniforms that are the same for every object in the frame on the
+// current program.
+/////////////////////////////////////////////////////////////////////////////
+static void SetFrameUniforms(const glm::mat4 &viewMat, const glm::mat4 &projMat)
+{
+    shaderProg->setUniform("LightPosition", lightPosition);
+    shaderProg->setUniform("LightAmbient", lightAmbient);
+    shaderProg->setUniform("LightDiffuse", lightDiffuse);
+    shaderProg->setUniform("LightSpecular", lightSpecular);
+
+    shaderProg->setUniform("ViewMatrix", viewMat);
+    shaderProg->setUniform("ViewportWidth", (float)renderWidth);
+    shaderProg->setUniform("ViewportHeight", (float)renderHeight);
+    shaderProg->setUniform("FocalLengthPixels", 0.5f * renderHeight * projMat[1][1]);
+
+    shaderProg->setUniform("ShowWireframe", showWireframe && wireframeOverlay == WIREFRAME_INLINE);
+
+    shaderProg->setUniform("TessEdgePixelLength", tessEdgePixelLength);
+    shaderProg->setUniform("TessLevelScale", 1.0f);
+    shaderProg->setUniform("MorphFullTilePixels", morphFullTilePixels);
+    shaderProg->setUniform("MorphFlatTilePixels", 0.5f * morphFullTilePixels);
+
+    shaderProg->setUniform("MirrorTileDensity", mirrorTileDensity);
+    shaderProg->setUniform("MirrorRadius", mirrorRadius);
+
+    LightClusters::Grid grid = GetClusterGrid(projMat);
+    shaderProg->setUniform("ClusterGridSize", glm::vec3((float)grid.tilesX, (float)grid.tilesY, (float)grid.slices));
+    shaderProg->setUniform("ClusterProjScale", glm::vec2(grid.projScaleX, grid.projScaleY));
+    shaderProg->setUniform("ClusterNearZ", grid.nearZ);
+    shaderProg->setUniform("ClusterSliceScale", grid.slices / log(grid.farZ / grid.nearZ));
+
+    // Eye space to each cascade's texture coordinates and depth.
+    glm::mat4 invViewMat = glm::inverse(viewMat);
+    glm::mat4 biasMat = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)), glm::vec3(0.5f));
+    glm::vec4 splits(shadowDistance);
+    for (int c = 0; c < numShadowCascades; c++) {
+        char name[32];
+        sprintf(name, "ShadowMatrices[%d]", c);
+        shaderProg->setUniform(name, biasMat * shadowCascades[c].viewProj * invViewMat);
+        splits[c] = shadowCascades[c].farZ;
+    }
+    shaderProg->setUniform("ShadowSplits", splits);
+    shaderProg->setUniform("NumShadowCascades", numShadowCascades);
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Draw the walls and the teapot from the light into each cascade's layer
+// of the shadow map. shadowCascades must be up to date. The programs keep
+// the view's ModelViewMatrix, so they displace as the view does, while
+// ModelViewProjMatrix and the viewport are the cascade's; the TCS's levels
+// are scaled down on top of that.
+/////////////////////////////////////////////////////////////////////////////
+static void RenderShadowMaps(const glm::mat4 &viewMat, const glm::mat4 &projMat, unsigned int permutation)
+{
+    GLint prevFramebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prevFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowFBO);
+    glViewport(0, 0, shadowMapSize, shadowMapSize);
+
+    // Slope-scaled bias against self-shadowing.
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+
+    unsigned int depthPermutation = (permutation & ~PERM_SHADING_MASK) | PERM_DEPTH_ONLY;
+    glm::mat4 invViewMat = glm::inverse(viewMat);
+    for (int c = 0; c < numShadowCascades; c++) {
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowMapTexID, 0, c);
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        // RenderObjects() multiplies this by viewMat * modelMat.
+        glm::mat4 lightProjMat = shadowCascades[c].viewProj * invViewMat;
+
+        for (int pass = 0; pass < (showTeapot ? 2 : 1); pass++) {
+            shaderProg = GetProcDispMapProgram(pass == 0 ? depthPermutation : (PERM_TEAPOT | PERM_DEPTH_ONLY));
+            shaderProg->use();
+            SetFrameUniforms(viewMat, projMat);
+            shaderProg->setUniform("ViewportWidth", (float)shadowMapSize);
+            shaderProg->setUniform("ViewportHeight", (float)shadowMapSize);
+            shaderProg->setUniform("TessLevelScale", shadowTessLevelScale);
+            if (pass == 0)
+                RenderObjects(viewMat, lightProjMat);
+            else
+                RenderTeapot(viewMat, lightProjMat);
+        }
+    }
+
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glBindFramebuffer(GL_FRAMEBUFFER, prevFramebuffer);
+    glViewport(0, 0, renderWidth, renderHeight);
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Picks this frame's render scale and size. Dynamic resolution gets the
+// newest GPU frame time that has come back, with the scale that frame was
+// drawn at.
+/////////////////////////////////////////////////////////////////////////////
+static void UpdateRenderScale()
+{
+    double ms;
+    int frame;
+    if (gpuFrameTimer->poll(ms, frame) && useDynamicResolution)
+        renderScale = dynamicResolution->update(ms, frameScales[frame % GpuFrameTimer::LATENCY]);
+    if (!useDynamicResolution) renderScale = 1.0f;
+    frameScales[gpuFrameTimer->getCurrentFrame() % GpuFrameTimer::LATENCY] = renderScale;
+
+    renderWidth = max(1, (int)(winWidth * renderScale + 0.5f));
+    renderHeight = max(1, (int)(winHeight * renderScale + 0.5f));
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Returns target, (re)made at the render resolution with the given samples
+// and color attachments: the scene's color, then the distance to the
+// nearest edge for the composited wireframe.
+/////////////////////////////////////////////////////////////////////////////
+static Framebuffer *GetRenderTarget(Framebuffer *&target, int numColors, int samples)
+{
+    if (target == NULL) target = new Framebuffer();
+    if (!target->matches(renderWidth, renderHeight, samples) || target->getNumColors() != numColors) {
+        const GLenum formats[2] = { GL_RGBA8, GL_R16F };
+        if (!target->create(renderWidth, renderHeight, formats, numColors, samples)) {
+            fprintf(stderr, "Error: Framebuffer of %d x %d, %d samples is incomplete.\n",
+                renderWidth, renderHeight, samples);
+            exit(EXIT_FAILURE);
+        }
+    }
+    return target;
+}
+
+
+
+// Draws a triangle over the whole viewport with the program in use.
+static void DrawFullScreenTriangle()
+{
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(emptyVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glEnable(GL_DEPTH_TEST);
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Draw the scene's color, with the wireframe over it if shown, from the
+// scene's render target into the bound framebuffer.
+/////////////////////////////////////////////////////////////////////////////
+static void RenderWireframeComposite(const Framebuffer *target)
+{
+    wireframeCompositeProg->use();
+    wireframeCompositeProg->setUniform("ShowWireframe", showWireframe);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, target->getColorTexture(0));
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, target->getColorTexture(1));
+
+    DrawFullScreenTriangle();
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Takes the frame from sceneTarget to the framebuffer output: resolves its
+// samples, lays the wireframe over it and filters it with FXAA, each if on,
+// at the render resolution, and stretches the result over the window if
+// that is smaller.
+/////////////////////////////////////////////////////////////////////////////
+static void RenderPostProcess(GLuint windowOutput, bool composite)
+{
+    const Framebuffer *image = sceneTarget;
+
+    bool upscale = (renderWidth != winWidth || renderHeight != winHeight);
+    GLuint output = windowOutput;
+    if (upscale && (sceneTarget->getSamples() > 1 || composite || useFXAA))
+        output = GetRenderTarget(scaledTarget, 1, 1)->getID();
+
+    if (sceneTarget->getSamples() > 1) {
+        if (gpuProfiler) gpuProfiler->beginScope("gpu msaa resolve");
+        if (composite || useFXAA) {
+            Framebuffer *resolved = GetRenderTarget(resolveTarget, sceneTarget->getNumColors(), 1);
+            sceneTarget->resolveTo(*resolved);
+            image = resolved;
+        }
+        else sceneTarget->resolveTo(output);
+        if (gpuProfiler) gpuProfiler->endScope();
+    }
+
+    if (composite) {
+        if (useFXAA) GetRenderTarget(postTarget, 1, 1)->bind();
+        else glBindFramebuffer(GL_FRAMEBUFFER, output);
+        if (gpuProfiler) gpuProfiler->beginScope("gpu wireframe composite");
+        RenderWireframeComposite(image);
+        if (gpuProfiler) gpuProfiler->endScope();
+        if (useFXAA) image = postTarget;
     }
+
+    if (useFXAA) {
+        glBindFramebuffer(GL_FRAMEBUFFER, output);
+        if (gpuProfiler) gpuProfiler->beginScope("gpu fxaa");
+        fxaaProg->use();
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, image->getColorTexture(0));
+        DrawFullScreenTriangle();
+        if (gpuProfiler) gpuProfiler->endScope();
+    }
+
+    if (upscale) {
+        if (gpuProfiler) gpuProfiler->beginScope("gpu upscale");
+        (output == windowOutput ? sceneTarget : scaledTarget)->stretchTo(windowOutput, winWidth, winHeight);
+        if (gpuProfiler) gpuProfiler->endScope();
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, windowOutput);
+    glViewport(0, 0, winWidth, winHeight);
 }
 
 
@@ -184,17 +911,44 @@ static void RenderObjects(const glm::mat4 &viewMat, const glm::mat4 &projMat)
 /////////////////////////////////////////////////////////////////////////////
 static void MyDrawFunc(void)
 {
+    unsigned int permutation = 0;
+    if (useQuadPatches) permutation |= PERM_QUAD_PATCHES;
+    if (useFeatureLOD) permutation |= PERM_FEATURE_LOD;
+    if (useLodMorph) permutation |= PERM_LOD_MORPH;
+    if (usePointLights) permutation |= PERM_CLUSTERED_LIGHTS;
+    if (useShadows) permutation |= PERM_SHADOWS;
+    permutation |= (unsigned int)wallKernel << PERM_KERNEL_SHIFT;
+
+    shaderProg = GetProcDispMapProgram(permutation);
+    shaderProg->use();
+
+    UpdateRenderScale();
+
+    // The composited wireframe, anti-aliasing and a reduced resolution draw
+    // the scene off-screen first, then into whichever framebuffer was bound.
+    bool composite = (wireframeOverlay == WIREFRAME_COMPOSITED);
+    bool offscreen = composite || msaaSamples > 1 || useFXAA || renderScale != 1.0f;
+    GLint outputFramebuffer = 0;
+    if (offscreen) {
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &outputFramebuffer);
+        GetRenderTarget(sceneTarget, composite ? 2 : 1, msaaSamples)->bind();
+    }
+
     glEnable(GL_DEPTH_TEST);  // Need to use depth testing.
-    glViewport(0, 0, winWidth, winHeight); // Viewport for main window.
+    glViewport(0, 0, renderWidth, renderHeight); // Viewport for main window, or its scaled target.
 
     glClearColor(0.2, 0.3, 0.6, 1.0);  // Set background color.
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (composite) {
+        const GLfloat noEdge[4] = { 65504.0f, 0.0f, 0.0f, 0.0f };
+        glClearBufferfv(GL_COLOR, 1, noEdge);
+    }
 
     //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
     // Perspective projection matrix.
-    glm::mat4 projMat = glm::perspective(glm::radians(60.0f), (float)winWidth / winHeight, 0.5f, 100.0f);
+    glm::mat4 projMat = glm::perspective(glm::radians(cameraFovY), (float)winWidth / winHeight, cameraNear, cameraFar);
 
     // View transformation matrix.
     glm::mat4 viewMat = glm::lookAt(glm::vec3(cam_eye[0], cam_eye[1], cam_eye[2]),
@@ -212,51 +966,140 @@ static void MyDrawFunc(void)
     // The final view transformation has the additional rotation from trackball.
     viewMat = viewMat * camRotMat;
 
-    shaderProg.setUniform("LightPosition", lightPosition);
-    shaderProg.setUniform("LightAmbient", lightAmbient);
-    shaderProg.setUniform("LightDiffuse", lightDiffuse);
-    shaderProg.setUniform("LightSpecular", lightSpecular);
+    if (useShadows) {
+        // LightPosition is a direction in eye space.
+        glm::vec3 lightDir = glm::normalize(glm::transpose(glm::mat3(viewMat)) * glm::vec3(lightPosition));
+        ShadowCascades::computeCascades(viewMat, glm::radians(cameraFovY), (float)winWidth / winHeight,
+                                        cameraNear, shadowDistance, shadowSplitLambda, numShadowCascades,
+                                        lightDir, shadowMapSize, shadowCasterDistance, shadowCascades);
+    }
+
+    SetFrameUniforms(viewMat, projMat);
+
+    if (usePointLights) UpdateLightClusters(viewMat, projMat);
+
+    if (animatePlane) {
+        // Wrap the time so the wave phases keep their float precision.
+        float time = (float)fmod(glfwGetTime(), 1000.0);
+        GetPlanePatches(planeDivisions, useQuadPatches)->animateWaves(planeWaves, 2, time);
+    }
+
+    if (useShadows) {
+        if (gpuProfiler) gpuProfiler->beginScope("gpu shadow maps");
+        RenderShadowMaps(viewMat, projMat, permutation);
+        if (gpuProfiler) gpuProfiler->endScope();
 
-    shaderProg.setUniform("ViewMatrix", viewMat);
-    shaderProg.setUniform("ViewportWidth", (float)winWidth);
-    shaderProg.setUniform("ViewportHeight", (float)winHeight);
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMapTexID);
+        shaderProg = GetProcDispMapProgram(permutation);
+        shaderProg->use();
+    }
 
-    shaderProg.setUniform("ShowWireframe", showWireframe);
+    if (useDepthPrepass) {
+        // Same patches and tessellation as below, depth only.
+        if (gpuProfiler) gpuProfiler->beginScope("gpu depth pre-pass");
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        shaderProg = GetProcDispMapProgram((permutation & ~PERM_SHADING_MASK) | PERM_DEPTH_ONLY);
+        shaderProg->use();
+        SetFrameUniforms(viewMat, projMat);
+        RenderObjects(viewMat, projMat);
+        if (showTeapot) {
+            shaderProg = GetProcDispMapProgram(PERM_TEAPOT | PERM_DEPTH_ONLY);
+            shaderProg->use();
+            SetFrameUniforms(viewMat, projMat);
+            RenderTeapot(viewMat, projMat);
+        }
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        if (gpuProfiler) gpuProfiler->endScope();
 
-    const float mirrorTileDensity = 3.0f;  // (0.0, inf)
-    const float mirrorRadius = 0.4f;  // In tile space; (0.0, 0.5]
-    const float mirrorRadiusObjectSpace = (1.0f / mirrorTileDensity) * mirrorRadius;
+        shaderProg = GetProcDispMapProgram(permutation);
+        shaderProg->use();
+    }
 
-    shaderProg.setUniform("MirrorTileDensity", mirrorTileDensity);
-    shaderProg.setUniform("MirrorRadius", mirrorRadius);
-    shaderProg.setUniform("MirrorRadiusObjectSpace", mirrorRadiusObjectSpace);
+    if (drawSkyboxFirst) {
+        if (gpuProfiler) gpuProfiler->beginScope("gpu skybox");
+        RenderSkybox(viewMat, projMat, false);
+        if (gpuProfiler) gpuProfiler->endScope();
+        shaderProg->use();
+    }
 
+    if (useDepthPrepass) {
+        // Only the nearest fragment of each pixel passes. The depth buffer is
+        // already final.
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+    }
+
+    if (gpuProfiler) gpuProfiler->beginScope("gpu planes");
     RenderObjects(viewMat, projMat);
+    if (gpuProfiler) gpuProfiler->endScope();
+
+    if (showTeapot) {
+        shaderProg = GetProcDispMapProgram(PERM_TEAPOT | (permutation & PERM_SHADING_MASK));
+        shaderProg->use();
+        SetFrameUniforms(viewMat, projMat);
+        if (gpuProfiler) gpuProfiler->beginScope("gpu teapot");
+        RenderTeapot(viewMat, projMat);
+        if (gpuProfiler) gpuProfiler->endScope();
+    }
+
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+
+    if (!drawSkyboxFirst) {
+        if (gpuProfiler) gpuProfiler->beginScope("gpu skybox");
+        RenderSkybox(viewMat, projMat, true);
+        if (gpuProfiler) gpuProfiler->endScope();
+    }
+
+    if (offscreen) RenderPostProcess(outputFramebuffer, composite);
 }
 
 
 
 /////////////////////////////////////////////////////////////////////////////
-// Set up texture map from image file.
+// An image file decoded by stb_image. Decoding touches no GL state, so it
+// can run as a job; the texture is set up from it on the GL thread.
 /////////////////////////////////////////////////////////////////////////////
-static void SetUpTextureMapFromFile(const char *texMapFile, bool mipmap,
-                                    GLuint *texObjID = NULL, int *numColorChannels = NULL)
+struct DecodedImage
 {
-    // Enable flipping of images vertically when read in.
-    // This is to follow OpenGL's image coordinate system, i.e. bottom-leftmost is (0, 0).
-    stbi_set_flip_vertically_on_load(true);
+    const char *file;
+    GLubyte *data;  // NULL if the file could not be read.
+    int width, height, numComponents;
+};
 
-    // Read texture image from file.
+static DecodedImage MakeDecodedImage(const char *file)
+{
+    DecodedImage image = { file, NULL, 0, 0, 0 };
+    return image;
+}
+
+// The vertical flip of stbi_set_flip_vertically_on_load() must be set
+// before any decoding starts.
+static void DecodeImage(DecodedImage &image)
+{
+    image.data = stbi_load(image.file, &image.width, &image.height, &image.numComponents, 0);
+}
+
+static void FreeDecodedImage(DecodedImage &image)
+{
+    if (image.data != NULL) stbi_image_free(image.data);
+    image.data = NULL;
+}
 
-    int imgWidth, imgHeight, numComponents;
 
-    GLubyte *imgData = stbi_load(texMapFile, &imgWidth, &imgHeight, &numComponents, 0);
 
-    if (imgData == NULL) {
-        fprintf(stderr, "Error: Fail to read image file %s.\n", texMapFile);
+/////////////////////////////////////////////////////////////////////////////
+// Set up texture map from a decoded image file.
+/////////////////////////////////////////////////////////////////////////////
+static void SetUpTextureMapFromImage(const DecodedImage &image, bool mipmap,
+                                     GLuint *texObjID = NULL, int *numColorChannels = NULL)
+{
+    if (image.data == NULL) {
+        fprintf(stderr, "Error: Fail to read image file %s.\n", image.file);
         exit(EXIT_FAILURE);
     }
-    printf("%s (%d x %d, %d components)\n", texMapFile, imgWidth, imgHeight, numComponents);
+    printf("%s (%d x %d, %d components)\n", image.file, image.width, image.height, image.numComponents);
 
     GLuint tid;
     glGenTextures(1, &tid);
@@ -273,31 +1116,55 @@ static void SetUpTextureMapFromFile(const char *texMapFile, bool mipmap,
     const GLint texFormat[4] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
     const GLenum dataFormat[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
 
-    if (1 <= numComponents && numComponents <= 4) {
-        glTexImage2D(GL_TEXTURE_2D, 0, texFormat[numComponents - 1], imgWidth, imgHeight, 0,
-            dataFormat[numComponents - 1], GL_UNSIGNED_BYTE, imgData);
+    if (1 <= image.numComponents && image.numComponents <= 4) {
+        glTexImage2D(GL_TEXTURE_2D, 0, texFormat[image.numComponents - 1], image.width, image.height, 0,
+            dataFormat[image.numComponents - 1], GL_UNSIGNED_BYTE, image.data);
     }
     else {
         fprintf(stderr, "Error: Unexpected image format.\n");
         exit(EXIT_FAILURE);
     }
 
-    stbi_image_free(imgData);
-
     if (mipmap) glGenerateMipmap(GL_TEXTURE_2D);
 
     // Return these values.
     if (texObjID != NULL) *texObjID = tid;
-    if (numColorChannels != NULL) *numColorChannels = numComponents;
+    if (numColorChannels != NULL) *numColorChannels = image.numComponents;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Set up the min/max pyramid of a height map as an RG32F texture whose mip
+// levels are the pyramid's levels. It is read with texelFetch() only.
+/////////////////////////////////////////////////////////////////////////////
+static void SetUpHeightPyramid(const HeightPyramid &pyramid, GLuint *texObjID = NULL)
+{
+    GLuint tid;
+    glGenTextures(1, &tid);
+    glBindTexture(GL_TEXTURE_2D, tid);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, pyramid.getNumLevels() - 1);
+
+    for (int level = 0; level < pyramid.getNumLevels(); level++) {
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RG32F,
+            pyramid.getLevelWidth(level), pyramid.getLevelHeight(level), 0,
+            GL_RG, GL_FLOAT, pyramid.getLevelData(level));
+    }
+
+    if (texObjID != NULL) *texObjID = tid;
 }
 
 
 
 /////////////////////////////////////////////////////////////////////////////
-// Set up the environment cubemap.
+// Set up the environment cubemap from its decoded faces.
 /////////////////////////////////////////////////////////////////////////////
-static void SetUpCubeMapFromFiles(const char *cubeMapFile[6], bool mipmap,
-                                  GLuint *texObjID = NULL, int *numColorChannels = NULL)
+static void SetUpCubeMapFromImages(const DecodedImage faces[6], bool mipmap,
+                                   GLuint *texObjID = NULL, int *numColorChannels = NULL)
 {
     GLuint target[6] = {
         GL_TEXTURE_CUBE_MAP_POSITIVE_X, GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
@@ -315,36 +1182,29 @@ static void SetUpCubeMapFromFiles(const char *cubeMapFile[6], bool mipmap,
     else
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 
-    // Enable flipping of images vertically when read in.
-    // This is to follow OpenGL's image coordinate system, i.e. bottom-leftmost is (0, 0).
-    stbi_set_flip_vertically_on_load(true);
-
-    int imgWidth, imgHeight, numComponents;
+    int numComponents = 0;
 
-    // Read texture images from files.
     for (int t = 0; t < 6; t++) {
 
-        GLubyte *imgData = stbi_load(cubeMapFile[t], &imgWidth, &imgHeight, &numComponents, 0);
-
-        if (imgData == NULL) {
-            fprintf(stderr, "Error: Fail to read image file %s.\n", cubeMapFile[t]);
+        const DecodedImage &face = faces[t];
+        if (face.data == NULL) {
+            fprintf(stderr, "Error: Fail to read image file %s.\n", face.file);
             exit(EXIT_FAILURE);
         }
-        printf("%s (%d x %d, %d components)\n", cubeMapFile[t], imgWidth, imgHeight, numComponents);
+        printf("%s (%d x %d, %d components)\n", face.file, face.width, face.height, face.numComponents);
 
         const GLint texFormat[4] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
         const GLenum dataFormat[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
 
-        if (1 <= numComponents && numComponents <= 4) {
-            glTexImage2D(target[t], 0, texFormat[numComponents - 1], imgWidth, imgHeight, 0,
-                dataFormat[numComponents - 1], GL_UNSIGNED_BYTE, imgData);
+        if (1 <= face.numComponents && face.numComponents <= 4) {
+            glTexImage2D(target[t], 0, texFormat[face.numComponents - 1], face.width, face.height, 0,
+                dataFormat[face.numComponents - 1], GL_UNSIGNED_BYTE, face.data);
         }
         else {
             fprintf(stderr, "Error: Unexpected image format.\n");
             exit(EXIT_FAILURE);
         }
-
-        stbi_image_free(imgData);
+        numComponents = face.numComponents;
     }
 
     if (mipmap) glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
@@ -358,29 +1218,68 @@ static void SetUpCubeMapFromFiles(const char *cubeMapFile[6], bool mipmap,
 
 
 /////////////////////////////////////////////////////////////////////////////
-// The init function.
+// Prefilter the environment cubemap on the CPU, one Phong lobe width per
+// mip level (see helper/envprefilter.h). Touches no GL state, so it runs as
+// a job. Leaves levels empty if the faces are not square RGB(A) images of
+// one power-of-two size.
 /////////////////////////////////////////////////////////////////////////////
-static void MyInit()
+static void PrefilterCubeMap(const DecodedImage faces[6], vector<EnvPrefilter::Level> &levels, double &ms)
 {
-    // Set up shader program.
-    try {
-        shaderProg.compileShader("ProcDispMap.vs.glsl", GLSLShader::VERTEX);
-        shaderProg.compileShader("ProcDispMap.tcs.glsl", GLSLShader::TESS_CONTROL);
-        shaderProg.compileShader("ProcDispMap.tes.glsl", GLSLShader::TESS_EVALUATION);
-        shaderProg.compileShader("ProcDispMap.gs.glsl", GLSLShader::GEOMETRY);
-        shaderProg.compileShader("ProcDispMap.fs.glsl", GLSLShader::FRAGMENT);
-        shaderProg.link();
-        shaderProg.validate();
-        shaderProg.use();
+    levels.clear();
+    const unsigned char *faceData[6];
+    for (int t = 0; t < 6; t++) {
+        if (faces[t].data == NULL || faces[t].width != faces[t].height || faces[t].width != faces[0].width ||
+            faces[t].numComponents != faces[0].numComponents || faces[t].numComponents < 3) return;
+        faceData[t] = faces[t].data;
     }
-    catch (GLSLProgramException &e) {
-        fprintf(stderr, "Error: %s.\n", e.what());
+
+    Stopwatch timer;
+    EnvPrefilter::prefilter(faceData, faces[0].width, faces[0].numComponents, levels);
+    ms = timer.elapsedMs();
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Set up the prefiltered environment cubemap from PrefilterCubeMap()'s
+// levels.
+/////////////////////////////////////////////////////////////////////////////
+static void SetUpPrefilteredCubeMap(const vector<EnvPrefilter::Level> &levels, double ms, GLuint *texObjID = NULL)
+{
+    if (levels.empty()) {
+        fprintf(stderr, "Error: Cubemap faces must be square RGB images of one power-of-two size.\n");
         exit(EXIT_FAILURE);
     }
+    printf("Prefiltered environment: %d levels in %.1f ms\n", (int)levels.size(), ms);
 
-    // Create geometry of rectangular plane, 
-    // which is made of a 2D array of triangle patches.
-    planePatches = new VBOPlanePatches(1.0, 1.0, 5, 5);
+    GLuint tid;
+    glGenTextures(1, &tid);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, tid);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+
+    for (int level = 0; level < (int)levels.size(); level++) {
+        for (int t = 0; t < 6; t++) {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + t, level, GL_RGB8,
+                levels[level].size, levels[level].size, 0, GL_RGB, GL_FLOAT, &levels[level].faces[t][0]);
+        }
+    }
+
+    if (texObjID != NULL) *texObjID = tid;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// The init function.
+/////////////////////////////////////////////////////////////////////////////
+static void MyInit()
+{
+    // Decode the images, prefilter the cubemap and build the height pyramid
+    // as jobs, while the shaders compile below; GL calls stay on this
+    // thread, which helps with the jobs when it waits for their results.
+    JobSystem &jobs = Parallel::getJobSystem();
 
     // Cubemap images' filenames.
     const char *cubeMapFile[6] = {
@@ -389,13 +1288,161 @@ static void MyInit()
         "images/cm2_back.png", "images/cm2_front.png"
     };
 
+    // Enable flipping of images vertically when read in.
+    // This is to follow OpenGL's image coordinate system, i.e. bottom-leftmost is (0, 0).
+    stbi_set_flip_vertically_on_load(true);
+
+    DecodedImage cubeMapImages[6];
+    JobSystem::Counter cubeMapDecoded, cubeMapPrefiltered;
+    for (int t = 0; t < 6; t++) {
+        cubeMapImages[t] = MakeDecodedImage(cubeMapFile[t]);
+        jobs.run([&cubeMapImages, t]() { DecodeImage(cubeMapImages[t]); }, &cubeMapDecoded);
+    }
+
+    vector<EnvPrefilter::Level> envLevels;
+    double prefilterMs = 0.0;
+    jobs.runAfter(cubeMapDecoded, [&]() { PrefilterCubeMap(cubeMapImages, envLevels, prefilterMs); },
+                  &cubeMapPrefiltered);
+
+    DecodedImage woodImage = MakeDecodedImage("images/wood.png");
+    JobSystem::Counter woodDecoded;
+    jobs.run([&]() { DecodeImage(woodImage); }, &woodDecoded);
+
+    // The heightfield kernel reads a CPU copy of the height map's first
+    // channel, and the pyramid is built from that.
+    DecodedImage heightMapImage = MakeDecodedImage(heightMapFile);
+    JobSystem::Counter heightMapDone;
+    double pyramidMs = 0.0;
+    jobs.run([&]() {
+        DecodeImage(heightMapImage);
+        if (heightMapImage.data == NULL) return;
+        heightMap.set(heightMapImage.data, heightMapImage.width, heightMapImage.height,
+            heightMapImage.numComponents);
+        Stopwatch pyramidTimer;
+        heightPyramid.build(heightMap);
+        pyramidMs = pyramidTimer.elapsedMs();
+    }, &heightMapDone);
+
+    // Set up shader program.
+    shaderProg = GetProcDispMapProgram(0);
+    shaderProg->use();
+
+    // Create geometry of rectangular plane, 
+    // which is made of a 2D array of triangle patches,
+    // and the same plane made of quad patches.
+    GetPlanePatches(planeDivisions, false);
+    GetPlanePatches(planeDivisions, true);
+
+    // Create the teapot's Bezier control points.
+    teapotPatch = new VBOTeapotPatch();
+
+    // Set up the skybox.
+    skyboxProg = new GLSLProgram();
+    try {
+        skyboxProg->compileShader(skyboxVertexShaderFile, GLSLShader::VERTEX);
+        skyboxProg->compileShader(skyboxFragmentShaderFile, GLSLShader::FRAGMENT);
+        skyboxProg->link();
+    }
+    catch (GLSLProgramException &e) {
+        fprintf(stderr, "Error: %s.\n", e.what());
+        exit(EXIT_FAILURE);
+    }
+
+    wireframeCompositeProg = new GLSLProgram();
+    try {
+        wireframeCompositeProg->compileShader(fullScreenVertexShaderFile, GLSLShader::VERTEX);
+        wireframeCompositeProg->compileShader(wireframeCompositeShaderFile, GLSLShader::FRAGMENT);
+        wireframeCompositeProg->link();
+    }
+    catch (GLSLProgramException &e) {
+        fprintf(stderr, "Error: %s.\n", e.what());
+        exit(EXIT_FAILURE);
+    }
+
+    fxaaProg = new GLSLProgram();
+    try {
+        fxaaProg->compileShader(fullScreenVertexShaderFile, GLSLShader::VERTEX);
+        fxaaProg->compileShader(fxaaShaderFile, GLSLShader::FRAGMENT);
+        fxaaProg->link();
+    }
+    catch (GLSLProgramException &e) {
+        fprintf(stderr, "Error: %s.\n", e.what());
+        exit(EXIT_FAILURE);
+    }
+    glGenVertexArrays(1, &emptyVAO);
+
+    gpuFrameTimer = new GpuFrameTimer();
+    dynamicResolution = new DynamicResolution(DynamicResolution::defaultParams(dynamicResolutionTargetMs));
+
+    // Sample counts beyond what the driver supports fall back to the most
+    // it does.
+    GLint maxSamples = 1;
+    glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+    maxMsaaSamples = std::min(std::max((int)maxSamples, 1), 8);
+    if (msaaSamples > maxMsaaSamples) {
+        printf("MSAA: %d samples not supported, using %d\n", msaaSamples, maxMsaaSamples);
+        msaaSamples = maxMsaaSamples;
+    }
+
+    // Set up the shadow map: a depth texture array with a layer per cascade,
+    // filtered with depth comparison, and a framebuffer to render into it.
+    glGenTextures(1, &shadowMapTexID);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMapTexID);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, shadowMapSize, shadowMapSize,
+                 numShadowCascades, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    glGenFramebuffers(1, &shadowFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowFBO);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowMapTexID, 0, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Error: Shadow map framebuffer is incomplete.\n");
+        exit(EXIT_FAILURE);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // Set up the point lights and their shader storage buffers.
+    SetUpPointLights();
+    glGenBuffers(3, lightBufferIDs);
+
     // Set up environment cubemap.
     // To be bound to Texture Unit 0.
-    SetUpCubeMapFromFiles(cubeMapFile, true, &(texObjID[0]));
+    jobs.wait(cubeMapDecoded);
+    SetUpCubeMapFromImages(cubeMapImages, true, &(texObjID[0]));
+
+    // And its prefiltered version.
+    // To be bound to Texture Unit 0 instead when usePrefilteredEnvMap.
+    jobs.wait(cubeMapPrefiltered);
+    SetUpPrefilteredCubeMap(envLevels, prefilterMs, &(texObjID[4]));
+    for (int t = 0; t < 6; t++) FreeDecodedImage(cubeMapImages[t]);
+
+    // Blurred levels must blend across face edges.
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
     // Set up wood texture.
     // To be bound to Texture Unit 1.
-    SetUpTextureMapFromFile("images/wood.png", true, &(texObjID[1]));
+    jobs.wait(woodDecoded);
+    SetUpTextureMapFromImage(woodImage, true, &(texObjID[1]));
+    FreeDecodedImage(woodImage);
+
+    // Set up height map of the heightfield displacement kernel.
+    // To be bound to Texture Unit 2.
+    jobs.wait(heightMapDone);
+    SetUpTextureMapFromImage(heightMapImage, true, &(texObjID[2]));
+    FreeDecodedImage(heightMapImage);
+
+    // Set up its min/max pyramid.
+    // To be bound to Texture Unit 3.
+    printf("Height pyramid: %d levels in %.1f ms\n", heightPyramid.getNumLevels(), pyramidMs);
+    SetUpHeightPyramid(heightPyramid, &(texObjID[3]));
 
 
     // Initialization for trackball.
@@ -418,8 +1465,8 @@ static void MyInit()
 /////////////////////////////////////////////////////////////////////////////
 static void MyReshapeFunc(GLFWwindow *window, int w, int h)
 {
-    winWidth = w;
-    winHeight = h;
+    inputState.winWidth = w;
+    inputState.winHeight = h;
 }
 
 
@@ -437,19 +1484,80 @@ static void MyKeyboardFunc(GLFWwindow* window, int key, int scancode, int action
         }
         else if (key == GLFW_KEY_R) {
             // Reset the trackball.
-            trackball(cam_curr_quat, 0, 0, 0, 0);
-            cam_eye[0] = initial_cam_eye[0];
-            cam_eye[1] = initial_cam_eye[1];
-            cam_eye[2] = initial_cam_eye[2];
-            cam_lookat[0] = initial_cam_lookat[0];
-            cam_lookat[1] = initial_cam_lookat[1];
-            cam_lookat[2] = initial_cam_lookat[2];
-            cam_up[0] = 0.0f;
-            cam_up[1] = 1.0f;
-            cam_up[2] = 0.0f;
+            trackball(inputState.cam_curr_quat, 0, 0, 0, 0);
+            inputState.cam_eye[0] = initial_cam_eye[0];
+            inputState.cam_eye[1] = initial_cam_eye[1];
+            inputState.cam_eye[2] = initial_cam_eye[2];
+            inputState.cam_lookat[0] = initial_cam_lookat[0];
+            inputState.cam_lookat[1] = initial_cam_lookat[1];
+            inputState.cam_lookat[2] = initial_cam_lookat[2];
+            inputState.cam_up[0] = 0.0f;
+            inputState.cam_up[1] = 1.0f;
+            inputState.cam_up[2] = 0.0f;
         }
         else if (key == GLFW_KEY_W) {
-            showWireframe = !showWireframe;
+            inputState.showWireframe = !inputState.showWireframe;
+        }
+        else if (key == GLFW_KEY_A) {
+            inputState.animatePlane = !inputState.animatePlane;
+        }
+        else if (key == GLFW_KEY_L) {
+            inputState.useFeatureLOD = !inputState.useFeatureLOD;
+            printf("Displacement-aware tessellation: %s\n", inputState.useFeatureLOD ? "on" : "off");
+        }
+        else if (key == GLFW_KEY_B) {
+            inputState.drawSkyboxFirst = !inputState.drawSkyboxFirst;
+            printf("Skybox: drawn %s\n",
+                inputState.drawSkyboxFirst ? "first, without depth test" : "last, at depth 1.0");
+        }
+        else if (key == GLFW_KEY_C) {
+            inputState.usePointLights = !inputState.usePointLights;
+            printf("Point lights: %s\n", inputState.usePointLights ? "on" : "off");
+        }
+        else if (key == GLFW_KEY_O) {
+            inputState.wireframeOverlay =
+                (inputState.wireframeOverlay == WIREFRAME_INLINE) ? WIREFRAME_COMPOSITED : WIREFRAME_INLINE;
+            printf("Wireframe overlay: %s\n", inputState.wireframeOverlay == WIREFRAME_INLINE ? "inline" : "composited");
+        }
+        else if (key == GLFW_KEY_N) {
+            inputState.msaaSamples =
+                (inputState.msaaSamples >= maxMsaaSamples) ? 1 : inputState.msaaSamples * 2;
+            printf("MSAA: %d sample%s\n", inputState.msaaSamples, inputState.msaaSamples > 1 ? "s" : "");
+        }
+        else if (key == GLFW_KEY_D) {
+            inputState.useDynamicResolution = !inputState.useDynamicResolution;
+            printf("Dynamic resolution: %s\n", inputState.useDynamicResolution ? "on" : "off");
+        }
+        else if (key == GLFW_KEY_F) {
+            inputState.useFXAA = !inputState.useFXAA;
+            printf("FXAA: %s\n", inputState.useFXAA ? "on" : "off");
+        }
+        else if (key == GLFW_KEY_S) {
+            inputState.useShadows = !inputState.useShadows;
+            printf("Shadows: %s\n", inputState.useShadows ? "on" : "off");
+        }
+        else if (key == GLFW_KEY_Z) {
+            inputState.useDepthPrepass = !inputState.useDepthPrepass;
+            printf("Depth pre-pass: %s\n", inputState.useDepthPrepass ? "on" : "off");
+        }
+        else if (key == GLFW_KEY_E) {
+            inputState.usePrefilteredEnvMap = !inputState.usePrefilteredEnvMap;
+            printf("Environment map: %s\n", inputState.usePrefilteredEnvMap ? "prefiltered" : "box-filtered mipmaps");
+        }
+        else if (key == GLFW_KEY_M) {
+            inputState.useLodMorph = !inputState.useLodMorph;
+            printf("Distance morph to normal perturbation: %s\n", inputState.useLodMorph ? "on" : "off");
+        }
+        else if (key == GLFW_KEY_P) {
+            inputState.useQuadPatches = !inputState.useQuadPatches;
+            printf("Patch type: %s\n", inputState.useQuadPatches ? "quads" : "triangles");
+        }
+        else if (key == GLFW_KEY_T) {
+            inputState.showTeapot = !inputState.showTeapot;
+        }
+        else if (key == GLFW_KEY_K) {
+            inputState.wallKernel = (Displacement::Kernel)((inputState.wallKernel + 1) % Displacement::NUM_KERNELS);
+            printf("Displacement kernel: %s\n", Displacement::getKernelName(inputState.wallKernel));
         }
     }
 }
@@ -499,22 +1607,22 @@ static void MyMouseMotionFunc(GLFWwindow* window, double mouse_x, double mouse_y
     float transScale = 5.0f;
 
     if (mouseLeftPressed) {
-        trackball(cam_prev_quat, rotScale * (2.0f * prevMouseX - winWidth) / (float)winWidth,
-            rotScale * (winHeight - 2.0f * prevMouseY) / (float)winHeight,
-            rotScale * (2.0f * mouse_x - winWidth) / (float)winWidth,
-            rotScale * (winHeight - 2.0f * mouse_y) / (float)winHeight);
+        trackball(cam_prev_quat, rotScale * (2.0f * prevMouseX - inputState.winWidth) / (float)inputState.winWidth,
+            rotScale * (inputState.winHeight - 2.0f * prevMouseY) / (float)inputState.winHeight,
+            rotScale * (2.0f * mouse_x - inputState.winWidth) / (float)inputState.winWidth,
+            rotScale * (inputState.winHeight - 2.0f * mouse_y) / (float)inputState.winHeight);
 
-        add_quats(cam_prev_quat, cam_curr_quat, cam_curr_quat);
+        add_quats(cam_prev_quat, inputState.cam_curr_quat, inputState.cam_curr_quat);
     }
     else if (mouseMiddlePressed) {
-        cam_eye[0] -= transScale * (mouse_x - prevMouseX) / (float)winWidth;
-        cam_lookat[0] -= transScale * (mouse_x - prevMouseX) / (float)winWidth;
-        cam_eye[1] += transScale * (mouse_y - prevMouseY) / (float)winHeight;
-        cam_lookat[1] += transScale * (mouse_y - prevMouseY) / (float)winHeight;
+        inputState.cam_eye[0] -= transScale * (mouse_x - prevMouseX) / (float)inputState.winWidth;
+        inputState.cam_lookat[0] -= transScale * (mouse_x - prevMouseX) / (float)inputState.winWidth;
+        inputState.cam_eye[1] += transScale * (mouse_y - prevMouseY) / (float)inputState.winHeight;
+        inputState.cam_lookat[1] += transScale * (mouse_y - prevMouseY) / (float)inputState.winHeight;
     }
     else if (mouseRightPressed) {
-        cam_eye[2] += transScale * (mouse_y - prevMouseY) / (float)winHeight;
-        cam_lookat[2] += transScale * (mouse_y - prevMouseY) / (float)winHeight;
+        inputState.cam_eye[2] += transScale * (mouse_y - prevMouseY) / (float)inputState.winHeight;
+        inputState.cam_lookat[2] += transScale * (mouse_y - prevMouseY) / (float)inputState.winHeight;
     }
 
     // Update mouse point
@@ -524,6 +1632,476 @@ static void MyMouseMotionFunc(GLFWwindow* window, double mouse_x, double mouse_y
 
 
 
+/////////////////////////////////////////////////////////////////////////////
+// Benchmark mode.
+//
+// The camera follows a fixed path, parameterized by frame number rather
+// than by time, so every run draws exactly the same frames: a view of the
+// whole cube, an orbit, close-ups of a wall and a corner that drive the
+// tessellation to its maximum, and a pass through the inside of the cube.
+/////////////////////////////////////////////////////////////////////////////
+struct CameraKey
+{
+    float eye[3];
+    float lookat[3];
+};
+
+static const CameraKey benchmarkPath[] = {
+    { {   0.0f,  0.0f, 20.0f }, {  0.0f,  0.0f,  0.0f } },
+    { {  14.0f,  6.0f, 14.0f }, {  0.0f,  0.0f,  0.0f } },
+    { {  16.0f, -4.0f, -8.0f }, {  0.0f,  0.0f,  0.0f } },
+    { {   1.0f,  0.5f,  6.5f }, {  0.0f,  0.0f,  5.0f } },
+    { {   0.3f,  0.2f,  5.3f }, {  0.0f,  0.0f,  5.0f } },   // Wall close-up.
+    { {   0.0f,  0.0f,  0.0f }, {  5.0f,  0.0f,  0.0f } },   // Inside the cube.
+    { {  -2.0f, -2.0f, -2.0f }, { -5.0f, -5.0f, -5.0f } },
+    { {   5.4f,  5.4f,  5.4f }, {  5.0f,  5.0f,  5.0f } },   // Corner close-up.
+    { {   0.0f,  0.0f, 20.0f }, {  0.0f,  0.0f,  0.0f } }
+};
+
+static const int numBenchmarkKeys = sizeof(benchmarkPath) / sizeof(benchmarkPath[0]);
+
+
+// Places the camera at t in [0, 1] along the benchmark path.
+static void SetBenchmarkCamera(float t)
+{
+    float s = t * (numBenchmarkKeys - 1);
+    int k = (int)s;
+    if (k >= numBenchmarkKeys - 1) k = numBenchmarkKeys - 2;
+    float f = s - k;
+    f = f * f * (3.0f - 2.0f * f);  // Ease in and out of each key.
+
+    const CameraKey &a = benchmarkPath[k];
+    const CameraKey &b = benchmarkPath[k + 1];
+    for (int i = 0; i < 3; i++) {
+        cam_eye[i] = a.eye[i] + f * (b.eye[i] - a.eye[i]);
+        cam_lookat[i] = a.lookat[i] + f * (b.lookat[i] - a.lookat[i]);
+    }
+    cam_up[0] = 0.0f;
+    cam_up[1] = 1.0f;
+    cam_up[2] = 0.0f;
+    trackball(cam_curr_quat, 0, 0, 0, 0);
+}
+
+
+// Runs the camera path once with the current settings and prints its
+// frame and GPU times.
+static void RunBenchmarkPath(GLFWwindow *window, FrameStats &frameStats)
+{
+    gpuProfiler = new GpuProfiler();
+    frameStats.clear();
+    FrameStats scaleStats;
+    Stopwatch frameTimer;
+    dynamicResolution->reset(1.0f);
+
+    for (int frame = -benchmarkWarmupFrames; frame < benchmarkFrames; frame++) {
+        if (glfwWindowShouldClose(window)) break;
+        glfwPollEvents();
+
+        float t = (frame < 0) ? 0.0f : (float)frame / (benchmarkFrames - 1);
+        SetBenchmarkCamera(t);
+
+        // Frame time is measured from swap to swap. Without vsync the driver
+        // only lets the CPU run a few frames ahead, so this follows GPU
+        // throughput once the queue is full.
+        gpuProfiler->beginFrame();
+        gpuFrameTimer->begin();
+        MyDrawFunc();
+        gpuFrameTimer->end();
+        gpuProfiler->endFrame();
+        glfwSwapBuffers(window);
+
+        double ms = frameTimer.elapsedMs();
+        frameTimer.reset();
+        if (frame == -1) gpuProfiler->reset();  // Drop the warm-up frames.
+        if (frame >= 0) {
+            frameStats.addSample(ms);
+            scaleStats.addSample(renderScale);
+        }
+    }
+
+    gpuProfiler->flush();
+    frameStats.print("frame");
+    gpuProfiler->print();
+    if (useDynamicResolution && scaleStats.count() > 0) {
+        printf("render scale min %.2f  avg %.3f  max %.2f  (target %.1f ms)\n", scaleStats.minimum(),
+               scaleStats.average(), scaleStats.maximum(), dynamicResolutionTargetMs);
+    }
+
+    delete gpuProfiler;
+    gpuProfiler = NULL;
+}
+
+
+static void RunBenchmark(GLFWwindow *window)
+{
+    printf("Benchmark: %d x %d, %s patches%s, TessEdgePixelLength %g, MirrorTileDensity %g, "
+           "MirrorRadius %g, skybox %s, %d point lights, shadows %s, FXAA %s, dynamic resolution %s, "
+           "%d frames\n",
+           winWidth, winHeight, useQuadPatches ? "quad" : "triangle", showTeapot ? " + teapot" : "",
+           tessEdgePixelLength, mirrorTileDensity, mirrorRadius, drawSkyboxFirst ? "first" : "last",
+           usePointLights ? numPointLights : 0, useShadows ? "on" : "off", useFXAA ? "on" : "off",
+           useDynamicResolution ? "on" : "off", benchmarkFrames);
+
+    // One run per depth pre-pass setting and MSAA sample count, compared
+    // with the first at the end. A low -tesspixels shows the pre-pass at
+    // its best, with many overlapping triangles, and at its worst, paying
+    // the tessellation twice. The resolve's own cost is in the GPU report.
+    size_t numSamples = benchmarkMsaaSamples.size();
+    vector<FrameStats> runs(benchmarkDepthPrepass.size() * numSamples);
+    vector<string> names(runs.size());
+    for (size_t r = 0; r < runs.size(); r++) {
+        if (glfwWindowShouldClose(window)) break;
+        useDepthPrepass = (benchmarkDepthPrepass[r / numSamples] != 0.0f);
+        msaaSamples = std::min((int)benchmarkMsaaSamples[r % numSamples], maxMsaaSamples);
+        char name[64];
+        sprintf(name, "Depth pre-pass %s, MSAA %dx", useDepthPrepass ? "on" : "off", msaaSamples);
+        names[r] = name;
+        if (runs.size() > 1) printf("%s:\n", name);
+        RunBenchmarkPath(window, runs[r]);
+    }
+
+    for (size_t r = 1; r < runs.size(); r++) {
+        if (runs[r].count() == 0 || runs[0].count() == 0) break;
+        printf("%s vs %s: avg %.3f vs %.3f ms (%+.1f%%), p95 %.3f vs %.3f ms\n",
+               names[r].c_str(), names[0].c_str(), runs[r].average(), runs[0].average(),
+               100.0 * (runs[r].average() / runs[0].average() - 1.0),
+               runs[r].percentile(95.0), runs[0].percentile(95.0));
+    }
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Sweep mode.
+//
+// Renders into an off-screen framebuffer of the window's size, from the
+// whole-cube view and the three close-ups of the benchmark path, with the
+// wireframe and the animation off. For each combination of MirrorTileDensity
+// and MirrorRadius the reference images are drawn with the finest plane and
+// TessEdgePixelLength sweepReferenceTessPixels; every combination of
+// TessEdgePixelLength and plane subdivision is then timed and compared with
+// them. Triangle counts come from GL_PRIMITIVES_GENERATED, so they are what
+// the geometry shader emits.
+/////////////////////////////////////////////////////////////////////////////
+static const int sweepViews[] = { 0, 4, 5, 7 };  // Keys of benchmarkPath.
+static const int numSweepViews = sizeof(sweepViews) / sizeof(sweepViews[0]);
+
+
+// Draws the current settings from the given benchmark key into the bound
+// framebuffer, numFrames times after one untimed frame, and reads back the
+// last image. Returns the average GPU time and primitive count per frame.
+static void RenderSweepView(int view, int numFrames, double *gpuMs, double *triangles,
+                            vector<unsigned char> &image)
+{
+    GLuint queries[2];
+    glGenQueries(2, queries);
+
+    SetBenchmarkCamera((float)sweepViews[view] / (numBenchmarkKeys - 1));
+    MyDrawFunc();  // Compiles the program and creates the plane if needed.
+
+    double totalNs = 0.0, totalPrimitives = 0.0;
+    for (int frame = 0; frame < numFrames; frame++) {
+        glBeginQuery(GL_TIME_ELAPSED, queries[0]);
+        glBeginQuery(GL_PRIMITIVES_GENERATED, queries[1]);
+        MyDrawFunc();
+        glEndQuery(GL_PRIMITIVES_GENERATED);
+        glEndQuery(GL_TIME_ELAPSED);
+
+        GLuint64 ns = 0, primitives = 0;
+        glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &ns);
+        glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &primitives);
+        totalNs += (double)ns;
+        totalPrimitives += (double)primitives;
+    }
+    glDeleteQueries(2, queries);
+
+    if (gpuMs != NULL) *gpuMs = totalNs / numFrames * 1.0e-6;
+    if (triangles != NULL) *triangles = totalPrimitives / numFrames;
+
+    image.resize((size_t)winWidth * winHeight * 4);
+    glReadPixels(0, 0, winWidth, winHeight, GL_RGBA, GL_UNSIGNED_BYTE, &image[0]);
+}
+
+
+static void RunSweep(GLFWwindow *window)
+{
+    // Off-screen target, since the window is hidden.
+    GLuint fbo, colorRB, depthRB;
+    glGenRenderbuffers(1, &colorRB);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorRB);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, winWidth, winHeight);
+    glGenRenderbuffers(1, &depthRB);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthRB);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, winWidth, winHeight);
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorRB);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRB);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Error: Sweep framebuffer is incomplete.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    showWireframe = false;
+    animatePlane = false;
+
+    int referenceDivisions = 0;
+    for (size_t i = 0; i < sweepPlaneDivisions.size(); i++)
+        referenceDivisions = max(referenceDivisions, (int)sweepPlaneDivisions[i]);
+
+    size_t numCombinations = sweepTessEdgePixelLengths.size() * sweepMirrorTileDensities.size() *
+                             sweepMirrorRadii.size() * sweepPlaneDivisions.size() * sweepFeatureLOD.size() *
+                             sweepLodMorph.size();
+    printf("Sweep: %d x %d, %s patches%s, %d combinations, %d views, reference %g pixels at %d divisions\n",
+           winWidth, winHeight, useQuadPatches ? "quad" : "triangle", showTeapot ? " + teapot" : "",
+           (int)numCombinations, numSweepViews, sweepReferenceTessPixels, referenceDivisions);
+
+    vector<Sweep::Result> results;
+    vector<vector<unsigned char> > reference(numSweepViews);
+    vector<unsigned char> image;
+
+    for (size_t d = 0; d < sweepMirrorTileDensities.size(); d++) {
+        for (size_t r = 0; r < sweepMirrorRadii.size(); r++) {
+            if (glfwWindowShouldClose(window)) break;
+            mirrorTileDensity = sweepMirrorTileDensities[d];
+            mirrorRadius = sweepMirrorRadii[r];
+
+            tessEdgePixelLength = sweepReferenceTessPixels;
+            planeDivisions = referenceDivisions;
+            useFeatureLOD = false;
+            useLodMorph = false;
+            for (int v = 0; v < numSweepViews; v++)
+                RenderSweepView(v, 1, NULL, NULL, reference[v]);
+
+            for (size_t t = 0; t < sweepTessEdgePixelLengths.size(); t++) {
+                size_t numLodModes = sweepFeatureLOD.size() * sweepLodMorph.size();
+                for (size_t p = 0; p < sweepPlaneDivisions.size() * numLodModes; p++) {
+                    glfwPollEvents();
+                    tessEdgePixelLength = sweepTessEdgePixelLengths[t];
+                    planeDivisions = (int)sweepPlaneDivisions[p / numLodModes];
+                    useFeatureLOD = (sweepFeatureLOD[p % numLodModes / sweepLodMorph.size()] != 0.0f);
+                    float lodMorph = sweepLodMorph[p % sweepLodMorph.size()];
+                    useLodMorph = (lodMorph != 0.0f);
+                    if (useLodMorph) morphFullTilePixels = lodMorph;
+
+                    Sweep::Result result = { tessEdgePixelLength, mirrorTileDensity, mirrorRadius,
+                                             planeDivisions, useFeatureLOD, lodMorph,
+                                             0.0, 0.0, 0.0, 0.0, false };
+                    for (int v = 0; v < numSweepViews; v++) {
+                        double gpuMs, triangles;
+                        RenderSweepView(v, sweepFramesPerView, &gpuMs, &triangles, image);
+                        result.gpuMs += gpuMs / numSweepViews;
+                        result.triangles += triangles / numSweepViews;
+                        result.psnr += ImageMetrics::psnr(&image[0], &reference[v][0],
+                                                          winWidth, winHeight, 4) / numSweepViews;
+                        result.ssim += ImageMetrics::ssim(&image[0], &reference[v][0],
+                                                          winWidth, winHeight, 4) / numSweepViews;
+                    }
+                    results.push_back(result);
+                    printf("  %d / %d\r", (int)results.size(), (int)numCombinations);
+                    fflush(stdout);
+                }
+            }
+        }
+    }
+    printf("\n");
+
+    Sweep::markParetoFront(results);
+    Sweep::printTable(results);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(1, &colorRB);
+    glDeleteRenderbuffers(1, &depthRB);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Bake the walls' displacement, with the current kernel and mirror
+// parameters, into normal and height maps.
+/////////////////////////////////////////////////////////////////////////////
+static bool RunBake()
+{
+    if (wallKernel == Displacement::HEIGHTFIELD) {
+        stbi_set_flip_vertically_on_load(true);
+        int imgWidth, imgHeight, numComponents;
+        GLubyte *imgData = stbi_load(heightMapFile, &imgWidth, &imgHeight, &numComponents, 0);
+        if (imgData == NULL) {
+            fprintf(stderr, "Error: Fail to read image file %s.\n", heightMapFile);
+            return false;
+        }
+        heightMap.set(imgData, imgWidth, imgHeight, numComponents);
+        stbi_image_free(imgData);
+    }
+
+    Displacement::Params params = { wallKernel, mirrorTileDensity, mirrorRadius, &heightMap, NULL };
+    NormalBaker::Maps maps;
+    Stopwatch timer;
+    NormalBaker::bake(params, bakeSize, bakeSamplesPerAxis, maps);
+    printf("Baked %s at %d x %d texels in %.1f ms, height scale %g\n",
+        Displacement::getKernelName(wallKernel), bakeSize, bakeSize, timer.elapsedMs(), maps.heightScale);
+
+    if (!NormalBaker::writePNG(maps, bakedNormalFile, bakedHeightFile)) {
+        fprintf(stderr, "Error: Fail to write %s or %s.\n", bakedNormalFile, bakedHeightFile);
+        return false;
+    }
+    printf("Wrote %s and %s\n", bakedNormalFile, bakedHeightFile);
+    return true;
+}
+
+
+static void PrintUsage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -benchmark          Run the scripted camera path without vsync and print frame times.\n"
+        "  -frames <n>         Number of measured benchmark frames (default %d).\n"
+        "  -warmup <n>         Number of unmeasured frames before them (default %d).\n"
+        "  -sweep              Render every combination of the lists below off-screen and\n"
+        "                      print triangles, GPU time and PSNR/SSIM against a reference.\n"
+        "  -tesspixels <list>  TessEdgePixelLength (default %g).\n"
+        "  -tiledensity <list> MirrorTileDensity (default %g).\n"
+        "  -mirrorradius <list> MirrorRadius (default %g).\n"
+        "  -divisions <list>   Plane patches per side (default %d).\n"
+        "  -featurelod <list>  1 to tessellate only where the walls are displaced (default 0).\n"
+        "  -lodmorph <list>    Tile size in pixels below which the displacement fades into\n"
+        "                      normal perturbation, gone at half of it; 0 for off (default 0).\n"
+        "  -quads              Start with quad patches.\n"
+        "  -teapot             Start with the teapot shown.\n"
+        "  -skyboxfirst        Draw the skybox before the walls instead of after them.\n"
+        "  -compositewire      Lay the wireframe over the scene in a full-screen pass from\n"
+        "                      a second render target instead of in the scene's shader.\n"
+        "  -msaa <list>        MSAA samples per pixel: 1, 2, 4 or 8 (default 1).\n"
+        "                      With -benchmark, the path is run once per number.\n"
+        "  -fxaa               Filter the finished image with FXAA.\n"
+        "  -dynres <ms>        Scale the render resolution to keep GPU frames under ms.\n"
+        "  -singlethread       Handle input and draw on one thread, not on a render thread.\n"
+        "  -shadows            Start with cascaded shadow maps of the directional light.\n"
+        "  -shadowtess <s>     Scale of the shadow pass's tessellation levels (default %g).\n"
+        "  -lights <n>         Light the wood with n point lights through clustered shading.\n"
+        "  -depthprepass <list> 1 to lay down depth in a pass of its own first (default 0).\n"
+        "                      With -benchmark, the path is run once per number, e.g. 0,1.\n"
+        "  -kernel <name>      Displacement kernel of the walls: hemispheres, fbm, voronoi\n"
+        "                      or heightfield (default hemispheres).\n"
+        "  -heightmap <file>   Height map of the heightfield kernel (default %s).\n"
+        "  -bake <size>        Bake the walls' displacement into %s and\n"
+        "                      %s, size x size texels, and exit.\n"
+        "  -cpubench <name>    Run a CPU benchmark and exit, with failure if\n"
+        "                      one of its checks fails.\n"
+        "A <list> is one number, or several separated by commas for -sweep.\n"
+        "Otherwise only the first number of a list is used.\n",
+        prog, benchmarkFrames, benchmarkWarmupFrames, tessEdgePixelLength, mirrorTileDensity, mirrorRadius,
+        planeDivisions, shadowTessLevelScale, heightMapFile, bakedNormalFile, bakedHeightFile);
+}
+
+
+// Returns false if the command line is malformed.
+static bool ParseCommandLine(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+
+        if (strcmp(arg, "-benchmark") == 0) benchmarkMode = true;
+        else if (strcmp(arg, "-sweep") == 0) sweepMode = true;
+        else if (strcmp(arg, "-quads") == 0) useQuadPatches = true;
+        else if (strcmp(arg, "-teapot") == 0) showTeapot = true;
+        else if (strcmp(arg, "-skyboxfirst") == 0) drawSkyboxFirst = true;
+        else if (strcmp(arg, "-kernel") == 0 && hasValue) {
+            const char *name = argv[++i];
+            int k = 0;
+            while (k < Displacement::NUM_KERNELS && strcmp(name, Displacement::getKernelName((Displacement::Kernel)k)) != 0) k++;
+            if (k == Displacement::NUM_KERNELS) return false;
+            wallKernel = (Displacement::Kernel)k;
+        }
+        else if (strcmp(arg, "-heightmap") == 0 && hasValue) heightMapFile = argv[++i];
+        else if (strcmp(arg, "-shadows") == 0) useShadows = true;
+        else if (strcmp(arg, "-compositewire") == 0) wireframeOverlay = WIREFRAME_COMPOSITED;
+        else if (strcmp(arg, "-fxaa") == 0) useFXAA = true;
+        else if (strcmp(arg, "-singlethread") == 0) useRenderThread = false;
+        else if (strcmp(arg, "-dynres") == 0 && hasValue) {
+            dynamicResolutionTargetMs = (float)atof(argv[++i]);
+            if (dynamicResolutionTargetMs <= 0.0f) return false;
+            useDynamicResolution = true;
+        }
+        else if (strcmp(arg, "-msaa") == 0 && hasValue) {
+            if (!Sweep::parseList(argv[++i], benchmarkMsaaSamples)) return false;
+        }
+        else if (strcmp(arg, "-shadowtess") == 0 && hasValue) {
+            shadowTessLevelScale = (float)atof(argv[++i]);
+            if (shadowTessLevelScale <= 0.0f) return false;
+        }
+        else if (strcmp(arg, "-lights") == 0 && hasValue) {
+            numPointLights = atoi(argv[++i]);
+            if (numPointLights < 0) return false;
+            usePointLights = (numPointLights > 0);
+        }
+        else if (strcmp(arg, "-bake") == 0 && hasValue) {
+            bakeSize = atoi(argv[++i]);
+            if (bakeSize <= 0) return false;
+        }
+        else if (strcmp(arg, "-frames") == 0 && hasValue) benchmarkFrames = atoi(argv[++i]);
+        else if (strcmp(arg, "-warmup") == 0 && hasValue) benchmarkWarmupFrames = atoi(argv[++i]);
+        else if (strcmp(arg, "-tesspixels") == 0 && hasValue) {
+            if (!Sweep::parseList(argv[++i], sweepTessEdgePixelLengths)) return false;
+        }
+        else if (strcmp(arg, "-tiledensity") == 0 && hasValue) {
+            if (!Sweep::parseList(argv[++i], sweepMirrorTileDensities)) return false;
+        }
+        else if (strcmp(arg, "-mirrorradius") == 0 && hasValue) {
+            if (!Sweep::parseList(argv[++i], sweepMirrorRadii)) return false;
+        }
+        else if (strcmp(arg, "-divisions") == 0 && hasValue) {
+            if (!Sweep::parseList(argv[++i], sweepPlaneDivisions)) return false;
+        }
+        else if (strcmp(arg, "-featurelod") == 0 && hasValue) {
+            if (!Sweep::parseList(argv[++i], sweepFeatureLOD)) return false;
+        }
+        else if (strcmp(arg, "-lodmorph") == 0 && hasValue) {
+            if (!Sweep::parseList(argv[++i], sweepLodMorph)) return false;
+        }
+        else if (strcmp(arg, "-depthprepass") == 0 && hasValue) {
+            if (!Sweep::parseList(argv[++i], benchmarkDepthPrepass)) return false;
+        }
+        else return false;
+    }
+
+    bool inRange = (benchmarkFrames >= 2 && benchmarkWarmupFrames >= 0);
+    for (size_t i = 0; i < sweepTessEdgePixelLengths.size(); i++)
+        inRange = inRange && sweepTessEdgePixelLengths[i] > 0.0f;
+    for (size_t i = 0; i < sweepMirrorTileDensities.size(); i++)
+        inRange = inRange && sweepMirrorTileDensities[i] > 0.0f;
+    for (size_t i = 0; i < sweepMirrorRadii.size(); i++)
+        inRange = inRange && sweepMirrorRadii[i] > 0.0f && sweepMirrorRadii[i] <= 0.5f;
+    for (size_t i = 0; i < sweepPlaneDivisions.size(); i++) {
+        float n = sweepPlaneDivisions[i];
+        inRange = inRange && n >= 1.0f && n == floorf(n);
+    }
+    for (size_t i = 0; i < sweepLodMorph.size(); i++)
+        inRange = inRange && sweepLodMorph[i] >= 0.0f;
+    for (size_t i = 0; i < benchmarkMsaaSamples.size(); i++) {
+        float n = benchmarkMsaaSamples[i];
+        inRange = inRange && (n == 1.0f || n == 2.0f || n == 4.0f || n == 8.0f);
+    }
+    if (!inRange) {
+        fprintf(stderr, "Error: Parameter out of range.\n");
+        return false;
+    }
+
+    tessEdgePixelLength = sweepTessEdgePixelLengths[0];
+    mirrorTileDensity = sweepMirrorTileDensities[0];
+    mirrorRadius = sweepMirrorRadii[0];
+    planeDivisions = (int)sweepPlaneDivisions[0];
+    useFeatureLOD = (sweepFeatureLOD[0] != 0.0f);
+    useLodMorph = (sweepLodMorph[0] != 0.0f);
+    if (useLodMorph) morphFullTilePixels = sweepLodMorph[0];
+    useDepthPrepass = (benchmarkDepthPrepass[0] != 0.0f);
+    msaaSamples = (int)benchmarkMsaaSamples[0];
+    return true;
+}
+
+
+
 static void glfw_error_callback(int error, const char* description)
 {
     fprintf(stderr, "Error: %s\n", description);
@@ -538,12 +2116,118 @@ static void WaitForEnterKeyBeforeExit(void)
 
 
 
+/////////////////////////////////////////////////////////////////////////////
+// The interactive loop, on one thread or split between the main thread and
+// the render thread.
+/////////////////////////////////////////////////////////////////////////////
+static void DrawFrame(GLFWwindow *window)
+{
+    gpuFrameTimer->begin();
+    MyDrawFunc();
+    gpuFrameTimer->end();
+    glfwSwapBuffers(window);
+}
+
+
+static void RenderThreadMain(GLFWwindow *window)
+{
+    glfwMakeContextCurrent(window);
+
+    // Only the newest snapshot is drawn. Without animation, frames are
+    // drawn only when snapshots arrive, and the thread sleeps in between.
+    FrameSnapshot snapshot, next;
+    bool haveSnapshot = false;
+    for (;;) {
+        if (!haveSnapshot || !snapshot.animatePlane) {
+            std::unique_lock<std::mutex> lock(snapshotMutex);
+            snapshotArrived.wait(lock, [&]() { return snapshotQueue.tryPop(next); });
+            snapshot = next;
+            haveSnapshot = true;
+        }
+        while (snapshotQueue.tryPop(next)) snapshot = next;
+        if (snapshot.quit) break;
+        ApplySnapshot(snapshot);
+        DrawFrame(window);
+    }
+
+    glfwMakeContextCurrent(NULL);
+}
+
+
+// Passes a snapshot to the render thread and wakes it. False if the queue
+// is full.
+static bool PushSnapshot(const FrameSnapshot &snapshot)
+{
+    if (!snapshotQueue.tryPush(snapshot)) return false;
+    { std::lock_guard<std::mutex> lock(snapshotMutex); }
+    snapshotArrived.notify_one();
+    return true;
+}
+
+
+static void RunInteractive(GLFWwindow *window)
+{
+    if (!useRenderThread) {
+        while (!glfwWindowShouldClose(window)) {
+            if (inputState.animatePlane)
+                glfwPollEvents();  // Use this if there is continuous animation.
+            else
+                glfwWaitEvents();  // Use this if there is no animation.
+            ApplySnapshot(inputState);
+            DrawFrame(window);
+        }
+        return;
+    }
+
+    glfwMakeContextCurrent(NULL);
+    std::thread renderThread(RenderThreadMain, window);
+
+    // The render thread animates by itself, so events are only waited for.
+    // A full queue means it is behind; the state is passed again shortly.
+    while (!glfwWindowShouldClose(window)) {
+        if (PushSnapshot(inputState))
+            glfwWaitEvents();
+        else
+            glfwWaitEventsTimeout(0.002);
+    }
+
+    FrameSnapshot last = inputState;
+    last.quit = true;
+    while (!PushSnapshot(last)) std::this_thread::yield();
+    renderThread.join();
+    glfwMakeContextCurrent(window);
+}
+
+
+
 /////////////////////////////////////////////////////////////////////////////
 // The main function.
 /////////////////////////////////////////////////////////////////////////////
 int main( int argc, char** argv )
 {
-    atexit(WaitForEnterKeyBeforeExit); // std::atexit() is declared in cstdlib
+    // CPU benchmarks: main -cpubench <name>
+    if (argc >= 2 && strcmp(argv[1], "-cpubench") == 0) {
+        if (argc >= 3) {
+            Benchmarks::Result result = Benchmarks::run(argv[2]);
+            if (result != Benchmarks::UNKNOWN_NAME)
+                return (result == Benchmarks::PASSED) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        fprintf(stderr, "Usage: %s -cpubench <name>\nAvailable benchmarks:\n", argv[0]);
+        Benchmarks::printNames();
+        return EXIT_FAILURE;
+    }
+
+    if (!ParseCommandLine(argc, argv)) {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Baking needs no window.
+    if (bakeSize > 0) return RunBake() ? 0 : EXIT_FAILURE;
+
+    // Benchmark and sweep runs are scripted, so do not wait for a key at the end.
+    if (!benchmarkMode && !sweepMode)
+        atexit(WaitForEnterKeyBeforeExit); // std::atexit() is declared in cstdlib
 
     glfwSetErrorCallback(glfw_error_callback);
     if (!glfwInit()) exit(EXIT_FAILURE);
@@ -552,6 +2236,7 @@ int main( int argc, char** argv )
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, sweepMode ? GLFW_FALSE : GLFW_TRUE);  // Sweeps render off-screen.
     GLFWwindow *window = glfwCreateWindow(winWidth, winHeight, "main", NULL, NULL);
 
     if (!window) {
@@ -560,7 +2245,7 @@ int main( int argc, char** argv )
     }
 
     glfwMakeContextCurrent(window);
-    glfwSwapInterval(1);
+    glfwSwapInterval((benchmarkMode || sweepMode) ? 0 : 1);  // Uncapped frame rate when measuring.
 
     // Register callback functions.
     glfwSetFramebufferSizeCallback(window, MyReshapeFunc);
@@ -588,15 +2273,16 @@ int main( int argc, char** argv )
         exit(EXIT_FAILURE);
     }
 
+    ProcessMemory::resetPeak();
+    Stopwatch initTimer;
     MyInit();
+    printf("Init: %.1f ms, peak resident %.1f MB\n", initTimer.elapsedMs(),
+        ProcessMemory::getPeakResidentBytes() / (1024.0 * 1024.0));
+    CaptureSnapshot(inputState);
 
-    while (!glfwWindowShouldClose(window))
-    {
-        //glfwPollEvents();  // Use this if there is continuous animation.
-        glfwWaitEvents();  // Use this if there is no animation.
-        MyDrawFunc();
-        glfwSwapBuffers(window);
-    }
+    if (sweepMode) RunSweep(window);
+    else if (benchmarkMode) RunBenchmark(window);
+    else RunInteractive(window);
 
     glfwDestroyWindow(window);
     glfwTerminate();